@@ -0,0 +1,494 @@
+/**
+ * @file micro_bench.c
+ * @brief Microbenchmarks of the shell's tokenizer, parser, command clean up, history and builtin lookup, over synthetic inputs of increasing size. Reports ns/op and the tracked allocations and bytes per op (see accounting.h).
+ * @version 0.1
+ *
+ * Usage: micro_bench [-t seconds] [-f filter] [-j file] [-c baseline]
+ *
+ * Every benchmark runs for at least -t seconds (0.2 by default) per size. -f runs the benchmarks whose name contains filter. -j writes the results as JSON, one benchmark per line, and -c compares the run against such a file, so two commits can be compared:
+ *
+ *     ./micro_bench -j before.json
+ *     (rebuild at the other commit)
+ *     ./micro_bench -c before.json
+ *
+ * It is linked with the shell's sources, except main.c.
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include "accounting.h"
+#include "parser.h"
+#include "shell_builtins.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_MIN_SECONDS 0.2
+#define MAX_RESULTS 128
+// files in the directory the glob benchmark expands
+#define GLOB_FILES 16
+
+// the shell's state, main.c isn't linked in
+ShellState* globalShellState;
+
+// measures the timed parts of a benchmark, like Go's b.StopTimer / b.StartTimer
+typedef struct Timer {
+    uint64_t start;
+    uint64_t elapsed;
+    uint64_t startAllocations;
+    uint64_t startBytes;
+    uint64_t allocations;
+    uint64_t bytes;
+} Timer;
+
+typedef struct Benchmark {
+    const char* name;
+    const int* sizes;                           //< 0 terminated, NULL for a benchmark without a size
+    void (*run)(Timer* timer, int size, long iterations);
+} Benchmark;
+
+typedef struct Result {
+    char name[64];
+    int size;
+    long iterations;
+    double nsPerOp;
+    double allocsPerOp;
+    double bytesPerOp;
+} Result;
+
+static char globDirectory[] = "/tmp/micro_bench.XXXXXX";
+
+static uint64_t nanoseconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// the tracked allocations of every subsystem so far
+static void totalAllocations(uint64_t* allocations, uint64_t* bytes)
+{
+    *allocations = 0;
+    *bytes = 0;
+
+    for (int i = 0; i < ALLOC_N_SUBSYSTEMS; i++)
+    {
+        AllocStats stats;
+        getAllocStats(i, &stats);
+        *allocations += stats.allocations;
+        *bytes += stats.allocatedBytes;
+    }
+}
+
+static void startTimer(Timer* timer)
+{
+    totalAllocations(&timer->startAllocations, &timer->startBytes);
+    timer->start = nanoseconds();
+}
+
+static void stopTimer(Timer* timer)
+{
+    timer->elapsed += nanoseconds() - timer->start;
+
+    uint64_t allocations, bytes;
+    totalAllocations(&allocations, &bytes);
+    timer->allocations += allocations - timer->startAllocations;
+    timer->bytes += bytes - timer->startBytes;
+}
+
+// a line of size words, like "echo word1 word2 ...", the caller frees it
+static char* makeLine(int size, const char* word)
+{
+    size_t length = strlen("echo") + 1;
+    for (int i = 0; i < size; i++)
+        length += strlen(word) + 12;
+
+    char* line = malloc(length);
+    if (!line)
+        return NULL;
+
+    char* out = line + sprintf(line, "echo");
+    for (int i = 0; i < size; i++)
+        out += sprintf(out, " %s%d", word, i);
+
+    return line;
+}
+
+/*-------------------------------Benchmarks----------------------------------------------*/
+
+static void benchTokenize(Timer* timer, int size, long iterations)
+{
+    char* line = makeLine(size, "word");
+
+    startTimer(timer);
+    for (long i = 0; i < iterations; i++)
+        freeTokens(tokenizeString(line, ' '));
+    stopTimer(timer);
+
+    free(line);
+}
+
+static void benchRemoveQuotes(Timer* timer, int size, long iterations)
+{
+    // removeQuotes frees its input, the inputs are made untimed in batches
+    enum { BATCH = 256 };
+    char* inputs[BATCH];
+    char* quoted = malloc(size + 3);
+    memset(quoted + 1, 'q', size);
+    quoted[0] = quoted[size + 1] = '"';
+    quoted[size + 2] = '\0';
+
+    for (long done = 0; done < iterations; done += BATCH)
+    {
+        int n = iterations - done < BATCH ? iterations - done : BATCH;
+        for (int i = 0; i < n; i++)
+            inputs[i] = trackedStrndup(ALLOC_TOKENIZER, quoted, size + 2);
+
+        startTimer(timer);
+        for (int i = 0; i < n; i++)
+            inputs[i] = removeQuotes(inputs[i]);
+        stopTimer(timer);
+
+        for (int i = 0; i < n; i++)
+            trackedFree(ALLOC_TOKENIZER, inputs[i]);
+    }
+
+    free(quoted);
+}
+
+static void parseLine(Timer* timer, const char* line, long iterations)
+{
+    char** tokens = tokenizeString(line, ' ');
+
+    for (long i = 0; i < iterations; i++)
+    {
+        startTimer(timer);
+        CommandChain* chain = parseTokens(tokens);
+        stopTimer(timer);
+
+        cleanUpCommandChain(chain);
+    }
+
+    freeTokens(tokens);
+}
+
+static void benchParse(Timer* timer, int size, long iterations)
+{
+    char* line = makeLine(size, "word");
+    parseLine(timer, line, iterations);
+    free(line);
+}
+
+static void benchParseGlob(Timer* timer, int size, long iterations)
+{
+    // every word expands to the GLOB_FILES files of the directory
+    char word[sizeof(globDirectory) + 8];
+    snprintf(word, sizeof(word), "%s/f*", globDirectory);
+
+    size_t length = strlen("echo") + 1 + size * (strlen(word) + 1);
+    char* line = malloc(length);
+    char* out = line + sprintf(line, "echo");
+    for (int i = 0; i < size; i++)
+        out += sprintf(out, " %s", word);
+
+    parseLine(timer, line, iterations);
+    free(line);
+}
+
+static void benchCleanUp(Timer* timer, int size, long iterations)
+{
+    char* line = makeLine(size, "word");
+    char** tokens = tokenizeString(line, ' ');
+
+    for (long i = 0; i < iterations; i++)
+    {
+        CommandChain* chain = parseTokens(tokens);
+
+        startTimer(timer);
+        cleanUpCommandChain(chain);
+        stopTimer(timer);
+    }
+
+    freeTokens(tokens);
+    free(line);
+}
+
+static void benchHistoryInsert(Timer* timer, int size, long iterations)
+{
+    // the list is emptied every size inserts, so it stays between 0 and size entries
+    HistoryList list = { NULL, NULL, 0 };
+    char* line = makeLine(8, "arg");
+
+    for (long done = 0; done < iterations; done += size)
+    {
+        long n = iterations - done < size ? iterations - done : size;
+
+        startTimer(timer);
+        for (long i = 0; i < n; i++)
+            add_to_history(&list, line);
+        stopTimer(timer);
+
+        clean_history(&list);
+        list.size = 0;
+    }
+
+    free(line);
+}
+
+static void benchHistoryLookup(Timer* timer, int size, long iterations)
+{
+    HistoryList list = { NULL, NULL, 0 };
+    char command[32];
+    for (int i = 0; i < size; i++)
+    {
+        snprintf(command, sizeof(command), "command%d --flag", i);
+        add_to_history(&list, command);
+    }
+
+    // a prefix of an entry in the middle, the lookup walks the whole list either way
+    char prefix[32];
+    snprintf(prefix, sizeof(prefix), "command%d", size / 2);
+
+    volatile size_t found = 0;
+    startTimer(timer);
+    for (long i = 0; i < iterations; i++)
+        found += find_last_command_with_prefix(&list, prefix) != NULL;
+    stopTimer(timer);
+
+    clean_history(&list);
+}
+
+static void benchExecutionFunction(Timer* timer, int size, long iterations)
+{
+    (void)size;
+
+    // a builtin at the end of the registry and a name that isn't one, the two ends of the search
+    char* names[] = { "shellstats", "gzip" };
+
+    volatile uintptr_t found = 0;
+    startTimer(timer);
+    for (long i = 0; i < iterations; i++)
+        found += (uintptr_t)getExecutionFunction(names[i & 1]);
+    stopTimer(timer);
+}
+
+static const int wordSizes[] = { 1, 8, 64, 512, 0 };
+static const int globSizes[] = { 1, 8, 64, 0 };
+static const int historySizes[] = { 16, 256, 4096, 0 };
+
+static const Benchmark benchmarks[] = {
+    {"tokenize", wordSizes, benchTokenize},
+    {"removeQuotes", wordSizes, benchRemoveQuotes},
+    {"parse", wordSizes, benchParse},
+    {"parse/glob", globSizes, benchParseGlob},
+    {"cleanUpCommandChain", wordSizes, benchCleanUp},
+    {"history/insert", historySizes, benchHistoryInsert},
+    {"history/lookup", historySizes, benchHistoryLookup},
+    {"getExecutionFunction", NULL, benchExecutionFunction},
+};
+
+/*-------------------------------Harness-------------------------------------------------*/
+
+// grows the iterations until a run takes minSeconds, like Go's testing package
+static void measure(const Benchmark* benchmark, int size, double minSeconds, Result* result)
+{
+    long iterations = 1;
+    Timer timer;
+
+    while (1)
+    {
+        memset(&timer, 0, sizeof(timer));
+        benchmark->run(&timer, size, iterations);
+
+        if (timer.elapsed >= minSeconds * 1e9 || iterations >= 1000000000L)
+            break;
+
+        // aim 20% past the target from the last rate, at most 100 times more
+        double perOp = timer.elapsed > 0 ? (double)timer.elapsed / iterations : 1;
+        long next = (long)(minSeconds * 1e9 * 1.2 / perOp);
+        if (next > iterations * 100)
+            next = iterations * 100;
+        if (next <= iterations)
+            next = iterations + 1;
+        iterations = next;
+    }
+
+    snprintf(result->name, sizeof(result->name), "%s", benchmark->name);
+    result->size = size;
+    result->iterations = iterations;
+    result->nsPerOp = (double)timer.elapsed / iterations;
+    result->allocsPerOp = (double)timer.allocations / iterations;
+    result->bytesPerOp = (double)timer.bytes / iterations;
+}
+
+// reads the results of an earlier -j run, one per line. Returns their number
+static int readBaseline(const char* path, Result* baseline, int max)
+{
+    FILE* file = fopen(path, "r");
+    if (!file)
+    {
+        fprintf(stderr, "micro_bench: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    int n = 0;
+    char line[512];
+    while (n < max && fgets(line, sizeof(line), file))
+    {
+        Result* result = &baseline[n];
+        if (sscanf(line, " {\"name\":\"%63[^\"]\",\"size\":%d,\"iterations\":%ld,\"nsPerOp\":%lf,\"allocsPerOp\":%lf,\"bytesPerOp\":%lf",
+                   result->name, &result->size, &result->iterations, &result->nsPerOp, &result->allocsPerOp, &result->bytesPerOp) == 6)
+            n++;
+    }
+
+    fclose(file);
+    return n;
+}
+
+static const Result* findResult(const Result* results, int n, const Result* result)
+{
+    for (int i = 0; i < n; i++)
+    {
+        if (strcmp(results[i].name, result->name) == 0 && results[i].size == result->size)
+            return &results[i];
+    }
+
+    return NULL;
+}
+
+static int writeJSON(const char* path, const Result* results, int n)
+{
+    FILE* file = fopen(path, "w");
+    if (!file)
+    {
+        fprintf(stderr, "micro_bench: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    fprintf(file, "{\"benchmarks\":[\n");
+    for (int i = 0; i < n; i++)
+    {
+        fprintf(file, "  {\"name\":\"%s\",\"size\":%d,\"iterations\":%ld,\"nsPerOp\":%.2f,\"allocsPerOp\":%.2f,\"bytesPerOp\":%.2f}%s\n",
+                results[i].name, results[i].size, results[i].iterations, results[i].nsPerOp, results[i].allocsPerOp,
+                results[i].bytesPerOp, i + 1 < n ? "," : "");
+    }
+    fprintf(file, "]}\n");
+
+    return fclose(file) == 0 ? 0 : -1;
+}
+
+static int makeGlobDirectory()
+{
+    if (!mkdtemp(globDirectory))
+        return -1;
+
+    for (int i = 0; i < GLOB_FILES; i++)
+    {
+        char path[sizeof(globDirectory) + 16];
+        snprintf(path, sizeof(path), "%s/f%02d", globDirectory, i);
+        int fd = open(path, O_WRONLY | O_CREAT, 0644);
+        if (fd == -1)
+            return -1;
+        close(fd);
+    }
+
+    return 0;
+}
+
+static void removeGlobDirectory()
+{
+    for (int i = 0; i < GLOB_FILES; i++)
+    {
+        char path[sizeof(globDirectory) + 16];
+        snprintf(path, sizeof(path), "%s/f%02d", globDirectory, i);
+        unlink(path);
+    }
+    rmdir(globDirectory);
+}
+
+int main(int argc, char** argv)
+{
+    double minSeconds = DEFAULT_MIN_SECONDS;
+    const char* filter = NULL;
+    const char* jsonPath = NULL;
+    const char* baselinePath = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:f:j:c:")) != -1)
+    {
+        switch (opt)
+        {
+            case 't': minSeconds = atof(optarg); break;
+            case 'f': filter = optarg; break;
+            case 'j': jsonPath = optarg; break;
+            case 'c': baselinePath = optarg; break;
+            default:
+                fprintf(stderr, "Usage: %s [-t seconds] [-f filter] [-j file] [-c baseline]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    if (minSeconds <= 0 || optind < argc)
+    {
+        fprintf(stderr, "Usage: %s [-t seconds] [-f filter] [-j file] [-c baseline]\n", argv[0]);
+        return 2;
+    }
+
+    static Result baseline[MAX_RESULTS];
+    int nBaseline = baselinePath ? readBaseline(baselinePath, baseline, MAX_RESULTS) : 0;
+    if (nBaseline == -1)
+        return 1;
+
+    globalShellState = init_shell_state();
+    if (makeGlobDirectory() == -1)
+    {
+        fprintf(stderr, "micro_bench: %s: %s\n", globDirectory, strerror(errno));
+        return 1;
+    }
+
+    static Result results[MAX_RESULTS];
+    int nResults = 0;
+
+    printf("%-24s %6s %12s %12s %10s %10s%s\n", "benchmark", "size", "iterations", "ns/op", "allocs/op", "B/op", baselinePath ? "    change" : "");
+
+    for (size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++)
+    {
+        const Benchmark* benchmark = &benchmarks[i];
+        if (filter && !strstr(benchmark->name, filter))
+            continue;
+
+        static const int noSize[] = { 1, 0 };
+        for (const int* size = benchmark->sizes ? benchmark->sizes : noSize; *size && nResults < MAX_RESULTS; size++)
+        {
+            Result* result = &results[nResults++];
+            measure(benchmark, *size, minSeconds, result);
+
+            printf("%-24s %6d %12ld %12.1f %10.1f %10.1f", result->name, result->size, result->iterations,
+                   result->nsPerOp, result->allocsPerOp, result->bytesPerOp);
+
+            const Result* before = baselinePath ? findResult(baseline, nBaseline, result) : NULL;
+            if (before && before->nsPerOp > 0)
+                printf("   %+6.1f%%", 100.0 * (result->nsPerOp - before->nsPerOp) / before->nsPerOp);
+            else if (baselinePath)
+                printf("       new");
+            printf("\n");
+            fflush(stdout);
+        }
+    }
+
+    removeGlobDirectory();
+
+    if (jsonPath && writeJSON(jsonPath, results, nResults) == -1)
+        return 1;
+
+    return 0;
+}
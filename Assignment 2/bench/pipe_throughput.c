@@ -0,0 +1,238 @@
+/**
+ * @file pipe_throughput.c
+ * @brief Measures the throughput of a bulk producer | consumer pipeline for several pipe capacities, with the context switches the two processes took.
+ * @version 0.1
+ *
+ * Usage: pipe_throughput [-m MiB] [-w write_size] [-r read_size] [-s shell] [capacity...]
+ *
+ * Capacities take a K or M suffix and default to 64K 256K 1M. With -s the pipeline runs through the given shell as `producer |SIZE consumer`, the producer and consumer being this program itself, so the numbers include the shell's pipe setup.
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_MEGABYTES 1024
+#define DEFAULT_WRITE_SIZE (64 * 1024)
+#define DEFAULT_READ_SIZE (128 * 1024)
+
+static size_t parseSize(const char* str)
+{
+    char* end;
+    size_t value = strtoul(str, &end, 10);
+    if (*end == 'k' || *end == 'K')
+        value <<= 10;
+    else if (*end == 'm' || *end == 'M')
+        value <<= 20;
+
+    return value;
+}
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// writes total bytes to stdout in writes of writeSize
+static int produce(size_t total, size_t writeSize)
+{
+    char* buffer = malloc(writeSize);
+    if (!buffer)
+        return 1;
+    memset(buffer, 'x', writeSize);
+
+    while (total > 0)
+    {
+        size_t length = total < writeSize ? total : writeSize;
+        ssize_t nwritten = write(STDOUT_FILENO, buffer, length);
+        if (nwritten == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return 1;
+        }
+        total -= nwritten;
+    }
+
+    free(buffer);
+    return 0;
+}
+
+// reads stdin to its end in reads of readSize
+static int consume(size_t readSize)
+{
+    char* buffer = malloc(readSize);
+    if (!buffer)
+        return 1;
+
+    ssize_t nread;
+    while ((nread = read(STDIN_FILENO, buffer, readSize)) != 0)
+    {
+        if (nread == -1 && errno != EINTR)
+            return 1;
+    }
+
+    free(buffer);
+    return 0;
+}
+
+// waits for a child, adding its context switches
+static int waitChild(pid_t pid, long* switches)
+{
+    int status;
+    struct rusage usage;
+    while (wait4(pid, &status, 0, &usage) == -1)
+    {
+        if (errno != EINTR)
+            return -1;
+    }
+
+    *switches += usage.ru_nvcsw + usage.ru_nivcsw;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+// runs the pipeline on a pipe made here. Returns the capacity the pipe got, -1 on failure
+static int runDirect(size_t capacity, size_t total, size_t writeSize, size_t readSize, long* switches)
+{
+    int fds[2];
+    if (pipe(fds) == -1)
+        return -1;
+
+    int actual = fcntl(fds[1], F_SETPIPE_SZ, (int)capacity);
+    if (actual == -1)
+        actual = fcntl(fds[1], F_GETPIPE_SZ);
+
+    pid_t producer = fork();
+    if (producer == 0)
+    {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        _exit(produce(total, writeSize));
+    }
+
+    pid_t consumer = fork();
+    if (consumer == 0)
+    {
+        dup2(fds[0], STDIN_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        _exit(consume(readSize));
+    }
+
+    close(fds[0]);
+    close(fds[1]);
+
+    int status = waitChild(producer, switches);
+    status |= waitChild(consumer, switches);
+
+    return status == 0 ? actual : -1;
+}
+
+// runs the pipeline through a shell, with the capacity in the pipe token
+static int runThroughShell(const char* shell, const char* self, size_t capacity, size_t total, size_t writeSize, size_t readSize, long* switches)
+{
+    char script[] = "/tmp/pipe-throughput-XXXXXX";
+    int fd = mkstemp(script);
+    if (fd == -1)
+        return -1;
+
+    dprintf(fd, "%s --produce %zu %zu |%zu %s --consume %zu\n", self, total, writeSize, capacity, self, readSize);
+    close(fd);
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        execl(shell, shell, script, (char*)NULL);
+        _exit(127);
+    }
+
+    // the rusage of the shell includes the stages it waited for
+    int status = waitChild(pid, switches);
+    unlink(script);
+
+    return status == 0 ? (int)capacity : -1;
+}
+
+int main(int argc, char** argv)
+{
+    // the stages of the -s mode
+    if (argc == 4 && strcmp(argv[1], "--produce") == 0)
+        return produce(strtoull(argv[2], NULL, 10), strtoull(argv[3], NULL, 10));
+    if (argc == 3 && strcmp(argv[1], "--consume") == 0)
+        return consume(strtoull(argv[2], NULL, 10));
+
+    size_t megabytes = DEFAULT_MEGABYTES;
+    size_t writeSize = DEFAULT_WRITE_SIZE;
+    size_t readSize = DEFAULT_READ_SIZE;
+    const char* shell = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "m:w:r:s:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'm': megabytes = strtoul(optarg, NULL, 10); break;
+            case 'w': writeSize = parseSize(optarg); break;
+            case 'r': readSize = parseSize(optarg); break;
+            case 's': shell = optarg; break;
+            default:
+                fprintf(stderr, "Usage: %s [-m MiB] [-w write_size] [-r read_size] [-s shell] [capacity...]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    if (megabytes == 0 || writeSize == 0 || readSize == 0)
+    {
+        fprintf(stderr, "%s: sizes must be positive\n", argv[0]);
+        return 2;
+    }
+
+    const char* defaults[] = { "64K", "256K", "1M" };
+    const char** capacities = optind < argc ? (const char**)argv + optind : defaults;
+    int nCapacities = optind < argc ? argc - optind : 3;
+
+    // the shell mode execs this program again, it needs a path that works from anywhere
+    char self[4096];
+    ssize_t selfLength = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (selfLength <= 0)
+        return 1;
+    self[selfLength] = '\0';
+
+    size_t total = megabytes << 20;
+    printf("%-10s %-10s %10s %10s %12s\n", "asked", "capacity", "seconds", "MiB/s", "ctx-switches");
+
+    for (int i = 0; i < nCapacities; i++)
+    {
+        size_t capacity = parseSize(capacities[i]);
+        long switches = 0;
+
+        double start = now();
+        int actual = shell ? runThroughShell(shell, self, capacity, total, writeSize, readSize, &switches)
+                           : runDirect(capacity, total, writeSize, readSize, &switches);
+        double elapsed = now() - start;
+
+        if (actual < 0)
+        {
+            fprintf(stderr, "%s: run with %s failed\n", argv[0], capacities[i]);
+            return 1;
+        }
+
+        printf("%-10s %-10d %10.3f %10.1f %12ld\n", capacities[i], actual, elapsed, megabytes / elapsed, switches);
+    }
+
+    return 0;
+}
@@ -0,0 +1,310 @@
+/**
+ * @file pty_latency.c
+ * @brief Measures the interactive latency of the shell over a pseudo-terminal: from the Enter of a line to the next prompt, for an empty line, a builtin, an external command and history recalls, after the history has been filled with 10k to 1M entries.
+ * @version 0.1
+ *
+ * Usage: pty_latency [-s shell] [-n samples] [history_size...]
+ *
+ * History sizes take a K or M suffix and default to 10K 100K 1M. For every size a new shell is started on a pty, the history is filled by typing `cd .` as many times, then each session line is typed -n times (100 by default) and the latencies are reported as percentiles:
+ *
+ *     empty          an empty line, the read loop alone
+ *     builtin        cd .
+ *     external       /bin/true
+ *     recall prefix  !pw, the newest entry starting with pw, found by walking the whole history, then run
+ *     recall index   !<size/2>, an entry in the middle of the history, then run
+ *
+ * The recalls are typed the way a user types them, so the parser's rewrite of !x into `history x` is measured along with the lookup.
+ *
+ * The history holds a single `pwd` near its start, so a prefix recall walks all of it. Echo is off on the pty and the prompt is set to a marker, so a prompt is found in the output by the marker alone. Everything runs locally.
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <poll.h>
+#include <pty.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_SHELL "./shell"
+#define DEFAULT_SAMPLES 100
+#define PROMPT_MARKER "@PTYLAT@"
+// lines typed at once while the history is filled
+#define FILL_BATCH 1024
+// a prompt that takes longer than this means the shell is stuck
+#define PROMPT_TIMEOUT_MS 60000
+
+typedef struct Session {
+    int master;
+    pid_t pid;
+    size_t matched;         //< the bytes of the marker matched at the end of the output read so far
+} Session;
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t parseSize(const char* str)
+{
+    char* end;
+    size_t value = strtoul(str, &end, 10);
+    if (*end == 'k' || *end == 'K')
+        value *= 1000;
+    else if (*end == 'm' || *end == 'M')
+        value *= 1000000;
+
+    return value;
+}
+
+/*-------------------------------Pty-----------------------------------------------------*/
+
+static int startSession(Session* session, const char* shell)
+{
+    // echo off, so the typed lines don't come back and don't fill the pty
+    struct termios termios;
+    memset(&termios, 0, sizeof(termios));
+    cfmakeraw(&termios);
+    termios.c_lflag |= ICANON;
+    termios.c_oflag |= OPOST | ONLCR;
+    termios.c_iflag |= ICRNL;
+    termios.c_cc[VMIN] = 1;
+
+    session->matched = 0;
+    session->pid = forkpty(&session->master, NULL, &termios, NULL);
+    if (session->pid == -1)
+        return -1;
+
+    if (session->pid == 0)
+    {
+        execl(shell, shell, (char*)NULL);
+        execlp(shell, shell, (char*)NULL);
+        _exit(127);
+    }
+
+    return 0;
+}
+
+static void stopSession(Session* session)
+{
+    close(session->master);
+    kill(session->pid, SIGKILL);
+    waitpid(session->pid, NULL, 0);
+}
+
+// reads what the shell wrote, returns the number of prompts in it, or -1 if it wrote nothing before the timeout
+static int readPrompts(Session* session, int timeout)
+{
+    struct pollfd pfd = { session->master, POLLIN, 0 };
+    if (poll(&pfd, 1, timeout) <= 0)
+        return -1;
+
+    char buffer[65536];
+    ssize_t length = read(session->master, buffer, sizeof(buffer));
+    if (length <= 0)
+        return -1;
+
+    // the marker may be split over two reads
+    static const char marker[] = PROMPT_MARKER;
+    int prompts = 0;
+    for (ssize_t i = 0; i < length; i++)
+    {
+        if (buffer[i] == marker[session->matched])
+            session->matched++;
+        else
+            session->matched = buffer[i] == marker[0];
+
+        if (session->matched == sizeof(marker) - 1)
+        {
+            prompts++;
+            session->matched = 0;
+        }
+    }
+
+    return prompts;
+}
+
+static int waitPrompts(Session* session, long count)
+{
+    while (count > 0)
+    {
+        int prompts = readPrompts(session, PROMPT_TIMEOUT_MS);
+        if (prompts == -1)
+            return -1;
+        count -= prompts;
+    }
+
+    return 0;
+}
+
+static int typeLine(Session* session, const char* line)
+{
+    size_t length = strlen(line);
+    while (length > 0)
+    {
+        ssize_t written = write(session->master, line, length);
+        if (written == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        line += written;
+        length -= written;
+    }
+
+    return 0;
+}
+
+// types count lines, reading the prompts in between so neither side of the pty fills up
+static int fillHistory(Session* session, size_t count)
+{
+    size_t typed = 0, prompted = 0;
+    while (prompted < count)
+    {
+        while (typed < count && typed - prompted < FILL_BATCH)
+        {
+            if (typeLine(session, "cd .\n") == -1)
+                return -1;
+            typed++;
+        }
+
+        int prompts = readPrompts(session, PROMPT_TIMEOUT_MS);
+        if (prompts == -1)
+            return -1;
+        prompted += prompts;
+    }
+
+    return 0;
+}
+
+/*-------------------------------Measure-------------------------------------------------*/
+
+static int compareDouble(const void* a, const void* b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double* sorted, int n, double p)
+{
+    int index = (int)(p / 100 * (n - 1) + 0.5);
+    return sorted[index];
+}
+
+// types line samples times, each after the prompt of the one before, and prints the percentiles in microseconds
+static int measureLine(Session* session, size_t historySize, const char* name, const char* line, int samples)
+{
+    double* latencies = malloc(samples * sizeof(double));
+    if (!latencies)
+        return -1;
+
+    for (int i = 0; i < samples; i++)
+    {
+        double start = now();
+        if (typeLine(session, line) == -1 || waitPrompts(session, 1) == -1)
+        {
+            fprintf(stderr, "pty_latency: no prompt after %s\n", name);
+            free(latencies);
+            return -1;
+        }
+        latencies[i] = (now() - start) * 1e6;
+    }
+
+    qsort(latencies, samples, sizeof(double), compareDouble);
+    printf("%10zu %-14s %10.1f %10.1f %10.1f %10.1f\n", historySize, name, percentile(latencies, samples, 50),
+           percentile(latencies, samples, 90), percentile(latencies, samples, 99), latencies[samples - 1]);
+    fflush(stdout);
+
+    free(latencies);
+    return 0;
+}
+
+static int measureSize(const char* shell, size_t historySize, int samples)
+{
+    Session session;
+    if (startSession(&session, shell) == -1)
+    {
+        fprintf(stderr, "pty_latency: forkpty: %s\n", strerror(errno));
+        return -1;
+    }
+
+    // the prompt becomes the marker, the first entries are the only pwd and the prompt line itself
+    int status = -1;
+    double fillStart = now();
+    if (typeLine(&session, "prompt " PROMPT_MARKER "\n") == -1 || waitPrompts(&session, 1) == -1
+        || typeLine(&session, "pwd\n") == -1 || waitPrompts(&session, 1) == -1
+        || fillHistory(&session, historySize) == -1)
+    {
+        fprintf(stderr, "pty_latency: %s: no prompt while filling the history\n", shell);
+        goto out;
+    }
+    fprintf(stderr, "pty_latency: %zu entries typed in %.2fs\n", historySize, now() - fillStart);
+
+    char recallIndex[64];
+    snprintf(recallIndex, sizeof(recallIndex), "!%zu\n", historySize / 2 + 3);
+
+    if (measureLine(&session, historySize, "empty", "\n", samples) == -1
+        || measureLine(&session, historySize, "builtin", "cd .\n", samples) == -1
+        || measureLine(&session, historySize, "external", "/bin/true\n", samples) == -1
+        || measureLine(&session, historySize, "recall prefix", "!pw\n", samples) == -1
+        || measureLine(&session, historySize, "recall index", recallIndex, samples) == -1)
+        goto out;
+
+    status = 0;
+
+out:
+    stopSession(&session);
+    return status;
+}
+
+int main(int argc, char** argv)
+{
+    const char* shell = DEFAULT_SHELL;
+    int samples = DEFAULT_SAMPLES;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:n:")) != -1)
+    {
+        switch (opt)
+        {
+            case 's': shell = optarg; break;
+            case 'n': samples = atoi(optarg); break;
+            default:
+                fprintf(stderr, "Usage: %s [-s shell] [-n samples] [history_size...]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    if (samples < 1)
+    {
+        fprintf(stderr, "Usage: %s [-s shell] [-n samples] [history_size...]\n", argv[0]);
+        return 2;
+    }
+
+    static const char* defaultSizes[] = { "10K", "100K", "1M" };
+    int nSizes = optind < argc ? argc - optind : 3;
+    const char** sizes = optind < argc ? (const char**)argv + optind : defaultSizes;
+
+    printf("%10s %-14s %10s %10s %10s %10s\n", "history", "line", "p50 us", "p90 us", "p99 us", "max us");
+
+    int failed = 0;
+    for (int i = 0; i < nSizes; i++)
+    {
+        if (measureSize(shell, parseSize(sizes[i]), samples) == -1)
+            failed = 1;
+    }
+
+    return failed;
+}
@@ -0,0 +1,489 @@
+/**
+ * @file workloads.c
+ * @brief Runs end-to-end workload scripts through the shell, and through dash and bash for reference when they are installed, and reports the wall time, the CPU time, the max RSS and the forks of every run.
+ * @version 0.1
+ *
+ * Usage: workloads [-s shell] [-d dir] [-x scale] [-r runs] [-w workload,...] [-j file]
+ *
+ * The scripts are generated in dir ($TMPDIR/shell_workloads by default), in the syntax the three shells share, so the shell has no loops to write them with:
+ *
+ *     spawn       100k trivial external commands
+ *     builtins    100k builtins (cd and pwd)
+ *     pipeline    10 stages moving 10 GiB
+ *     background  10k background commands, then wait
+ *     glob        globs over a tree of 1M files, made once in dir and kept
+ *     early-exit  cat and grep producers of 256 MiB piped into a consumer that exits at once
+ *
+ * -x scales every size, -x 0.01 makes a quick run. Every workload runs -r times (3 by default) per shell, the run with the median wall time is reported. The CPU time and max RSS are those of the shell and the children it reaped, from wait4. The forks are the change in the processes counter of /proc/stat, so they count the whole machine and are exact on an idle one. -j writes the reported runs as JSON, one per line. A run of early-exit is killed after EARLY_EXIT_TIMEOUT seconds, a producer that never sees EPIPE makes it fail instead of hang.
+ *
+ * Nothing is downloaded, it needs a Linux /proc and the coreutils the scripts call.
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_SHELL "./shell"
+#define DEFAULT_RUNS 3
+#define MAX_RUNS 31
+#define MAX_SHELLS 3
+
+#define SPAWN_COMMANDS 100000
+#define BUILTIN_COMMANDS 100000
+#define PIPELINE_BYTES (10ULL << 30)
+#define PIPELINE_STAGES 10
+#define BACKGROUND_COMMANDS 10000
+#define GLOB_DIRECTORIES 1000
+#define GLOB_FILES_PER_DIRECTORY 1000
+#define GLOB_LINES 10
+#define EARLY_EXIT_BYTES (256LL << 20)
+#define EARLY_EXIT_TIMEOUT 30
+
+// the directories are shorter, the room left is for the file names under them
+#define DIR_LENGTH 4096
+#define PATH_LENGTH (DIR_LENGTH + 64)
+
+typedef struct Workload {
+    const char* name;
+    int (*generate)(FILE* script, double scale, const char* dir);
+    unsigned timeout;       //< seconds, 0 for none
+} Workload;
+
+typedef struct Run {
+    double wall;
+    double user;
+    double system;
+    long maxRSS;            //< KiB
+    long forks;
+    int status;
+} Run;
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long scaled(long count, double scale)
+{
+    long value = (long)(count * scale);
+    return value > 0 ? value : 1;
+}
+
+/*-------------------------------Scripts-------------------------------------------------*/
+
+// /bin/true, not true, which bash and dash run as a builtin
+static int generateSpawn(FILE* script, double scale, const char* dir)
+{
+    (void)dir;
+    long commands = scaled(SPAWN_COMMANDS, scale);
+    for (long i = 0; i < commands; i++)
+        fprintf(script, "/bin/true\n");
+    return 0;
+}
+
+static int generateBuiltins(FILE* script, double scale, const char* dir)
+{
+    long commands = scaled(BUILTIN_COMMANDS, scale);
+    for (long i = 0; i < commands; i += 2)
+        fprintf(script, "cd %s\npwd\n", dir);
+    return 0;
+}
+
+static int generatePipeline(FILE* script, double scale, const char* dir)
+{
+    (void)dir;
+    // lines of yes, the text builtins are made for lines
+    fprintf(script, "yes | head -c %llu", (unsigned long long)(PIPELINE_BYTES * scale));
+    for (int i = 3; i < PIPELINE_STAGES; i++)
+        fprintf(script, " | cat");
+    fprintf(script, " | wc -c\n");
+    return 0;
+}
+
+static int generateBackground(FILE* script, double scale, const char* dir)
+{
+    (void)dir;
+    long commands = scaled(BACKGROUND_COMMANDS, scale);
+    for (long i = 0; i < commands; i++)
+        fprintf(script, "/bin/true &\n");
+    fprintf(script, "wait\n");
+    return 0;
+}
+
+// the tree is dir/glob<scale>/dNNN/fNNN, made once. Its name has the scale so smaller runs don't reuse a bigger tree
+static int makeGlobTree(const char* tree, long directories, long files)
+{
+    char path[PATH_LENGTH];
+    snprintf(path, sizeof(path), "%s/.complete", tree);
+    if (access(path, F_OK) == 0)
+        return 0;
+
+    fprintf(stderr, "workloads: making %ld files in %s\n", directories * files, tree);
+    if (mkdir(tree, 0755) == -1 && errno != EEXIST)
+        return -1;
+
+    for (long d = 0; d < directories; d++)
+    {
+        snprintf(path, sizeof(path), "%s/d%03ld", tree, d);
+        if (mkdir(path, 0755) == -1 && errno != EEXIST)
+            return -1;
+
+        for (long f = 0; f < files; f++)
+        {
+            snprintf(path, sizeof(path), "%s/d%03ld/f%03ld", tree, d, f);
+            int fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+            if (fd == -1)
+                return -1;
+            close(fd);
+        }
+    }
+
+    snprintf(path, sizeof(path), "%s/.complete", tree);
+    int fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1)
+        return -1;
+    close(fd);
+    return 0;
+}
+
+static int generateGlob(FILE* script, double scale, const char* dir)
+{
+    long directories = scaled(GLOB_DIRECTORIES, scale < 1 ? scale : 1);
+    long files = scaled(GLOB_FILES_PER_DIRECTORY, scale < 1 ? 1 : scale);
+
+    char tree[DIR_LENGTH];
+    snprintf(tree, sizeof(tree), "%s/glob%ldx%ld", dir, directories, files);
+    if (makeGlobTree(tree, directories, files) == -1)
+    {
+        fprintf(stderr, "workloads: %s: %s\n", tree, strerror(errno));
+        return -1;
+    }
+
+    // every pattern reads every directory of the tree, and matches one file in a hundred, well within ARG_MAX
+    for (int i = 0; i < GLOB_LINES; i++)
+        fprintf(script, "/bin/echo %s/*/f%d?\n", tree, i);
+    return 0;
+}
+
+// the producers are builtins of the shell, run in a subshell of the pipeline. Each one must get EPIPE once true has exited
+static int generateEarlyExit(FILE* script, double scale, const char* dir)
+{
+    long long bytes = (long long)(EARLY_EXIT_BYTES * scale);
+    char path[PATH_LENGTH];
+    snprintf(path, sizeof(path), "%s/early_exit%lld.txt", dir, bytes);
+
+    struct stat st;
+    if (stat(path, &st) == -1 || st.st_size < bytes)
+    {
+        FILE* file = fopen(path, "we");
+        if (!file)
+        {
+            fprintf(stderr, "workloads: %s: %s\n", path, strerror(errno));
+            return -1;
+        }
+
+        for (long long written = 0; written < bytes; written += 16)
+            fprintf(file, "line %010lld\n", written / 16);
+        if (fclose(file) != 0)
+            return -1;
+    }
+
+    fprintf(script, "cat %s | true\n", path);
+    fprintf(script, "grep -F line %s | true\n", path);
+    return 0;
+}
+
+static const Workload workloads[] = {
+    {"spawn", generateSpawn, 0},
+    {"builtins", generateBuiltins, 0},
+    {"pipeline", generatePipeline, 0},
+    {"background", generateBackground, 0},
+    {"glob", generateGlob, 0},
+    {"early-exit", generateEarlyExit, EARLY_EXIT_TIMEOUT},
+};
+
+static int writeScript(const Workload* workload, double scale, const char* dir, char* path, size_t size)
+{
+    snprintf(path, size, "%s/%s.sh", dir, workload->name);
+    FILE* script = fopen(path, "we");
+    if (!script)
+    {
+        fprintf(stderr, "workloads: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    int status = workload->generate(script, scale, dir);
+    if (fclose(script) != 0)
+        status = -1;
+    return status;
+}
+
+/*-------------------------------Runs----------------------------------------------------*/
+
+// the number of processes the machine has forked since boot
+static long forkCount()
+{
+    FILE* file = fopen("/proc/stat", "re");
+    if (!file)
+        return -1;
+
+    char line[256];
+    long processes = -1;
+    while (fgets(line, sizeof(line), file))
+    {
+        if (sscanf(line, "processes %ld", &processes) == 1)
+            break;
+    }
+
+    fclose(file);
+    return processes;
+}
+
+// only there to interrupt wait4
+static void onAlarm(int signal)
+{
+    (void)signal;
+}
+
+// runs shell on the script, with its output discarded. After timeout seconds, unless it is 0, the shell and its children are killed: the shell handles SIGALRM itself, so the alarm is the parent's
+static int runScript(const char* shell, const char* script, unsigned timeout, Run* run)
+{
+    long forksBefore = forkCount();
+    double start = now();
+
+    pid_t pid = fork();
+    if (pid == -1)
+        return -1;
+
+    if (pid == 0)
+    {
+        // its own group, so a stage left hanging is killed with it
+        setpgid(0, 0);
+        int devNull = open("/dev/null", O_WRONLY);
+        if (devNull != -1)
+        {
+            dup2(devNull, STDOUT_FILENO);
+            close(devNull);
+        }
+        execl(shell, shell, script, (char*)NULL);
+        execlp(shell, shell, script, (char*)NULL);
+        _exit(127);
+    }
+
+    struct sigaction action = { .sa_handler = onAlarm }, oldAction;
+    sigaction(SIGALRM, &action, &oldAction);
+    alarm(timeout);
+
+    int status;
+    struct rusage usage;
+    pid_t reaped;
+    while ((reaped = wait4(pid, &status, 0, &usage)) == -1 && errno == EINTR)
+    {
+        fprintf(stderr, "workloads: %s %s: killed after %us\n", shell, script, timeout);
+        kill(-pid, SIGKILL);
+    }
+
+    alarm(0);
+    sigaction(SIGALRM, &oldAction, NULL);
+    if (reaped == -1)
+        return -1;
+
+    run->wall = now() - start;
+    run->user = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6;
+    run->system = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+    run->maxRSS = usage.ru_maxrss;
+    run->forks = forksBefore == -1 ? -1 : forkCount() - forksBefore - 1;
+    run->status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    return 0;
+}
+
+static int compareWall(const void* a, const void* b)
+{
+    double wallA = ((const Run*)a)->wall;
+    double wallB = ((const Run*)b)->wall;
+    return (wallA > wallB) - (wallA < wallB);
+}
+
+// the first of dash or bash found in PATH, NULL if there is none
+static const char* findShell(const char* name, char* path, size_t size)
+{
+    const char* search = getenv("PATH");
+    if (!search)
+        search = "/usr/bin:/bin";
+
+    while (*search)
+    {
+        size_t length = strcspn(search, ":");
+        snprintf(path, size, "%.*s/%s", (int)length, search, name);
+        if (length > 0 && access(path, X_OK) == 0)
+            return path;
+
+        search += length;
+        if (*search == ':')
+            search++;
+    }
+
+    return NULL;
+}
+
+static bool selected(const char* list, const char* name)
+{
+    if (!list)
+        return true;
+
+    size_t length = strlen(name);
+    for (const char* entry = list; *entry;)
+    {
+        size_t entryLength = strcspn(entry, ",");
+        if (entryLength == length && strncmp(entry, name, length) == 0)
+            return true;
+
+        entry += entryLength;
+        if (*entry == ',')
+            entry++;
+    }
+
+    return false;
+}
+
+static void usage(const char* program)
+{
+    fprintf(stderr, "Usage: %s [-s shell] [-d dir] [-x scale] [-r runs] [-w workload,...] [-j file]\n", program);
+}
+
+int main(int argc, char** argv)
+{
+    const char* shells[MAX_SHELLS] = { DEFAULT_SHELL };
+    const char* dir = NULL;
+    const char* list = NULL;
+    const char* jsonPath = NULL;
+    double scale = 1;
+    int runs = DEFAULT_RUNS;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:d:x:r:w:j:")) != -1)
+    {
+        switch (opt)
+        {
+            case 's': shells[0] = optarg; break;
+            case 'd': dir = optarg; break;
+            case 'x': scale = atof(optarg); break;
+            case 'r': runs = atoi(optarg); break;
+            case 'w': list = optarg; break;
+            case 'j': jsonPath = optarg; break;
+            default:
+                usage(argv[0]);
+                return 2;
+        }
+    }
+
+    if (scale <= 0 || runs < 1 || runs > MAX_RUNS || optind < argc)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    char defaultDir[DIR_LENGTH];
+    if (!dir)
+    {
+        const char* tmp = getenv("TMPDIR");
+        snprintf(defaultDir, sizeof(defaultDir), "%s/shell_workloads", tmp ? tmp : "/tmp");
+        dir = defaultDir;
+    }
+    if (mkdir(dir, 0755) == -1 && errno != EEXIST)
+    {
+        fprintf(stderr, "workloads: %s: %s\n", dir, strerror(errno));
+        return 1;
+    }
+
+    // the shell may be given relative to the current directory, the builtins workload changes it in the script only
+    char shellPath[4096];
+    if (strchr(shells[0], '/') && realpath(shells[0], shellPath))
+        shells[0] = shellPath;
+
+    int nShells = 1;
+    char dashPath[4096], bashPath[4096];
+    if ((shells[nShells] = findShell("dash", dashPath, sizeof(dashPath))))
+        nShells++;
+    if ((shells[nShells] = findShell("bash", bashPath, sizeof(bashPath))))
+        nShells++;
+
+    FILE* json = NULL;
+    if (jsonPath && !(json = fopen(jsonPath, "we")))
+    {
+        fprintf(stderr, "workloads: %s: %s\n", jsonPath, strerror(errno));
+        return 1;
+    }
+
+    printf("%-12s %-24s %10s %10s %10s %10s %10s %6s\n", "workload", "shell", "wall", "user", "sys", "maxrss", "forks", "exit");
+
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++)
+    {
+        const Workload* workload = &workloads[i];
+        if (!selected(list, workload->name))
+            continue;
+
+        char script[PATH_LENGTH];
+        if (writeScript(workload, scale, dir, script, sizeof(script)) == -1)
+        {
+            failed = 1;
+            continue;
+        }
+
+        for (int s = 0; s < nShells; s++)
+        {
+            Run results[MAX_RUNS];
+            int completed = 0;
+            for (int r = 0; r < runs; r++)
+            {
+                if (runScript(shells[s], script, workload->timeout, &results[completed]) == 0)
+                    completed++;
+            }
+
+            if (completed == 0)
+            {
+                fprintf(stderr, "workloads: %s: %s\n", shells[s], strerror(errno));
+                failed = 1;
+                continue;
+            }
+
+            qsort(results, completed, sizeof(Run), compareWall);
+            Run* median = &results[completed / 2];
+            if (median->status != 0)
+                failed = 1;
+
+            printf("%-12s %-24s %9.3fs %9.3fs %9.3fs %8ldKB %10ld %6d\n", workload->name, shells[s],
+                   median->wall, median->user, median->system, median->maxRSS, median->forks, median->status);
+            fflush(stdout);
+
+            if (json)
+            {
+                fprintf(json, "{\"workload\":\"%s\",\"shell\":\"%s\",\"scale\":%g,\"runs\":%d,\"wall\":%.6f,\"user\":%.6f,\"system\":%.6f,\"maxRSS\":%ld,\"forks\":%ld,\"exit\":%d}\n",
+                        workload->name, shells[s], scale, completed, median->wall, median->user, median->system,
+                        median->maxRSS, median->forks, median->status);
+            }
+        }
+    }
+
+    if (json && fclose(json) != 0)
+        failed = 1;
+
+    return failed;
+}
@@ -0,0 +1,162 @@
+/**
+ * @file shell_client.c
+ * @brief A small client for the shell server. It hands its working directory, environment and stdio to the server, which runs the script, and exits with the script's status.
+ * @version 0.1
+ *
+ * Usage: shell-client <socket> <script | ->
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "server.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+extern char** environ;
+
+// writes the whole buffer
+static int writeFully(int fd, const void* buffer, size_t length)
+{
+    size_t written = 0;
+    while (written < length)
+    {
+        ssize_t nwritten = write(fd, (const char*)buffer + written, length - written);
+        if (nwritten == -1 && errno == EINTR)
+            continue;
+        if (nwritten <= 0)
+            return -1;
+        written += nwritten;
+    }
+
+    return 0;
+}
+
+// appends a NUL terminated string to the request
+static char* appendString(char* request, size_t* length, const char* str)
+{
+    size_t size = strlen(str) + 1;
+    char* grown = (char*)realloc(request, *length + size);
+    if (!grown)
+    {
+        free(request);
+        return NULL;
+    }
+
+    memcpy(grown + *length, str, size);
+    *length += size;
+    return grown;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc != 3)
+    {
+        fprintf(stderr, "Usage: %s <socket> <script | %s>\n", argv[0], SERVER_SCRIPT_STDIN);
+        return 2;
+    }
+
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd)))
+    {
+        perror("getcwd");
+        return 1;
+    }
+
+    // the server resolves the script in its own directory, so send an absolute path
+    char script[PATH_MAX];
+    if (strcmp(argv[2], SERVER_SCRIPT_STDIN) == 0)
+        snprintf(script, sizeof(script), "%s", SERVER_SCRIPT_STDIN);
+    else if (!realpath(argv[2], script))
+    {
+        fprintf(stderr, "%s: %s: %s\n", argv[0], argv[2], strerror(errno));
+        return 127;
+    }
+
+    char* strings = NULL;
+    size_t length = 0;
+    uint32_t envCount = 0;
+
+    strings = appendString(strings, &length, cwd);
+    if (strings)
+        strings = appendString(strings, &length, script);
+    for (char** env = environ; strings && *env; env++, envCount++)
+        strings = appendString(strings, &length, *env);
+
+    if (!strings || length > SERVER_MAX_REQUEST_LENGTH)
+    {
+        fprintf(stderr, "%s: request too large\n", argv[0]);
+        return 1;
+    }
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s", argv[1]);
+
+    int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connection == -1 || connect(connection, (struct sockaddr*)&address, sizeof(address)) == -1)
+    {
+        fprintf(stderr, "%s: %s: %s\n", argv[0], argv[1], strerror(errno));
+        return 1;
+    }
+
+    // the header carries our stdin, stdout and stderr
+    ServerRequestHeader header = { SERVER_PROTOCOL_MAGIC, (uint32_t)length, envCount };
+    struct iovec iov = { .iov_base = &header, .iov_len = sizeof(header) };
+
+    int fds[SERVER_PASSED_FDS] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+    union {
+        char buffer[CMSG_SPACE(sizeof(fds))];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.buffer;
+    message.msg_controllen = sizeof(control.buffer);
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    ssize_t sent;
+    while ((sent = sendmsg(connection, &message, 0)) == -1 && errno == EINTR);
+
+    if (sent != sizeof(header) || writeFully(connection, strings, length) != 0)
+    {
+        fprintf(stderr, "%s: failed to send the request: %s\n", argv[0], strerror(errno));
+        return 1;
+    }
+    free(strings);
+
+    // the server answers once the script is done
+    int32_t status;
+    size_t received = 0;
+    while (received < sizeof(status))
+    {
+        ssize_t nread = read(connection, (char*)&status + received, sizeof(status) - received);
+        if (nread == -1 && errno == EINTR)
+            continue;
+        if (nread <= 0)
+        {
+            fprintf(stderr, "%s: the server closed the connection\n", argv[0]);
+            return 1;
+        }
+        received += nread;
+    }
+
+    close(connection);
+    return status & 0xff;
+}
\ No newline at end of file
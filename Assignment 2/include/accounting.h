@@ -0,0 +1,131 @@
+/**
+ * @file accounting.h
+ * @brief Heap and fd accounting of the shell, to find what a long-running shell leaks. The tokenizer, the parser, the history, the execution and the path cache allocate through tracked wrappers, which keep the live bytes and blocks of every subsystem in atomic counters, sized with malloc_usable_size. The fds the shell opens are registered with their origin. The shellstats builtin reports both, and `setopt leakcheck 1` checks after every top-level command that the fds and the heap of the transient subsystems are back where they were.
+ * @version 0.1
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef ACCOUNTING_H
+#define ACCOUNTING_H
+
+#include "command.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// fds whose origin is remembered, the ones above are listed without it
+#define FD_REGISTRY_SIZE 1024
+
+// the subsystems the tracked allocations are charged to
+typedef enum AllocSubsystem {
+    ALLOC_TOKENIZER,
+    ALLOC_PARSER,
+    ALLOC_HISTORY,
+    ALLOC_EXEC,
+    ALLOC_PATH_CACHE,
+    ALLOC_N_SUBSYSTEMS
+} AllocSubsystem;
+
+// in the order of AllocSubsystem
+#define ALLOC_SUBSYSTEM_NAMES { "tokenizer", "parser", "history", "exec", "path cache" }
+
+// the history and the path cache grow by design, leakcheck leaves them out
+#define ALLOC_TRANSIENT(subsystem) ((subsystem) != ALLOC_HISTORY && (subsystem) != ALLOC_PATH_CACHE)
+
+// copies a string like COPY, charged to a subsystem
+#define TRACKED_COPY(subsystem, str) (str ? trackedStrndup(subsystem, str, MAX_STRING_LENGTH) : NULL)
+
+// the counters of a subsystem. A realloc counts as an allocation of its new size, without a block of its own
+typedef struct AllocStats {
+    int64_t liveBytes;
+    int64_t liveBlocks;
+    uint64_t allocations;
+    uint64_t allocatedBytes;
+    uint64_t frees;
+} AllocStats;
+
+// the heap and fds before a top-level command, for leakcheck
+typedef struct LeakMark {
+    int64_t bytes;
+    int64_t blocks;
+    int fds;
+} LeakMark;
+
+/**
+ * @brief malloc, charged to a subsystem. The block must be freed with trackedFree() and the same subsystem.
+ *
+ */
+void* trackedMalloc(AllocSubsystem subsystem, size_t size);
+
+/**
+ * @brief calloc, charged to a subsystem.
+ *
+ */
+void* trackedCalloc(AllocSubsystem subsystem, size_t count, size_t size);
+
+/**
+ * @brief realloc, charged to a subsystem. A NULL ptr allocates, like realloc.
+ *
+ */
+void* trackedRealloc(AllocSubsystem subsystem, void* ptr, size_t size);
+
+/**
+ * @brief strndup, charged to a subsystem.
+ *
+ */
+char* trackedStrndup(AllocSubsystem subsystem, const char* str, size_t length);
+
+/**
+ * @brief free, of a block charged to a subsystem. NULL is ignored.
+ *
+ */
+void trackedFree(AllocSubsystem subsystem, void* ptr);
+
+/**
+ * @brief Reads the counters of a subsystem.
+ *
+ */
+void getAllocStats(AllocSubsystem subsystem, AllocStats* stats);
+
+/**
+ * @brief Remembers where an fd comes from, like "pipe" or "redirection". The origin must be a string literal.
+ *
+ */
+void registerFD(int fd, const char* origin);
+
+/**
+ * @brief Forgets the origin of an fd that is being closed.
+ *
+ */
+void forgetFD(int fd);
+
+/**
+ * @brief Takes the heap of the transient subsystems and the number of open fds before a top-level command.
+ *
+ */
+void startLeakCheck(LeakMark* mark);
+
+/**
+ * @brief Logs an error if the heap of the transient subsystems or the number of open fds grew since the mark.
+ *
+ * @param mark The mark taken before the command
+ * @param line The command, for the report
+ * @return int 0 if nothing grew, -1 otherwise
+ */
+int endLeakCheck(const LeakMark* mark, const char* line);
+
+/**
+ * @brief This function is the builtin for the shellstats command.
+ *
+ * Usage: `shellstats`
+ *
+ * Prints the live bytes, live blocks, allocations and frees of every subsystem, then every open fd with its origin and what it points to.
+ *
+ * @param simpleCommand The command to be executed.
+ * @return int Returns 0 on success, -1 on failure.
+ */
+int shellstats(SimpleCommand* simpleCommand);
+
+#endif // ACCOUNTING_H
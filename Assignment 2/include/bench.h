@@ -0,0 +1,38 @@
+/**
+ * @file bench.h
+ * @brief Declaration of the bench builtin, which runs a command line repeatedly through the normal execution path and reports the distribution of its wall time.
+ * @version 0.1
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "command.h"
+
+// number of measured runs without -n
+#define BENCH_DEFAULT_RUNS 10
+// upper bound of -n and -j, so a typo doesn't allocate or fork without end
+#define BENCH_MAX_RUNS 10000000
+#define BENCH_MAX_CONCURRENCY 1024
+// Tukey's fences, a run further than this many IQRs outside the quartiles is a mild or a severe outlier
+#define BENCH_MILD_OUTLIER_IQR 1.5
+#define BENCH_SEVERE_OUTLIER_IQR 3.0
+
+/**
+ * @brief This function is the builtin for the bench command.
+ *
+ * Usage: `bench [-n runs] [-w warmup] [-j concurrency] [-s] [--export-csv file] [--export-json file] -- command [args]*`
+ *
+ * The command line after `--` is tokenized once, a single argument is taken as a whole command line so `'a | b'` benchmarks a pipeline. Every run parses it again, since the parser opens the pipes and files of the run, and executes it with executeCommandChain(). Only the execution is timed. The -w warmup runs aren't measured. With -j the runs are shared by that many forked copies of the shell running concurrently. The command reads /dev/null and its output is discarded, unless -s shows it. A lone builtin runs in the shell like any other, so cd, exit, prompt and setopt are refused, they would change the shell on every run.
+ *
+ * The report gives the min, mean, standard deviation, p50, p90, p99 and max of the wall time, the mean user and system CPU time of a run (the shell's and its children's), and the outliers by Tukey's fences. Every run can be exported as CSV, and the summary and the runs as JSON.
+ *
+ * @param command The command to be executed.
+ * @return int Returns 0 when every run exited with 0, 1 if some didn't, -1 on usage errors.
+ */
+int bench(SimpleCommand* command);
+
+#endif // BENCH_H
@@ -36,6 +36,8 @@ typedef struct SimpleCommand {
 
     int noWait;        //< specifies that whether dont need to wait for this simple command to finish. default is 0, in case of a background job, it is 1
 
+    char* cpuList;     //< cpulist the process is pinned to before exec, from @cpulist or the cpu placement. Default is NULL, no pinning
+
     int (*execute)(struct SimpleCommand*); //< function pointer to the function that will execute the simple command.
 } SimpleCommand;
 
@@ -53,6 +55,10 @@ typedef struct Command {
 
     bool background;                        //< flag for background execution
 
+    struct PipeStat* stats;                 //< statistics of the running stages with setopt pipestat, NULL otherwise
+    struct CommandTiming* timing;           //< what the time keyword measures, NULL if the command isn't timed
+    char** sourceTokens;                    //< the tokens of a background command, a queued job parses them again when it starts. NULL otherwise
+
     char* chainingOperator;                 //< what chaining operator is used to chain with the next command. can be ';'/'&' but you can add more
     struct Command* next;                   //< pointer to the next command in the chain
 } Command;
@@ -140,6 +146,13 @@ int addSimpleCommand(Command* command, SimpleCommand* simpleCommand);
  */
 void cleanUpSimpleCommand(SimpleCommand* simpleCommand);
 
+/**
+ * @brief Closes the pipes and files the parser opened for the stages of a command that won't be executed. Executing a command closes them itself.
+ *
+ * @param command The command
+ */
+void closeCommandFDs(Command* command);
+
 /**
  * @brief The function is responsible for freeing up the memory allocated by a command. All the internal arrays and strings are freed, and the pointer is set to NULL.
  * 
@@ -169,15 +182,23 @@ void cleanUpCommandChain(CommandChain* chain);
 int executeCommandChain(CommandChain* chain);
 
 /**
- * @brief This function executes a command. The function traverses the simple commands in the command, and executes them one by one.
+ * @brief This function executes a command. A lone simple command runs as before, builtins run in the shell itself. In a pipeline every stage is launched before any is waited for, and builtin stages run in a forked subshell, so all stages run concurrently and no stage blocks on a pipe nobody reads yet.
  * 
  * @param command The command to execute
- * @return int Status code (exit status of the last command)
+ * @return int Status code (exit status of the last stage)
  */
 int executeCommand(Command* command);
 
 // ------------------------- Debug --------------------------------
 
+/**
+ * @brief This function joins the args of all the stages of a command into a readable command line, like `ls -l | grep a`. It returns NULL on failure. The caller is responsible for freeing the string.
+ * 
+ * @param command The command to describe
+ * @return char* The command line
+ */
+char* describeCommand(Command* command);
+
 /**
  * @brief This function prints the command chain in a readable format. Purely a debug utility.
  * 
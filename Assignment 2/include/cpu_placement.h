@@ -0,0 +1,48 @@
+/**
+ * @file cpu_placement.h
+ * @brief CPU placement of pipeline stages. With `setopt cpu-placement 1` the stages of a pipeline share the CPUs of one L3 cache (or NUMA node), and successive pipelines go round robin over the groups. An `@cpulist` before a command pins it explicitly.
+ * @version 0.1
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef CPU_PLACEMENT_H
+#define CPU_PLACEMENT_H
+
+#include "command.h"
+
+#include <stdbool.h>
+
+// the sysfs files are read into buffers of this size
+#define CPU_LIST_LENGTH 1024
+// cache levels looked at under cpu<N>/cache/index<i>
+#define CPU_CACHE_INDEXES 8
+
+// checks if the token pins the command after it, like @0-3,8
+#define IS_CPU_PLACEMENT(token) (token[0] == '@' && token[1] >= '0' && token[1] <= '9')
+
+/**
+ * @brief Tells whether a string is a cpulist the kernel would take, like 0-3,8,10-11.
+ *
+ */
+bool isValidCpuList(const char* list);
+
+/**
+ * @brief Pins the calling process to the CPUs of a cpulist. Meant for a child between fork and exec.
+ *
+ * @param list The cpulist
+ * @return int Returns 0 on success, -1 on failure.
+ */
+int applyCpuList(const char* list);
+
+/**
+ * @brief Picks the next CPU group for a pipeline and sets it as the cpuList of the stages that weren't pinned with @. Does nothing when the machine has a single group, the stages may run anywhere then.
+ *
+ * The groups are read once from /sys/devices/system/cpu: the CPUs sharing an L3 cache, or else a package, restricted to the CPUs the shell may run on.
+ *
+ * @param command The pipeline
+ */
+void placePipeline(Command* command);
+
+#endif // CPU_PLACEMENT_H
@@ -0,0 +1,57 @@
+/**
+ * @file io_builtins.h
+ * @brief Declarations of the cat and tee builtins. They move data between fds inside the kernel (copy_file_range, sendfile, splice and tee) and fall back to read and write for terminals, appends and ring buffers.
+ * @version 0.1
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef IO_BUILTINS_H
+#define IO_BUILTINS_H
+
+#include "command.h"
+#include "stream.h"
+
+#include <stdbool.h>
+
+// most bytes moved by one copy_file_range, sendfile or splice call
+#define IO_COPY_SIZE (1024 * 1024)
+// size asked for the pipes tee spools its input through
+#define IO_PIPE_SIZE (1024 * 1024)
+// buffer of the read and write fallback
+#define IO_BUFFER_SIZE (128 * 1024)
+
+/**
+ * @brief This function is the builtin for cat.
+ *
+ * Usage: `cat [file...]`
+ *
+ * Without files, or for a file named -, the input of the command is copied. A file is copied to a file with copy_file_range, to a pipe with splice and to anything else with sendfile. Options run the cat found in PATH instead.
+ *
+ * @param command The command to be executed.
+ * @return int Returns 0 on success, -1 on failure.
+ */
+int cat(SimpleCommand* command);
+
+/**
+ * @brief This function is the builtin for tee, named so it doesn't clash with tee(2).
+ *
+ * Usage: `tee [-a] [file...]`
+ *
+ * The input is spliced into a pipe, duplicated with tee(2) for all but the last destination and spliced out to each of them, so the data never reaches user space. Terminals and files opened for appending (-a or >>) take the read and write path.
+ *
+ * @param command The command to be executed.
+ * @return int Returns 0 on success, -1 on failure.
+ */
+int teeBuiltin(SimpleCommand* command);
+
+// the stream functions of the builtins above, see StreamFunction in shell_builtins.h
+int catStream(SimpleCommand* command, Stream* input, Stream* output);
+int teeStream(SimpleCommand* command, Stream* input, Stream* output);
+
+// whether the builtins implement the options of an invocation, see SupportFunction in shell_builtins.h
+bool catSupported(SimpleCommand* command);
+bool teeSupported(SimpleCommand* command);
+
+#endif // IO_BUILTINS_H
@@ -0,0 +1,118 @@
+/**
+ * @file jobs.h
+ * @brief Admission control for background jobs. Pipelines sent to the background wait in a FIFO queue until the configured limits let them start.
+ * @version 0.1
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef JOBS_H
+#define JOBS_H
+
+#include "command.h"
+
+#include <sys/types.h>
+
+// files exposing the pressure stall information of the system
+#define PSI_CPU_PATH "/proc/pressure/cpu"
+#define PSI_MEMORY_PATH "/proc/pressure/memory"
+
+// how often a queue held back by pressure is checked again, in milliseconds
+#define JOB_THROTTLE_RECHECK_MS 250
+
+// state of a background job
+typedef enum JobState {
+    JOB_QUEUED,     //< waiting for room under the limits
+    JOB_RUNNING,    //< launched, some of its processes are still alive
+    JOB_DONE        //< all of its processes were reaped
+} JobState;
+
+// a background job, i.e. a pipeline sent to the background with &
+typedef struct Job {
+    int id;                 //< job number, as shown by the jobs builtin
+    Command* command;       //< the pipeline, owned by the job. A queued job has no stages, they are parsed from its tokens when it starts
+    char** tokens;          //< the tokens of the pipeline, until the job starts
+    char* description;      //< command line of the pipeline, for display
+    JobState state;
+    pid_t owner;            //< the shell process that submitted the job, a forked subshell leaves the jobs it inherited alone
+
+    pid_t* pids;            //< pids of the external stages, 0 once reaped
+    int nPids;
+    int status;             //< exit status of the last stage
+
+    struct Job* next;
+} Job;
+
+/**
+ * @brief Takes over a background command and either starts it right away, or queues it until the limits allow it to run.
+ *
+ * The simple commands are moved out of the given command into the job, so the caller can clean up its chain as usual. Returns 0 on success, -1 on failure.
+ *
+ * @param command The background command
+ * @return int Status code (0 on success, -1 on failure)
+ */
+int submitBackgroundJob(Command* command);
+
+/**
+ * @brief Records that a child exited or the throttle timer fired. Async-signal-safe, called from the SIGCHLD and SIGALRM handlers.
+ *
+ */
+void notifyJobEvent();
+
+/**
+ * @brief Reaps the finished background processes without blocking, and starts queued jobs while the limits allow it. Safe to call at any time from the main loop, and from the foreground waits when SIGCHLD interrupts them.
+ *
+ */
+void reapJobs();
+
+/**
+ * @brief Blocks until every background job, queued or running, has finished.
+ *
+ * @return int Exit status of the last job that finished
+ */
+int waitForJobs();
+
+/**
+ * @brief Blocks until the queue of background jobs is empty, i.e. every job has been started. Used before the shell exits so queued jobs are not lost.
+ *
+ */
+void drainJobQueue();
+
+/**
+ * @brief Returns the number of background jobs currently running.
+ *
+ * @return int Number of running jobs
+ */
+int getRunningJobCount();
+
+/**
+ * @brief Returns the number of background jobs the shell still holds, queued, running or done but not yet cleaned up.
+ *
+ * @return int Number of jobs
+ */
+int getJobCount();
+
+/**
+ * @brief Frees the bookkeeping of all jobs. Jobs that are still running are left alone.
+ *
+ */
+void cleanUpJobs();
+
+/**
+ * @brief This function is the builtin for the jobs command. Lists the running and queued background jobs, with -v followed by the live statistics of their stages when pipestat is on.
+ *
+ * @param command The command to be executed.
+ * @return int Returns 0 on success, -1 on failure.
+ */
+int jobs(SimpleCommand* command);
+
+/**
+ * @brief This function is the builtin for the wait command. Waits for all background jobs, including the queued ones.
+ *
+ * @param command The command to be executed.
+ * @return int Returns the exit status of the last job.
+ */
+int waitBuiltin(SimpleCommand* command);
+
+#endif // JOBS_H
\ No newline at end of file
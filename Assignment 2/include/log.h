@@ -1,8 +1,10 @@
 /**
  * @file log.h
  * @brief A collection of macros and functions to facilitate logging in a helpful manner, instead of using plain printf statements.
+ *
+ * Errors and debug messages go through a logging backend. Every thread formats its messages into a ring buffer of its own, and a flusher thread writes the rings out with batched writev calls to the log fd (stderr, or SHELL_LOG_FD / SHELL_LOG_FILE). Errors are flushed at once. The level is chosen at runtime (SHELL_LOG_LEVEL or `setopt loglevel`) and cached, so a disabled LOG_DEBUG costs a load and a branch. LOG_PRINT is command output and stays a plain printf to stdout.
  * @version 0.1
- * 
+ *
  * @copyright Copyright (c) 2023
  */
 
@@ -20,9 +22,9 @@
 #define LOG_CYAN    "\033[1;36m"
 #define LOG_WHITE   "\033[1;37m"
 
-// defines for logging modes
+// defines for logging modes, they are also the levels: a message is logged if its mode is at most the current level
 #define LOG_ERR     0  /* For printing critical errors, always get printed */
-#define LOG_DBG     1  /* For printing debug print statements, only in debug mode */
+#define LOG_DBG     1  /* For printing debug print statements, only at the debug level */
 #define LOG_PRI     2  /* For normal printing of messages, always get printed without annotations */
 
 // Default colors for different log types
@@ -30,49 +32,72 @@
 #define LOG_COLOR_DBG   LOG_CYAN
 #define LOG_COLOR_PRI   LOG_WHITE
 
-// debug mode, debug messages are printed only if this is set to 1 (debug is provided as a compiler flag)
+// debug builds start at the debug level, the others can get there at runtime (debug is provided as a compiler flag)
 #ifdef DEBUG
-#define ANNOTATIONS 1      /* Change this to zero to disable all annotations even in debug mode */
+#define LOG_DEFAULT_LEVEL LOG_DBG
 #else
 #define DEBUG 0
-#define ANNOTATIONS 0
+#define LOG_DEFAULT_LEVEL LOG_ERR
 #endif
 
-// Macros to change the behavior of annotations
+// Macros to change the behavior of annotations, which are added at the debug level
 #define ANNOTATIONS_INFO 1  /* Change this to zero to disable annotations info */
 
 #define ANNOTATIONS_FILE 0
 #define ANNOTATIONS_FUNC 1
 #define ANNOTATIONS_LINE 1
 
+// size of the ring buffer of each thread, and the longest message, longer ones are truncated
+#define LOG_RING_SIZE (64 * 1024)
+#define LOG_MAX_MESSAGE 2048
+// how often the flusher writes the rings out, it is woken up earlier by a ring that is half full
+#define LOG_FLUSH_INTERVAL_MS 50
+
 // output function for printing, default is printf
 #define LOG_OUT(...) printf(__VA_ARGS__)
 
-// defines the annotation string.
-#define ANNOTATION_INFO_STRING do {\
-    if (ANNOTATIONS_INFO) {\
-        LOG_OUT(" ("); \
-        if (ANNOTATIONS_FILE) printf("%s", __FILE__); \
-        if (ANNOTATIONS_FILE) printf(","); \
-        if (ANNOTATIONS_FUNC) printf("%s", __func__); \
-        if (ANNOTATIONS_FUNC) printf(","); \
-        if (ANNOTATIONS_LINE) printf("%d", __LINE__); \
-        LOG_OUT(") ");\
-    }\
-} while (0)
+// the current level, read without a lock on every message
+extern int logLevel;
+
+// checks if messages of a mode are logged at the current level
+#define LOG_ENABLED(type) __builtin_expect(__atomic_load_n(&logLevel, __ATOMIC_RELAXED) >= (type), (type) == LOG_ERR)
 
 // macro to log a message.
 #define LOG(type, prefix, color, ...) \
     do { \
-        if (DEBUG) {\
-            LOG_OUT("%s%s%s: ", color, prefix, LOG_RESET); \
-            ANNOTATION_INFO_STRING; \
-            if (type == LOG_DBG) { \
-                LOG_OUT(__VA_ARGS__); \
-                break; \
-            } \
-        }\
-        if (type == LOG_ERR || type == LOG_PRI) { LOG_OUT(__VA_ARGS__); } \
+        if (type == LOG_PRI) { LOG_OUT(__VA_ARGS__); break; } \
+        if (LOG_ENABLED(type)) \
+            logMessage(type, prefix, color, __FILE__, __func__, __LINE__, __VA_ARGS__); \
     } while (0)
 
-#endif // LOG_H
\ No newline at end of file
+/**
+ * @brief Reads SHELL_LOG_LEVEL, SHELL_LOG_FD and SHELL_LOG_FILE and starts the flusher thread. Until then, and in forked children, messages are written synchronously.
+ *
+ */
+void initLogging();
+
+/**
+ * @brief Formats a message into the ring of the calling thread. Use the LOG_ macros instead.
+ *
+ */
+void logMessage(int type, const char* prefix, const char* color, const char* file, const char* func, int line, const char* format, ...) __attribute__((format(printf, 7, 8)));
+
+/**
+ * @brief Writes out everything logged so far, from every thread.
+ *
+ */
+void flushLogs();
+
+/**
+ * @brief Changes the level, LOG_ERR or LOG_DBG.
+ *
+ */
+void setLogLevel(int level);
+
+/**
+ * @brief Parses a level, by name (error, debug) or number. Returns -1 if it isn't one.
+ *
+ */
+int parseLogLevel(const char* str);
+
+#endif // LOG_H
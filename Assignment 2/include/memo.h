@@ -0,0 +1,37 @@
+/**
+ * @file memo.h
+ * @brief Declaration of the memo builtin, which caches the output and exit status of deterministic commands, keyed by their inputs.
+ * @version 0.1
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef MEMO_H
+#define MEMO_H
+
+#include "command.h"
+
+// environment variable that overrides the cache directory
+#define MEMO_DIR_ENV "SHELL_MEMO_DIR"
+// name of the cache directory under $XDG_CACHE_HOME or ~/.cache
+#define MEMO_DIR_NAME "shell-memo"
+// suffix of the cache entries
+#define MEMO_ENTRY_SUFFIX ".memo"
+// every entry starts with this fixed width header holding the exit status
+#define MEMO_HEADER_FORMAT "memo1 %3d\n"
+#define MEMO_HEADER_LENGTH 10
+
+/**
+ * @brief This function is the builtin for the memo command.
+ *
+ * Usage: `memo [-i file]* [-c file]* [-e name]* [--] command [args]*`
+ *
+ * The key of an entry hashes the working directory, the args of the command, the path, size and mtime of every `-i` file, the contents of every `-c` file, the name and value of every `-e` environment variable, and the stdin of the command unless it is a terminal or /dev/null. A piped stdin is read to a temporary file first, which the command then reads on a miss. On a hit the cached stdout is replayed to the outputFD and the cached exit status is returned without forking. On a miss the command runs, and its stdout is passed through while it is stored. The cache lives in $SHELL_MEMO_DIR, or else in $XDG_CACHE_HOME/shell-memo or ~/.cache/shell-memo, and the least recently used entries are evicted once it grows over the memo-max-mb option.
+ *
+ * @param command The command to be executed.
+ * @return int Returns the exit status of the command, -1 on failure.
+ */
+int memo(SimpleCommand* command);
+
+#endif // MEMO_H
\ No newline at end of file
@@ -0,0 +1,86 @@
+/**
+ * @file metrics.h
+ * @brief Activity counters and latency histograms of the shell, exported in the Prometheus text format by the stats builtin, or written to SHELL_METRICS_FILE every SHELL_METRICS_INTERVAL seconds for the node-exporter textfile collector.
+ *
+ * The cells are atomics in a shared anonymous mapping, so they are updated without locks from the shell's threads, and from its forked children too: a child that fails to exec, or a forked copy of the shell (a builtin run in a subshell, bench -j, the server mode) counts into the same cells as the shell.
+ * @version 0.1
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "command.h"
+
+#include <stdint.h>
+#include <sys/types.h>
+
+// seconds between two writes of SHELL_METRICS_FILE, SHELL_METRICS_INTERVAL overrides it
+#define METRICS_DEFAULT_INTERVAL 15
+// children whose fork time is kept for their runtime, from fork to reap. Later ones aren't timed
+#define METRICS_MAX_CHILDREN 1024
+
+// the counters, exported as shell_<name>_total
+typedef enum MetricCounter {
+    METRIC_BUILTIN_COMMANDS,
+    METRIC_EXTERNAL_COMMANDS,
+    METRIC_FORKS,
+    METRIC_EXEC_FAILURES,
+    METRIC_NONZERO_EXITS,
+    METRIC_PARSE_ERRORS,
+    METRIC_GLOB_EXPANSIONS,
+    METRIC_N_COUNTERS
+} MetricCounter;
+
+/**
+ * @brief Maps the cells shared with the forked children, and starts writing SHELL_METRICS_FILE if it is set. Before it the counters go to cells of the shell alone.
+ *
+ */
+void initMetrics();
+
+/**
+ * @brief Adds one to a counter.
+ *
+ */
+void countMetric(MetricCounter counter);
+
+/**
+ * @brief The current value of a counter.
+ *
+ */
+uint64_t readMetric(MetricCounter counter);
+
+/**
+ * @brief Counts a fork that returned in the shell, and records its latency from forkStart (traceNow()). The child's runtime starts there.
+ *
+ */
+void recordSpawn(pid_t pid, uint64_t forkStart);
+
+/**
+ * @brief Records the runtime of a reaped child, from its fork.
+ *
+ */
+void recordChildExit(pid_t pid);
+
+/**
+ * @brief Writes every metric in the Prometheus text format.
+ *
+ * @return int 0 on success, -1 if the write failed
+ */
+int writeMetrics(int fd);
+
+/**
+ * @brief This function is the builtin for the stats command.
+ *
+ * Usage: `stats [-o file]`
+ *
+ * Prints the metrics in the Prometheus text format, or with -o replaces file with them, through a temporary file and a rename so a scraper never reads half of it.
+ *
+ * @param simpleCommand The command to be executed.
+ * @return int Returns 0 on success, -1 on failure.
+ */
+int stats(SimpleCommand* simpleCommand);
+
+#endif // METRICS_H
@@ -0,0 +1,34 @@
+/**
+ * @file parallel.h
+ * @brief Declaration of the parallel builtin, which runs a command template once per input item on a bounded pool of workers.
+ * @version 0.1
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "command.h"
+
+// the placeholder that gets replaced by the item in the command template
+#define PARALLEL_PLACEHOLDER "{}"
+// separates the command template from the items given as arguments
+#define PARALLEL_ITEMS_SEPARATOR ":::"
+// the exit status is the number of failed items, capped like GNU parallel does
+#define PARALLEL_MAX_FAILED_STATUS 101
+
+/**
+ * @brief This function is the builtin for the parallel command.
+ *
+ * Usage: `parallel [-j jobs] [-k] [-v] command [args]* [::: item [item]*]`
+ *
+ * The items are the arguments after `:::`, or else the lines read from the inputFD of the simple command. Every `{}` in the template is replaced by the item, and when the template has no `{}` the item is appended as the last argument. The commands run on a pool of `-j` workers (the number of online CPUs by default). With `-k` the output of every item is buffered and written in the order of the items, otherwise the commands write straight to the outputFD. Items that exit with a non-zero status are reported as errors on completion, `-v` also lists the successful ones on the stderrFD.
+ *
+ * @param command The command to be executed.
+ * @return int Returns 0 when all items succeed, the number of failed items (at most 101) otherwise, -1 on usage errors.
+ */
+int parallel(SimpleCommand* command);
+
+#endif // PARALLEL_H
\ No newline at end of file
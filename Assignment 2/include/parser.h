@@ -18,8 +18,8 @@
 #define IS_CHAINING_OPERATOR(token) (strcmp(token, "&") == 0 || strcmp(token, ";") == 0)
 // checks if the token is a background operator
 #define IS_BACKGROUND(token) (token && strcmp(token, "&") == 0)
-// check if the token is a pipe
-#define IS_PIPE(token) (strcmp(token, "|") == 0)
+// check if the token is a pipe, either | or a pipe with its capacity like |1M
+#define IS_PIPE(token) (token[0] == '|' && (token[1] == '\0' || (token[1] >= '0' && token[1] <= '9')))
 // check if the token is file output redirection operator
 #define IS_FILE_OUT_REDIR(token) (strcmp(token, ">") == 0 || strcmp(token, ">>") == 0)
 // check if the token is file input redirection operator
@@ -41,4 +41,12 @@
  */
 CommandChain* parseTokens(char** tokens);
 
+/**
+ * @brief Tokenizes, parses and executes a line of input. This is the path every line typed or read from a script goes through.
+ * 
+ * @param input The line to execute
+ * @return int Status code (exit status of the chain)
+ */
+int executeInputLine(const char* input);
+
 #endif // PARSER_H
\ No newline at end of file
@@ -0,0 +1,55 @@
+/**
+ * @file path_cache.h
+ * @brief A cache of the PATH lookups of external commands, so a command is searched for once instead of on every exec.
+ * @version 0.1
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef PATH_CACHE_H
+#define PATH_CACHE_H
+
+#include "command.h"
+
+#include <stdbool.h>
+
+// number of buckets of the cache's hash table, a power of two
+#define PATH_CACHE_BUCKETS 256
+
+/**
+ * @brief Returns the full path of an external command, searching PATH on the first lookup and the cache afterwards. The cache is dropped whenever PATH changes.
+ *
+ * Names containing a slash are returned as they are. Commands that can't be found are not cached, so a command installed later is picked up.
+ *
+ * @param commandName The name of the command
+ * @return const char* The path of the executable (owned by the cache), NULL if it's not in PATH
+ */
+const char* resolveCommandPath(const char* commandName);
+
+/**
+ * @brief Drops all the cached paths.
+ *
+ */
+void invalidatePathCache();
+
+/**
+ * @brief Drops the cached paths if a directory of PATH changed since they were looked up, a command installed earlier in PATH would be shadowed otherwise. It stats every directory of PATH, the resident server calls it once per request.
+ *
+ * @return bool Returns true if the cache was dropped.
+ */
+bool revalidatePathCache();
+
+/**
+ * @brief This function is the builtin for the hash command.
+ *
+ * Usage: `hash [-r] [name]*`
+ *
+ * `hash` lists the cached paths, `hash -r` forgets them, and `hash name` looks a command up and caches it.
+ *
+ * @param command The command to be executed.
+ * @return int Returns 0 on success, 1 if a name wasn't found, -1 on usage errors.
+ */
+int hashBuiltin(SimpleCommand* command);
+
+#endif // PATH_CACHE_H
\ No newline at end of file
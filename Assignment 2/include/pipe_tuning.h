@@ -0,0 +1,75 @@
+/**
+ * @file pipe_tuning.h
+ * @brief Sizing of the pipes between the stages of a pipeline. Pipes get the capacity of `setopt pipesize` or of a `|SIZE` token, and in adaptive mode a monitor thread grows the pipes whose writer keeps finding them full.
+ * @version 0.1
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef PIPE_TUNING_H
+#define PIPE_TUNING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+// capacity limit for unprivileged processes, read when the kernel's isn't readable
+#define PIPE_DEFAULT_MAX_SIZE (1024 * 1024)
+// time between two samples of the monitored pipes
+#define PIPE_MONITOR_INTERVAL_MS 10
+// number of samples in a row a pipe has to be full on before it grows
+#define PIPE_GROW_SAMPLES 3
+// a pipe with less room than this is full, the writer is blocked on it
+#define PIPE_FULL_SLACK 4096
+
+typedef struct PipeMonitor PipeMonitor;
+
+/**
+ * @brief Parses a pipe size: a number of bytes, or of KiB or MiB with a K or M suffix.
+ *
+ * @param str The size
+ * @param size Set to the size in bytes
+ * @return bool Returns false if str isn't a size.
+ */
+bool parsePipeSize(const char* str, size_t* size);
+
+/**
+ * @brief Returns the largest capacity an unprivileged process may give a pipe, from /proc/sys/fs/pipe-max-size.
+ *
+ */
+size_t getPipeMaxSize();
+
+/**
+ * @brief Sets the capacity of a pipe, capped at getPipeMaxSize(). A pipe the kernel refuses to grow (the user is over its pipe buffer quota) keeps its capacity.
+ *
+ * @param fd Either end of the pipe
+ * @param size The capacity asked for
+ * @return int Returns the capacity the pipe has, -1 on failure.
+ */
+int setPipeSize(int fd, size_t size);
+
+/**
+ * @brief Starts a thread that samples the pipes the given processes read from, through /proc/<pid>/fd/0, and doubles the capacity of a pipe every time it is found full PIPE_GROW_SAMPLES times in a row.
+ *
+ * @param readers The pids of the stages reading from a pipe
+ * @param nReaders Number of pids
+ * @return PipeMonitor* The monitor, NULL if it couldn't start.
+ */
+PipeMonitor* startPipeMonitor(const pid_t* readers, int nReaders);
+
+/**
+ * @brief Stops sampling the pipe of a reader that exited. It has to be called before the reader is reaped, its pid may be reused by an unrelated process afterwards. Does nothing for NULL.
+ *
+ * @param monitor The monitor
+ * @param reader The pid of the reader
+ */
+void forgetPipeReader(PipeMonitor* monitor, pid_t reader);
+
+/**
+ * @brief Stops a monitor and frees it. Does nothing for NULL.
+ *
+ */
+void stopPipeMonitor(PipeMonitor* monitor);
+
+#endif // PIPE_TUNING_H
@@ -0,0 +1,70 @@
+/**
+ * @file pipestat.h
+ * @brief Per-stage statistics of running pipelines. With `setopt pipestat 1` a thread samples every process of a pipeline from /proc: the bytes it read and wrote, its CPU time and the time it spent blocked on an empty or a full pipe. `jobs -v` shows them live, and a summary is printed when the pipeline ends.
+ * @version 0.1
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef PIPESTAT_H
+#define PIPESTAT_H
+
+#include "command.h"
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+// time between two samples of a pipeline's processes
+#define PIPESTAT_INTERVAL_MS 50
+
+// statistics of one stage, the counters are the ones of the last sample
+typedef struct StageStats {
+    pid_t pid;                          //< 0 for stages running on a thread of the shell, they aren't sampled
+    bool finished;                      //< the last sample was taken after the process exited
+    unsigned long long readBytes;       //< rchar of /proc/<pid>/io, splice moves data without counting it
+    unsigned long long writtenBytes;    //< wchar of /proc/<pid>/io
+    double cpuSeconds;                  //< user and system time
+    double blockedReading;              //< seconds it was found waiting on an empty pipe
+    double blockedWriting;              //< seconds it was found waiting on a full pipe
+    double lastSample;                  //< when it was last sampled, on the monotonic clock
+} StageStats;
+
+typedef struct PipeStat PipeStat;
+
+/**
+ * @brief Starts sampling the processes of a launched pipeline.
+ *
+ * @param command The pipeline, its stages have their pids
+ * @return PipeStat* The statistics, NULL if the pipeline has no processes or the sampler couldn't start.
+ */
+PipeStat* startPipeStat(Command* command);
+
+/**
+ * @brief Takes the last sample of a stage that exited but wasn't reaped yet, so its counters are complete. Waiters call this between waitid(WNOWAIT) and the reap.
+ *
+ */
+void finishStageStats(PipeStat* stats, pid_t pid);
+
+/**
+ * @brief Stops the sampling thread. The statistics stay readable until cleanUpPipeStat().
+ *
+ */
+void stopPipeStat(PipeStat* stats);
+
+/**
+ * @brief Prints a table of the stages, marking the one that was blocked the least as the likely bottleneck.
+ *
+ * @param stats The statistics
+ * @param command The pipeline, for the names of the stages
+ * @param fd Where to print
+ */
+void printPipeStat(PipeStat* stats, Command* command, int fd);
+
+/**
+ * @brief Stops the sampling if it still runs and frees the statistics. Does nothing for NULL.
+ *
+ */
+void cleanUpPipeStat(PipeStat* stats);
+
+#endif // PIPESTAT_H
@@ -0,0 +1,85 @@
+/**
+ * @file probes.h
+ * @brief USDT static probes at the boundaries of the shell's hot paths, for attaching bpftrace or perf to a running shell. With <sys/sdt.h> (systemtap-sdt-dev) every probe is a NOP instruction and an ELF note until a tracer attaches, without it they compile to nothing. Define SHELL_NO_PROBES to leave them out anyway. The probes belong to the provider "shell", e.g. `usdt:./shell:shell:spawn__start`, tools/ has sample bpftrace scripts.
+ * @version 0.1
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef PROBES_H
+#define PROBES_H
+
+#include "command.h"
+
+#if !defined(SHELL_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+// every probe gets a semaphore, defined in probes.c, that a tracer raises while it is attached
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+#define SHELL_PROBES 1
+#endif
+#endif
+
+#ifdef SHELL_PROBES
+
+extern unsigned short shell_line__read_semaphore;
+extern unsigned short shell_tokens_semaphore;
+extern unsigned short shell_parse__done_semaphore;
+extern unsigned short shell_spawn__start_semaphore;
+extern unsigned short shell_spawn__done_semaphore;
+extern unsigned short shell_exec__failed_semaphore;
+extern unsigned short shell_child__exit_semaphore;
+extern unsigned short shell_builtin__enter_semaphore;
+extern unsigned short shell_builtin__exit_semaphore;
+
+// whether a tracer is attached to a probe, the probes with arguments to compute check it first
+#define PROBE_ENABLED(name) __builtin_expect(shell_##name##_semaphore != 0, 0)
+
+// a line was read: the line, its length
+#define PROBE_LINE_READ(line, length) do { \
+    if (PROBE_ENABLED(line__read)) \
+        DTRACE_PROBE2(shell, line__read, line, length); \
+} while (0)
+// a line was tokenized: the number of tokens, the line
+#define PROBE_TOKENS(count, line) DTRACE_PROBE2(shell, tokens, count, line)
+// a line was parsed: the number of commands in the chain, the number of stages in all of them
+#define PROBE_PARSE_DONE(chain) do { \
+    if (PROBE_ENABLED(parse__done)) { \
+        int nCommands = 0, nStages = 0; \
+        for (Command* command = (chain) ? (chain)->head : NULL; command; command = command->next) { \
+            nCommands++; \
+            nStages += command->nSimpleCommands; \
+        } \
+        DTRACE_PROBE2(shell, parse__done, nCommands, nStages); \
+    } \
+} while (0)
+// a process is about to be forked for a simple command: its name, its argc
+#define PROBE_SPAWN_START(simpleCommand) DTRACE_PROBE2(shell, spawn__start, (simpleCommand)->commandName, (simpleCommand)->argc)
+// the fork returned in the parent: the name, the pid of the child
+#define PROBE_SPAWN_DONE(simpleCommand) DTRACE_PROBE2(shell, spawn__done, (simpleCommand)->commandName, (simpleCommand)->pid)
+// the exec failed in the child: the name, errno
+#define PROBE_EXEC_FAILED(simpleCommand, error) DTRACE_PROBE2(shell, exec__failed, (simpleCommand)->commandName, error)
+// a child was reaped: its pid, its exit status (128 + the signal if it was killed)
+#define PROBE_CHILD_EXIT(pid, status) DTRACE_PROBE2(shell, child__exit, pid, status)
+// a builtin starts: its name, its argc
+#define PROBE_BUILTIN_ENTER(simpleCommand) DTRACE_PROBE2(shell, builtin__enter, (simpleCommand)->commandName, (simpleCommand)->argc)
+// a builtin returned: its name, its return value
+#define PROBE_BUILTIN_EXIT(simpleCommand, status) DTRACE_PROBE2(shell, builtin__exit, (simpleCommand)->commandName, status)
+
+#else
+
+#define PROBE_LINE_READ(line, length) do {} while (0)
+#define PROBE_TOKENS(count, line) do {} while (0)
+#define PROBE_PARSE_DONE(chain) do {} while (0)
+#define PROBE_SPAWN_START(simpleCommand) do {} while (0)
+#define PROBE_SPAWN_DONE(simpleCommand) do {} while (0)
+#define PROBE_EXEC_FAILED(simpleCommand, error) do {} while (0)
+#define PROBE_CHILD_EXIT(pid, status) do {} while (0)
+#define PROBE_BUILTIN_ENTER(simpleCommand) do {} while (0)
+#define PROBE_BUILTIN_EXIT(simpleCommand, status) do {} while (0)
+#define PROBE_ENABLED(name) 0
+
+#endif // SHELL_PROBES
+
+#endif // PROBES_H
@@ -0,0 +1,57 @@
+/**
+ * @file profile.h
+ * @brief The line profiler of `--profile`. Every line the shell reads is charged with its wall time, the CPU time of the children it reaped (RUSAGE_CHILDREN), the shell's own CPU time and the processes it forked. The totals are kept in a table indexed by the line number and written when the shell exits, as a report sorted by wall time or in the callgrind format for kcachegrind.
+ * @version 0.1
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/resource.h>
+
+// lines with a slot of their own, the ones past it are added to a single overflow slot
+#define PROFILE_MAX_LINES (1 << 16)
+// characters of the line shown in the report
+#define PROFILE_TEXT_LENGTH 48
+
+// set by --profile, the hooks cost a branch otherwise
+extern bool profiling;
+
+// what is measured at the start of a line, to be charged to it at its end
+typedef struct ProfileMark {
+    uint64_t start;
+    uint64_t forks;
+    struct rusage self;
+    struct rusage children;
+} ProfileMark;
+
+/**
+ * @brief Starts profiling, the results are written at exit.
+ *
+ * @param script The script that is run, NULL for the standard input, named in the output
+ * @param output The file of the callgrind output, NULL for the report on stderr
+ * @return int 0 on success, -1 on failure
+ */
+int initProfile(const char* script, const char* output);
+
+/**
+ * @brief Takes the measures at the start of a line.
+ *
+ */
+void startProfileLine(ProfileMark* mark);
+
+/**
+ * @brief Charges what happened since the mark to a line.
+ *
+ * @param mark The mark taken at the start of the line
+ * @param line The line number, from 1
+ * @param text The line, copied the first time the line is seen
+ */
+void endProfileLine(const ProfileMark* mark, int line, const char* text);
+
+#endif // PROFILE_H
@@ -0,0 +1,47 @@
+/**
+ * @file psort.h
+ * @brief Declaration of the psort builtin, a sort that sorts chunks of its input in parallel on the thread pool and merges them, spilling sorted runs to temporary files when the input doesn't fit in its memory budget.
+ * @version 0.1
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef PSORT_H
+#define PSORT_H
+
+#include "command.h"
+#include "stream.h"
+
+// memory budget for the input and its records before sorted runs are spilled to disk
+#define PSORT_DEFAULT_MEMORY (512UL * 1024 * 1024)
+// size of the chunks the input is cut into, every chunk is sorted by one task
+#define PSORT_CHUNK_SIZE (8UL * 1024 * 1024)
+// smallest chunk size, whatever the budget
+#define PSORT_MIN_CHUNK_SIZE (64UL * 1024)
+// read buffer of each spilled run during the merge
+#define PSORT_RUN_BUFFER_SIZE (1024 * 1024)
+// runs of records with the same radix prefix shorter than this are insertion sorted
+#define PSORT_INSERTION_THRESHOLD 16
+
+/**
+ * @brief This function is the builtin for the psort command.
+ *
+ * Usage: `psort [-n] [-r] [-u] [-t char] [-k start[,end]] [-S size[K|M|G]] [file]`
+ *
+ * Lines are compared bytewise (the C locale), or numerically with -n, on the whole line or on the fields start to end of -k. Fields are separated by the char of -t, or else start at a run of blanks. Lines with equal keys are compared as a whole, unless -u asks for the first line of every run of equal keys only. -r reverses the order, and -S sets the memory budget (in KiB without a suffix).
+ *
+ * Every record carries a 64-bit prefix of its key (the first 8 bytes, or an order preserving encoding of the number), chunks are radix sorted on it and only records with equal prefixes are compared in full. The sorted chunks are merged by a k-way heap merge. Once the budget is used up the chunks read so far are merged into a run in $TMPDIR, and the runs are merged with the rest at the end.
+ *
+ * @param command The command to be executed.
+ * @return int Returns 0 on success, -1 on failure.
+ */
+int psort(SimpleCommand* command);
+
+/**
+ * @brief The stream function of psort, see StreamFunction in shell_builtins.h
+ *
+ */
+int psortStream(SimpleCommand* command, Stream* input, Stream* output);
+
+#endif // PSORT_H
@@ -0,0 +1,60 @@
+/**
+ * @file record.h
+ * @brief Session recording and replay. `--record file` logs every line the shell reads with the time it was read, its run time, the working directory and the exit status, to a compact binary file. `--replay file` feeds such a recording back as the shell's input, at the recorded pace or with `--fast` as fast as it can, optionally under a `--sandbox` directory, and reports the lines whose exit status changed.
+ *
+ * The file starts with the magic "SHRC", then varints: the version, the start time (unix us), the length and bytes of the starting directory. Every line follows as varints: the time since the previous line was read (us), its run time (us), its exit status (zigzag), the length + 1 and bytes of its directory or 0 if unchanged, the length and bytes of the line. The lines of a task block share the status and run time of the block.
+ * @version 0.1
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <stdbool.h>
+
+#define RECORD_MAGIC "SHRC"
+#define RECORD_VERSION 1
+
+// set by --record and --replay, the hooks cost a branch otherwise
+extern bool recording;
+extern bool replaying;
+
+/**
+ * @brief Starts recording to path, replacing it.
+ *
+ * @return int 0 on success, -1 on failure
+ */
+int initRecord(const char* path);
+
+/**
+ * @brief Loads a recording to replay as the shell's input. The summary is written to stderr at exit.
+ *
+ * @param path The recording
+ * @param fast Whether to run the lines back to back, instead of at the recorded pace
+ * @param sandbox The directory the recorded directories are moved under, NULL to run in them. The recorded starting directory becomes the sandbox
+ * @return int 0 on success, -1 on failure
+ */
+int initReplay(const char* path, bool fast, const char* sandbox);
+
+/**
+ * @brief Takes a line the shell read, it is written once the top-level line it belongs to ends. Empty lines are left out.
+ *
+ */
+void recordInput(const char* line);
+
+/**
+ * @brief Ends a top-level line: writes the lines read for it with its status when recording, and compares the status to the recorded one when replaying.
+ *
+ */
+void endRecordedLine(int status);
+
+/**
+ * @brief The next line of the replay, after waiting for its time unless it is fast, in its directory.
+ *
+ * @return char* The line, to be freed, or NULL at the end of the recording
+ */
+char* nextReplayLine();
+
+#endif // RECORD_H
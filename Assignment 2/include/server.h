@@ -0,0 +1,59 @@
+/**
+ * @file server.h
+ * @brief A persistent shell server. The shell listens on a Unix domain socket and runs the scripts submitted by clients in forked workers, so the startup cost is paid once.
+ * @version 0.1
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// first word of every request, "SHSV"
+#define SERVER_PROTOCOL_MAGIC 0x53485356u
+// upper bound on the size of the strings of a request
+#define SERVER_MAX_REQUEST_LENGTH (4 * 1024 * 1024)
+// number of fds passed with a request: stdin, stdout and stderr of the client
+#define SERVER_PASSED_FDS 3
+// script name that makes the worker read the script from the client's stdin
+#define SERVER_SCRIPT_STDIN "-"
+// number of scripts kept in the server's script cache
+#define SERVER_SCRIPT_CACHE_ENTRIES 64
+// backlog of the listening socket
+#define SERVER_BACKLOG 128
+// time a client has to send its request, the server reads the requests one at a time
+#define SERVER_RECEIVE_TIMEOUT_MS 1000
+
+/**
+ * @brief Header of a request. It is sent along with the client's stdin, stdout and stderr as SCM_RIGHTS ancillary data, and followed by `length` bytes of NUL terminated strings: the working directory, the script path, then `envCount` environment entries.
+ *
+ * The server answers with the exit status of the script as an int32_t once the worker is done.
+ */
+typedef struct ServerRequestHeader {
+    uint32_t magic;
+    uint32_t length;
+    uint32_t envCount;
+} ServerRequestHeader;
+
+/**
+ * @brief Runs a script in the worker, reading it from the given stream. Returns the exit status of the script.
+ *
+ */
+typedef int (*ScriptRunner)(FILE* script);
+
+/**
+ * @brief Serves requests on a Unix domain socket until the shell is killed.
+ *
+ * Every request is handled by a forked worker, which takes over the client's working directory, environment and stdio before running the script. The server keeps the scripts it has seen (keyed by path, size and mtime) and the PATH lookups of their commands warm, so the workers inherit them.
+ *
+ * @param socketPath Path of the socket to listen on. A stale socket at that path is replaced
+ * @param runScript Runs a script inside a worker
+ * @return int Status code (-1 if the server couldn't start)
+ */
+int runServer(const char* socketPath, ScriptRunner runScript);
+
+#endif // SERVER_H
\ No newline at end of file
@@ -11,6 +11,7 @@
 #define BUILTINS_H
 
 #include "command.h"
+#include "stream.h"
 
 #define HOME_DIR getenv("HOME")
 #define MAX_PATH_LENGTH 1024
@@ -39,6 +40,20 @@ void clean_history(HistoryList* list);
 // finds the last command that starts with the prefix
 char* find_last_command_with_prefix(HistoryList* list, const char* prefix);
 
+// tunable options of the shell, changed at runtime with the setopt builtin
+typedef struct ShellOptions {
+    int maxJobs;            // max number of background jobs running at once, 0 means no limit
+    int psiCpuLimit;        // queued jobs are held while the cpu pressure (some avg10, in %) is above this, 0 disables
+    int psiMemoryLimit;     // queued jobs are held while the memory pressure (some avg10, in %) is above this, 0 disables
+    int memoMaxMegabytes;   // size of the memo cache before the least recently used entries are evicted, 0 means no limit
+    int pipeSizeKilobytes;  // capacity of the pipes between pipeline stages, 0 keeps the kernel default
+    int pipeAdaptive;       // grow the pipes a foreground pipeline's writers keep finding full, 0 disables
+    int cpuPlacement;       // pin the stages of each pipeline to one L3/NUMA group of CPUs, round robin over the groups, 0 disables
+    int pipeStat;           // sample the stages of pipelines and print their statistics when they end, 0 disables
+    int logLevel;           // level of the messages logged, 0 for errors only, 1 for debug messages as well
+    int leakCheck;          // check that the heap and the fds are back to where they were after every top-level command, 0 disables
+} ShellOptions;
+
 // To represent the state of the shell.
 typedef struct ShellState {
 
@@ -47,11 +62,18 @@ typedef struct ShellState {
     int originalStdinFD;
     int originalStderrFD;
 
+    // the file the shell's stdin was at start, to tell a command reading it from a redirected or piped one
+    dev_t stdinDevice;
+    ino_t stdinInode;
+
     // shell variable that holds the current prompt
     char prompt_buffer[MAX_STRING_LENGTH];
 
     // represents the history node list, storing tail for quick insertions
     HistoryList history;
+
+    // runtime options
+    ShellOptions options;
 } ShellState;
 
 // initializes the shell state
@@ -69,6 +91,43 @@ typedef int (*ExecutionFunction)(SimpleCommand*);
 */
 ExecutionFunction getExecutionFunction(char* commandName);
 
+/**
+ * @brief The body of a builtin that reads its input from and writes its output to streams instead of fds, so it can be linked to its neighbours in a pipeline by ring buffers.
+ *
+ */
+typedef int (*StreamFunction)(SimpleCommand* command, Stream* input, Stream* output);
+
+/**
+ * @brief Tells whether a builtin implements the options of an invocation. A builtin standing in for a utility (like grep) only implements its common options.
+ *
+ */
+typedef bool (*SupportFunction)(SimpleCommand* command);
+
+/**
+ * @brief Returns the execution function for a parsed simple command. Unlike getExecutionFunction() it looks at the args, an invocation with options its builtin doesn't implement runs the utility found in PATH instead.
+ *
+ * @param command The simple command
+ * @return ExecutionFunction The execution function for the simple command.
+ */
+ExecutionFunction resolveExecutionFunction(SimpleCommand* command);
+
+/**
+ * @brief Returns the stream function of a builtin, NULL if it doesn't have one or if this invocation has side effects on the shell (history recalling a command), because stream functions may run on a thread next to the shell.
+ *
+ * @param command The simple command
+ * @return StreamFunction The stream function, or NULL
+ */
+StreamFunction getStreamFunction(SimpleCommand* command);
+
+/**
+ * @brief Runs a stream function over the fds of a simple command. This is how a stream builtin runs outside of a run of builtins.
+ *
+ * @param command The simple command
+ * @param function Its stream function
+ * @return int Returns 0 on success, the builtin's status on failure.
+ */
+int runStreamBuiltin(SimpleCommand* command, StreamFunction function);
+
 /**
  * @brief This function is the builtin for the cd command.
  * 
@@ -101,6 +160,16 @@ int pwd(SimpleCommand* command);
  */
 int history(SimpleCommand* command);
 
+/**
+ * @brief This function is the builtin for the setopt command.
+ *
+ * `setopt` lists all the options with their values, `setopt name` prints one option, and `setopt name value` changes it.
+ *
+ * @param command The command to be executed.
+ * @return int Returns 0 on success, -1 on failure.
+ */
+int setopt(SimpleCommand* command);
+
 /**
  * @brief This function executes a process.
  * 
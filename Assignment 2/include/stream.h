@@ -0,0 +1,144 @@
+/**
+ * @file stream.h
+ * @brief Byte streams used by the builtins for their input and output. A stream is either an fd or one end of an in-process ring buffer, so adjacent builtins of a pipeline can pass data to each other without going through the kernel.
+ * @version 0.1
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// capacity of the ring buffer between two builtins, must be a power of two
+#define RING_BUFFER_CAPACITY (64 * 1024)
+// number of times a ring end polls the other before sleeping on the futex, only on machines with more than one CPU
+#define RING_SPIN_ITERATIONS 2000
+// size of the write buffer of an fd stream
+#define STREAM_BUFFER_SIZE 8192
+
+/**
+ * @brief A single-producer/single-consumer ring buffer.
+ *
+ * The producer only moves head and the consumer only moves tail, both are running byte counts, so passing a chunk costs no syscall and no lock. An end that finds the buffer full (or empty) polls for a while and then sleeps on the futex word `event`, which the other end bumps and wakes only if someone is sleeping.
+ *
+ */
+typedef struct RingBuffer {
+    _Atomic size_t head;            //< total bytes written by the producer
+    _Atomic size_t tail;            //< total bytes read by the consumer
+
+    _Atomic uint32_t event;         //< futex word, bumped whenever a sleeping end has to recheck
+    _Atomic int sleepers;           //< number of ends sleeping on the futex
+
+    _Atomic bool writerClosed;      //< the producer is done, the consumer sees EOF once the buffer drains
+    _Atomic bool readerClosed;      //< the consumer is gone, the producer's writes fail with EPIPE
+
+    size_t capacity;
+    char* data;
+} RingBuffer;
+
+typedef enum StreamType {
+    STREAM_FD,
+    STREAM_RING
+} StreamType;
+
+/**
+ * @brief One end of a byte stream. Writes to an fd stream are buffered and go out on streamFlush() or streamClose().
+ *
+ */
+typedef struct Stream {
+    StreamType type;
+    int fd;                         //< STREAM_FD only, the stream does not own it
+    RingBuffer* ring;               //< STREAM_RING only
+    bool writable;                  //< which end of the ring this is
+
+    char buffer[STREAM_BUFFER_SIZE];
+    size_t buffered;
+    int error;                      //< errno of the first failed write, later writes fail straight away
+} Stream;
+
+/**
+ * @brief Creates a ring buffer. It returns NULL on failure. The caller frees it via cleanUpRingBuffer() once both ends are closed.
+ *
+ * @param capacity Capacity in bytes, rounded up to a power of two. 0 selects RING_BUFFER_CAPACITY
+ * @return RingBuffer* Pointer to the ring buffer
+ */
+RingBuffer* initRingBuffer(size_t capacity);
+
+/**
+ * @brief Frees a ring buffer.
+ *
+ * @param ring The ring buffer to free
+ */
+void cleanUpRingBuffer(RingBuffer* ring);
+
+/**
+ * @brief Sets up a stream over an fd.
+ *
+ * @param stream The stream to set up
+ * @param fd The fd to read from or write to
+ * @param writable Whether the stream is written to
+ */
+void initFDStream(Stream* stream, int fd, bool writable);
+
+/**
+ * @brief Sets up a stream over one end of a ring buffer.
+ *
+ * @param stream The stream to set up
+ * @param ring The ring buffer
+ * @param writable true for the producer's end, false for the consumer's
+ */
+void initRingStream(Stream* stream, RingBuffer* ring, bool writable);
+
+/**
+ * @brief Reads up to length bytes. Blocks until some data is there.
+ *
+ * @param stream The stream to read from
+ * @param buffer Where to store the data
+ * @param length Size of the buffer
+ * @return ssize_t Number of bytes read, 0 at EOF, -1 on failure
+ */
+ssize_t streamRead(Stream* stream, void* buffer, size_t length);
+
+/**
+ * @brief Writes all of the data. It returns 0 on success, -1 on failure (errno is EPIPE once the reader is gone).
+ *
+ * @param stream The stream to write to
+ * @param data The data to write
+ * @param length Number of bytes to write
+ * @return int Status code (0 on success, -1 on failure)
+ */
+int streamWrite(Stream* stream, const void* data, size_t length);
+
+/**
+ * @brief printf to a stream. It returns 0 on success, -1 on failure.
+ *
+ * @param stream The stream to write to
+ * @param format The format string
+ * @return int Status code (0 on success, -1 on failure)
+ */
+int streamPrintf(Stream* stream, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * @brief Writes out the buffered data of an fd stream. It returns 0 on success, -1 on failure.
+ *
+ * @param stream The stream to flush
+ * @return int Status code (0 on success, -1 on failure)
+ */
+int streamFlush(Stream* stream);
+
+/**
+ * @brief Flushes a stream and closes its end of a ring buffer, which wakes the other end. The fd of an fd stream is left open.
+ *
+ * @param stream The stream to close
+ * @return int Status code (0 on success, -1 if the final flush failed)
+ */
+int streamClose(Stream* stream);
+
+#endif // STREAM_H
@@ -0,0 +1,72 @@
+/**
+ * @file taskgraph.h
+ * @brief Dependency graph execution of script blocks. A `tasks` block declares tasks and their dependencies makefile-style, and the ready tasks run concurrently.
+ * @version 0.1
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef TASKGRAPH_H
+#define TASKGRAPH_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+// the lines opening and closing a task block
+#define TASK_BLOCK_START "tasks"
+#define TASK_BLOCK_END "end"
+
+/**
+ * @brief A task of a task block.
+ *
+ * A task is declared by a line `name: [dependency]*` and owns the indented lines that follow it. The lines run in order in a subshell, and the task fails at the first line that fails.
+ */
+typedef struct Task {
+    char* name;
+    char** lines;           //< the commands of the task
+    int nLines;
+
+    int* dependencies;      //< indexes of the tasks this one depends on
+    int nDependencies;
+    int* dependents;        //< indexes of the tasks depending on this one
+    int nDependents;
+
+    atomic_int pendingDependencies; //< dependencies not finished yet, the task is ready at 0
+    atomic_int pid;         //< pid of the subshell while the task runs, 0 otherwise
+    int status;             //< exit status of the task
+    bool ran;
+    double start;           //< seconds since the block started
+    double end;
+} Task;
+
+/**
+ * @brief Checks whether a line opens a task block, i.e. it is `tasks [-j jobs]`.
+ *
+ * @param line The line to check
+ * @return bool true if the line starts a task block
+ */
+bool isTaskBlockStart(const char* line);
+
+/**
+ * @brief Checks whether a line closes a task block.
+ *
+ * @param line The line to check
+ * @return bool true if the line is `end`
+ */
+bool isTaskBlockEnd(const char* line);
+
+/**
+ * @brief Runs a task block.
+ *
+ * The tasks form a DAG, the tasks whose dependencies are all done run concurrently on a work-stealing pool of `-j` workers (the number of online CPUs by default). The first failing task stops the block: no new task starts and the running ones are terminated. At the end the timing of every task and the critical path of the graph are reported on stderr.
+ *
+ * @param header The line that opened the block
+ * @param lines The lines of the block, without the closing `end`
+ * @param nLines Number of lines
+ * @return int 0 if all the tasks succeeded, the status of the first failed task otherwise, -1 if the block is invalid
+ */
+int runTaskBlock(const char* header, char** lines, int nLines);
+
+#endif // TASKGRAPH_H
\ No newline at end of file
@@ -0,0 +1,83 @@
+/**
+ * @file text_builtins.h
+ * @brief Declarations of the text filter builtins grep -F, wc, head and tail. They scan their input with SSE2 kernels (with scalar fallbacks), and map regular files instead of reading them.
+ * @version 0.1
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef TEXT_BUILTINS_H
+#define TEXT_BUILTINS_H
+
+#include "command.h"
+#include "stream.h"
+
+#include <stdbool.h>
+
+// size of the reads from pipes and ring buffers
+#define TEXT_READ_SIZE (256 * 1024)
+// tail drops what can't be part of the last lines once its buffer grows past this
+#define TAIL_COMPACT_SIZE (4 * 1024 * 1024)
+// number of lines printed by head and tail by default
+#define TEXT_DEFAULT_LINES 10
+
+/**
+ * @brief This function is the builtin for grep.
+ *
+ * Usage: `grep -F [-v] [-c] [-q] pattern [file]`
+ *
+ * Only fixed string searches are builtin. A pattern without -F, other options or more than one file run the grep found in PATH instead.
+ *
+ * With -c or -q nothing is printed, so the input is scanned in fixed size chunks and a line of any length takes no more memory.
+ *
+ * @param command The command to be executed.
+ * @return int Returns 0 if a line was selected, 1 if none was, 2 on failure.
+ */
+int grep(SimpleCommand* command);
+
+/**
+ * @brief This function is the builtin for wc.
+ *
+ * Usage: `wc [-l] [-w] [-c] [file]`
+ *
+ * The counts carry over the chunks of the input, a line is never buffered whole.
+ *
+ * @param command The command to be executed.
+ * @return int Returns 0 on success, -1 on failure.
+ */
+int wc(SimpleCommand* command);
+
+/**
+ * @brief This function is the builtin for head. It stops reading once it has the lines, so the writer before it in the pipeline ends early.
+ *
+ * Usage: `head [-n N | -N] [file]`
+ *
+ * @param command The command to be executed.
+ * @return int Returns 0 on success, -1 on failure.
+ */
+int head(SimpleCommand* command);
+
+/**
+ * @brief This function is the builtin for tail. A regular file is scanned backwards from its end, other input is buffered keeping only what may be part of the last lines.
+ *
+ * Usage: `tail [-n N | -N] [file]`
+ *
+ * @param command The command to be executed.
+ * @return int Returns 0 on success, -1 on failure.
+ */
+int tail(SimpleCommand* command);
+
+// the stream functions of the builtins above, see StreamFunction in shell_builtins.h
+int grepStream(SimpleCommand* command, Stream* input, Stream* output);
+int wcStream(SimpleCommand* command, Stream* input, Stream* output);
+int headStream(SimpleCommand* command, Stream* input, Stream* output);
+int tailStream(SimpleCommand* command, Stream* input, Stream* output);
+
+// whether the builtins implement the options of an invocation, see SupportFunction in shell_builtins.h
+bool grepSupported(SimpleCommand* command);
+bool wcSupported(SimpleCommand* command);
+bool headSupported(SimpleCommand* command);
+bool tailSupported(SimpleCommand* command);
+
+#endif // TEXT_BUILTINS_H
@@ -0,0 +1,90 @@
+/**
+ * @file thread_pool.h
+ * @brief A fixed size pool of worker threads, fed by lock-free work queues, used by the builtins that fan work out across the CPUs.
+ * @version 0.1
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stddef.h>
+
+// default capacity of each worker's queue, must be a power of two
+#define TASK_QUEUE_CAPACITY 1024
+
+/**
+ * @brief A function that can be run on the pool. The arg is passed as is.
+ *
+ */
+typedef void (*TaskFunction)(void* arg);
+
+/**
+ * @brief Opaque handle of a thread pool.
+ *
+ * Every worker owns a bounded multi-producer/multi-consumer queue. A worker pops from its own queue first and steals from the queues of the other workers when its own queue is empty, so a burst of work submitted to one worker is spread over the whole pool. Tasks submitted by a worker go to its own queue, tasks submitted from outside the pool are spread round robin.
+ *
+ */
+typedef struct ThreadPool ThreadPool;
+
+/**
+ * @brief Creates a pool with nWorkers threads, started with every signal blocked so the signals go to the shell's main thread. It returns NULL on failure. The caller is responsible for freeing the pool via cleanUpThreadPool().
+ *
+ * @param nWorkers Number of worker threads, if it is less than 1 the number of online CPUs is used
+ * @param queueCapacity Capacity of each worker queue, rounded up to a power of two. 0 selects TASK_QUEUE_CAPACITY
+ * @return ThreadPool* Pointer to the pool
+ */
+ThreadPool* initThreadPool(int nWorkers, size_t queueCapacity);
+
+/**
+ * @brief Tries to queue a task on the pool without blocking. It returns 0 on success, -1 if all the queues are full.
+ *
+ * @param pool The pool to submit to
+ * @param function The function to run
+ * @param arg The argument passed to the function
+ * @return int Status code (0 on success, -1 when the pool is full)
+ */
+int trySubmitTask(ThreadPool* pool, TaskFunction function, void* arg);
+
+/**
+ * @brief Queues a task on the pool. If the pool is full, a worker runs the task inline, while any other thread yields until there is room. It returns 0 on success, -1 on failure.
+ *
+ * @param pool The pool to submit to
+ * @param function The function to run
+ * @param arg The argument passed to the function
+ * @return int Status code (0 on success, -1 on failure)
+ */
+int submitTask(ThreadPool* pool, TaskFunction function, void* arg);
+
+/**
+ * @brief Blocks until every task submitted so far, including the tasks they submitted in turn, has finished.
+ *
+ * @param pool The pool to wait on
+ */
+void waitThreadPool(ThreadPool* pool);
+
+/**
+ * @brief Returns the number of worker threads in the pool.
+ *
+ * @param pool The pool
+ * @return int Number of workers
+ */
+int getThreadPoolSize(ThreadPool* pool);
+
+/**
+ * @brief Waits for the queued tasks to finish, stops the workers and frees the pool.
+ *
+ * @param pool The pool to free
+ */
+void cleanUpThreadPool(ThreadPool* pool);
+
+/**
+ * @brief Returns the number of CPUs this process may run on (at least 1).
+ *
+ * @return int Number of usable online CPUs
+ */
+int getOnlineCPUs();
+
+#endif // THREAD_POOL_H
\ No newline at end of file
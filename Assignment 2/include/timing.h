@@ -0,0 +1,94 @@
+/**
+ * @file timing.h
+ * @brief The time keyword. `time [-j] [-o fd|file] pipeline` reports the wall time of the pipeline and the rusage of each of its stages (user and system CPU, max RSS, page faults, context switches and block I/O), as a table or as a JSON line.
+ * @version 0.1
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef TIMING_H
+#define TIMING_H
+
+#include "command.h"
+
+#include <stdbool.h>
+#include <sys/resource.h>
+
+// checks if the token is the time keyword
+#define IS_TIME_KEYWORD(token) (token && strcmp(token, "time") == 0)
+
+// what the time keyword measures of one pipeline
+typedef struct CommandTiming {
+    bool json;              //< a JSON line instead of the table
+    int fd;                 //< where the report goes, -1 to append to path
+    char* path;             //< file the report is appended to, NULL for fd
+
+    double start;           //< wall clock at launch, on the monotonic clock
+    double end;             //< when the last stage was reaped, 0 until then. A background pipeline is reported later than it ends
+    int nStages;
+    struct rusage* usage;   //< rusage of each stage
+    bool* measured;         //< whether a stage's rusage was recorded
+} CommandTiming;
+
+/**
+ * @brief Allocates the timing of a pipeline, reporting to stderr as a table until told otherwise.
+ *
+ * @return CommandTiming* The timing, NULL on failure.
+ */
+CommandTiming* initCommandTiming();
+
+/**
+ * @brief Parses an option of the time keyword: -j, or -o with the fd or file that follows.
+ *
+ * @param timing The timing to update
+ * @param option The option
+ * @param value The token after the option
+ * @return int Returns the number of tokens used (1 or 2), 0 if option isn't an option of time, -1 if it is one with a bad value.
+ */
+int parseTimingOption(CommandTiming* timing, const char* option, const char* value);
+
+/**
+ * @brief Starts the clock for a pipeline of nStages stages.
+ *
+ * @return int Returns 0 on success, -1 on failure.
+ */
+int startCommandTiming(CommandTiming* timing, int nStages);
+
+/**
+ * @brief Records the rusage of a stage, from wait4 for processes or RUSAGE_THREAD for the stages run by the shell, and the time it ended.
+ *
+ */
+void recordStageUsage(CommandTiming* timing, int stage, const struct rusage* usage);
+
+/**
+ * @brief Gets the rusage of the calling thread, all zero if the kernel doesn't give it.
+ *
+ */
+void getThreadUsage(struct rusage* usage);
+
+/**
+ * @brief Records the rusage of a builtin the shell ran on the calling thread, as the difference with a getThreadUsage() taken before it ran.
+ *
+ * @param timing The timing
+ * @param stage Index of the stage
+ * @param since The rusage of the thread before the builtin ran
+ */
+void recordThreadUsage(CommandTiming* timing, int stage, const struct rusage* since);
+
+/**
+ * @brief Writes the report of a finished pipeline.
+ *
+ * @param timing The timing
+ * @param command The pipeline, for the names of its stages
+ * @param status Exit status of the pipeline
+ */
+void reportCommandTiming(CommandTiming* timing, Command* command, int status);
+
+/**
+ * @brief Frees a timing. Does nothing for NULL.
+ *
+ */
+void cleanUpCommandTiming(CommandTiming* timing);
+
+#endif // TIMING_H
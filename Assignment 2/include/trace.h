@@ -0,0 +1,68 @@
+/**
+ * @file trace.h
+ * @brief Span tracing of the shell. With SHELL_TRACE=file the shell records spans for reading input, tokenizing, parsing, glob expansion, fork, exec, waits and builtins, and writes them as Chrome trace-event JSON when it exits, to be opened in chrome://tracing or Perfetto. Every child process gets a track of its own, with the time from fork to exec and the time it ran.
+ * @version 0.1
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// events recorded before the buffer is full, SHELL_TRACE_EVENTS overrides it. Later events are counted as dropped
+#define TRACE_DEFAULT_EVENTS (1 << 16)
+// child processes tracked at once, from fork to reap
+#define TRACE_MAX_PROCESSES 1024
+// length of the detail of an event, like the command name, longer ones are cut
+#define TRACE_DETAIL_LENGTH 48
+
+// set when SHELL_TRACE is, the macros cost a branch otherwise
+extern bool tracing;
+
+// timestamp of the start of a span, 0 when not tracing
+#define TRACE_START() (tracing ? traceNow() : 0)
+// records a span from start to now on the calling thread
+#define TRACE_SPAN(name, category, start, detail) do { if (tracing) traceSpan(name, category, start, detail); } while (0)
+// ends the track of a reaped child
+#define TRACE_PROCESS_EXIT(pid) do { if (tracing) traceProcessExit(pid); } while (0)
+
+/**
+ * @brief Reads SHELL_TRACE and SHELL_TRACE_EVENTS, allocates the event buffer and has the trace written when the shell exits.
+ *
+ */
+void initTracing();
+
+/**
+ * @brief The monotonic clock, in nanoseconds.
+ *
+ */
+uint64_t traceNow();
+
+/**
+ * @brief Records a span from start to now on the calling thread. The name and category must be string literals, the detail is copied.
+ *
+ */
+void traceSpan(const char* name, const char* category, uint64_t start, const char* detail);
+
+/**
+ * @brief Starts the track of a child process. Its first span goes from the fork to start, named phase if it isn't NULL, and its main span from start until traceProcessExit().
+ *
+ * @param pid The child
+ * @param command The command it runs, the name of its track
+ * @param forkTime When it was forked
+ * @param phase Name of the span from the fork to start, like "exec"
+ */
+void traceProcessStart(pid_t pid, const char* command, uint64_t forkTime, const char* phase);
+
+/**
+ * @brief Ends the main span of a child process, once it is reaped.
+ *
+ */
+void traceProcessExit(pid_t pid);
+
+#endif // TRACE_H
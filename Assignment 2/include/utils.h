@@ -12,8 +12,12 @@
 
 #include "log.h"
 
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <sys/time.h>
 
 // Exposed macros for logging
 #define LOG_ERROR(...) LOG(LOG_ERR, "[ERROR]", LOG_COLOR_ERR, __VA_ARGS__)
@@ -26,6 +30,18 @@
 // in order to be consistent, let's just define a macro for copying strings
 #define COPY(str) (str ? strndup(str, MAX_STRING_LENGTH) : NULL)
 
+// a thread that calls sample every interval until stopped, see startPeriodicSampler()
+typedef struct PeriodicSampler {
+    pthread_t thread;
+    pthread_mutex_t mutex;      //< held while sampling, take it to change or read what sample works on
+    pthread_cond_t wakeUp;
+    bool stop;
+
+    int intervalMs;
+    void (*sample)(void* arg);
+    void* arg;
+} PeriodicSampler;
+
 // Useful macros for file descriptors to make the code more readable
 #define STDIN_FD 0
 #define STDOUT_FD 1
@@ -37,7 +53,7 @@
  * @brief This function tokenizes a string, given a delimiter.
  * 
  * It returns an array of tokens, and the number of tokens in the array. The function ignores any delimiter encountered inside quotes.
- * It is the responsibility of the caller to free the memory via the freeTokens() function.
+ * It is the responsibility of the caller to free the memory via the freeTokens() function. The tokens are charged to the tokenizer (see accounting.h), an array built elsewhere and freed with freeTokens() has to be allocated the same way.
  * 
  * @param str String to tokenize
  * @param delimiter Delimiter to use for tokenization
@@ -68,4 +84,71 @@ char* removeQuotes(char* str);
  */
 int getTokenCount(char** tokens);
 
+/**
+ * @brief Copies the first count tokens, the copy is freed with freeTokens()
+ * 
+ * @param tokens The tokens
+ * @param count Number of tokens to copy
+ * @return char** The NULL terminated copy, NULL on failure
+ */
+char** copyTokens(char** tokens, int count);
+
+/**
+ * @brief The time on the monotonic clock, in seconds
+ * 
+ * @return double Seconds since an arbitrary point, only differences mean something
+ */
+double monotonicSeconds();
+
+/**
+ * @brief Converts a timeval, as found in a rusage, to seconds
+ * 
+ * @param tv The timeval
+ * @return double The seconds
+ */
+double toSeconds(struct timeval tv);
+
+/**
+ * @brief Writes a string as a quoted JSON string, escaping the quotes, the backslashes and the control characters
+ * 
+ * @param file Where to write it
+ * @param str The string
+ */
+void writeJSONString(FILE* file, const char* str);
+
+/**
+ * @brief Starts a helper thread with every signal blocked, so the signals are left to the main thread. A write to a closed pipe fails with EPIPE on the thread, the SIGPIPE stays pending instead of killing the shell
+ * 
+ * @param thread Where to store the thread
+ * @param function The function of the thread
+ * @param arg The argument passed to it
+ * @return int 0, or the error number of pthread_create
+ */
+int startHelperThread(pthread_t* thread, void* (*function)(void*), void* arg);
+
+/**
+ * @brief Starts a helper thread that calls sample(arg) every intervalMs, with the mutex of the sampler held, until stopPeriodicSampler()
+ * 
+ * @param sampler The sampler, its mutex and condition are initialized here
+ * @param intervalMs Time between two samples
+ * @param sample Called on the thread
+ * @param arg Its argument
+ * @return int 0, or the error number of pthread_create. The sampler is left destroyed on failure
+ */
+int startPeriodicSampler(PeriodicSampler* sampler, int intervalMs, void (*sample)(void* arg), void* arg);
+
+/**
+ * @brief Stops the thread of a sampler without waiting for the end of the interval, and joins it. The mutex stays usable until destroyPeriodicSampler()
+ * 
+ * @param sampler The sampler
+ */
+void stopPeriodicSampler(PeriodicSampler* sampler);
+
+/**
+ * @brief Destroys the mutex and the condition of a stopped sampler
+ * 
+ * @param sampler The sampler
+ */
+void destroyPeriodicSampler(PeriodicSampler* sampler);
+
 #endif // UTILS_H
\ No newline at end of file
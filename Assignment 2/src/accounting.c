@@ -0,0 +1,250 @@
+/**
+ * @file accounting.c
+ * @brief Contains the function definitions for the heap and fd accounting declared in accounting.h
+ * @version 0.1
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include "accounting.h"
+#include "jobs.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <malloc.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <unistd.h>
+
+// the counters of a subsystem. The stage threads allocate next to the main thread, so they are atomic
+typedef struct AllocCounters {
+    atomic_int_fast64_t liveBytes;
+    atomic_int_fast64_t liveBlocks;
+    atomic_uint_fast64_t allocations;
+    atomic_uint_fast64_t allocatedBytes;
+    atomic_uint_fast64_t frees;
+} AllocCounters;
+
+static AllocCounters counters[ALLOC_N_SUBSYSTEMS];
+static const char* subsystemNames[ALLOC_N_SUBSYSTEMS] = ALLOC_SUBSYSTEM_NAMES;
+
+// the fds are opened and closed by the main thread only
+static const char* fdOrigins[FD_REGISTRY_SIZE] = { "stdin", "stdout", "stderr" };
+
+/*-------------------------------Heap----------------------------------------------------*/
+
+static void charge(AllocSubsystem subsystem, void* ptr)
+{
+    size_t size = malloc_usable_size(ptr);
+    atomic_fetch_add_explicit(&counters[subsystem].liveBytes, size, memory_order_relaxed);
+    atomic_fetch_add_explicit(&counters[subsystem].liveBlocks, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&counters[subsystem].allocations, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&counters[subsystem].allocatedBytes, size, memory_order_relaxed);
+}
+
+static void discharge(AllocSubsystem subsystem, void* ptr)
+{
+    atomic_fetch_sub_explicit(&counters[subsystem].liveBytes, malloc_usable_size(ptr), memory_order_relaxed);
+    atomic_fetch_sub_explicit(&counters[subsystem].liveBlocks, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&counters[subsystem].frees, 1, memory_order_relaxed);
+}
+
+void* trackedMalloc(AllocSubsystem subsystem, size_t size)
+{
+    void* ptr = malloc(size);
+    if (ptr)
+        charge(subsystem, ptr);
+    return ptr;
+}
+
+void* trackedCalloc(AllocSubsystem subsystem, size_t count, size_t size)
+{
+    void* ptr = calloc(count, size);
+    if (ptr)
+        charge(subsystem, ptr);
+    return ptr;
+}
+
+void* trackedRealloc(AllocSubsystem subsystem, void* ptr, size_t size)
+{
+    if (!ptr)
+        return trackedMalloc(subsystem, size);
+
+    // the old block is discharged only once it is gone, a failed realloc leaves it live
+    size_t oldSize = malloc_usable_size(ptr);
+    void* grown = realloc(ptr, size);
+    if (!grown)
+        return NULL;
+
+    size_t newSize = malloc_usable_size(grown);
+    atomic_fetch_add_explicit(&counters[subsystem].liveBytes, (int64_t)newSize - (int64_t)oldSize, memory_order_relaxed);
+    atomic_fetch_add_explicit(&counters[subsystem].allocations, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&counters[subsystem].allocatedBytes, newSize, memory_order_relaxed);
+    return grown;
+}
+
+char* trackedStrndup(AllocSubsystem subsystem, const char* str, size_t length)
+{
+    char* copy = strndup(str, length);
+    if (copy)
+        charge(subsystem, copy);
+    return copy;
+}
+
+void trackedFree(AllocSubsystem subsystem, void* ptr)
+{
+    if (!ptr)
+        return;
+
+    discharge(subsystem, ptr);
+    free(ptr);
+}
+
+void getAllocStats(AllocSubsystem subsystem, AllocStats* stats)
+{
+    stats->liveBytes = atomic_load_explicit(&counters[subsystem].liveBytes, memory_order_relaxed);
+    stats->liveBlocks = atomic_load_explicit(&counters[subsystem].liveBlocks, memory_order_relaxed);
+    stats->allocations = atomic_load_explicit(&counters[subsystem].allocations, memory_order_relaxed);
+    stats->allocatedBytes = atomic_load_explicit(&counters[subsystem].allocatedBytes, memory_order_relaxed);
+    stats->frees = atomic_load_explicit(&counters[subsystem].frees, memory_order_relaxed);
+}
+
+/*-------------------------------Fds-----------------------------------------------------*/
+
+void registerFD(int fd, const char* origin)
+{
+    if (fd >= 0 && fd < FD_REGISTRY_SIZE)
+        fdOrigins[fd] = origin;
+}
+
+void forgetFD(int fd)
+{
+    if (fd >= 0 && fd < FD_REGISTRY_SIZE)
+        fdOrigins[fd] = NULL;
+}
+
+// calls visit for every fd open in the shell, returns the number of them or -1
+static int forEachOpenFD(void (*visit)(int fd, void* arg), void* arg)
+{
+    DIR* dir = opendir("/proc/self/fd");
+    if (!dir)
+        return -1;
+
+    int count = 0;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (entry->d_name[0] == '.')
+            continue;
+
+        // the directory's own fd isn't the shell's
+        int fd = atoi(entry->d_name);
+        if (fd == dirfd(dir))
+            continue;
+
+        count++;
+        if (visit)
+            visit(fd, arg);
+    }
+
+    closedir(dir);
+    return count;
+}
+
+static void printOpenFD(int fd, void* arg)
+{
+    int outputFD = *(int*)arg;
+
+    char path[32];
+    char target[PATH_MAX];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+
+    ssize_t length = readlink(path, target, sizeof(target) - 1);
+    if (length == -1)
+        length = 0;
+    target[length] = '\0';
+
+    const char* origin = fd < FD_REGISTRY_SIZE && fdOrigins[fd] ? fdOrigins[fd] : "-";
+    dprintf(outputFD, "  %-4d %-14s %s\n", fd, origin, target);
+}
+
+/*-------------------------------Leak check----------------------------------------------*/
+
+// the live heap of the subsystems that should be back to where they were after a command
+static void transientHeap(int64_t* bytes, int64_t* blocks)
+{
+    *bytes = 0;
+    *blocks = 0;
+
+    for (int i = 0; i < ALLOC_N_SUBSYSTEMS; i++)
+    {
+        if (ALLOC_TRANSIENT(i))
+        {
+            *bytes += atomic_load_explicit(&counters[i].liveBytes, memory_order_relaxed);
+            *blocks += atomic_load_explicit(&counters[i].liveBlocks, memory_order_relaxed);
+        }
+    }
+}
+
+void startLeakCheck(LeakMark* mark)
+{
+    transientHeap(&mark->bytes, &mark->blocks);
+    mark->fds = forEachOpenFD(NULL, NULL);
+}
+
+int endLeakCheck(const LeakMark* mark, const char* line)
+{
+    // a background job keeps its command and its fds until it is reaped
+    if (getJobCount() > 0)
+    {
+        LOG_DEBUG("leakcheck: skipped, background jobs hold their commands\n");
+        return 0;
+    }
+
+    int64_t bytes, blocks;
+    transientHeap(&bytes, &blocks);
+    int fds = forEachOpenFD(NULL, NULL);
+
+    if (bytes <= mark->bytes && blocks <= mark->blocks && fds <= mark->fds)
+        return 0;
+
+    LOG_ERROR("leakcheck: '%s' left %+ld bytes in %+ld blocks and %+d fds behind, see shellstats\n",
+              line, (long)(bytes - mark->bytes), (long)(blocks - mark->blocks), fds - mark->fds);
+    return -1;
+}
+
+/*-------------------------------Builtin-------------------------------------------------*/
+
+int shellstats(SimpleCommand* simpleCommand)
+{
+    if (simpleCommand->argc > 1)
+    {
+        LOG_ERROR("shellstats: Usage: shellstats\n");
+        return -1;
+    }
+
+    int outputFD = simpleCommand->outputFD;
+
+    dprintf(outputFD, "%-12s %12s %10s %12s %12s\n", "heap", "live bytes", "blocks", "allocs", "frees");
+    for (int i = 0; i < ALLOC_N_SUBSYSTEMS; i++)
+    {
+        dprintf(outputFD, "%-12s %12ld %10ld %12lu %12lu\n", subsystemNames[i],
+                (long)atomic_load_explicit(&counters[i].liveBytes, memory_order_relaxed),
+                (long)atomic_load_explicit(&counters[i].liveBlocks, memory_order_relaxed),
+                (unsigned long)atomic_load_explicit(&counters[i].allocations, memory_order_relaxed),
+                (unsigned long)atomic_load_explicit(&counters[i].frees, memory_order_relaxed));
+    }
+
+    dprintf(outputFD, "\nfds\n");
+    if (forEachOpenFD(printOpenFD, &outputFD) == -1)
+    {
+        LOG_ERROR("shellstats: /proc/self/fd: %s\n", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,541 @@
+/**
+ * @file bench.c
+ * @brief Contains the definition of the bench builtin declared in bench.h
+ * @version 0.1
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include "bench.h"
+#include "parser.h"
+#include "accounting.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+
+/*----------------------------------------------------------------------------------------*/
+
+// what one run measured
+typedef struct BenchSample {
+    double wall;        // seconds, on the monotonic clock
+    double user;        // CPU seconds of the shell and the children it reaped during the run
+    double sys;
+    int status;
+} BenchSample;
+
+// the command line being benchmarked, tokenized once
+typedef struct BenchPlan {
+    char** tokens;
+    int nullFD;         // /dev/null for the input and the output of the runs, -1 with -s
+} BenchPlan;
+
+typedef struct BenchSummary {
+    int nRuns;
+    double min, mean, stddev, p50, p90, p99, max;
+    double meanUser, meanSys;
+    int mildOutliers, severeOutliers;
+    int failed;
+} BenchSummary;
+
+/*-------------------------------Helpers-------------------------------------------------*/
+
+// parses a count of -n, -w or -j. Returns false if it isn't a number in [min, max]
+static bool parseCount(const char* str, int min, int max, int* count)
+{
+    if (!str || !*str || strspn(str, "0123456789") != strlen(str) || strlen(str) > 9)
+        return false;
+
+    *count = atoi(str);
+    return *count >= min && *count <= max;
+}
+
+// a single argument is a whole command line, several are joined back with quotes around the ones holding blanks
+static char* buildCommandLine(char** args, int nArgs)
+{
+    if (nArgs == 1)
+        return strdup(args[0]);
+
+    size_t length = 1;
+    for (int i = 0; i < nArgs; i++)
+        length += strlen(args[i]) + 3;
+
+    char* line = (char*)calloc(length, sizeof(char));
+    if (!line)
+        return NULL;
+
+    for (int i = 0; i < nArgs; i++)
+    {
+        bool quote = strpbrk(args[i], " \t") != NULL;
+
+        if (i > 0)
+            strcat(line, " ");
+        if (quote)
+            strcat(line, strchr(args[i], '"') ? "'" : "\"");
+        strcat(line, args[i]);
+        if (quote)
+            strcat(line, strchr(args[i], '"') ? "'" : "\"");
+    }
+
+    return line;
+}
+
+// points the stages that would read the terminal or write to it at /dev/null
+static void silenceChain(CommandChain* chain, int nullFD)
+{
+    for (Command* command = chain->head; command; command = command->next)
+    {
+        for (int i = 0; i < command->nSimpleCommands; i++)
+        {
+            SimpleCommand* simpleCommand = command->simpleCommands[i];
+
+            if (simpleCommand->inputFD == STDIN_FD)
+                simpleCommand->inputFD = fcntl(nullFD, F_DUPFD_CLOEXEC, STDERR_FD + 1);
+            if (simpleCommand->outputFD == STDOUT_FD)
+                simpleCommand->outputFD = fcntl(nullFD, F_DUPFD_CLOEXEC, STDERR_FD + 1);
+
+            // a failed dup leaves the stage on the terminal
+            if (simpleCommand->inputFD == -1)
+                simpleCommand->inputFD = STDIN_FD;
+            if (simpleCommand->outputFD == -1)
+                simpleCommand->outputFD = STDOUT_FD;
+        }
+    }
+}
+
+// finds a lone builtin that changes the shell itself, it would run in the shell on every run: exit would end it, cd would move it. Returns its name, NULL if there's none or the line doesn't parse
+static const char* findShellBuiltin(BenchPlan* plan)
+{
+    static const char* shellBuiltins[] = { "cd", "exit", "prompt", "setopt", NULL };
+
+    char** tokens = copyTokens(plan->tokens, getTokenCount(plan->tokens));
+    CommandChain* chain = tokens ? parseTokens(tokens) : NULL;
+    const char* found = NULL;
+
+    for (Command* command = chain ? chain->head : NULL; command; command = command->next)
+    {
+        // the stages of a pipeline run in subshells
+        for (int i = 0; !found && command->nSimpleCommands == 1 && shellBuiltins[i]; i++)
+        {
+            const char* name = command->simpleCommands[0]->commandName;
+            if (name && strcmp(name, shellBuiltins[i]) == 0)
+                found = shellBuiltins[i];
+        }
+
+        closeCommandFDs(command);
+    }
+
+    cleanUpCommandChain(chain);
+    if (tokens)
+        freeTokens(tokens);
+    return found;
+}
+
+/*-------------------------------Runs----------------------------------------------------*/
+
+// parses and executes the command line once, only the execution is measured. Returns -1 if it doesn't parse
+static int runOnce(BenchPlan* plan, BenchSample* sample)
+{
+    // the parser frees and replaces the tokens it unquotes, so every run parses its own copy
+    char** tokens = copyTokens(plan->tokens, getTokenCount(plan->tokens));
+    if (!tokens)
+        return -1;
+
+    CommandChain* chain = parseTokens(tokens);
+    if (!chain)
+    {
+        freeTokens(tokens);
+        return -1;
+    }
+
+    if (plan->nullFD != -1)
+        silenceChain(chain, plan->nullFD);
+
+    struct rusage selfBefore, childrenBefore, selfAfter, childrenAfter;
+    getrusage(RUSAGE_SELF, &selfBefore);
+    getrusage(RUSAGE_CHILDREN, &childrenBefore);
+    double start = monotonicSeconds();
+
+    int status = executeCommandChain(chain);
+
+    sample->wall = monotonicSeconds() - start;
+    getrusage(RUSAGE_SELF, &selfAfter);
+    getrusage(RUSAGE_CHILDREN, &childrenAfter);
+
+    sample->user = toSeconds(selfAfter.ru_utime) - toSeconds(selfBefore.ru_utime) + toSeconds(childrenAfter.ru_utime) - toSeconds(childrenBefore.ru_utime);
+    sample->sys = toSeconds(selfAfter.ru_stime) - toSeconds(selfBefore.ru_stime) + toSeconds(childrenAfter.ru_stime) - toSeconds(childrenBefore.ru_stime);
+    sample->status = status == 0 ? 0 : (status < 0 ? 1 : status & 0xff);
+
+    cleanUpCommandChain(chain);
+    freeTokens(tokens);
+    return 0;
+}
+
+// runs the runs one after the other in the shell. Returns the number of runs done, -1 if the command line doesn't parse
+static int runSequential(BenchPlan* plan, BenchSample* samples, int nRuns)
+{
+    for (int i = 0; i < nRuns; i++)
+    {
+        if (runOnce(plan, &samples[i]) == -1)
+            return -1;
+    }
+
+    return nRuns;
+}
+
+// shares the runs between forked copies of the shell, each sends its samples back over a pipe. Returns the number of samples received, -1 on failure
+static int runConcurrent(BenchPlan* plan, BenchSample* samples, int nRuns, int concurrency)
+{
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) == -1)
+    {
+        LOG_ERROR("bench: pipe: %s\n", strerror(errno));
+        return -1;
+    }
+
+    // anything buffered would be written again by every worker
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t workers[concurrency];
+    int nWorkers = 0;
+
+    for (int w = 0; w < concurrency; w++)
+    {
+        int share = nRuns / concurrency + (w < nRuns % concurrency);
+        if (share == 0)
+            break;
+
+        pid_t pid = fork();
+        if (pid == -1)
+        {
+            LOG_ERROR("bench: fork: %s\n", strerror(errno));
+            break;
+        }
+
+        if (pid == 0)
+        {
+            close(fds[PIPE_READ_END]);
+
+            // a sample is smaller than PIPE_BUF, so the writes of the workers don't interleave
+            for (int i = 0; i < share; i++)
+            {
+                BenchSample sample;
+                if (runOnce(plan, &sample) == -1)
+                    _exit(1);
+
+                if (write(fds[PIPE_WRITE_END], &sample, sizeof(sample)) != sizeof(sample))
+                    _exit(1);
+            }
+
+            fflush(stdout);
+            fflush(stderr);
+            _exit(0);
+        }
+
+        workers[nWorkers++] = pid;
+    }
+
+    close(fds[PIPE_WRITE_END]);
+
+    int nSamples = 0;
+    size_t received = 0;
+    while (nSamples < nRuns)
+    {
+        ssize_t nread = read(fds[PIPE_READ_END], (char*)samples + received, nRuns * sizeof(BenchSample) - received);
+        if (nread == -1 && errno == EINTR)
+            continue;
+        if (nread <= 0)
+            break;
+
+        received += nread;
+        nSamples = received / sizeof(BenchSample);
+    }
+
+    close(fds[PIPE_READ_END]);
+
+    for (int w = 0; w < nWorkers; w++)
+    {
+        while (waitpid(workers[w], NULL, 0) == -1 && errno == EINTR);
+    }
+
+    return nWorkers ? nSamples : -1;
+}
+
+/*-------------------------------Statistics----------------------------------------------*/
+
+static int compareDoubles(const void* a, const void* b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// the p-th percentile of sorted values, interpolated between the closest ranks
+static double percentile(const double* sorted, int n, double p)
+{
+    double rank = p / 100.0 * (n - 1);
+    int low = (int)rank;
+    if (low >= n - 1)
+        return sorted[n - 1];
+
+    return sorted[low] + (rank - low) * (sorted[low + 1] - sorted[low]);
+}
+
+static int summarize(const BenchSample* samples, int nRuns, BenchSummary* summary)
+{
+    double* walls = (double*)malloc(nRuns * sizeof(double));
+    if (!walls)
+        return -1;
+
+    memset(summary, 0, sizeof(*summary));
+    summary->nRuns = nRuns;
+
+    for (int i = 0; i < nRuns; i++)
+    {
+        walls[i] = samples[i].wall;
+        summary->mean += samples[i].wall;
+        summary->meanUser += samples[i].user;
+        summary->meanSys += samples[i].sys;
+        summary->failed += samples[i].status != 0;
+    }
+
+    summary->mean /= nRuns;
+    summary->meanUser /= nRuns;
+    summary->meanSys /= nRuns;
+
+    for (int i = 0; i < nRuns; i++)
+        summary->stddev += (walls[i] - summary->mean) * (walls[i] - summary->mean);
+    summary->stddev = nRuns > 1 ? sqrt(summary->stddev / (nRuns - 1)) : 0;
+
+    qsort(walls, nRuns, sizeof(double), compareDoubles);
+    summary->min = walls[0];
+    summary->max = walls[nRuns - 1];
+    summary->p50 = percentile(walls, nRuns, 50);
+    summary->p90 = percentile(walls, nRuns, 90);
+    summary->p99 = percentile(walls, nRuns, 99);
+
+    // Tukey's fences around the quartiles, the severe outliers are counted once
+    double q1 = percentile(walls, nRuns, 25);
+    double q3 = percentile(walls, nRuns, 75);
+    double iqr = q3 - q1;
+
+    for (int i = 0; i < nRuns; i++)
+    {
+        if (walls[i] < q1 - BENCH_SEVERE_OUTLIER_IQR * iqr || walls[i] > q3 + BENCH_SEVERE_OUTLIER_IQR * iqr)
+            summary->severeOutliers++;
+        else if (walls[i] < q1 - BENCH_MILD_OUTLIER_IQR * iqr || walls[i] > q3 + BENCH_MILD_OUTLIER_IQR * iqr)
+            summary->mildOutliers++;
+    }
+
+    free(walls);
+    return 0;
+}
+
+/*-------------------------------Reports-------------------------------------------------*/
+
+// formats a duration with the unit that suits it
+static const char* formatDuration(char* buffer, size_t size, double seconds)
+{
+    if (seconds < 1e-3)
+        snprintf(buffer, size, "%.1fus", seconds * 1e6);
+    else if (seconds < 1)
+        snprintf(buffer, size, "%.2fms", seconds * 1e3);
+    else
+        snprintf(buffer, size, "%.3fs", seconds);
+
+    return buffer;
+}
+
+static void printSummary(int fd, const char* commandLine, BenchSummary* summary, int warmup, int concurrency, double elapsed)
+{
+    char a[32], b[32], c[32], d[32];
+
+    dprintf(fd, "bench: %s\n", commandLine);
+    dprintf(fd, "  runs      %d (%d warmup, %d concurrent)\n", summary->nRuns, warmup, concurrency);
+    dprintf(fd, "  wall      min %s  mean %s +- %s  max %s\n", formatDuration(a, sizeof(a), summary->min), formatDuration(b, sizeof(b), summary->mean),
+            formatDuration(c, sizeof(c), summary->stddev), formatDuration(d, sizeof(d), summary->max));
+    dprintf(fd, "            p50 %s  p90 %s  p99 %s\n", formatDuration(a, sizeof(a), summary->p50), formatDuration(b, sizeof(b), summary->p90),
+            formatDuration(c, sizeof(c), summary->p99));
+    dprintf(fd, "  cpu       user %s  sys %s  per run\n", formatDuration(a, sizeof(a), summary->meanUser), formatDuration(b, sizeof(b), summary->meanSys));
+
+    if (concurrency > 1)
+        dprintf(fd, "  rate      %.1f runs/s\n", summary->nRuns / elapsed);
+
+    int outliers = summary->mildOutliers + summary->severeOutliers;
+    dprintf(fd, "  outliers  %d (%d mild, %d severe)%s\n", outliers, summary->mildOutliers, summary->severeOutliers,
+            outliers * 10 > summary->nRuns ? ", the runs were disturbed, consider more warmup or a quieter machine" : "");
+
+    if (summary->failed)
+        dprintf(fd, "  failed    %d runs exited with a non-zero status\n", summary->failed);
+}
+
+static FILE* openExport(const char* path)
+{
+    FILE* file = fopen(path, "we");
+    if (!file)
+        LOG_ERROR("bench: %s: %s\n", path, strerror(errno));
+
+    return file;
+}
+
+static int exportCSV(const char* path, const BenchSample* samples, int nRuns)
+{
+    FILE* file = openExport(path);
+    if (!file)
+        return -1;
+
+    fprintf(file, "run,wall_seconds,user_seconds,sys_seconds,status\n");
+    for (int i = 0; i < nRuns; i++)
+        fprintf(file, "%d,%.9f,%.6f,%.6f,%d\n", i, samples[i].wall, samples[i].user, samples[i].sys, samples[i].status);
+
+    return fclose(file) == 0 ? 0 : -1;
+}
+
+static int exportJSON(const char* path, const char* commandLine, BenchSummary* summary, const BenchSample* samples, int warmup, int concurrency)
+{
+    FILE* file = openExport(path);
+    if (!file)
+        return -1;
+
+    fprintf(file, "{\"command\":");
+    writeJSONString(file, commandLine);
+    fprintf(file, ",\"runs\":%d,\"warmup\":%d,\"concurrency\":%d,\"failed\":%d", summary->nRuns, warmup, concurrency, summary->failed);
+    fprintf(file, ",\"wall\":{\"min\":%.9f,\"mean\":%.9f,\"stddev\":%.9f,\"p50\":%.9f,\"p90\":%.9f,\"p99\":%.9f,\"max\":%.9f}",
+            summary->min, summary->mean, summary->stddev, summary->p50, summary->p90, summary->p99, summary->max);
+    fprintf(file, ",\"cpu\":{\"user\":%.6f,\"sys\":%.6f}", summary->meanUser, summary->meanSys);
+    fprintf(file, ",\"outliers\":{\"mild\":%d,\"severe\":%d}", summary->mildOutliers, summary->severeOutliers);
+
+    fprintf(file, ",\"samples\":[");
+    for (int i = 0; i < summary->nRuns; i++)
+        fprintf(file, "%s{\"wall\":%.9f,\"user\":%.6f,\"sys\":%.6f,\"status\":%d}", i ? "," : "", samples[i].wall, samples[i].user, samples[i].sys, samples[i].status);
+    fprintf(file, "]}\n");
+
+    return fclose(file) == 0 ? 0 : -1;
+}
+
+/*-------------------------------Builtin-------------------------------------------------*/
+
+int bench(SimpleCommand* simpleCommand)
+{
+    int nRuns = BENCH_DEFAULT_RUNS;
+    int warmup = 0;
+    int concurrency = 1;
+    bool showOutput = false;
+    const char* csvPath = NULL;
+    const char* jsonPath = NULL;
+
+    // the options come before the command, which starts after -- or at the first argument that isn't an option
+    int i = 1;
+    for (; i < simpleCommand->argc && simpleCommand->args[i][0] == '-'; i++)
+    {
+        const char* option = simpleCommand->args[i];
+        const char* value = i + 1 < simpleCommand->argc ? simpleCommand->args[i + 1] : NULL;
+
+        if (strcmp(option, "--") == 0)
+        {
+            i++;
+            break;
+        }
+        else if (strcmp(option, "-s") == 0)
+            showOutput = true;
+        else if (strcmp(option, "-n") == 0 && parseCount(value, 1, BENCH_MAX_RUNS, &nRuns))
+            i++;
+        else if (strcmp(option, "-w") == 0 && parseCount(value, 0, BENCH_MAX_RUNS, &warmup))
+            i++;
+        else if (strcmp(option, "-j") == 0 && parseCount(value, 1, BENCH_MAX_CONCURRENCY, &concurrency))
+            i++;
+        else if (strcmp(option, "--export-csv") == 0 && value)
+            csvPath = simpleCommand->args[++i];
+        else if (strcmp(option, "--export-json") == 0 && value)
+            jsonPath = simpleCommand->args[++i];
+        else
+        {
+            LOG_ERROR("bench: bad option %s\n", option);
+            return -1;
+        }
+    }
+
+    if (i >= simpleCommand->argc)
+    {
+        LOG_ERROR("Usage: bench [-n runs] [-w warmup] [-j concurrency] [-s] [--export-csv file] [--export-json file] -- command [args]*\n");
+        return -1;
+    }
+
+    char* commandLine = buildCommandLine(&simpleCommand->args[i], simpleCommand->argc - i);
+    BenchPlan plan = {NULL, -1};
+    plan.tokens = commandLine ? tokenizeString(commandLine, ' ') : NULL;
+    BenchSample* samples = (BenchSample*)calloc(nRuns, sizeof(BenchSample));
+
+    if (!showOutput)
+        plan.nullFD = open("/dev/null", O_RDWR | O_CLOEXEC);
+
+    int status = -1;
+    if (!commandLine || !plan.tokens || !samples)
+    {
+        LOG_ERROR("bench: malloc failure\n");
+        goto done;
+    }
+
+    const char* shellBuiltin = findShellBuiltin(&plan);
+    if (shellBuiltin)
+    {
+        LOG_ERROR("bench: %s changes the shell itself, it can't be benchmarked\n", shellBuiltin);
+        goto done;
+    }
+
+    // the warmup fills the caches, the path cache among them, and runs in the shell whatever the concurrency
+    BenchSample discarded;
+    for (int w = 0; w < warmup; w++)
+    {
+        if (runOnce(&plan, &discarded) == -1)
+        {
+            LOG_ERROR("bench: can't parse %s\n", commandLine);
+            goto done;
+        }
+    }
+
+    double start = monotonicSeconds();
+    int nDone = concurrency > 1 ? runConcurrent(&plan, samples, nRuns, concurrency) : runSequential(&plan, samples, nRuns);
+    double elapsed = monotonicSeconds() - start;
+
+    if (nDone <= 0)
+    {
+        LOG_ERROR("bench: can't run %s\n", commandLine);
+        goto done;
+    }
+
+    if (nDone < nRuns)
+        LOG_ERROR("bench: only %d of the %d runs reported\n", nDone, nRuns);
+
+    BenchSummary summary;
+    if (summarize(samples, nDone, &summary) == -1)
+    {
+        LOG_ERROR("bench: malloc failure\n");
+        goto done;
+    }
+
+    printSummary(simpleCommand->outputFD, commandLine, &summary, warmup, concurrency, elapsed);
+    status = summary.failed || nDone < nRuns ? 1 : 0;
+
+    if (csvPath && exportCSV(csvPath, samples, nDone) == -1)
+        status = 1;
+    if (jsonPath && exportJSON(jsonPath, commandLine, &summary, samples, warmup, concurrency) == -1)
+        status = 1;
+
+done:
+    if (plan.nullFD != -1)
+        close(plan.nullFD);
+    if (plan.tokens)
+        freeTokens(plan.tokens);
+    free(samples);
+    free(commandLine);
+    return status;
+}
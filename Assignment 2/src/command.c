@@ -8,6 +8,24 @@
  */
 
 #include "command.h"
+#include "accounting.h"
+#include "cpu_placement.h"
+#include "jobs.h"
+#include "metrics.h"
+#include "pipe_tuning.h"
+#include "pipestat.h"
+#include "probes.h"
+#include "shell_builtins.h"
+#include "timing.h"
+#include "trace.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <sys/wait.h>
+
+extern ShellState* globalShellState;
 
 // simple macro to check if this command is chained with a certain operator  with the last command(just a hack for readability)
 #define CHAINED_WITH(opr) (prevCommand ? (prevCommand->chainingOperator ? (strcmp(prevCommand->chainingOperator, opr) == 0) : 0) : 0)
@@ -19,7 +37,7 @@
 // initializes a simple command with default values
 SimpleCommand* initSimpleCommand()
 {
-    SimpleCommand* simpleCommand = (SimpleCommand*) malloc(sizeof(SimpleCommand));
+    SimpleCommand* simpleCommand = (SimpleCommand*) trackedMalloc(ALLOC_PARSER, sizeof(SimpleCommand));
 
     if (!simpleCommand)
         return NULL;
@@ -33,6 +51,7 @@ SimpleCommand* initSimpleCommand()
     simpleCommand->noWait      = 0;
     simpleCommand->execute     = NULL;
     simpleCommand->pid         = -1;
+    simpleCommand->cpuList     = NULL;
 
     return simpleCommand;
 }
@@ -40,7 +59,7 @@ SimpleCommand* initSimpleCommand()
 // initializes a command with default values
 Command* initCommand()
 {
-    Command* command = (Command*)malloc(sizeof(Command));
+    Command* command = (Command*)trackedMalloc(ALLOC_PARSER, sizeof(Command));
 
     if (!command)
         return NULL;
@@ -48,6 +67,9 @@ Command* initCommand()
     command->simpleCommands   = NULL;
     command->nSimpleCommands  = 0;
     command->background       = false;
+    command->stats            = NULL;
+    command->timing           = NULL;
+    command->sourceTokens     = NULL;
     command->chainingOperator = NULL;
     command->next             = NULL;
 
@@ -57,7 +79,7 @@ Command* initCommand()
 // initializes a command chain with default values
 CommandChain* initCommandChain()
 {
-    CommandChain* chain = (CommandChain*)malloc(sizeof(CommandChain));
+    CommandChain* chain = (CommandChain*)trackedMalloc(ALLOC_PARSER, sizeof(CommandChain));
 
     if (!chain)
         return NULL;
@@ -111,7 +133,7 @@ int addSimpleCommand(Command* command, SimpleCommand* simpleCommand)
     }
 
     // we need to realloc the array containing the commands.
-    SimpleCommand** temp = (SimpleCommand**)realloc(command->simpleCommands, (command->nSimpleCommands + 1) * sizeof(SimpleCommand*));
+    SimpleCommand** temp = (SimpleCommand**)trackedRealloc(ALLOC_PARSER, command->simpleCommands, (command->nSimpleCommands + 1) * sizeof(SimpleCommand*));
 
     if (!temp)
     {
@@ -142,7 +164,7 @@ int pushArgs(char* arg, SimpleCommand* simpleCommand)
     }
 
     // when NULL ptr given, realloc behaves like malloc
-    char** temp = (char**)realloc(simpleCommand->args, (simpleCommand->argc + 2) * sizeof(char*));
+    char** temp = (char**)trackedRealloc(ALLOC_PARSER, simpleCommand->args, (simpleCommand->argc + 2) * sizeof(char*));
 
     if (!temp)
     {
@@ -153,13 +175,13 @@ int pushArgs(char* arg, SimpleCommand* simpleCommand)
     simpleCommand->args = temp;
     temp = NULL;
 
-    simpleCommand->args[simpleCommand->argc] = COPY(arg);
+    simpleCommand->args[simpleCommand->argc] = TRACKED_COPY(ALLOC_PARSER, arg);
     simpleCommand->args[simpleCommand->argc + 1] = NULL;
     simpleCommand->argc++;
 
     if (simpleCommand->argc == 1)
     {
-        simpleCommand->commandName = COPY(arg);
+        simpleCommand->commandName = TRACKED_COPY(ALLOC_PARSER, arg);
     }
 
     return 0;
@@ -183,8 +205,15 @@ int executeCommandChain(CommandChain* chain)
 
     while (command)
     {   
-        // execute the current command in the chain
-        lastStatus = executeCommand(command);
+        // background pipelines go through the job scheduler, which may hold them back until the limits allow them to start
+        if (command->background)
+            lastStatus = submitBackgroundJob(command);
+        else
+        {
+            lastStatus = executeCommand(command);
+            if (lastStatus != 0)
+                countMetric(METRIC_NONZERO_EXITS);
+        }
 
         // move on to the next one
         command = command->next;
@@ -193,6 +222,359 @@ int executeCommandChain(CommandChain* chain)
     return lastStatus;
 }
 
+// closes the fds the parser opened for a simple command, the parent has no use for them once the stage is launched
+static void closeStageFDs(SimpleCommand* simpleCommand)
+{
+    if (simpleCommand->inputFD != STDIN_FD)
+    {
+        forgetFD(simpleCommand->inputFD);
+        close(simpleCommand->inputFD);
+    }
+
+    if (simpleCommand->outputFD != STDOUT_FD)
+    {
+        forgetFD(simpleCommand->outputFD);
+        close(simpleCommand->outputFD);
+    }
+
+    if (simpleCommand->stderrFD != STDERR_FD)
+    {
+        forgetFD(simpleCommand->stderrFD);
+        close(simpleCommand->stderrFD);
+    }
+
+    simpleCommand->inputFD = STDIN_FD;
+    simpleCommand->outputFD = STDOUT_FD;
+    simpleCommand->stderrFD = STDERR_FD;
+}
+
+void closeCommandFDs(Command* command)
+{
+    for (int i = 0; i < command->nSimpleCommands; i++)
+        closeStageFDs(command->simpleCommands[i]);
+}
+
+// runs a builtin stage of a pipeline in a subshell, so it writes to the pipe while the other stages read from it
+static int executeBuiltinInSubshell(Command* command, SimpleCommand* simpleCommand)
+{
+    // anything buffered would be written again by the child
+    fflush(stdout);
+    fflush(stderr);
+
+    countMetric(METRIC_BUILTIN_COMMANDS);
+
+    uint64_t forkStart = traceNow();
+    int pid = fork();
+
+    if (pid == -1)
+    {
+        LOG_DEBUG("fork: %s\n", strerror(errno));
+        return -1;
+    }
+    else if (pid == 0)
+    {
+        // the subshell owns the stage's fds, so the builtin writes straight to the pipe instead of swapping them in and out
+        int fds[] = { simpleCommand->inputFD, simpleCommand->outputFD, simpleCommand->stderrFD };
+        for (int i = 0; i < 3; i++)
+        {
+            if (fds[i] != i && dup2(fds[i], i) == -1)
+            {
+                LOG_ERROR("dup2: %s\n", strerror(errno));
+                _exit(1);
+            }
+        }
+
+        // the builtin never execs, so its close-on-exec fds stay open unless closed here: holding the read end of its own output pipe, a producer would never see EPIPE. This closes the stage's own copies too, they now live on 0, 1 and 2
+        closeCommandFDs(command);
+
+        if (simpleCommand->cpuList && applyCpuList(simpleCommand->cpuList) == -1)
+            LOG_DEBUG("sched_setaffinity %s: %s\n", simpleCommand->cpuList, strerror(errno));
+
+        PROBE_BUILTIN_ENTER(simpleCommand);
+        int status = simpleCommand->execute(simpleCommand);
+        PROBE_BUILTIN_EXIT(simpleCommand, status);
+
+        fflush(stdout);
+        fflush(stderr);
+        _exit(status == 0 ? 0 : (status < 0 ? 1 : status & 0xff));
+    }
+
+    simpleCommand->pid = pid;
+    recordSpawn(pid, forkStart);
+    TRACE_SPAN("fork", "spawn", forkStart, simpleCommand->commandName);
+
+    // a subshell doesn't exec, its track runs from the fork
+    if (tracing)
+        traceProcessStart(pid, simpleCommand->commandName, forkStart, NULL);
+
+    return 0;
+}
+
+// starts the adaptive sizing of the pipes the processes of a pipeline read from. Threaded stages are linked by ring buffers and have nothing to grow
+static PipeMonitor* monitorPipelinePipes(Command* command)
+{
+    pid_t readers[command->nSimpleCommands];
+    int nReaders = 0;
+
+    for (int i = 1; i < command->nSimpleCommands; i++)
+    {
+        if (command->simpleCommands[i]->pid > 0)
+            readers[nReaders++] = command->simpleCommands[i]->pid;
+    }
+
+    return startPipeMonitor(readers, nReaders);
+}
+
+// waits for every launched stage of a pipeline, and returns the exit status of the last one. The stages leave the pipe monitor before they are reaped
+static int waitForPipeline(Command* command, PipeMonitor* monitor)
+{
+    int lastStatus = 0;
+
+    for (int i = 0; i < command->nSimpleCommands; i++)
+    {
+        SimpleCommand* simpleCommand = command->simpleCommands[i];
+        if (simpleCommand->pid <= 0)
+            continue;
+
+        int status = 0;
+        LOG_DEBUG("Waiting for child process, with command name %s\n", simpleCommand->commandName);
+
+        // the last sample of a stage is taken while it is a zombie, its counters are gone once it is reaped. Its pid stays its own until then too
+        if (command->stats || monitor)
+        {
+            siginfo_t info;
+            while (waitid(P_PID, simpleCommand->pid, &info, WEXITED | WNOWAIT) == -1 && errno == EINTR)
+                reapJobs();
+
+            if (command->stats)
+                finishStageStats(command->stats, simpleCommand->pid);
+            forgetPipeReader(monitor, simpleCommand->pid);
+        }
+
+        // wait4 hands the stage's rusage over with its status, for the time keyword
+        uint64_t waitStart = TRACE_START();
+        struct rusage usage;
+        pid_t waited;
+        while ((waited = wait4(simpleCommand->pid, &status, 0, &usage)) == -1)
+        {
+            // SIGCHLD from background jobs interrupts the wait, the queued jobs take their place without waiting for the prompt
+            if (errno == EINTR)
+            {
+                reapJobs();
+                continue;
+            }
+
+            LOG_ERROR("waitpid: %s\n", strerror(errno));
+            status = 1 << 8;
+            break;
+        }
+
+        TRACE_SPAN("wait", "wait", waitStart, simpleCommand->commandName);
+        if (waited > 0)
+        {
+            TRACE_PROCESS_EXIT(waited);
+            PROBE_CHILD_EXIT(waited, WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+            recordChildExit(waited);
+        }
+
+        if (waited > 0 && command->timing)
+            recordStageUsage(command->timing, i, &usage);
+
+        if (WIFEXITED(status))
+            lastStatus = WEXITSTATUS(status);
+        else if (WIFSIGNALED(status))
+            lastStatus = 128 + WTERMSIG(status);
+
+        if (lastStatus)
+            LOG_DEBUG("Non zero exit status : %d\n", lastStatus);
+    }
+
+    return lastStatus;
+}
+
+// a builtin stage of a pipeline that runs on a thread of the shell, inside a run of adjacent stream builtins
+typedef struct StageThread {
+    pthread_t thread;
+    SimpleCommand* simpleCommand;
+    StreamFunction function;    //< NULL for the stages that run as processes
+    Stream input;
+    Stream output;
+    RingBuffer* outputRing;     //< ring to the next stage, if it is threaded as well
+    struct rusage usage;        //< rusage of the thread when the builtin was done
+    int status;
+    bool started;
+} StageThread;
+
+// maps a builtin's return value to an exit status, like the exit of a subshell would
+static int builtinExitStatus(int status)
+{
+    if (status == 0)
+        return 0;
+
+    return status < 0 ? 1 : status & 0xff;
+}
+
+static void* runStageThread(void* arg)
+{
+    StageThread* stage = (StageThread*)arg;
+
+    PROBE_BUILTIN_ENTER(stage->simpleCommand);
+    countMetric(METRIC_BUILTIN_COMMANDS);
+    uint64_t start = TRACE_START();
+    stage->status = stage->function(stage->simpleCommand, &stage->input, &stage->output);
+    TRACE_SPAN("builtin", "builtin", start, stage->simpleCommand->commandName);
+    PROBE_BUILTIN_EXIT(stage->simpleCommand, stage->status);
+    if (streamClose(&stage->output) != 0 && stage->status == 0)
+        stage->status = -1;
+
+    // the reader going away ends a writer the way SIGPIPE ends a process
+    if (stage->output.error == EPIPE)
+        stage->status = 128 + SIGPIPE;
+
+    streamClose(&stage->input);
+    getThreadUsage(&stage->usage);
+
+    // the fds at the boundary with processes are closed here, so the processes see EOF as soon as the builtin is done
+    closeStageFDs(stage->simpleCommand);
+    return NULL;
+}
+
+// finds the runs of at least two adjacent stream builtins and links them with ring buffers, returns NULL if there's no such run
+static StageThread* planStageThreads(Command* command)
+{
+    int n = command->nSimpleCommands;
+    StageThread* stages = (StageThread*)trackedCalloc(ALLOC_EXEC, n, sizeof(StageThread));
+    if (!stages)
+        return NULL;
+
+    for (int i = 0; i < n; i++)
+    {
+        stages[i].simpleCommand = command->simpleCommands[i];
+        stages[i].function = getStreamFunction(command->simpleCommands[i]);
+    }
+
+    // a lone stream builtin gains nothing from a thread, it is forked like any other builtin
+    bool anyThreaded = false;
+    bool previousStreams = false;
+    for (int i = 0; i < n; i++)
+    {
+        bool streams = stages[i].function != NULL;
+        bool nextStreams = i + 1 < n && stages[i + 1].function != NULL;
+
+        if (streams && !previousStreams && !nextStreams)
+            stages[i].function = NULL;
+
+        anyThreaded |= stages[i].function != NULL;
+        previousStreams = streams;
+    }
+
+    if (!anyThreaded)
+    {
+        trackedFree(ALLOC_EXEC, stages);
+        return NULL;
+    }
+
+    // the pipes the parser made between two threaded stages are replaced by rings, if a ring can't be had the pipe is kept
+    for (int i = 0; i + 1 < n; i++)
+    {
+        if (!stages[i].function || !stages[i + 1].function)
+            continue;
+
+        RingBuffer* ring = initRingBuffer(0);
+        if (!ring)
+            continue;
+
+        SimpleCommand* writer = command->simpleCommands[i];
+        SimpleCommand* reader = command->simpleCommands[i + 1];
+        forgetFD(writer->outputFD);
+        forgetFD(reader->inputFD);
+        close(writer->outputFD);
+        close(reader->inputFD);
+        writer->outputFD = STDOUT_FD;
+        reader->inputFD = STDIN_FD;
+
+        stages[i].outputRing = ring;
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        if (!stages[i].function)
+            continue;
+
+        if (i > 0 && stages[i - 1].outputRing)
+            initRingStream(&stages[i].input, stages[i - 1].outputRing, false);
+        else
+            initFDStream(&stages[i].input, stages[i].simpleCommand->inputFD, false);
+
+        if (stages[i].outputRing)
+            initRingStream(&stages[i].output, stages[i].outputRing, true);
+        else
+            initFDStream(&stages[i].output, stages[i].simpleCommand->outputFD, true);
+    }
+
+    return stages;
+}
+
+// starts the threaded stages. A stage that doesn't start closes its ends, so its neighbours don't wait on it
+static int startStageThreads(Command* command, StageThread* stages, int launchStatus)
+{
+    // the shell's own buffered output goes first
+    fflush(stdout);
+
+    for (int i = 0; i < command->nSimpleCommands; i++)
+    {
+        StageThread* stage = &stages[i];
+        if (!stage->function)
+            continue;
+
+        // with SIGPIPE blocked, a write to a closed pipe fails with EPIPE instead of killing the shell
+        if (!launchStatus && startHelperThread(&stage->thread, runStageThread, stage) == 0)
+        {
+            LOG_DEBUG("Executing command on a thread : %s\n", stage->simpleCommand->commandName);
+            stage->started = true;
+            continue;
+        }
+
+        if (!launchStatus)
+        {
+            LOG_DEBUG("pthread_create failed for %s\n", stage->simpleCommand->commandName);
+            launchStatus = -1;
+        }
+
+        streamClose(&stage->output);
+        streamClose(&stage->input);
+        closeStageFDs(stage->simpleCommand);
+    }
+
+    return launchStatus;
+}
+
+// joins the threaded stages and frees the rings, returns the status of the last stage if it is threaded, -1 otherwise
+static int joinStageThreads(Command* command, StageThread* stages)
+{
+    int lastStatus = -1;
+
+    for (int i = 0; i < command->nSimpleCommands; i++)
+    {
+        if (stages[i].started)
+        {
+            pthread_join(stages[i].thread, NULL);
+
+            if (command->timing)
+                recordStageUsage(command->timing, i, &stages[i].usage);
+
+            if (i == command->nSimpleCommands - 1)
+                lastStatus = builtinExitStatus(stages[i].status);
+        }
+    }
+
+    for (int i = 0; i < command->nSimpleCommands; i++)
+        cleanUpRingBuffer(stages[i].outputRing);
+
+    trackedFree(ALLOC_EXEC, stages);
+    return lastStatus;
+}
+
 // executes a Command (with or without IO redirs)
 int executeCommand(Command* command)
 {
@@ -209,41 +591,140 @@ int executeCommand(Command* command)
         return -1;
     }
 
-    for (int i = 0; i < command->nSimpleCommands; i++)
-    {
-        LOG_DEBUG("Executing command : %s\n", command->simpleCommands[i]->commandName);
-        SimpleCommand* simpleCommand = command->simpleCommands[i];
+    if (command->timing && startCommandTiming(command->timing, command->nSimpleCommands) == -1)
+        LOG_DEBUG("Failed to allocate memory for the timing\n");
 
-        // if this is a background pipeline, we dont wait for any command
-        if (command->background)
-            simpleCommand->noWait = 1;
+    // a lone simple command keeps the builtin semantics, cd or exit have to run in the shell itself
+    if (command->nSimpleCommands == 1)
+    {
+        SimpleCommand* simpleCommand = command->simpleCommands[0];
+        LOG_DEBUG("Executing command : %s\n", simpleCommand->commandName);
 
-        // If the command name is empty, return an error
         if (!simpleCommand->commandName)
         {
             LOG_DEBUG("Invalid command name. It's empty\n");
             return -1;
         }
-        
+
+        // if this is a background pipeline, we dont wait for it
+        if (command->background)
+            simpleCommand->noWait = 1;
+
+        // a timed process is waited for with the pipelines, so its rusage comes with it. A builtin is measured on the shell's thread
+        bool external = simpleCommand->execute == executeProcess;
+        struct rusage before;
+        if (command->timing && external)
+            simpleCommand->noWait = 1;
+        else if (command->timing)
+            getThreadUsage(&before);
+
         // non-zero status means the command execution failed (both for built-in and external commands)
+        if (!external)
+        {
+            PROBE_BUILTIN_ENTER(simpleCommand);
+            countMetric(METRIC_BUILTIN_COMMANDS);
+        }
+
+        uint64_t start = TRACE_START();
         int status = simpleCommand->execute(simpleCommand);
+
+        if (!external)
+        {
+            TRACE_SPAN("builtin", "builtin", start, simpleCommand->commandName);
+            PROBE_BUILTIN_EXIT(simpleCommand, status);
+        }
         LOG_DEBUG("Command executing with pid: %d\n", simpleCommand->pid);
 
-        // If the command failed, return the status
-        if (status)
+        closeStageFDs(simpleCommand);
+
+        if (command->timing)
         {
-            return status;
+            if (!external)
+                recordThreadUsage(command->timing, 0, &before);
+            else if (!command->background && status == 0)
+                status = waitForPipeline(command, NULL);
+
+            // the job scheduler reports the background ones when they are done
+            if (!command->background)
+                reportCommandTiming(command->timing, command, status);
         }
 
-        // if the command succeeded, simply close the file descriptors
-        if (simpleCommand->inputFD != STDIN_FD)
-            close(simpleCommand->inputFD);
-        
-        if (simpleCommand->outputFD != STDOUT_FD)
-            close(simpleCommand->outputFD);
+        return status;
     }
 
-    return 0;
+    // adjacent stream builtins of a foreground pipeline run on threads linked by ring buffers, background pipelines are left to processes so the job scheduler can reap them
+    StageThread* stages = command->background ? NULL : planStageThreads(command);
+
+    // the stages share the caches of one CPU group, the next pipeline gets the next group
+    if (globalShellState->options.cpuPlacement)
+        placePipeline(command);
+
+    // launch every stage before waiting for any, a stage blocked on a full pipe needs its reader to be running already. The processes are forked before the threads start
+    int launchStatus = 0;
+    for (int i = 0; i < command->nSimpleCommands; i++)
+    {
+        SimpleCommand* simpleCommand = command->simpleCommands[i];
+
+        if (stages && stages[i].function)
+            continue;
+
+        LOG_DEBUG("Executing command : %s\n", simpleCommand->commandName);
+
+        if (!launchStatus)
+        {
+            simpleCommand->noWait = 1;
+
+            if (!simpleCommand->commandName)
+            {
+                LOG_DEBUG("Invalid command name. It's empty\n");
+                launchStatus = -1;
+            }
+            else if (simpleCommand->execute == executeProcess)
+                launchStatus = simpleCommand->execute(simpleCommand);
+            else
+                launchStatus = executeBuiltinInSubshell(command, simpleCommand);
+
+            LOG_DEBUG("Command executing with pid: %d\n", simpleCommand->pid);
+        }
+
+        // the stages that didn't launch still have their fds closed, so the ones that did see EOF
+        closeStageFDs(simpleCommand);
+    }
+
+    if (stages)
+        launchStatus = startStageThreads(command, stages, launchStatus);
+
+    if (globalShellState->options.pipeStat && !launchStatus)
+        command->stats = startPipeStat(command);
+
+    // the job scheduler reaps background pipelines
+    if (command->background)
+        return launchStatus;
+
+    PipeMonitor* monitor = globalShellState->options.pipeAdaptive ? monitorPipelinePipes(command) : NULL;
+    int status = waitForPipeline(command, monitor);
+    stopPipeMonitor(monitor);
+
+    if (command->stats)
+    {
+        stopPipeStat(command->stats);
+        printPipeStat(command->stats, command, STDERR_FD);
+    }
+
+    if (stages)
+    {
+        int threadStatus = joinStageThreads(command, stages);
+        if (threadStatus != -1)
+            status = threadStatus;
+    }
+
+    if (launchStatus)
+        status = launchStatus;
+
+    if (command->timing)
+        reportCommandTiming(command->timing, command, status);
+
+    return status;
 }
 
 /*-------------------------------Clean up functions---------------------------------------*/
@@ -259,7 +740,7 @@ void cleanUpSimpleCommand(SimpleCommand* simpleCommand)
     // free the commandName. It was allocated with strdup, so this is the only pointer to that string. The source for the string was the input token, which is freed in the main loop.
     if (simpleCommand->commandName)
     {
-        free(simpleCommand->commandName);
+        trackedFree(ALLOC_PARSER, simpleCommand->commandName);
         simpleCommand->commandName = NULL;
     }
 
@@ -270,17 +751,20 @@ void cleanUpSimpleCommand(SimpleCommand* simpleCommand)
         {
             if (simpleCommand->args[i])
             {
-                free(simpleCommand->args[i]);
+                trackedFree(ALLOC_PARSER, simpleCommand->args[i]);
                 simpleCommand->args[i] = NULL;
             }
         }
 
-        free(simpleCommand->args);
+        trackedFree(ALLOC_PARSER, simpleCommand->args);
         simpleCommand->args = NULL;
     }
 
+    free(simpleCommand->cpuList);
+    simpleCommand->cpuList = NULL;
+
     // free the  simpleCommand
-    free(simpleCommand);
+    trackedFree(ALLOC_PARSER, simpleCommand);
     simpleCommand = NULL;
 }
 
@@ -299,12 +783,24 @@ void cleanUpCommand(Command* command)
         }
     }
 
-    free(command->simpleCommands);
+    trackedFree(ALLOC_PARSER, command->simpleCommands);
+
+    cleanUpPipeStat(command->stats);
+    command->stats = NULL;
+
+    cleanUpCommandTiming(command->timing);
+    command->timing = NULL;
+
+    if (command->sourceTokens)
+    {
+        freeTokens(command->sourceTokens);
+        command->sourceTokens = NULL;
+    }
 
     // free the chainingOperator, it was allocated with strndup
     if (command->chainingOperator)
     {
-        free(command->chainingOperator);
+        trackedFree(ALLOC_PARSER, command->chainingOperator);
         command->chainingOperator = NULL;
     }
 
@@ -325,18 +821,49 @@ void cleanUpCommandChain(CommandChain* chain)
         {
             Command* nextCommand = command->next;
             cleanUpCommand(command);
-            free(command);
+            trackedFree(ALLOC_PARSER, command);
             command = nextCommand;
         }
     }
 
     // free the chain
-    free(chain);
+    trackedFree(ALLOC_PARSER, chain);
     chain = NULL;
 }
 
 /*-------------------------------Utility functions----------------------------------------*/
 
+// joins the args of all the stages into a readable command line. The caller frees it
+char* describeCommand(Command* command)
+{
+    size_t length = 1;
+    for (int i = 0; i < command->nSimpleCommands; i++)
+    {
+        for (int j = 0; j < command->simpleCommands[i]->argc; j++)
+            length += strlen(command->simpleCommands[i]->args[j]) + 1;
+        length += 3;
+    }
+
+    char* description = (char*)calloc(length, sizeof(char));
+    if (!description)
+        return NULL;
+
+    for (int i = 0; i < command->nSimpleCommands; i++)
+    {
+        if (i > 0)
+            strcat(description, " | ");
+
+        for (int j = 0; j < command->simpleCommands[i]->argc; j++)
+        {
+            if (j > 0)
+                strcat(description, " ");
+            strcat(description, command->simpleCommands[i]->args[j]);
+        }
+    }
+
+    return description;
+}
+
 void printCommandChain(CommandChain* chain)
 {
     LOG_DEBUG("Printing command chain\n");
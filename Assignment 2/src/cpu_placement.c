@@ -0,0 +1,270 @@
+/**
+ * @file cpu_placement.c
+ * @brief Contains the function definitions for the CPU placement declared in cpu_placement.h
+ * @version 0.1
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include "cpu_placement.h"
+#include "utils.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <sched.h>
+
+// CPUs sharing a cache or a node, as the cpulist handed to the stages
+typedef struct CpuGroup {
+    cpu_set_t cpus;
+    char* list;
+} CpuGroup;
+
+static CpuGroup* groups = NULL;
+static int nGroups = 0;
+static bool topologyLoaded = false;
+
+// the group the next pipeline goes to
+static int nextGroup = 0;
+
+/*-------------------------------Cpulists------------------------------------------------*/
+
+static bool parseCpuList(const char* str, cpu_set_t* set)
+{
+    CPU_ZERO(set);
+
+    const char* p = str;
+    while (*p)
+    {
+        char* end;
+        long first = strtol(p, &end, 10);
+        if (end == p || first < 0)
+            return false;
+
+        long last = first;
+        if (*end == '-')
+        {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first)
+                return false;
+        }
+
+        if (last >= CPU_SETSIZE)
+            return false;
+
+        for (long cpu = first; cpu <= last; cpu++)
+            CPU_SET(cpu, set);
+
+        if (*end == ',')
+            end++;
+        else if (*end != '\0')
+            return false;
+
+        p = end;
+    }
+
+    return CPU_COUNT(set) > 0;
+}
+
+// formats a set as a cpulist, with ranges for consecutive CPUs
+static char* formatCpuList(const cpu_set_t* set)
+{
+    char list[CPU_LIST_LENGTH];
+    size_t length = 0;
+    list[0] = '\0';
+
+    for (int cpu = 0; cpu < CPU_SETSIZE && length < sizeof(list); cpu++)
+    {
+        if (!CPU_ISSET(cpu, set))
+            continue;
+
+        int last = cpu;
+        while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, set))
+            last++;
+
+        const char* separator = length ? "," : "";
+        if (last == cpu)
+            length += snprintf(list + length, sizeof(list) - length, "%s%d", separator, cpu);
+        else
+            length += snprintf(list + length, sizeof(list) - length, "%s%d-%d", separator, cpu, last);
+
+        cpu = last;
+    }
+
+    return length < sizeof(list) ? strdup(list) : NULL;
+}
+
+// reads the first line of a sysfs file, without its newline
+static bool readSysfsLine(const char* path, char* buffer, size_t size)
+{
+    FILE* file = fopen(path, "re");
+    if (!file)
+        return false;
+
+    bool read = fgets(buffer, size, file) != NULL;
+    fclose(file);
+
+    if (read)
+        buffer[strcspn(buffer, "\n")] = '\0';
+
+    return read;
+}
+
+static bool readSysfsCpuList(const char* path, cpu_set_t* set)
+{
+    char buffer[CPU_LIST_LENGTH];
+    return readSysfsLine(path, buffer, sizeof(buffer)) && parseCpuList(buffer, set);
+}
+
+bool isValidCpuList(const char* list)
+{
+    cpu_set_t set;
+    return parseCpuList(list, &set);
+}
+
+int applyCpuList(const char* list)
+{
+    cpu_set_t set;
+    if (!parseCpuList(list, &set))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return sched_setaffinity(0, sizeof(set), &set);
+}
+
+/*-------------------------------Topology------------------------------------------------*/
+
+// the CPUs sharing the last level cache with cpu
+static bool findCacheGroup(int cpu, cpu_set_t* set)
+{
+    for (int index = 0; index < CPU_CACHE_INDEXES; index++)
+    {
+        char path[128], level[16];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/level", cpu, index);
+        if (!readSysfsLine(path, level, sizeof(level)))
+            break;
+
+        if (strcmp(level, "3") != 0)
+            continue;
+
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/shared_cpu_list", cpu, index);
+        return readSysfsCpuList(path, set);
+    }
+
+    return false;
+}
+
+// the CPUs of the NUMA node of cpu
+static bool findNodeGroup(int cpu, cpu_set_t* set)
+{
+    DIR* dir = opendir("/sys/devices/system/node");
+    if (!dir)
+        return false;
+
+    bool found = false;
+    struct dirent* entry;
+    while (!found && (entry = readdir(dir)) != NULL)
+    {
+        if (strncmp(entry->d_name, "node", 4) != 0 || entry->d_name[4] < '0' || entry->d_name[4] > '9')
+            continue;
+
+        char path[300];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/%s/cpulist", entry->d_name);
+        found = readSysfsCpuList(path, set) && CPU_ISSET(cpu, set);
+    }
+
+    closedir(dir);
+    return found;
+}
+
+// the CPUs of the package of cpu
+static bool findPackageGroup(int cpu, cpu_set_t* set)
+{
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/package_cpus_list", cpu);
+    if (readSysfsCpuList(path, set))
+        return true;
+
+    // the name before Linux 5.4
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/core_siblings_list", cpu);
+    return readSysfsCpuList(path, set);
+}
+
+static bool addGroup(const cpu_set_t* cpus)
+{
+    CpuGroup* grown = (CpuGroup*)realloc(groups, (nGroups + 1) * sizeof(CpuGroup));
+    if (!grown)
+        return false;
+    groups = grown;
+
+    groups[nGroups].cpus = *cpus;
+    groups[nGroups].list = formatCpuList(cpus);
+    if (!groups[nGroups].list)
+        return false;
+
+    LOG_DEBUG("cpu group %d: %s\n", nGroups, groups[nGroups].list);
+    nGroups++;
+    return true;
+}
+
+// splits the CPUs the shell may run on into groups, each CPU in the first group found for it
+static void loadTopology()
+{
+    topologyLoaded = true;
+
+    cpu_set_t allowed, online;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1)
+        return;
+    if (readSysfsCpuList("/sys/devices/system/cpu/online", &online))
+        CPU_AND(&allowed, &allowed, &online);
+
+    cpu_set_t assigned;
+    CPU_ZERO(&assigned);
+
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (!CPU_ISSET(cpu, &allowed) || CPU_ISSET(cpu, &assigned))
+            continue;
+
+        cpu_set_t group;
+        if (!findCacheGroup(cpu, &group) && !findNodeGroup(cpu, &group) && !findPackageGroup(cpu, &group))
+            group = allowed;
+
+        CPU_AND(&group, &group, &allowed);
+        CPU_SET(cpu, &group);
+
+        // a CPU already in an earlier group stays there
+        cpu_set_t overlap;
+        CPU_AND(&overlap, &group, &assigned);
+        CPU_XOR(&group, &group, &overlap);
+
+        CPU_OR(&assigned, &assigned, &group);
+        if (!addGroup(&group))
+            return;
+    }
+}
+
+void placePipeline(Command* command)
+{
+    if (!topologyLoaded)
+        loadTopology();
+
+    // with a single group every stage shares the cache already
+    if (nGroups < 2)
+        return;
+
+    CpuGroup* group = &groups[nextGroup];
+    nextGroup = (nextGroup + 1) % nGroups;
+
+    for (int i = 0; i < command->nSimpleCommands; i++)
+    {
+        SimpleCommand* simpleCommand = command->simpleCommands[i];
+        if (!simpleCommand->cpuList)
+            simpleCommand->cpuList = strdup(group->list);
+    }
+}
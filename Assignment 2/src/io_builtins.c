@@ -0,0 +1,489 @@
+/**
+ * @file io_builtins.c
+ * @brief Contains the function definitions for the cat and tee builtins declared in io_builtins.h
+ * @version 0.1
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include "io_builtins.h"
+#include "shell_builtins.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// the kernel copies, in order of preference
+typedef enum CopyMethod {
+    COPY_FILE_RANGE,
+    COPY_SPLICE,
+    COPY_SENDFILE,
+    COPY_METHOD_COUNT
+} CopyMethod;
+
+/*-------------------------------Kernel copies-------------------------------------------*/
+
+static ssize_t copyOnce(CopyMethod method, int inFD, int outFD, size_t length)
+{
+    switch (method)
+    {
+        case COPY_FILE_RANGE:
+            return copy_file_range(inFD, NULL, outFD, NULL, length, 0);
+        case COPY_SPLICE:
+            return splice(inFD, NULL, outFD, NULL, length, SPLICE_F_MOVE | SPLICE_F_MORE);
+        case COPY_SENDFILE:
+            return sendfile(outFD, inFD, NULL, length);
+        default:
+            errno = EINVAL;
+            return -1;
+    }
+}
+
+// whether an error means the kernel can't copy between these fds, rather than a failed copy
+static bool isUnsupportedCopy(int error)
+{
+    return error == EINVAL || error == ENOSYS || error == EXDEV || error == EOPNOTSUPP;
+}
+
+// copies until the end of the input. It returns 0 at the end, -1 on failure, 1 when the method doesn't work for these fds and nothing was copied
+static int copyWith(CopyMethod method, int inFD, int outFD)
+{
+    bool copied = false;
+
+    while (1)
+    {
+        ssize_t ncopied = copyOnce(method, inFD, outFD, IO_COPY_SIZE);
+        if (ncopied > 0)
+        {
+            copied = true;
+            continue;
+        }
+
+        if (ncopied == 0)
+            return 0;
+
+        if (errno == EINTR)
+            continue;
+
+        return !copied && isUnsupportedCopy(errno) ? 1 : -1;
+    }
+}
+
+// terminals want their reads and writes as they come, and the kernel copies refuse fds opened for appending
+static bool needsReadWrite(int fd)
+{
+    int flags = fcntl(fd, F_GETFL);
+    return isatty(fd) || (flags != -1 && (flags & O_APPEND));
+}
+
+/**
+ * @brief Copies an fd to another inside the kernel, with the methods that fit the kinds of the fds. Regular files that report no size (like the ones in /proc) are only read.
+ *
+ * @return int Returns 0 on success, -1 on failure, 1 when the copy has to be done with read and write.
+ */
+static int copyFD(int inFD, int outFD)
+{
+    if (needsReadWrite(inFD) || needsReadWrite(outFD))
+        return 1;
+
+    struct stat inStat, outStat;
+    if (fstat(inFD, &inStat) == -1 || fstat(outFD, &outStat) == -1)
+        return -1;
+
+    bool inFile = S_ISREG(inStat.st_mode) && inStat.st_size > 0;
+    bool anyPipe = S_ISFIFO(inStat.st_mode) || S_ISFIFO(outStat.st_mode);
+
+    bool usable[COPY_METHOD_COUNT] = {
+        [COPY_FILE_RANGE] = inFile && S_ISREG(outStat.st_mode),
+        [COPY_SPLICE] = anyPipe,
+        [COPY_SENDFILE] = inFile,
+    };
+
+    for (int method = 0; method < COPY_METHOD_COUNT; method++)
+    {
+        if (!usable[method])
+            continue;
+
+        int status = copyWith((CopyMethod)method, inFD, outFD);
+        if (status != 1)
+            return status;
+
+        LOG_DEBUG("copy method %d not supported, trying the next one\n", method);
+    }
+
+    return 1;
+}
+
+// copies a stream to another through a buffer
+static int copyStream(Stream* input, Stream* output)
+{
+    char* buffer = (char*)malloc(IO_BUFFER_SIZE);
+    if (!buffer)
+        return -1;
+
+    int status = 0;
+    while (1)
+    {
+        ssize_t nread = streamRead(input, buffer, IO_BUFFER_SIZE);
+        if (nread <= 0)
+        {
+            status = nread < 0 ? -1 : 0;
+            break;
+        }
+
+        if (streamWrite(output, buffer, nread) != 0)
+        {
+            status = -1;
+            break;
+        }
+    }
+
+    free(buffer);
+    return status;
+}
+
+// copies input to output, in the kernel when both are fds
+static int copyInput(Stream* input, Stream* output)
+{
+    if (input->type == STREAM_FD && output->type == STREAM_FD)
+    {
+        // what is buffered goes out before the kernel writes behind the buffer's back
+        if (streamFlush(output) != 0)
+            return -1;
+
+        int status = copyFD(input->fd, output->fd);
+        if (status != 1)
+        {
+            if (status != 0 && errno == EPIPE)
+                output->error = EPIPE;
+            return status;
+        }
+    }
+
+    return copyStream(input, output);
+}
+
+/*-------------------------------cat-----------------------------------------------------*/
+
+bool catSupported(SimpleCommand* simpleCommand)
+{
+    for (int i = 1; i < simpleCommand->argc; i++)
+    {
+        const char* arg = simpleCommand->args[i];
+        if (arg[0] == '-' && arg[1] != '\0')
+            return false;
+    }
+
+    return true;
+}
+
+int catStream(SimpleCommand* simpleCommand, Stream* input, Stream* output)
+{
+    if (!catSupported(simpleCommand))
+    {
+        LOG_ERROR("cat: unsupported options\n");
+        return -1;
+    }
+
+    if (simpleCommand->argc == 1)
+        return copyInput(input, output);
+
+    int status = 0;
+    for (int i = 1; i < simpleCommand->argc; i++)
+    {
+        const char* path = simpleCommand->args[i];
+
+        if (strcmp(path, "-") == 0)
+        {
+            if (copyInput(input, output) != 0)
+                return -1;
+            continue;
+        }
+
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+        {
+            // like cat, a missing file doesn't stop the others
+            LOG_ERROR("cat: %s: %s\n", path, strerror(errno));
+            status = -1;
+            continue;
+        }
+
+        Stream file;
+        initFDStream(&file, fd, false);
+        int copied = copyInput(&file, output);
+        int error = errno;
+        close(fd);
+
+        if (copied != 0)
+        {
+            if (output->error != EPIPE)
+                LOG_ERROR("cat: %s: %s\n", path, strerror(error));
+            return -1;
+        }
+    }
+
+    return status;
+}
+
+int cat(SimpleCommand* simpleCommand)
+{
+    return runStreamBuiltin(simpleCommand, catStream);
+}
+
+/*-------------------------------tee-----------------------------------------------------*/
+
+static bool parseTeeOptions(SimpleCommand* simpleCommand, bool* append, int* firstFile)
+{
+    *append = false;
+    *firstFile = simpleCommand->argc;
+
+    for (int i = 1; i < simpleCommand->argc; i++)
+    {
+        const char* arg = simpleCommand->args[i];
+        if (arg[0] != '-' || arg[1] == '\0')
+        {
+            *firstFile = i;
+            break;
+        }
+
+        for (const char* flag = arg + 1; *flag; flag++)
+        {
+            if (*flag != 'a')
+                return false;
+            *append = true;
+        }
+    }
+
+    // options after the first file are left to the system tee
+    for (int i = *firstFile; i < simpleCommand->argc; i++)
+    {
+        if (simpleCommand->args[i][0] == '-' && simpleCommand->args[i][1] != '\0')
+            return false;
+    }
+
+    return true;
+}
+
+bool teeSupported(SimpleCommand* simpleCommand)
+{
+    bool append;
+    int firstFile;
+    return parseTeeOptions(simpleCommand, &append, &firstFile);
+}
+
+// splices exactly length bytes out of a pipe
+static int drainPipe(int pipeFD, int outFD, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t nspliced = splice(pipeFD, NULL, outFD, NULL, length, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (nspliced == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        length -= nspliced;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Copies an fd to several fds inside the kernel. Every chunk of the input is spliced into a spool pipe, tee(2) duplicates it into a second pipe of the same size for every destination but the last, and the last one takes the spool itself.
+ *
+ * @return int Returns 0 on success, -1 on failure, 1 when the input can't be spliced and nothing was read.
+ */
+static int teeFD(int inFD, const int* outFDs, int nOutputs)
+{
+    if (needsReadWrite(inFD))
+        return 1;
+
+    for (int i = 0; i < nOutputs; i++)
+    {
+        if (needsReadWrite(outFDs[i]))
+            return 1;
+    }
+
+    int spool[2], copy[2];
+    if (pipe2(spool, O_CLOEXEC) == -1)
+        return -1;
+    if (pipe2(copy, O_CLOEXEC) == -1)
+    {
+        close(spool[PIPE_READ_END]);
+        close(spool[PIPE_WRITE_END]);
+        return -1;
+    }
+
+    // the copy pipe has room for everything the spool holds, so a tee never stops short
+    fcntl(spool[PIPE_WRITE_END], F_SETPIPE_SZ, IO_PIPE_SIZE);
+    int spoolSize = fcntl(spool[PIPE_WRITE_END], F_GETPIPE_SZ);
+    fcntl(copy[PIPE_WRITE_END], F_SETPIPE_SZ, spoolSize);
+
+    bool started = false;
+    int status = 0;
+
+    while (status == 0)
+    {
+        ssize_t nspliced = splice(inFD, NULL, spool[PIPE_WRITE_END], NULL, spoolSize, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (nspliced == -1)
+        {
+            if (errno == EINTR)
+                continue;
+
+            status = !started && isUnsupportedCopy(errno) ? 1 : -1;
+            break;
+        }
+
+        if (nspliced == 0)
+            break;
+
+        started = true;
+
+        for (int i = 0; i < nOutputs && status == 0; i++)
+        {
+            int source = spool[PIPE_READ_END];
+
+            if (i < nOutputs - 1)
+            {
+                ssize_t nteed = tee(spool[PIPE_READ_END], copy[PIPE_WRITE_END], nspliced, 0);
+                if (nteed != nspliced)
+                {
+                    if (nteed >= 0)
+                        errno = EIO;
+                    status = -1;
+                    break;
+                }
+
+                source = copy[PIPE_READ_END];
+            }
+
+            status = drainPipe(source, outFDs[i], nspliced);
+        }
+    }
+
+    int error = errno;
+    close(spool[PIPE_READ_END]);
+    close(spool[PIPE_WRITE_END]);
+    close(copy[PIPE_READ_END]);
+    close(copy[PIPE_WRITE_END]);
+    errno = error;
+
+    return status;
+}
+
+// copies input to all outputs through a buffer
+static int teeStreams(Stream* input, Stream* outputs, int nOutputs)
+{
+    char* buffer = (char*)malloc(IO_BUFFER_SIZE);
+    if (!buffer)
+        return -1;
+
+    int status = 0;
+    while (status == 0)
+    {
+        ssize_t nread = streamRead(input, buffer, IO_BUFFER_SIZE);
+        if (nread <= 0)
+        {
+            status = nread < 0 ? -1 : 0;
+            break;
+        }
+
+        for (int i = 0; i < nOutputs && status == 0; i++)
+            status = streamWrite(&outputs[i], buffer, nread);
+    }
+
+    free(buffer);
+    return status;
+}
+
+int teeStream(SimpleCommand* simpleCommand, Stream* input, Stream* output)
+{
+    bool append;
+    int firstFile;
+    if (!parseTeeOptions(simpleCommand, &append, &firstFile))
+    {
+        LOG_ERROR("tee: unsupported options\n");
+        return -1;
+    }
+
+    // the command's output is the first destination, the files follow
+    int nFiles = simpleCommand->argc - firstFile;
+    Stream* outputs = (Stream*)malloc((nFiles + 1) * sizeof(Stream));
+    int* outFDs = (int*)malloc((nFiles + 1) * sizeof(int));
+    if (!outputs || !outFDs)
+    {
+        free(outputs);
+        free(outFDs);
+        return -1;
+    }
+
+    int nOutputs = 1;
+    int status = 0;
+    outputs[0] = *output;
+
+    for (int i = firstFile; i < simpleCommand->argc; i++)
+    {
+        const char* path = simpleCommand->args[i];
+        int fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC), 0644);
+        if (fd == -1)
+        {
+            // like tee, a file that can't be opened doesn't stop the others
+            LOG_ERROR("tee: %s: %s\n", path, strerror(errno));
+            status = -1;
+            continue;
+        }
+
+        initFDStream(&outputs[nOutputs++], fd, true);
+    }
+
+    bool allFDs = input->type == STREAM_FD;
+    for (int i = 0; i < nOutputs; i++)
+    {
+        allFDs = allFDs && outputs[i].type == STREAM_FD;
+        outFDs[i] = outputs[i].fd;
+    }
+
+    int copied = 1;
+    if (allFDs && streamFlush(&outputs[0]) == 0)
+        copied = teeFD(input->fd, outFDs, nOutputs);
+    if (copied == 1)
+        copied = teeStreams(input, outputs, nOutputs);
+
+    int error = errno;
+    for (int i = 1; i < nOutputs; i++)
+    {
+        if (streamClose(&outputs[i]) != 0)
+            copied = -1;
+        close(outputs[i].fd);
+    }
+
+    // the command's output is handed back with what is still buffered in it
+    *output = outputs[0];
+    if (copied != 0 && error == EPIPE)
+        output->error = EPIPE;
+
+    if (copied != 0 && output->error != EPIPE)
+    {
+        LOG_ERROR("tee: %s\n", strerror(error));
+        status = -1;
+    }
+    else if (copied != 0)
+        status = -1;
+
+    free(outputs);
+    free(outFDs);
+    return status;
+}
+
+int teeBuiltin(SimpleCommand* simpleCommand)
+{
+    return runStreamBuiltin(simpleCommand, teeStream);
+}
@@ -0,0 +1,527 @@
+/**
+ * @file jobs.c
+ * @brief Contains the function definitions for the background job scheduler declared in jobs.h
+ * @version 0.1
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "jobs.h"
+#include "accounting.h"
+#include "metrics.h"
+#include "parser.h"
+#include "pipestat.h"
+#include "probes.h"
+#include "shell_builtins.h"
+#include "timing.h"
+#include "trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+extern ShellState* globalShellState;
+
+// all the background jobs in submission order, which is also the FIFO order of the queue
+static Job* jobsHead = NULL;
+static Job* jobsTail = NULL;
+
+static int nRunningJobs = 0;
+static int nQueuedJobs = 0;
+static int nextJobId = 1;
+
+// exit status of the most recently finished job
+static int lastJobStatus = 0;
+
+// set from the signal handlers when a child exited or the throttle timer fired
+static volatile sig_atomic_t jobEventPending = 0;
+
+// guards against reapJobs being re-entered by a builtin running inside a job it starts
+static bool reaping = false;
+
+// the process the counts belong to. A forked subshell inherits the jobs of its parent but can't wait for them, it leaves them alone
+static pid_t schedulerPid = 0;
+
+/*-------------------------------Helpers-------------------------------------------------*/
+
+// in a forked subshell, forgets the counts of the inherited jobs so only its own jobs are scheduled
+static void adoptScheduler()
+{
+    pid_t pid = getpid();
+    if (schedulerPid == pid)
+        return;
+
+    schedulerPid = pid;
+    nRunningJobs = 0;
+    nQueuedJobs = 0;
+}
+
+/**
+ * @brief Drops the stages of a job that has to wait in the queue, closing the pipes and files the parser opened for them. A long queue would run out of fds otherwise. The stages are parsed again from the job's tokens when it starts.
+ *
+ */
+static void releaseQueuedJob(Job* job)
+{
+    Command* command = job->command;
+    closeCommandFDs(command);
+    cleanUpCommand(command);
+    command->simpleCommands = NULL;
+    command->nSimpleCommands = 0;
+}
+
+// parses the stages of a released job again, into its command. Returns -1 if they no longer parse, like a redirection from a file that is gone
+static int parseQueuedJob(Job* job)
+{
+    CommandChain* chain = parseTokens(job->tokens);
+    if (!chain || !chain->head || chain->head->nSimpleCommands == 0)
+    {
+        cleanUpCommandChain(chain);
+        return -1;
+    }
+
+    Command* parsed = chain->head;
+    job->command->simpleCommands = parsed->simpleCommands;
+    job->command->nSimpleCommands = parsed->nSimpleCommands;
+    job->command->timing = parsed->timing;
+    parsed->simpleCommands = NULL;
+    parsed->nSimpleCommands = 0;
+    parsed->timing = NULL;
+
+    cleanUpCommandChain(chain);
+    return 0;
+}
+
+// reads the avg10 value of the "some" line of a pressure file. Returns -1 if it can't be read
+static double readPressure(const char* path)
+{
+    FILE* file = fopen(path, "r");
+    if (!file)
+        return -1;
+
+    double avg10 = -1;
+    if (fscanf(file, "some avg10=%lf", &avg10) != 1)
+        avg10 = -1;
+
+    fclose(file);
+    return avg10;
+}
+
+// whether the pressure thresholds hold the queue back
+static bool underPressure()
+{
+    ShellOptions* options = &globalShellState->options;
+
+    if (options->psiCpuLimit > 0 && readPressure(PSI_CPU_PATH) > options->psiCpuLimit)
+        return true;
+
+    if (options->psiMemoryLimit > 0 && readPressure(PSI_MEMORY_PATH) > options->psiMemoryLimit)
+        return true;
+
+    return false;
+}
+
+// arms a one shot timer, so a queue held back by pressure is looked at again even if no child exits
+static void armThrottleTimer()
+{
+    struct itimerval timer = {0};
+    timer.it_value.tv_usec = JOB_THROTTLE_RECHECK_MS * 1000;
+    setitimer(ITIMER_REAL, &timer, NULL);
+}
+
+// launches a queued job
+static void startJob(Job* job)
+{
+    nQueuedJobs--;
+
+    if (job->command->nSimpleCommands == 0 && parseQueuedJob(job) == -1)
+    {
+        LOG_ERROR("[%d] %s: can't start, the command no longer parses\n", job->id, job->description);
+        job->state = JOB_DONE;
+        job->status = lastJobStatus = 1;
+        countMetric(METRIC_NONZERO_EXITS);
+        return;
+    }
+
+    freeTokens(job->tokens);
+    job->tokens = NULL;
+
+    // the pipeline runs through the normal execution path, it doesn't wait since the command is in the background
+    int status = executeCommand(job->command);
+
+    job->nPids = 0;
+    job->pids = (pid_t*)calloc(job->command->nSimpleCommands, sizeof(pid_t));
+
+    for (int i = 0; job->pids && i < job->command->nSimpleCommands; i++)
+    {
+        if (job->command->simpleCommands[i]->pid > 0)
+            job->pids[job->nPids++] = job->command->simpleCommands[i]->pid;
+    }
+
+    // builtins ran synchronously, so a pipeline without external stages is already done
+    if (job->nPids == 0)
+    {
+        job->state = JOB_DONE;
+        job->status = status;
+        lastJobStatus = status;
+
+        if (status != 0)
+            countMetric(METRIC_NONZERO_EXITS);
+        if (status == -1)
+            LOG_ERROR("[%d] %s: failed to start\n", job->id, job->description);
+
+        if (job->command->timing)
+            reportCommandTiming(job->command->timing, job->command, status);
+        return;
+    }
+
+    job->state = JOB_RUNNING;
+    nRunningJobs++;
+    LOG_DEBUG("Started job [%d] %s\n", job->id, job->description);
+}
+
+// unlinks and frees the jobs that are done
+static void removeFinishedJobs()
+{
+    Job* prev = NULL;
+    Job* job = jobsHead;
+
+    while (job)
+    {
+        Job* next = job->next;
+
+        if (job->state == JOB_DONE)
+        {
+            if (prev)
+                prev->next = next;
+            else
+                jobsHead = next;
+
+            if (jobsTail == job)
+                jobsTail = prev;
+
+            cleanUpCommand(job->command);
+            trackedFree(ALLOC_PARSER, job->command);
+            if (job->tokens)
+                freeTokens(job->tokens);
+            free(job->description);
+            free(job->pids);
+            free(job);
+        }
+        else
+        {
+            prev = job;
+        }
+
+        job = next;
+    }
+}
+
+/*-------------------------------Scheduler-----------------------------------------------*/
+
+int submitBackgroundJob(Command* command)
+{
+    if (!command || command->nSimpleCommands == 0)
+    {
+        LOG_DEBUG("Invalid background command passed\n");
+        return -1;
+    }
+
+    Job* job = (Job*)calloc(1, sizeof(Job));
+    Command* detached = initCommand();
+    if (!job || !detached)
+    {
+        LOG_DEBUG("Failed to allocate memory for job\n");
+        free(job);
+        trackedFree(ALLOC_PARSER, detached);
+        return -1;
+    }
+
+    // take the pipeline over, the caller's command is left empty and cleans up as usual
+    detached->simpleCommands = command->simpleCommands;
+    detached->nSimpleCommands = command->nSimpleCommands;
+    detached->timing = command->timing;
+    detached->background = true;
+    job->tokens = command->sourceTokens;
+    command->simpleCommands = NULL;
+    command->nSimpleCommands = 0;
+    command->timing = NULL;
+    command->sourceTokens = NULL;
+
+    adoptScheduler();
+    job->id = nextJobId++;
+    job->owner = schedulerPid;
+    job->command = detached;
+    job->description = describeCommand(detached);
+    job->state = JOB_QUEUED;
+
+    if (jobsTail)
+        jobsTail->next = job;
+    else
+        jobsHead = job;
+    jobsTail = job;
+    nQueuedJobs++;
+
+    LOG_DEBUG("Submitted job [%d] %s\n", job->id, job->description);
+
+    // the scheduler decides, the job may be done and freed when this returns. Only finished jobs are removed, so a job still at the tail is this one
+    int id = job->id;
+    reapJobs();
+
+    if (jobsTail && jobsTail->id == id && jobsTail->state == JOB_QUEUED && jobsTail->tokens)
+        releaseQueuedJob(jobsTail);
+
+    return 0;
+}
+
+void notifyJobEvent()
+{
+    jobEventPending = 1;
+}
+
+void reapJobs()
+{
+    if (reaping)
+        return;
+    reaping = true;
+    adoptScheduler();
+
+    // reap whatever exited, only our own background pids so the foreground waits keep their children
+    for (Job* job = jobsHead; job; job = job->next)
+    {
+        if (job->state != JOB_RUNNING || job->owner != schedulerPid)
+            continue;
+
+        int alive = 0;
+        for (int i = 0; i < job->nPids; i++)
+        {
+            if (job->pids[i] == 0)
+                continue;
+
+            // with pipestat the stage is sampled one last time before it is reaped
+            if (job->command->stats)
+            {
+                siginfo_t info = {0};
+                if (waitid(P_PID, job->pids[i], &info, WEXITED | WNOHANG | WNOWAIT) == 0 && info.si_pid == job->pids[i])
+                    finishStageStats(job->command->stats, job->pids[i]);
+            }
+
+            int status;
+            struct rusage usage;
+            pid_t pid = wait4(job->pids[i], &status, WNOHANG, &usage);
+
+            if (pid > 0)
+            {
+                TRACE_PROCESS_EXIT(pid);
+                PROBE_CHILD_EXIT(pid, WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+                recordChildExit(pid);
+            }
+
+            // the pids of a job skip the stages that didn't fork, the stage is found by its pid
+            for (int j = 0; pid > 0 && job->command->timing && j < job->command->nSimpleCommands; j++)
+            {
+                if (job->command->simpleCommands[j]->pid == pid)
+                    recordStageUsage(job->command->timing, j, &usage);
+            }
+
+            if (pid == 0 || (pid == -1 && errno == EINTR))
+            {
+                alive++;
+                continue;
+            }
+
+            // the last stage gives the status of the pipeline
+            if (pid > 0 && i == job->nPids - 1)
+                job->status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+
+            job->pids[i] = 0;
+        }
+
+        if (!alive)
+        {
+            job->state = JOB_DONE;
+            lastJobStatus = job->status;
+            nRunningJobs--;
+            LOG_DEBUG("Job [%d] done with status %d\n", job->id, job->status);
+
+            if (job->status != 0)
+                countMetric(METRIC_NONZERO_EXITS);
+
+            if (job->command->stats)
+            {
+                stopPipeStat(job->command->stats);
+                dprintf(STDERR_FD, "[%d] Done %s\n", job->id, job->description);
+                printPipeStat(job->command->stats, job->command, STDERR_FD);
+            }
+
+            if (job->command->timing)
+                reportCommandTiming(job->command->timing, job->command, job->status);
+        }
+    }
+
+    // start the queued jobs in order, as long as the limits allow
+    if (nQueuedJobs > 0)
+    {
+        ShellOptions* options = &globalShellState->options;
+        bool throttled = (options->psiCpuLimit > 0 || options->psiMemoryLimit > 0) && underPressure();
+
+        for (Job* job = jobsHead; job && !throttled; job = job->next)
+        {
+            if (job->state != JOB_QUEUED || job->owner != schedulerPid)
+                continue;
+
+            if (options->maxJobs > 0 && nRunningJobs >= options->maxJobs)
+                break;
+
+            startJob(job);
+        }
+
+        if (throttled)
+            armThrottleTimer();
+    }
+
+    removeFinishedJobs();
+    reaping = false;
+}
+
+// blocks until the condition is false, sleeping until a child exits or the throttle timer fires
+static void waitWhile(bool (*condition)())
+{
+    sigset_t blocked, original;
+    sigemptyset(&blocked);
+    sigaddset(&blocked, SIGCHLD);
+    sigaddset(&blocked, SIGALRM);
+
+    while (1)
+    {
+        // the signals stay unblocked while jobs are started, the children would inherit the mask otherwise
+        jobEventPending = 0;
+        reapJobs();
+
+        // a child exiting after the reap sets the flag again, so checking it with the signals blocked can't miss it
+        sigprocmask(SIG_BLOCK, &blocked, &original);
+
+        if (!condition())
+        {
+            sigprocmask(SIG_SETMASK, &original, NULL);
+            break;
+        }
+
+        if (!jobEventPending)
+        {
+            // nothing may wake us up if all the processes were reaped and only pressure holds the queue
+            if (nRunningJobs == 0)
+                armThrottleTimer();
+
+            sigsuspend(&original);
+        }
+
+        sigprocmask(SIG_SETMASK, &original, NULL);
+    }
+}
+
+static bool hasJobs()
+{
+    for (Job* job = jobsHead; job; job = job->next)
+    {
+        if (job->owner == schedulerPid)
+            return true;
+    }
+
+    return false;
+}
+
+static bool hasQueuedJobs()
+{
+    return nQueuedJobs > 0;
+}
+
+int waitForJobs()
+{
+    waitWhile(hasJobs);
+    return lastJobStatus;
+}
+
+void drainJobQueue()
+{
+    waitWhile(hasQueuedJobs);
+}
+
+int getRunningJobCount()
+{
+    return nRunningJobs;
+}
+
+int getJobCount()
+{
+    int count = 0;
+    for (Job* job = jobsHead; job; job = job->next)
+        count++;
+
+    return count;
+}
+
+void cleanUpJobs()
+{
+    Job* job = jobsHead;
+    while (job)
+    {
+        Job* next = job->next;
+
+        cleanUpCommand(job->command);
+        trackedFree(ALLOC_PARSER, job->command);
+        if (job->tokens)
+            freeTokens(job->tokens);
+        free(job->description);
+        free(job->pids);
+        free(job);
+
+        job = next;
+    }
+
+    jobsHead = NULL;
+    jobsTail = NULL;
+    nRunningJobs = 0;
+    nQueuedJobs = 0;
+}
+
+/*-------------------------------Builtins-----------------------------------------------*/
+
+int jobs(SimpleCommand* simpleCommand)
+{
+    // -v adds the live statistics of the stages, with setopt pipestat
+    bool verbose = simpleCommand->argc == 2 && strcmp(simpleCommand->args[1], "-v") == 0;
+
+    if (simpleCommand->argc > 2 || (simpleCommand->argc == 2 && !verbose))
+    {
+        LOG_ERROR("jobs: Usage: jobs [-v]\n");
+        return -1;
+    }
+
+    reapJobs();
+
+    for (Job* job = jobsHead; job; job = job->next)
+    {
+        dprintf(simpleCommand->outputFD, "[%d] %-8s %s\n", job->id, job->state == JOB_RUNNING ? "Running" : "Queued", job->description);
+
+        if (verbose && job->command->stats)
+            printPipeStat(job->command->stats, job->command, simpleCommand->outputFD);
+    }
+
+    return 0;
+}
+
+int waitBuiltin(SimpleCommand* simpleCommand)
+{
+    if (simpleCommand->argc > 1)
+    {
+        LOG_ERROR("wait: Too many arguments\n");
+        return -1;
+    }
+
+    return waitForJobs();
+}
\ No newline at end of file
@@ -0,0 +1,424 @@
+/**
+ * @file log.c
+ * @brief Contains the function definitions for the logging backend declared in log.h
+ * @version 0.1
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include "log.h"
+#include "accounting.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+// iovecs handed to one writev, two per ring at most
+#define LOG_MAX_IOV 64
+
+int logLevel = LOG_DEFAULT_LEVEL;
+
+// the ring of one thread. The thread is the only producer, whoever holds flushMutex the only consumer
+typedef struct LogRing {
+    char buffer[LOG_RING_SIZE];
+    atomic_size_t head;         //< bytes written by the thread so far
+    atomic_size_t tail;         //< bytes written out so far
+    atomic_bool owned;          //< a thread uses it, rings of exited threads are taken over by new ones
+    struct LogRing* next;
+} LogRing;
+
+// every ring ever made, new rings are pushed at the head and none is ever removed
+static _Atomic(LogRing*) rings = NULL;
+
+static __thread LogRing* threadRing = NULL;
+// set while the thread is in the logger, a signal handler logging meanwhile writes synchronously
+static __thread bool inLogger = false;
+
+static pthread_key_t ringKey;
+static pthread_once_t ringKeyOnce = PTHREAD_ONCE_INIT;
+
+static int logFD = 2;
+static bool colors = false;
+static int fileFD = -1;
+
+// the flusher, and whoever writes the rings out, hold flushMutex
+static pthread_mutex_t flushMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t flushWakeUp = PTHREAD_COND_INITIALIZER;
+static pthread_t flusher;
+static bool flusherRunning = false;
+static bool flusherStop = false;
+
+// without a flusher every message is written as soon as it is formatted
+static atomic_bool asynchronous = false;
+
+/*-------------------------------Rings---------------------------------------------------*/
+
+// the ring of an exited thread is left to the flusher, and to the next thread that needs one
+static void releaseRing(void* ring)
+{
+    atomic_store_explicit(&((LogRing*)ring)->owned, false, memory_order_release);
+}
+
+static void createRingKey()
+{
+    pthread_key_create(&ringKey, releaseRing);
+}
+
+static LogRing* getThreadRing()
+{
+    if (threadRing)
+        return threadRing;
+
+    pthread_once(&ringKeyOnce, createRingKey);
+
+    for (LogRing* ring = atomic_load_explicit(&rings, memory_order_acquire); ring; ring = ring->next)
+    {
+        bool expected = false;
+        if (atomic_compare_exchange_strong(&ring->owned, &expected, true))
+        {
+            threadRing = ring;
+            break;
+        }
+    }
+
+    if (!threadRing)
+    {
+        LogRing* ring = (LogRing*)calloc(1, sizeof(LogRing));
+        if (!ring)
+            return NULL;
+
+        atomic_init(&ring->owned, true);
+        ring->next = atomic_load_explicit(&rings, memory_order_relaxed);
+        while (!atomic_compare_exchange_weak_explicit(&rings, &ring->next, ring, memory_order_release, memory_order_relaxed));
+
+        threadRing = ring;
+    }
+
+    pthread_setspecific(ringKey, threadRing);
+    return threadRing;
+}
+
+// copies a message into the ring, returns false if it doesn't fit
+static bool pushToRing(LogRing* ring, const char* message, size_t length)
+{
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    if (LOG_RING_SIZE - (head - tail) < length)
+        return false;
+
+    size_t offset = head % LOG_RING_SIZE;
+    size_t first = length < LOG_RING_SIZE - offset ? length : LOG_RING_SIZE - offset;
+    memcpy(ring->buffer + offset, message, first);
+    memcpy(ring->buffer, message + first, length - first);
+
+    atomic_store_explicit(&ring->head, head + length, memory_order_release);
+
+    // a ring more than half full has the flusher come early
+    if (head + length - tail > LOG_RING_SIZE / 2)
+        pthread_cond_signal(&flushWakeUp);
+
+    return true;
+}
+
+/*-------------------------------Writing-------------------------------------------------*/
+
+// writes the iovecs out whole, a write error drops what is left
+static void writeAllv(struct iovec* iov, int count)
+{
+    while (count > 0)
+    {
+        ssize_t written = writev(logFD, iov, count);
+        if (written == -1 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return;
+
+        while (count > 0 && (size_t)written >= iov->iov_len)
+        {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+
+        if (count > 0)
+        {
+            iov->iov_base = (char*)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+}
+
+// writes out every ring. The caller holds flushMutex
+static void drainRings()
+{
+    struct iovec iov[LOG_MAX_IOV];
+    LogRing* drained[LOG_MAX_IOV];
+    size_t heads[LOG_MAX_IOV];
+    int nIov = 0, nDrained = 0;
+
+    LogRing* ring = atomic_load_explicit(&rings, memory_order_acquire);
+    while (ring || nDrained)
+    {
+        // a batch is written when the iovecs run out or every ring was looked at
+        if (!ring || nIov + 2 > LOG_MAX_IOV)
+        {
+            writeAllv(iov, nIov);
+            for (int i = 0; i < nDrained; i++)
+                atomic_store_explicit(&drained[i]->tail, heads[i], memory_order_release);
+
+            nIov = nDrained = 0;
+            continue;
+        }
+
+        size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+        if (head != tail)
+        {
+            size_t offset = tail % LOG_RING_SIZE;
+            size_t length = head - tail;
+            size_t first = length < LOG_RING_SIZE - offset ? length : LOG_RING_SIZE - offset;
+
+            iov[nIov].iov_base = ring->buffer + offset;
+            iov[nIov++].iov_len = first;
+            if (length > first)
+            {
+                iov[nIov].iov_base = ring->buffer;
+                iov[nIov++].iov_len = length - first;
+            }
+
+            drained[nDrained] = ring;
+            heads[nDrained++] = head;
+        }
+
+        ring = ring->next;
+    }
+}
+
+void flushLogs()
+{
+    if (inLogger)
+        return;
+
+    inLogger = true;
+    pthread_mutex_lock(&flushMutex);
+    drainRings();
+    pthread_mutex_unlock(&flushMutex);
+    inLogger = false;
+}
+
+static void writeSynchronously(const char* message, size_t length)
+{
+    struct iovec iov = { (void*)message, length };
+    writeAllv(&iov, 1);
+}
+
+static void* runFlusher(void* arg)
+{
+    (void)arg;
+
+    pthread_mutex_lock(&flushMutex);
+    while (!flusherStop)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += LOG_FLUSH_INTERVAL_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        pthread_cond_timedwait(&flushWakeUp, &flushMutex, &deadline);
+        drainRings();
+    }
+    pthread_mutex_unlock(&flushMutex);
+
+    return NULL;
+}
+
+/*-------------------------------Messages------------------------------------------------*/
+
+void logMessage(int type, const char* prefix, const char* color, const char* file, const char* func, int line, const char* format, ...)
+{
+    char message[LOG_MAX_MESSAGE];
+    size_t length = 0;
+
+    // the prefix and the annotation are added at the debug level only, errors are plain messages otherwise
+    if (__atomic_load_n(&logLevel, __ATOMIC_RELAXED) >= LOG_DBG)
+    {
+        length += snprintf(message, sizeof(message), "%s%s%s: ", colors ? color : "", prefix, colors ? LOG_RESET : "");
+
+        if (ANNOTATIONS_INFO)
+        {
+            length += snprintf(message + length, sizeof(message) - length, "(%s%s%s%s%.0d) ",
+                               ANNOTATIONS_FILE ? file : "", ANNOTATIONS_FILE ? "," : "",
+                               ANNOTATIONS_FUNC ? func : "", ANNOTATIONS_FUNC ? "," : "",
+                               ANNOTATIONS_LINE ? line : 0);
+        }
+    }
+
+    va_list args;
+    va_start(args, format);
+    int formatted = vsnprintf(message + length, sizeof(message) - length, format, args);
+    va_end(args);
+
+    if (formatted < 0)
+        return;
+
+    length += formatted;
+    if (length >= sizeof(message))
+    {
+        // a truncated message still ends its line
+        length = sizeof(message) - 1;
+        message[length - 1] = '\n';
+    }
+
+    LogRing* ring = NULL;
+    if (atomic_load_explicit(&asynchronous, memory_order_acquire) && !inLogger)
+        ring = getThreadRing();
+
+    if (!ring)
+    {
+        // the write is atomic for the short messages, which keeps them whole
+        writeSynchronously(message, length);
+        return;
+    }
+
+    inLogger = true;
+    bool pushed = pushToRing(ring, message, length);
+    if (!pushed)
+    {
+        // a full ring is written out by its thread, what the flusher hasn't got to yet goes first
+        pthread_mutex_lock(&flushMutex);
+        drainRings();
+        pushed = pushToRing(ring, message, length);
+        if (!pushed)
+            writeSynchronously(message, length);
+        pthread_mutex_unlock(&flushMutex);
+    }
+    inLogger = false;
+
+    // errors go out at once, after the debug messages that led to them
+    if (type == LOG_ERR && pushed)
+        flushLogs();
+}
+
+/*-------------------------------Setup---------------------------------------------------*/
+
+int parseLogLevel(const char* str)
+{
+    if (!str)
+        return -1;
+
+    if (strcmp(str, "error") == 0 || strcmp(str, "0") == 0)
+        return LOG_ERR;
+    if (strcmp(str, "debug") == 0 || strcmp(str, "1") == 0)
+        return LOG_DBG;
+
+    return -1;
+}
+
+void setLogLevel(int level)
+{
+    __atomic_store_n(&logLevel, level, __ATOMIC_RELAXED);
+}
+
+static void setLogFD(int fd)
+{
+    logFD = fd;
+    colors = isatty(fd);
+}
+
+// the flusher holds the mutex while it writes, a fork waits for the write to finish so the child gets a consistent mutex
+static void prepareFork()
+{
+    pthread_mutex_lock(&flushMutex);
+}
+
+static void resumeAfterFork()
+{
+    pthread_mutex_unlock(&flushMutex);
+}
+
+// the child has no flusher, and the messages in the rings are the parent's to write
+static void resetInChild()
+{
+    pthread_mutex_unlock(&flushMutex);
+
+    atomic_store(&asynchronous, false);
+    flusherRunning = false;
+
+    for (LogRing* ring = atomic_load(&rings); ring; ring = ring->next)
+        atomic_store(&ring->tail, atomic_load(&ring->head));
+}
+
+static void stopLogging()
+{
+    if (flusherRunning)
+    {
+        pthread_mutex_lock(&flushMutex);
+        flusherStop = true;
+        pthread_cond_signal(&flushWakeUp);
+        pthread_mutex_unlock(&flushMutex);
+
+        pthread_join(flusher, NULL);
+        flusherRunning = false;
+    }
+
+    atomic_store(&asynchronous, false);
+    flushLogs();
+}
+
+void initLogging()
+{
+    int level = parseLogLevel(getenv("SHELL_LOG_LEVEL"));
+    if (level != -1)
+        setLogLevel(level);
+
+    setLogFD(2);
+
+    const char* fdString = getenv("SHELL_LOG_FD");
+    const char* path = getenv("SHELL_LOG_FILE");
+    if (path && *path)
+    {
+        fileFD = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fileFD != -1)
+        {
+            setLogFD(fileFD);
+            registerFD(fileFD, "log");
+        }
+        else
+            logMessage(LOG_ERR, "[ERROR]", LOG_COLOR_ERR, __FILE__, __func__, __LINE__, "SHELL_LOG_FILE %s: %s\n", path, strerror(errno));
+    }
+    else if (fdString && *fdString && strspn(fdString, "0123456789") == strlen(fdString) && fcntl(atoi(fdString), F_GETFD) != -1)
+    {
+        setLogFD(atoi(fdString));
+    }
+
+    pthread_atfork(prepareFork, resumeAfterFork, resetInChild);
+
+    // the flusher leaves every signal to the main thread
+    flusherRunning = startHelperThread(&flusher, runFlusher, NULL) == 0;
+
+    // without a flusher the messages keep being written synchronously
+    if (flusherRunning)
+    {
+        atomic_store(&asynchronous, true);
+        atexit(stopLogging);
+    }
+}
@@ -8,15 +8,25 @@
  */
 
 #include "utils.h"
+#include "accounting.h"
 #include "command.h"
 #include "parser.h"
+#include "probes.h"
+#include "profile.h"
+#include "record.h"
 #include "shell_builtins.h"
+#include "jobs.h"
+#include "metrics.h"
+#include "taskgraph.h"
+#include "trace.h"
+#include "server.h"
 
 #include <errno.h>
 #include <readline/readline.h>
 #include <readline/history.h>
 #include <signal.h>
 #include <fcntl.h>
+#include <getopt.h>
 #include <sys/wait.h>
 
 // Global variables
@@ -27,8 +37,23 @@ ShellState* globalShellState;
 // shell can also support scripting, useful for testing
 FILE* scriptFile;
 
+// number of the last line read, for the profiler
+static int inputLine = 0;
+
 char* getInput(int interactive)
 {
+    // a replay takes the place of the terminal or the script
+    if (replaying)
+    {
+        char* input = nextReplayLine();
+        if (input)
+        {
+            inputLine++;
+            recordInput(input);
+        }
+        return input;
+    }
+
     char* input = malloc(MAX_STRING_LENGTH);
 
     if (interactive)
@@ -41,8 +66,20 @@ char* getInput(int interactive)
             printf("%s ", globalShellState->prompt_buffer);
             linept = fgets(input, MAX_STRING_LENGTH, stdin);
             if (linept == NULL) 
-                if (errno == EINTR)
-                    again = 1;        // signal interruption, read again
+            {
+                if (errno == EINTR && !feof(stdin))
+                {
+                    // signal interruption, a background job may have finished so let queued jobs start, then read again
+                    clearerr(stdin);
+                    reapJobs();
+                    again = 1;
+                }
+                else
+                {
+                    free(input);
+                    return NULL;
+                }
+            }
         }
 
         // remove the trailing newline
@@ -55,6 +92,11 @@ char* getInput(int interactive)
         size_t len = 0;
         ssize_t read;
         read = getline(&input, &len, scriptFile);
+        while (read == -1 && errno == EINTR && !feof(scriptFile))
+        {
+            clearerr(scriptFile);
+            read = getline(&input, &len, scriptFile);
+        }
         if (read == -1)
         {
             free(input);
@@ -65,9 +107,58 @@ char* getInput(int interactive)
             input[read - 1] = '\0';
     }
 
+    inputLine++;
+    recordInput(input);
     return input;
 }
 
+/**
+ * @brief Reads the lines of a task block up to its `end` line, and runs the block.
+ * 
+ * @param header The line that opened the block
+ * @param interactive Whether the input comes from the terminal
+ * @return int Status of the block
+ */
+static int readTaskBlock(const char* header, int interactive)
+{
+    char** lines = NULL;
+    int nLines = 0;
+    int closed = 0;
+
+    char* line;
+    while ((line = getInput(interactive)) != NULL)
+    {
+        if (isTaskBlockEnd(line))
+        {
+            free(line);
+            closed = 1;
+            break;
+        }
+
+        char** temp = realloc(lines, (nLines + 1) * sizeof(char*));
+        if (!temp)
+        {
+            free(line);
+            break;
+        }
+
+        lines = temp;
+        lines[nLines++] = line;
+    }
+
+    int status = -1;
+    if (closed)
+        status = runTaskBlock(header, lines, nLines);
+    else
+        LOG_ERROR("tasks: missing '%s'\n", TASK_BLOCK_END);
+
+    for (int i = 0; i < nLines; i++)
+        free(lines[i]);
+    free(lines);
+
+    return status;
+}
+
 void sigint_handler(int signo) {
     // Handle SIGINT (CTRL-C)
     LOG_DEBUG("\nCTRL-C pressed. signo: %d\n", signo);
@@ -85,15 +176,133 @@ void sigquit_handler(int signo) {
 
 void sigchld_handler(int signo) {
     (void) signo;
-    int more = 1;        // more zombies to claim
-    pid_t pid;           // pid of the zombie
-    int status;          // termination status of the zombie
-
-    while (more) {
-        pid = waitpid(-1, &status, WNOHANG);
-        if (pid <= 0) 
-            more = 0;
+    // background processes are reaped by the job scheduler from the main loop, the foreground ones by whoever waits for them
+    notifyJobEvent();
+}
+
+void sigalrm_handler(int signo) {
+    (void) signo;
+    // the throttle timer of the job scheduler fired
+    notifyJobEvent();
+}
+
+/**
+ * @brief Registers a handler without SA_RESTART, so a blocking read of the input is interrupted and the main loop gets to run the job scheduler.
+ * 
+ * @param signo The signal
+ * @param handler The handler
+ * @return int Status code (0 on success, -1 on failure)
+ */
+static int registerInterruptingHandler(int signo, void (*handler)(int))
+{
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handler;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = 0;
+
+    return sigaction(signo, &action, NULL);
+}
+
+/**
+ * @brief Reads and executes lines until the input runs out or `exit` is read.
+ * 
+ * @param interactive Whether the input comes from the terminal, otherwise it comes from scriptFile
+ * @return int Exit status of the last line
+ */
+static int runShellLoop(int interactive)
+{
+    while (1) 
+    {
+        // collect finished background jobs and start queued ones
+        reapJobs();
+
+        // read input
+        uint64_t readStart = TRACE_START();
+        char* input = getInput(interactive);
+        TRACE_SPAN("read input", "input", readStart, NULL);
+
+        // Check for EOF.
+        if (!input)
+            break;
+
+        PROBE_LINE_READ(input, strlen(input));
+        if (strcmp(input, "") == 0) 
+        {
+            free(input);
+            continue;
+        }
+        if (strcmp(input, "exit") == 0)
+        {
+            free(input);
+            break;
+        }
+
+        // Add input to readline history.
+        add_to_history(&globalShellState->history, input);
+
+        // a task block takes over the lines up to its end, and is charged to its first line
+        if (isTaskBlockStart(input))
+        {
+            ProfileMark mark;
+            int line = inputLine;
+            if (profiling)
+                startProfileLine(&mark);
+
+            lastExitStatus = readTaskBlock(input, interactive);
+
+            if (profiling)
+                endProfileLine(&mark, line, input);
+            if (recording || replaying)
+                endRecordedLine(lastExitStatus);
+            free(input);
+            continue;
+        }
+
+        // tokenize, parse and execute the line
+        ProfileMark mark;
+        int line = inputLine;
+        if (profiling)
+            startProfileLine(&mark);
+
+        // with setopt leakcheck, the heap and the fds have to be back where they were once the line is done
+        LeakMark leakMark;
+        bool leakCheck = globalShellState->options.leakCheck;
+        if (leakCheck)
+            startLeakCheck(&leakMark);
+
+        lastExitStatus = executeInputLine(input);
+
+        if (leakCheck)
+            endLeakCheck(&leakMark, input);
+
+        if (profiling)
+            endProfileLine(&mark, line, input);
+
+        if (recording || replaying)
+            endRecordedLine(lastExitStatus);
+
+        // Free buffer that was allocated for input
+        free(input);
     }
+
+    // queued background jobs still get to start before we leave
+    drainJobQueue();
+    cleanUpJobs();
+
+    return lastExitStatus;
+}
+
+/**
+ * @brief Runs a script submitted to the server, in a worker forked for it. Used as the server's script runner.
+ * 
+ * @param script The script to run
+ * @return int Exit status of the script
+ */
+static int runServerScript(FILE* script)
+{
+    scriptFile = script;
+    return runShellLoop(0);
 }
 
 /**
@@ -103,34 +312,100 @@ void sigchld_handler(int signo) {
  */
 int main(int argc, char** argv)
 {
+    // the log level and destination come from the environment, the messages from here on go through the flusher
+    initLogging();
+    initTracing();
+    initMetrics();
+
     // by default we are in interactive
     int interactive = 1;
     scriptFile = NULL;
 
-    if (argc > 2)
+    const char* serverSocket = NULL;
+    bool profile = false;
+    const char* profileOutput = NULL;
+    const char* recordPath = NULL;
+    const char* replayPath = NULL;
+    const char* sandbox = NULL;
+    bool fast = false;
+    static const struct option longOptions[] = {
+        {"server", required_argument, NULL, 's'},
+        {"profile", optional_argument, NULL, 'p'},
+        {"record", required_argument, NULL, 'r'},
+        {"replay", required_argument, NULL, 'R'},
+        {"fast", no_argument, NULL, 'f'},
+        {"sandbox", required_argument, NULL, 'd'},
+        {NULL, 0, NULL, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", longOptions, NULL)) != -1)
     {
-        LOG_ERROR("Usage: %s [script]\n", argv[0]);
+        switch (opt)
+        {
+            case 's':
+                serverSocket = optarg;
+                break;
+            case 'p':
+                profile = true;
+                profileOutput = optarg;
+                break;
+            case 'r':
+                recordPath = optarg;
+                break;
+            case 'R':
+                replayPath = optarg;
+                break;
+            case 'f':
+                fast = true;
+                break;
+            case 'd':
+                sandbox = optarg;
+                break;
+            default:
+                LOG_ERROR("Usage: %s [--server socket] [--profile[=callgrind-file]] [--record file] [--replay file [--fast] [--sandbox dir]] [script]\n", argv[0]);
+                exit(1);
+        }
+    }
+
+    // a replay is the input, like a script, and the server takes its scripts from its clients
+    bool replayOptions = fast || sandbox;
+    if (argc - optind > 1 || (serverSocket && (argc - optind > 0 || recordPath || replayPath))
+        || (replayPath && argc - optind > 0) || (replayOptions && !replayPath))
+    {
+        LOG_ERROR("Usage: %s [--server socket] [--profile[=callgrind-file]] [--record file] [--replay file [--fast] [--sandbox dir]] [script]\n", argv[0]);
         exit(1);
     }
 
     // If a script is provided, run it and exit
-    if (argc == 2)
+    if (argc - optind == 1)
     {
         interactive = 0;
-        LOG_DEBUG("Running script %s\n", argv[1]);
-        scriptFile = fopen(argv[1], "r");
+        LOG_DEBUG("Running script %s\n", argv[optind]);
+        scriptFile = fopen(argv[optind], "r");
         if (!scriptFile)
         {
-            LOG_ERROR("Error opening script %s: %s\n", argv[1], strerror(errno));
+            LOG_ERROR("Error opening script %s: %s\n", argv[optind], strerror(errno));
             exit(1);
         }
+        registerFD(fileno(scriptFile), "script");
+    }
+    if (replayPath)
+    {
+        interactive = 0;
+        if (initReplay(replayPath, fast, sandbox) == -1)
+            exit(1);
     }
+    if (recordPath && initRecord(recordPath) == -1)
+        exit(1);
+    // the results are written at exit, as a report on stderr or a callgrind file
+    if (profile && initProfile(interactive ? NULL : argv[optind], profileOutput) == -1)
+        exit(1);
+
     globalShellState = init_shell_state();
 
     LOG_DEBUG("Starting shell\n");
 
-    char delimiter = ' ';
-
     if (signal(SIGINT, sigint_handler) == SIG_ERR) {
         LOG_ERROR("Unable to register SIGINT handler");
         exit(EXIT_FAILURE);
@@ -146,62 +421,24 @@ int main(int argc, char** argv)
         exit(EXIT_FAILURE);
     }
 
-    if (signal(SIGCHLD, sigchld_handler) == SIG_ERR) {
+    if (registerInterruptingHandler(SIGCHLD, sigchld_handler) == -1) {
         LOG_ERROR("Unable to register SIGCHLD handler");
         exit(EXIT_FAILURE);
     }
 
-    while (1) 
-    {
-        // read input
-        char* input = getInput(interactive);
-
-        // Check for EOF.
-        if (!input)
-            break;
-        if (strcmp(input, "") == 0) 
-        {
-            free(input);
-            continue;
-        }
-        if (strcmp(input, "exit") == 0)
-        {
-            free(input);
-            break;
-        }
-
-        // Add input to readline history.
-        add_to_history(&globalShellState->history, input);
-
-        // simple whitespace tokenizer
-        char** tokens = tokenizeString(input, delimiter);
-
-        for (int i = 0; tokens[i] != NULL; i++) {
-            LOG_DEBUG("Token %d: [%s]\n", i, tokens[i]);
-        }
-
-        // generate the command from tokens
-        CommandChain* commandChain = parseTokens(tokens);
-
-        // display the command chain
-        printCommandChain(commandChain);
-        
-        // execute the command
-        int status = executeCommandChain(commandChain);
-        LOG_DEBUG("Command executed with status %d\n", status);
-
-        // Free tokens
-        freeTokens(tokens);
-
-        // free the command chain
-        cleanUpCommandChain(commandChain);
-
-        // Free buffer that was allocated for input
-        free(input);
+    if (registerInterruptingHandler(SIGALRM, sigalrm_handler) == -1) {
+        LOG_ERROR("Unable to register SIGALRM handler");
+        exit(EXIT_FAILURE);
     }
 
+    int status;
+    if (serverSocket)
+        status = runServer(serverSocket, runServerScript);
+    else
+        status = runShellLoop(interactive);
+
     // clean up history before we leave
     clean_history(&globalShellState->history);
 
-    return 0;
+    return status;
 }
\ No newline at end of file
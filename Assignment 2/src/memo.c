@@ -0,0 +1,606 @@
+/**
+ * @file memo.c
+ * @brief Contains the definition of the memo builtin declared in memo.h
+ * @version 0.1
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include "memo.h"
+#include "shell_builtins.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/wait.h>
+
+extern char** environ;
+extern ShellState* globalShellState;
+
+// size of the buffer used to pass the output through
+#define MEMO_BUFFER_SIZE 65536
+
+/*----------------------------------------------------------------------------------------*/
+
+// 128 bit key, built from two independent 64 bit hashes of the same input
+typedef struct MemoHash {
+    uint64_t fnv;
+    uint64_t mix;
+} MemoHash;
+
+// an entry of the cache directory, used for eviction
+typedef struct MemoEntry {
+    char* name;
+    off_t size;
+    struct timespec lastUse;
+} MemoEntry;
+
+/*-------------------------------Hashing-------------------------------------------------*/
+
+// writes the whole buffer, retrying on short writes
+static int writeAll(int fd, const char* buffer, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t written = write(fd, buffer, length);
+        if (written == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        buffer += written;
+        length -= written;
+    }
+
+    return 0;
+}
+
+static void initMemoHash(MemoHash* hash)
+{
+    hash->fnv = 0xcbf29ce484222325ULL;
+    hash->mix = 0x9e3779b97f4a7c15ULL;
+}
+
+static void updateMemoHash(MemoHash* hash, const void* data, size_t length)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+
+    for (size_t i = 0; i < length; i++)
+    {
+        // FNV-1a
+        hash->fnv ^= bytes[i];
+        hash->fnv *= 0x100000001b3ULL;
+
+        // a multiply-rotate hash, so a collision would need to fool both
+        hash->mix = (hash->mix ^ bytes[i]) * 0xff51afd7ed558ccdULL;
+        hash->mix = (hash->mix << 29) | (hash->mix >> 35);
+    }
+}
+
+// hashes a string along with its length, so "ab","c" and "a","bc" differ
+static void updateMemoHashString(MemoHash* hash, const char* str)
+{
+    size_t length = strlen(str);
+    updateMemoHash(hash, &length, sizeof(length));
+    updateMemoHash(hash, str, length);
+}
+
+// hashes the path, size and mtime of a file
+static int hashFileStat(MemoHash* hash, const char* path)
+{
+    struct stat st;
+    if (stat(path, &st) == -1)
+    {
+        LOG_ERROR("memo: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    updateMemoHashString(hash, path);
+    updateMemoHash(hash, &st.st_size, sizeof(st.st_size));
+    updateMemoHash(hash, &st.st_mtim, sizeof(st.st_mtim));
+    return 0;
+}
+
+// hashes the size and the bytes of a regular file from offset to its end, without moving its offset
+static int hashFDContents(MemoHash* hash, int fd, off_t offset)
+{
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+        return -1;
+
+    off_t size = st.st_size > offset ? st.st_size - offset : 0;
+    updateMemoHash(hash, &size, sizeof(size));
+    if (size == 0)
+        return 0;
+
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+        return -1;
+
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    updateMemoHash(hash, (const char*)data + offset, size);
+    munmap(data, st.st_size);
+    return 0;
+}
+
+// hashes the path and contents of a file
+static int hashFileContents(MemoHash* hash, const char* path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        LOG_ERROR("memo: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    updateMemoHashString(hash, path);
+    int status = hashFDContents(hash, fd, 0);
+    if (status != 0)
+        LOG_ERROR("memo: %s: %s\n", path, strerror(errno));
+
+    close(fd);
+    return status;
+}
+
+// copies an input that can't be hashed in place, like a pipe, to an unlinked temporary file. Returns it rewound, or -1
+static int spoolInput(int inputFD)
+{
+    const char* tmp = getenv("TMPDIR");
+    char path[MAX_PATH_LENGTH];
+    snprintf(path, sizeof(path), "%s/memo-stdin.XXXXXX", tmp && *tmp ? tmp : "/tmp");
+
+    int fd = mkostemp(path, O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+    unlink(path);
+
+    char buffer[MEMO_BUFFER_SIZE];
+    while (1)
+    {
+        ssize_t nread = read(inputFD, buffer, sizeof(buffer));
+        if (nread == -1 && errno == EINTR)
+            continue;
+        if (nread == 0)
+            break;
+        if (nread == -1 || writeAll(fd, buffer, nread) != 0)
+        {
+            close(fd);
+            return -1;
+        }
+    }
+
+    if (lseek(fd, 0, SEEK_SET) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/**
+ * @brief Hashes the stdin of the command, which is an input like the declared ones. A terminal or /dev/null carries no data and isn't hashed. A regular file is hashed from its offset, where the command starts reading. Anything else is spooled to a temporary file first, which then becomes the command's stdin.
+ *
+ * The shell's own stdin, when it isn't a terminal, is the rest of a script or of a piped session. It is left alone and the command isn't cached.
+ *
+ * @param inputFD The stdin of the command
+ * @param spoolFD Set to the temporary file, or -1 if there is none
+ * @return int 0 on success, 1 if the command can't be cached, -1 on failure
+ */
+static int hashStdin(MemoHash* hash, int inputFD, int* spoolFD)
+{
+    *spoolFD = -1;
+
+    struct stat st;
+    if (isatty(inputFD) || fstat(inputFD, &st) == -1)
+        return 0;
+    if (S_ISCHR(st.st_mode) && st.st_rdev == makedev(1, 3))
+        return 0;
+    if (st.st_dev == globalShellState->stdinDevice && st.st_ino == globalShellState->stdinInode)
+        return 1;
+
+    updateMemoHashString(hash, "stdin");
+
+    if (S_ISREG(st.st_mode))
+    {
+        off_t offset = lseek(inputFD, 0, SEEK_CUR);
+        return hashFDContents(hash, inputFD, offset == -1 ? 0 : offset);
+    }
+
+    *spoolFD = spoolInput(inputFD);
+    if (*spoolFD == -1 || hashFDContents(hash, *spoolFD, 0) != 0)
+    {
+        if (*spoolFD != -1)
+            close(*spoolFD);
+        *spoolFD = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+/*-------------------------------Cache directory-----------------------------------------*/
+
+// creates a directory and its parents
+static int makeDirectories(const char* path)
+{
+    char buffer[MAX_PATH_LENGTH];
+    strncpy(buffer, path, sizeof(buffer) - 1);
+    buffer[sizeof(buffer) - 1] = '\0';
+
+    for (char* p = buffer + 1; *p; p++)
+    {
+        if (*p != '/')
+            continue;
+
+        *p = '\0';
+        if (mkdir(buffer, 0755) == -1 && errno != EEXIST)
+            return -1;
+        *p = '/';
+    }
+
+    if (mkdir(buffer, 0755) == -1 && errno != EEXIST)
+        return -1;
+
+    return 0;
+}
+
+// finds the cache directory and makes sure it exists
+static int getMemoDirectory(char* path, size_t size)
+{
+    const char* dir = getenv(MEMO_DIR_ENV);
+    const char* cacheHome = getenv("XDG_CACHE_HOME");
+
+    if (dir && *dir)
+        snprintf(path, size, "%s", dir);
+    else if (cacheHome && *cacheHome)
+        snprintf(path, size, "%s/%s", cacheHome, MEMO_DIR_NAME);
+    else if (HOME_DIR)
+        snprintf(path, size, "%s/.cache/%s", HOME_DIR, MEMO_DIR_NAME);
+    else
+        return -1;
+
+    return makeDirectories(path);
+}
+
+static int compareLastUse(const void* a, const void* b)
+{
+    const MemoEntry* x = (const MemoEntry*)a;
+    const MemoEntry* y = (const MemoEntry*)b;
+
+    if (x->lastUse.tv_sec != y->lastUse.tv_sec)
+        return x->lastUse.tv_sec < y->lastUse.tv_sec ? -1 : 1;
+    if (x->lastUse.tv_nsec != y->lastUse.tv_nsec)
+        return x->lastUse.tv_nsec < y->lastUse.tv_nsec ? -1 : 1;
+    return 0;
+}
+
+// removes the least recently used entries until the cache fits in the budget. The mtime of an entry is bumped on every hit, so it tells the last use
+static void evictMemoEntries(const char* dirPath, long long maxBytes)
+{
+    DIR* dir = opendir(dirPath);
+    if (!dir)
+        return;
+
+    MemoEntry* entries = NULL;
+    size_t nEntries = 0, capacity = 0;
+    long long total = 0;
+
+    struct dirent* dirent;
+    while ((dirent = readdir(dir)) != NULL)
+    {
+        size_t length = strlen(dirent->d_name);
+        size_t suffixLength = strlen(MEMO_ENTRY_SUFFIX);
+        if (length <= suffixLength || strcmp(dirent->d_name + length - suffixLength, MEMO_ENTRY_SUFFIX) != 0)
+            continue;
+
+        struct stat st;
+        if (fstatat(dirfd(dir), dirent->d_name, &st, 0) == -1)
+            continue;
+
+        if (nEntries == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 64;
+            MemoEntry* temp = (MemoEntry*)realloc(entries, capacity * sizeof(MemoEntry));
+            if (!temp)
+                break;
+            entries = temp;
+        }
+
+        entries[nEntries].name = strdup(dirent->d_name);
+        entries[nEntries].size = st.st_size;
+        entries[nEntries].lastUse = st.st_mtim;
+        total += st.st_size;
+        nEntries++;
+    }
+
+    if (total > maxBytes)
+    {
+        qsort(entries, nEntries, sizeof(MemoEntry), compareLastUse);
+
+        for (size_t i = 0; i < nEntries && total > maxBytes; i++)
+        {
+            if (entries[i].name && unlinkat(dirfd(dir), entries[i].name, 0) == 0)
+            {
+                total -= entries[i].size;
+                LOG_DEBUG("memo: evicted %s\n", entries[i].name);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < nEntries; i++)
+        free(entries[i].name);
+    free(entries);
+    closedir(dir);
+}
+
+/*-------------------------------Replay and record---------------------------------------*/
+
+// replays a cached entry to the output. Returns the cached status, or -1 if the entry is missing or broken
+static int replayMemoEntry(const char* path, int outputFD)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return -1;
+
+    char header[MEMO_HEADER_LENGTH + 1] = {0};
+    int status;
+    struct stat st;
+    if (read(fd, header, MEMO_HEADER_LENGTH) != MEMO_HEADER_LENGTH || sscanf(header, "memo1 %d", &status) != 1 || fstat(fd, &st) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+
+    // mark the entry as recently used
+    futimens(fd, NULL);
+
+    // the kernel copies the output, falling back to read/write where sendfile can't be used
+    off_t offset = MEMO_HEADER_LENGTH;
+    while (offset < st.st_size)
+    {
+        ssize_t sent = sendfile(outputFD, fd, &offset, st.st_size - offset);
+        if (sent > 0)
+            continue;
+        if (sent == -1 && errno == EINTR)
+            continue;
+        if (sent == -1 && (errno == EINVAL || errno == ENOSYS))
+        {
+            char buffer[MEMO_BUFFER_SIZE];
+            ssize_t nread;
+            while ((nread = pread(fd, buffer, sizeof(buffer), offset)) > 0)
+            {
+                if (writeAll(outputFD, buffer, nread) != 0)
+                    break;
+                offset += nread;
+            }
+        }
+        break;
+    }
+
+    close(fd);
+    return status;
+}
+
+// runs the command, passes its stdout through and stores it in the entry, unless path is NULL. Returns the exit status of the command
+static int recordMemoEntry(SimpleCommand* simpleCommand, int inputFD, char** args, const char* path)
+{
+    char tempPath[MAX_PATH_LENGTH + 32];
+    int entryFD = -1;
+    if (path)
+    {
+        snprintf(tempPath, sizeof(tempPath), "%s.%d.tmp", path, getpid());
+        entryFD = open(tempPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (entryFD == -1)
+            LOG_DEBUG("memo: can't create %s: %s\n", tempPath, strerror(errno));
+    }
+
+    int pipeFD[2];
+    if (pipe2(pipeFD, O_CLOEXEC) == -1)
+    {
+        LOG_ERROR("memo: pipe: %s\n", strerror(errno));
+        if (entryFD != -1)
+        {
+            close(entryFD);
+            unlink(tempPath);
+        }
+        return -1;
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (inputFD != STDIN_FD)
+        posix_spawn_file_actions_adddup2(&actions, inputFD, STDIN_FD);
+    posix_spawn_file_actions_adddup2(&actions, pipeFD[PIPE_WRITE_END], STDOUT_FD);
+    if (simpleCommand->stderrFD != STDERR_FD)
+        posix_spawn_file_actions_adddup2(&actions, simpleCommand->stderrFD, STDERR_FD);
+
+    pid_t pid;
+    int spawnError = posix_spawnp(&pid, args[0], &actions, NULL, args, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(pipeFD[PIPE_WRITE_END]);
+
+    if (spawnError)
+    {
+        LOG_ERROR("memo: %s: %s\n", args[0], strerror(spawnError));
+        close(pipeFD[PIPE_READ_END]);
+        if (entryFD != -1)
+        {
+            close(entryFD);
+            unlink(tempPath);
+        }
+        return 127;
+    }
+
+    // room for the header, it's filled in once the status is known
+    bool storing = entryFD != -1 && lseek(entryFD, MEMO_HEADER_LENGTH, SEEK_SET) == MEMO_HEADER_LENGTH;
+
+    char buffer[MEMO_BUFFER_SIZE];
+    while (1)
+    {
+        ssize_t nread = read(pipeFD[PIPE_READ_END], buffer, sizeof(buffer));
+        if (nread == -1 && errno == EINTR)
+            continue;
+        if (nread <= 0)
+            break;
+
+        writeAll(simpleCommand->outputFD, buffer, nread);
+        if (storing && writeAll(entryFD, buffer, nread) != 0)
+            storing = false;
+    }
+    close(pipeFD[PIPE_READ_END]);
+
+    int status = 0;
+    int waitResult;
+    while ((waitResult = waitpid(pid, &status, 0)) == -1 && errno == EINTR);
+
+    if (waitResult == -1)
+        status = -1;
+    else if (WIFEXITED(status))
+        status = WEXITSTATUS(status);
+    else
+    {
+        // killed by a signal, that's not a result worth replaying
+        status = 128 + WTERMSIG(status);
+        storing = false;
+    }
+
+    if (entryFD != -1)
+    {
+        char header[MEMO_HEADER_LENGTH + 1];
+        snprintf(header, sizeof(header), MEMO_HEADER_FORMAT, status);
+
+        if (storing && status >= 0 && pwrite(entryFD, header, MEMO_HEADER_LENGTH, 0) == MEMO_HEADER_LENGTH && close(entryFD) == 0)
+        {
+            // the rename makes the entry visible atomically
+            if (rename(tempPath, path) == -1)
+                unlink(tempPath);
+        }
+        else
+        {
+            close(entryFD);
+            unlink(tempPath);
+        }
+    }
+
+    return status;
+}
+
+/*-------------------------------Builtin-------------------------------------------------*/
+
+int memo(SimpleCommand* simpleCommand)
+{
+    MemoHash hash;
+    initMemoHash(&hash);
+
+    // the working directory is part of the key, relative paths in the args depend on it
+    char cwd[MAX_PATH_LENGTH];
+    if (getcwd(cwd, sizeof(cwd)) == NULL)
+    {
+        LOG_ERROR("memo: %s\n", strerror(errno));
+        return -1;
+    }
+    updateMemoHashString(&hash, cwd);
+
+    // the options declare the inputs of the command
+    int i = 1;
+    for (; i < simpleCommand->argc && simpleCommand->args[i][0] == '-'; i++)
+    {
+        const char* option = simpleCommand->args[i];
+        if (strcmp(option, "--") == 0)
+        {
+            i++;
+            break;
+        }
+
+        if (i + 1 >= simpleCommand->argc || (strcmp(option, "-i") != 0 && strcmp(option, "-c") != 0 && strcmp(option, "-e") != 0))
+        {
+            LOG_ERROR("Usage: memo [-i file]* [-c file]* [-e name]* [--] command [args]*\n");
+            return -1;
+        }
+
+        const char* value = simpleCommand->args[++i];
+        updateMemoHashString(&hash, option);
+
+        if (strcmp(option, "-i") == 0 && hashFileStat(&hash, value) != 0)
+            return -1;
+        if (strcmp(option, "-c") == 0 && hashFileContents(&hash, value) != 0)
+            return -1;
+        if (strcmp(option, "-e") == 0)
+        {
+            const char* env = getenv(value);
+            updateMemoHashString(&hash, value);
+            updateMemoHashString(&hash, env ? env : "");
+            // unset and empty are different inputs
+            updateMemoHash(&hash, env ? "1" : "0", 1);
+        }
+    }
+
+    if (i >= simpleCommand->argc)
+    {
+        LOG_ERROR("Usage: memo [-i file]* [-c file]* [-e name]* [--] command [args]*\n");
+        return -1;
+    }
+
+    char** args = &simpleCommand->args[i];
+    for (int j = 0; args[j] != NULL; j++)
+        updateMemoHashString(&hash, args[j]);
+
+    // a redirected or piped stdin is an input too, two runs on different data must not share an entry
+    int spoolFD;
+    int stdinStatus = hashStdin(&hash, simpleCommand->inputFD, &spoolFD);
+    if (stdinStatus == -1)
+    {
+        LOG_ERROR("memo: can't hash stdin: %s\n", strerror(errno));
+        return -1;
+    }
+    if (stdinStatus == 1)
+    {
+        LOG_DEBUG("memo: %s reads the shell's stdin, not cached\n", args[0]);
+        return recordMemoEntry(simpleCommand, simpleCommand->inputFD, args, NULL);
+    }
+
+    char dir[MAX_PATH_LENGTH];
+    if (getMemoDirectory(dir, sizeof(dir)) != 0)
+    {
+        LOG_ERROR("memo: can't create the cache directory: %s\n", strerror(errno));
+        if (spoolFD != -1)
+            close(spoolFD);
+        return -1;
+    }
+
+    char path[MAX_PATH_LENGTH + 64];
+    snprintf(path, sizeof(path), "%s/%016llx%016llx%s", dir, (unsigned long long)hash.fnv, (unsigned long long)hash.mix, MEMO_ENTRY_SUFFIX);
+
+    // a hit never forks
+    int status = replayMemoEntry(path, simpleCommand->outputFD);
+    if (status >= 0)
+    {
+        LOG_DEBUG("memo: hit %s\n", path);
+        if (spoolFD != -1)
+            close(spoolFD);
+        return status;
+    }
+
+    LOG_DEBUG("memo: miss %s\n", path);
+    status = recordMemoEntry(simpleCommand, spoolFD != -1 ? spoolFD : simpleCommand->inputFD, args, path);
+    if (spoolFD != -1)
+        close(spoolFD);
+
+    if (globalShellState->options.memoMaxMegabytes > 0)
+        evictMemoEntries(dir, (long long)globalShellState->options.memoMaxMegabytes * 1024 * 1024);
+
+    return status;
+}
\ No newline at end of file
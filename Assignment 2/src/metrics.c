@@ -0,0 +1,302 @@
+/**
+ * @file metrics.c
+ * @brief Contains the function definitions for the metrics declared in metrics.h
+ * @version 0.1
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include "metrics.h"
+#include "trace.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// upper bounds of the buckets, in nanoseconds. A fork takes tens of microseconds, a child anything up to minutes
+static const uint64_t spawnBuckets[] = {
+    25000, 50000, 100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000, 50000000
+};
+static const uint64_t runtimeBuckets[] = {
+    1000000, 5000000, 10000000, 50000000, 100000000, 500000000, 1000000000ULL, 5000000000ULL, 30000000000ULL, 300000000000ULL
+};
+
+#define N_BUCKETS (sizeof(spawnBuckets) / sizeof(spawnBuckets[0]))
+_Static_assert(sizeof(runtimeBuckets) == sizeof(spawnBuckets), "the histograms share N_BUCKETS");
+
+// the buckets aren't cumulative, they are added up when written. The last one is +Inf
+typedef struct Histogram {
+    atomic_uint_fast64_t buckets[N_BUCKETS + 1];
+    atomic_uint_fast64_t count;
+    atomic_uint_fast64_t sum;   //< nanoseconds
+} Histogram;
+
+typedef struct Metrics {
+    atomic_uint_fast64_t counters[METRIC_N_COUNTERS];
+    Histogram spawnLatency;
+    Histogram childRuntime;
+} Metrics;
+
+// a child between its fork and its reap
+typedef struct SpawnedChild {
+    pid_t pid;
+    uint64_t start;
+} SpawnedChild;
+
+// the name and help of every counter, in the order of MetricCounter
+static const struct {
+    const char* name;
+    const char* label;
+    const char* help;
+} counterInfo[METRIC_N_COUNTERS] = {
+    {"shell_commands_total", "kind=\"builtin\"", "Simple commands executed, by kind."},
+    {"shell_commands_total", "kind=\"external\"", NULL},
+    {"shell_forks_total", NULL, "Processes forked by the shell."},
+    {"shell_exec_failures_total", NULL, "Forked children that failed to exec their command."},
+    {"shell_nonzero_exits_total", NULL, "Pipelines that ended with a non-zero status."},
+    {"shell_parse_errors_total", NULL, "Input lines that failed to parse."},
+    {"shell_glob_expansions_total", NULL, "Words with wildcards expanded by glob."},
+};
+
+// the cells of the shell until initMetrics() maps the shared ones
+static Metrics localMetrics;
+static Metrics* metrics = &localMetrics;
+
+// the children are forked and reaped by the main thread only
+static SpawnedChild children[METRICS_MAX_CHILDREN];
+
+static char* metricsPath = NULL;
+static pid_t metricsPid = 0;
+static pthread_mutex_t fileLock = PTHREAD_MUTEX_INITIALIZER;
+
+void countMetric(MetricCounter counter)
+{
+    atomic_fetch_add_explicit(&metrics->counters[counter], 1, memory_order_relaxed);
+}
+
+uint64_t readMetric(MetricCounter counter)
+{
+    return atomic_load_explicit(&metrics->counters[counter], memory_order_relaxed);
+}
+
+static void observe(Histogram* histogram, const uint64_t* bounds, uint64_t value)
+{
+    size_t bucket = 0;
+    while (bucket < N_BUCKETS && value > bounds[bucket])
+        bucket++;
+
+    atomic_fetch_add_explicit(&histogram->buckets[bucket], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->sum, value, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->count, 1, memory_order_relaxed);
+}
+
+void recordSpawn(pid_t pid, uint64_t forkStart)
+{
+    uint64_t now = traceNow();
+
+    countMetric(METRIC_FORKS);
+    observe(&metrics->spawnLatency, spawnBuckets, now - forkStart);
+
+    for (int i = 0; i < METRICS_MAX_CHILDREN; i++)
+    {
+        if (children[i].pid == 0)
+        {
+            children[i].pid = pid;
+            children[i].start = forkStart;
+            return;
+        }
+    }
+}
+
+void recordChildExit(pid_t pid)
+{
+    for (int i = 0; i < METRICS_MAX_CHILDREN; i++)
+    {
+        if (children[i].pid == pid)
+        {
+            observe(&metrics->childRuntime, runtimeBuckets, traceNow() - children[i].start);
+            children[i].pid = 0;
+            return;
+        }
+    }
+}
+
+/*-------------------------------Output--------------------------------------------------*/
+
+static void writeHistogram(FILE* file, const char* name, const char* help, Histogram* histogram, const uint64_t* bounds)
+{
+    fprintf(file, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+
+    // the count is read first, a bucket updated since makes +Inf a little larger, never smaller
+    uint64_t count = atomic_load_explicit(&histogram->count, memory_order_relaxed);
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < N_BUCKETS; i++)
+    {
+        cumulative += atomic_load_explicit(&histogram->buckets[i], memory_order_relaxed);
+        fprintf(file, "%s_bucket{le=\"%g\"} %lu\n", name, bounds[i] / 1e9, (unsigned long)cumulative);
+    }
+
+    cumulative += atomic_load_explicit(&histogram->buckets[N_BUCKETS], memory_order_relaxed);
+    if (cumulative > count)
+        count = cumulative;
+
+    fprintf(file, "%s_bucket{le=\"+Inf\"} %lu\n", name, (unsigned long)count);
+    fprintf(file, "%s_sum %.9f\n", name, atomic_load_explicit(&histogram->sum, memory_order_relaxed) / 1e9);
+    fprintf(file, "%s_count %lu\n", name, (unsigned long)count);
+}
+
+int writeMetrics(int fd)
+{
+    char* buffer = NULL;
+    size_t size = 0;
+    FILE* file = open_memstream(&buffer, &size);
+    if (!file)
+        return -1;
+
+    for (int i = 0; i < METRIC_N_COUNTERS; i++)
+    {
+        if (counterInfo[i].help)
+            fprintf(file, "# HELP %s %s\n# TYPE %s counter\n", counterInfo[i].name, counterInfo[i].help, counterInfo[i].name);
+
+        uint64_t value = atomic_load_explicit(&metrics->counters[i], memory_order_relaxed);
+        if (counterInfo[i].label)
+            fprintf(file, "%s{%s} %lu\n", counterInfo[i].name, counterInfo[i].label, (unsigned long)value);
+        else
+            fprintf(file, "%s %lu\n", counterInfo[i].name, (unsigned long)value);
+    }
+
+    writeHistogram(file, "shell_spawn_latency_seconds", "Time from the fork call to its return in the shell.", &metrics->spawnLatency, spawnBuckets);
+    writeHistogram(file, "shell_child_runtime_seconds", "Time from the fork of a child to its reap.", &metrics->childRuntime, runtimeBuckets);
+    fclose(file);
+
+    int status = write(fd, buffer, size) == (ssize_t)size ? 0 : -1;
+    free(buffer);
+    return status;
+}
+
+// replaces the file with the metrics through a rename, a scraper sees the old file or the new one
+static int writeMetricsFile(const char* path)
+{
+    size_t length = strlen(path) + sizeof(".tmp");
+    char temporary[length];
+    snprintf(temporary, length, "%s.tmp", path);
+
+    pthread_mutex_lock(&fileLock);
+
+    int status = -1;
+    int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd != -1)
+    {
+        status = writeMetrics(fd);
+        if (close(fd) == -1)
+            status = -1;
+
+        if (status == 0)
+            status = rename(temporary, path);
+        else
+            unlink(temporary);
+    }
+
+    pthread_mutex_unlock(&fileLock);
+    return status;
+}
+
+// rewrites SHELL_METRICS_FILE every interval, for as long as the shell runs
+static void* metricsWriter(void* arg)
+{
+    unsigned int interval = *(unsigned int*)arg;
+    free(arg);
+
+    while (1)
+    {
+        sleep(interval);
+        if (writeMetricsFile(metricsPath) == -1)
+            LOG_DEBUG("SHELL_METRICS_FILE %s: %s\n", metricsPath, strerror(errno));
+    }
+
+    return NULL;
+}
+
+// the last values are written when the shell exits, its forked children leave the file alone
+static void writeFinalMetrics()
+{
+    if (getpid() == metricsPid && writeMetricsFile(metricsPath) == -1)
+        LOG_ERROR("SHELL_METRICS_FILE %s: %s\n", metricsPath, strerror(errno));
+}
+
+void initMetrics()
+{
+    // shared with the forked children, a failed exec is only seen by the child
+    Metrics* shared = mmap(NULL, sizeof(Metrics), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED)
+        LOG_DEBUG("metrics: mmap: %s\n", strerror(errno));
+    else
+    {
+        memcpy(shared, &localMetrics, sizeof(Metrics));
+        metrics = shared;
+    }
+
+    const char* path = getenv("SHELL_METRICS_FILE");
+    if (!path || !*path)
+        return;
+
+    unsigned int* interval = malloc(sizeof(unsigned int));
+    metricsPath = strdup(path);
+    if (!interval || !metricsPath)
+    {
+        LOG_ERROR("SHELL_METRICS_FILE: malloc failure\n");
+        free(interval);
+        free(metricsPath);
+        metricsPath = NULL;
+        return;
+    }
+
+    *interval = METRICS_DEFAULT_INTERVAL;
+    const char* seconds = getenv("SHELL_METRICS_INTERVAL");
+    if (seconds && strspn(seconds, "0123456789") == strlen(seconds) && strlen(seconds) <= 6 && atoi(seconds) > 0)
+        *interval = atoi(seconds);
+
+    metricsPid = getpid();
+    atexit(writeFinalMetrics);
+
+    // the signals are for the main thread, the writer starts with them blocked
+    pthread_t thread;
+    int error = startHelperThread(&thread, metricsWriter, interval);
+    if (error)
+    {
+        LOG_ERROR("SHELL_METRICS_FILE: can't start the writer: %s\n", strerror(error));
+        free(interval);
+        return;
+    }
+    pthread_detach(thread);
+}
+
+/*-------------------------------Builtin-------------------------------------------------*/
+
+int stats(SimpleCommand* simpleCommand)
+{
+    if (simpleCommand->argc == 1)
+        return writeMetrics(simpleCommand->outputFD);
+
+    if (simpleCommand->argc != 3 || strcmp(simpleCommand->args[1], "-o") != 0)
+    {
+        LOG_ERROR("stats: Usage: stats [-o file]\n");
+        return -1;
+    }
+
+    if (writeMetricsFile(simpleCommand->args[2]) == -1)
+    {
+        LOG_ERROR("stats: %s: %s\n", simpleCommand->args[2], strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,516 @@
+/**
+ * @file parallel.c
+ * @brief Contains the definition of the parallel builtin declared in parallel.h
+ * @version 0.1
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include "parallel.h"
+#include "thread_pool.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdatomic.h>
+#include <sys/wait.h>
+
+extern char** environ;
+
+// size of the chunks used to read the items and the buffered output
+#define PARALLEL_READ_CHUNK 65536
+
+/*----------------------------------------------------------------------------------------*/
+
+// shared state of one invocation of the builtin
+typedef struct ParallelRun {
+    char** template;          // command template, points into the args of the simple command
+    int templateArgc;
+    int hasPlaceholder;       // whether any template arg contains {}
+
+    int outputFD;
+    int stderrFD;
+    bool keepOrder;
+    posix_spawnattr_t spawnAttr;  // gives the children the shell's signal mask, not the workers'
+
+    pthread_mutex_t lock;     // guards finished and the progress condition
+    pthread_cond_t progress;  // signalled every time an item finishes
+    size_t finished;          // number of finished items
+} ParallelRun;
+
+// a single item, and its result once it ran
+typedef struct ParallelItem {
+    ParallelRun* run;
+    char* value;
+
+    char* output;             // buffered output, only with -k
+    size_t outputLength;
+
+    int status;
+    atomic_bool done;
+} ParallelItem;
+
+/*-------------------------------Helpers-------------------------------------------------*/
+
+// writes the whole buffer, retrying on short writes
+static int writeAll(int fd, const char* buffer, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t written = write(fd, buffer, length);
+        if (written == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        buffer += written;
+        length -= written;
+    }
+
+    return 0;
+}
+
+// replaces every {} in str with the item. The caller frees the returned string
+static char* substitutePlaceholder(const char* str, const char* item)
+{
+    size_t placeholderLength = strlen(PARALLEL_PLACEHOLDER);
+    size_t itemLength = strlen(item);
+
+    size_t count = 0;
+    for (const char* p = strstr(str, PARALLEL_PLACEHOLDER); p; p = strstr(p + placeholderLength, PARALLEL_PLACEHOLDER))
+        count++;
+
+    char* result = (char*)malloc(strlen(str) + count * itemLength + 1);
+    if (!result)
+        return NULL;
+
+    char* out = result;
+    const char* p = str;
+    const char* match;
+    while ((match = strstr(p, PARALLEL_PLACEHOLDER)) != NULL)
+    {
+        memcpy(out, p, match - p);
+        out += match - p;
+        memcpy(out, item, itemLength);
+        out += itemLength;
+        p = match + placeholderLength;
+    }
+    strcpy(out, p);
+
+    return result;
+}
+
+// frees an argv built by buildItemArgs
+static void freeItemArgs(char** args)
+{
+    for (int i = 0; args[i] != NULL; i++)
+        free(args[i]);
+    free(args);
+}
+
+// builds the NULL terminated argv for one item
+static char** buildItemArgs(ParallelRun* run, const char* item)
+{
+    int argc = run->templateArgc + (run->hasPlaceholder ? 0 : 1);
+    char** args = (char**)calloc(argc + 1, sizeof(char*));
+    if (!args)
+        return NULL;
+
+    for (int i = 0; i < run->templateArgc; i++)
+    {
+        args[i] = substitutePlaceholder(run->template[i], item);
+        if (!args[i])
+        {
+            freeItemArgs(args);
+            return NULL;
+        }
+    }
+
+    if (!run->hasPlaceholder)
+    {
+        args[run->templateArgc] = COPY(item);
+        if (!args[run->templateArgc])
+        {
+            freeItemArgs(args);
+            return NULL;
+        }
+    }
+
+    return args;
+}
+
+// reads all the data from fd into a malloc'd buffer, the caller frees it
+static char* readAll(int fd, size_t* length)
+{
+    size_t capacity = PARALLEL_READ_CHUNK;
+    size_t used = 0;
+    char* buffer = (char*)malloc(capacity + 1);
+    if (!buffer)
+        return NULL;
+
+    while (1)
+    {
+        if (capacity - used < PARALLEL_READ_CHUNK)
+        {
+            char* temp = (char*)realloc(buffer, capacity * 2 + 1);
+            if (!temp)
+            {
+                free(buffer);
+                return NULL;
+            }
+            buffer = temp;
+            capacity *= 2;
+        }
+
+        ssize_t nread = read(fd, buffer + used, capacity - used);
+        if (nread == -1 && errno == EINTR)
+            continue;
+        if (nread <= 0)
+            break;
+
+        used += nread;
+    }
+
+    buffer[used] = '\0';
+    *length = used;
+    return buffer;
+}
+
+// splits the input into items, one per non-empty line. The items point into the buffer
+static char** splitLines(char* buffer, size_t* count)
+{
+    size_t capacity = 64;
+    size_t n = 0;
+    char** items = (char**)malloc(capacity * sizeof(char*));
+    if (!items)
+        return NULL;
+
+    char* saveptr = NULL;
+    for (char* line = strtok_r(buffer, "\n", &saveptr); line; line = strtok_r(NULL, "\n", &saveptr))
+    {
+        if (n == capacity)
+        {
+            char** temp = (char**)realloc(items, capacity * 2 * sizeof(char*));
+            if (!temp)
+            {
+                free(items);
+                return NULL;
+            }
+            items = temp;
+            capacity *= 2;
+        }
+        items[n++] = line;
+    }
+
+    *count = n;
+    return items;
+}
+
+/*-------------------------------Workers-------------------------------------------------*/
+
+// runs one item to completion on a worker of the pool
+static void runParallelItem(void* arg)
+{
+    ParallelItem* item = (ParallelItem*)arg;
+    ParallelRun* run = item->run;
+
+    int captureFD[2] = {-1, -1};
+    int stdoutFD = run->outputFD;
+
+    char** args = buildItemArgs(run, item->value);
+    if (!args)
+    {
+        item->status = 127;
+        goto done;
+    }
+
+    // the capture pipe must not leak into the children spawned by the other workers
+    if (run->keepOrder)
+    {
+        if (pipe2(captureFD, O_CLOEXEC) == -1)
+        {
+            LOG_ERROR("parallel: pipe: %s\n", strerror(errno));
+            item->status = 127;
+            goto done;
+        }
+        stdoutFD = captureFD[PIPE_WRITE_END];
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FD, "/dev/null", O_RDONLY, 0);
+    if (stdoutFD != STDOUT_FD)
+        posix_spawn_file_actions_adddup2(&actions, stdoutFD, STDOUT_FD);
+    if (run->stderrFD != STDERR_FD)
+        posix_spawn_file_actions_adddup2(&actions, run->stderrFD, STDERR_FD);
+
+    pid_t pid;
+    int spawnError = posix_spawnp(&pid, args[0], &actions, &run->spawnAttr, args, environ);
+    posix_spawn_file_actions_destroy(&actions);
+
+    if (captureFD[PIPE_WRITE_END] != -1)
+        close(captureFD[PIPE_WRITE_END]);
+
+    if (spawnError)
+    {
+        LOG_ERROR("parallel: %s: %s\n", args[0], strerror(spawnError));
+        item->status = 127;
+        goto done;
+    }
+
+    if (run->keepOrder)
+        item->output = readAll(captureFD[PIPE_READ_END], &item->outputLength);
+
+    int status = 0;
+    int waitResult;
+    while ((waitResult = waitpid(pid, &status, 0)) == -1 && errno == EINTR);
+
+    if (waitResult == -1)
+    {
+        LOG_DEBUG("parallel: waitpid: %s\n", strerror(errno));
+        item->status = 127;
+    }
+    else if (WIFEXITED(status))
+        item->status = WEXITSTATUS(status);
+    else if (WIFSIGNALED(status))
+        item->status = 128 + WTERMSIG(status);
+
+done:
+    if (captureFD[PIPE_READ_END] != -1)
+        close(captureFD[PIPE_READ_END]);
+    if (args)
+        freeItemArgs(args);
+
+    pthread_mutex_lock(&run->lock);
+    atomic_store_explicit(&item->done, true, memory_order_release);
+    run->finished++;
+    pthread_cond_signal(&run->progress);
+    pthread_mutex_unlock(&run->lock);
+}
+
+// writes the buffered outputs of the finished items that are next in order. Returns the new count of emitted items
+static size_t emitInOrder(ParallelRun* run, ParallelItem* items, size_t emitted, size_t nItems)
+{
+    while (emitted < nItems && atomic_load_explicit(&items[emitted].done, memory_order_acquire))
+    {
+        ParallelItem* item = &items[emitted];
+        if (item->output)
+        {
+            if (writeAll(run->outputFD, item->output, item->outputLength) != 0)
+                LOG_DEBUG("parallel: write: %s\n", strerror(errno));
+            free(item->output);
+            item->output = NULL;
+        }
+        emitted++;
+    }
+
+    return emitted;
+}
+
+/*-------------------------------Builtin-------------------------------------------------*/
+
+int parallel(SimpleCommand* simpleCommand)
+{
+    int jobs = 0;
+    bool keepOrder = false;
+    bool verbose = false;
+
+    // parse the options, they come before the command template
+    int i = 1;
+    for (; i < simpleCommand->argc && simpleCommand->args[i][0] == '-'; i++)
+    {
+        if (strcmp(simpleCommand->args[i], "-k") == 0)
+            keepOrder = true;
+        else if (strcmp(simpleCommand->args[i], "-v") == 0)
+            verbose = true;
+        else if (strcmp(simpleCommand->args[i], "-j") == 0 && i + 1 < simpleCommand->argc)
+        {
+            i++;
+            if (strspn(simpleCommand->args[i], "0123456789") != strlen(simpleCommand->args[i]) || atoi(simpleCommand->args[i]) < 1)
+            {
+                LOG_ERROR("parallel: -j expects a positive number\n");
+                return -1;
+            }
+            jobs = atoi(simpleCommand->args[i]);
+        }
+        else
+        {
+            LOG_ERROR("parallel: unknown option %s\n", simpleCommand->args[i]);
+            return -1;
+        }
+    }
+
+    int templateStart = i;
+    int templateEnd = templateStart;
+    while (templateEnd < simpleCommand->argc && strcmp(simpleCommand->args[templateEnd], PARALLEL_ITEMS_SEPARATOR) != 0)
+        templateEnd++;
+
+    if (templateEnd == templateStart)
+    {
+        LOG_ERROR("Usage: parallel [-j jobs] [-k] [-v] command [args]* [::: item [item]*]\n");
+        return -1;
+    }
+
+    // collect the items, either from the arguments or from the input, one per line
+    char* inputBuffer = NULL;
+    char** values = NULL;
+    size_t nItems = 0;
+
+    if (templateEnd < simpleCommand->argc)
+    {
+        values = &simpleCommand->args[templateEnd + 1];
+        nItems = simpleCommand->argc - templateEnd - 1;
+    }
+    else
+    {
+        size_t length = 0;
+        inputBuffer = readAll(simpleCommand->inputFD, &length);
+        if (!inputBuffer)
+        {
+            LOG_ERROR("parallel: failed to read the items\n");
+            return -1;
+        }
+
+        values = splitLines(inputBuffer, &nItems);
+        if (!values)
+        {
+            LOG_ERROR("parallel: malloc failure\n");
+            free(inputBuffer);
+            return -1;
+        }
+    }
+
+    if (nItems == 0)
+    {
+        if (inputBuffer)
+        {
+            free(values);
+            free(inputBuffer);
+        }
+        return 0;
+    }
+
+    ParallelRun run;
+    run.template = &simpleCommand->args[templateStart];
+    run.templateArgc = templateEnd - templateStart;
+    run.hasPlaceholder = 0;
+    for (int t = 0; t < run.templateArgc; t++)
+    {
+        if (strstr(run.template[t], PARALLEL_PLACEHOLDER))
+            run.hasPlaceholder = 1;
+    }
+    run.outputFD = simpleCommand->outputFD;
+    run.stderrFD = simpleCommand->stderrFD;
+    run.keepOrder = keepOrder;
+    run.finished = 0;
+    pthread_mutex_init(&run.lock, NULL);
+    pthread_cond_init(&run.progress, NULL);
+
+    ParallelItem* items = (ParallelItem*)calloc(nItems, sizeof(ParallelItem));
+    if (!items)
+    {
+        LOG_ERROR("parallel: malloc failure\n");
+        if (inputBuffer)
+        {
+            free(values);
+            free(inputBuffer);
+        }
+        return -1;
+    }
+
+    for (size_t n = 0; n < nItems; n++)
+    {
+        items[n].run = &run;
+        items[n].value = values[n];
+        atomic_init(&items[n].done, false);
+    }
+
+    // the workers reap their own children, so keep the shell's SIGCHLD handler from stealing them. The workers block every signal already, this keeps it off the main thread
+    sigset_t childMask, oldMask;
+    sigemptyset(&childMask);
+    sigaddset(&childMask, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &childMask, &oldMask);
+
+    // the children must not start with SIGCHLD blocked, nor ignored
+    posix_spawnattr_init(&run.spawnAttr);
+    posix_spawnattr_setflags(&run.spawnAttr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+    posix_spawnattr_setsigmask(&run.spawnAttr, &oldMask);
+    posix_spawnattr_setsigdefault(&run.spawnAttr, &childMask);
+
+    ThreadPool* pool = initThreadPool(jobs, 0);
+    if (!pool)
+    {
+        LOG_ERROR("parallel: failed to start the workers\n");
+        pthread_sigmask(SIG_SETMASK, &oldMask, NULL);
+        posix_spawnattr_destroy(&run.spawnAttr);
+        free(items);
+        if (inputBuffer)
+        {
+            free(values);
+            free(inputBuffer);
+        }
+        return -1;
+    }
+
+    LOG_DEBUG("parallel: %zu items on %d workers\n", nItems, getThreadPoolSize(pool));
+
+    // feed the pool, and write the ordered output as soon as a prefix of the items is done
+    size_t submitted = 0;
+    size_t emitted = 0;
+    while (submitted < nItems || (keepOrder && emitted < nItems))
+    {
+        pthread_mutex_lock(&run.lock);
+        size_t finished = run.finished;
+        pthread_mutex_unlock(&run.lock);
+
+        while (submitted < nItems && trySubmitTask(pool, runParallelItem, &items[submitted]) == 0)
+            submitted++;
+
+        if (keepOrder)
+            emitted = emitInOrder(&run, items, emitted, nItems);
+
+        if (submitted == nItems && (!keepOrder || emitted == nItems))
+            break;
+
+        // wait until some item finishes, that frees room in the queues and may unblock the output
+        pthread_mutex_lock(&run.lock);
+        while (run.finished == finished)
+            pthread_cond_wait(&run.progress, &run.lock);
+        pthread_mutex_unlock(&run.lock);
+    }
+
+    cleanUpThreadPool(pool);
+    pthread_sigmask(SIG_SETMASK, &oldMask, NULL);
+
+    // report the per item exit statuses
+    size_t failed = 0;
+    for (size_t n = 0; n < nItems; n++)
+    {
+        if (items[n].status != 0)
+            failed++;
+
+        if (items[n].status != 0)
+            LOG_ERROR("parallel: [%zu] %s: exit status %d\n", n + 1, items[n].value, items[n].status);
+        else if (verbose)
+            dprintf(run.stderrFD, "parallel: [%zu] %s: exit status 0\n", n + 1, items[n].value);
+    }
+
+    posix_spawnattr_destroy(&run.spawnAttr);
+    pthread_mutex_destroy(&run.lock);
+    pthread_cond_destroy(&run.progress);
+    free(items);
+    if (inputBuffer)
+    {
+        free(values);
+        free(inputBuffer);
+    }
+
+    return failed > PARALLEL_MAX_FAILED_STATUS ? PARALLEL_MAX_FAILED_STATUS : (int)failed;
+}
\ No newline at end of file
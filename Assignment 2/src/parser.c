@@ -1,14 +1,39 @@
+#define _GNU_SOURCE
+
 #ifndef PARSER_H_
 #define PARSER_H_
 
+#include "accounting.h"
+#include "cpu_placement.h"
+#include "metrics.h"
 #include "parser.h"
+#include "pipe_tuning.h"
+#include "probes.h"
 #include "shell_builtins.h"
+#include "timing.h"
+#include "trace.h"
 
 #include <fcntl.h>
 #include <glob.h>
 
+extern ShellState* globalShellState;
+
 #define COMPARE_TOKEN(token, string) (token && strcmp(token, string) == 0)
 
+// the index of the first token after index that isn't whitespace, the index of the terminating NULL if there's none
+static int nextToken(char** tokens, int index)
+{
+    if (IS_NULL(tokens[index]))
+        return index;
+
+    do
+    {
+        index++;
+    } while (IGNORE(tokens[index]));
+
+    return index;
+}
+
 // Parses an array of tokens and generates a command chain, where each link is a table of commands to be executed.
 CommandChain* parseTokens(char** tokens)
 {
@@ -32,6 +57,19 @@ CommandChain* parseTokens(char** tokens)
             return NULL;
         }
 
+        // a background command keeps its tokens, unquoted and unexpanded, so a queued job opens its pipes and files only when it starts
+        int end = currentIndexInTokens;
+        while (!IS_NULL(tokens[end]) && !IS_CHAINING_OPERATOR(tokens[end]))
+            end++;
+        if (IS_BACKGROUND(tokens[end]) && !(command->sourceTokens = copyTokens(tokens + currentIndexInTokens, end - currentIndexInTokens)))
+        {
+            LOG_DEBUG("Failed to allocate memory for the tokens of a background command\n");
+            cleanUpCommandChain(chain);
+            cleanUpCommand(command);
+            trackedFree(ALLOC_PARSER, command);
+            return NULL;
+        }
+
         // the simple commands are added to the command using this temporary
         SimpleCommand* simpleCommand = initSimpleCommand();
         if (!simpleCommand)
@@ -56,7 +94,7 @@ CommandChain* parseTokens(char** tokens)
                     cleanUpSimpleCommand(simpleCommand);
                     return NULL;
                 }
-                simpleCommand->execute = getExecutionFunction(simpleCommand->commandName);
+                simpleCommand->execute = resolveExecutionFunction(simpleCommand);
                 addSimpleCommand(command, simpleCommand);
                 simpleCommand = NULL; // no more simple commands
                 break;
@@ -86,8 +124,19 @@ CommandChain* parseTokens(char** tokens)
                     return NULL;
                 }
 
+                // a size after the pipe (like |1M) overrides the pipesize option for this pipe
+                size_t pipeSize = (size_t)globalShellState->options.pipeSizeKilobytes * 1024;
+                if (tokens[currentIndexInTokens][1] != '\0' && !parsePipeSize(tokens[currentIndexInTokens] + 1, &pipeSize))
+                {
+                    LOG_ERROR("Invalid pipe size \'%s\'\n", tokens[currentIndexInTokens] + 1);
+                    cleanUpCommandChain(chain);
+                    cleanUpCommand(command);
+                    cleanUpSimpleCommand(simpleCommand);
+                    return NULL;
+                }
+
                 int pipeFD[2];
-                if (pipe(pipeFD) == -1)
+                if (pipe2(pipeFD, O_CLOEXEC) == -1)
                 {
                     LOG_DEBUG("Failed to create pipe\n");
                     cleanUpCommandChain(chain);
@@ -96,8 +145,14 @@ CommandChain* parseTokens(char** tokens)
                     return NULL;
                 }
 
+                registerFD(pipeFD[PIPE_READ_END], "pipe");
+                registerFD(pipeFD[PIPE_WRITE_END], "pipe");
+
+                if (pipeSize > 0)
+                    setPipeSize(pipeFD[PIPE_WRITE_END], pipeSize);
+
                 simpleCommand->outputFD = pipeFD[PIPE_WRITE_END];
-                simpleCommand->execute = getExecutionFunction(simpleCommand->commandName);
+                simpleCommand->execute = resolveExecutionFunction(simpleCommand);
                 addSimpleCommand(command, simpleCommand);
 
                 // start with a new simple command
@@ -148,9 +203,9 @@ CommandChain* parseTokens(char** tokens)
                 } while (IGNORE(fileNameToken));
 
                 if (isAppend)
-                    fileFD = open(fileNameToken, O_WRONLY | O_CREAT | O_APPEND, 0644);
+                    fileFD = open(fileNameToken, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
                 else
-                    fileFD = open(fileNameToken, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                    fileFD = open(fileNameToken, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
 
                 if (fileFD == -1)
                 {
@@ -161,6 +216,7 @@ CommandChain* parseTokens(char** tokens)
                     return NULL;
                 }
 
+                registerFD(fileFD, "redirection");
                 simpleCommand->outputFD = fileFD;
             }
             else if (IS_FILE_IN_REDIR(tokens[currentIndexInTokens]))
@@ -180,7 +236,7 @@ CommandChain* parseTokens(char** tokens)
                     fileNameToken = tokens[++currentIndexInTokens];
                 } while (IGNORE(fileNameToken));
 
-                int fileFD = open(fileNameToken, O_RDONLY);
+                int fileFD = open(fileNameToken, O_RDONLY | O_CLOEXEC);
                 if (fileFD == -1)
                 {
                     LOG_DEBUG("Failed to open file for input redirection\n");
@@ -188,6 +244,7 @@ CommandChain* parseTokens(char** tokens)
                     return NULL;
                 }
 
+                registerFD(fileFD, "redirection");
                 simpleCommand->inputFD = fileFD;
             }
             else if (IS_STDERR_REDIR(tokens[currentIndexInTokens]))
@@ -207,7 +264,7 @@ CommandChain* parseTokens(char** tokens)
                     fileNameToken = tokens[++currentIndexInTokens];
                 } while (IGNORE(fileNameToken));
 
-                int fileFD = open(fileNameToken, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                int fileFD = open(fileNameToken, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
 
                 if (fileFD == -1)
                 {
@@ -216,12 +273,66 @@ CommandChain* parseTokens(char** tokens)
                     return NULL;
                 }
 
+                registerFD(fileFD, "redirection");
                 simpleCommand->stderrFD = fileFD;
             }
             else if (IGNORE(tokens[currentIndexInTokens]))
             {
                 continue;
             }
+            else if (command->nSimpleCommands == 0 && !simpleCommand->commandName && !simpleCommand->cpuList && !command->timing && IS_TIME_KEYWORD(tokens[currentIndexInTokens]))
+            {
+                // time before the first stage measures the whole pipeline, its options come right after it
+                command->timing = initCommandTiming();
+                if (!command->timing)
+                {
+                    LOG_DEBUG("Failed to allocate memory for the timing\n");
+                    cleanUpCommandChain(chain);
+                    cleanUpCommand(command);
+                    cleanUpSimpleCommand(simpleCommand);
+                    return NULL;
+                }
+
+                while (1)
+                {
+                    int optionIndex = nextToken(tokens, currentIndexInTokens);
+                    if (IS_NULL(tokens[optionIndex]) || IS_CHAINING_OPERATOR(tokens[optionIndex]))
+                        break;
+
+                    int valueIndex = nextToken(tokens, optionIndex);
+                    const char* value = IS_NULL(tokens[valueIndex]) || IS_CHAINING_OPERATOR(tokens[valueIndex]) ? NULL : tokens[valueIndex];
+
+                    int used = parseTimingOption(command->timing, tokens[optionIndex], value);
+                    if (used == 0)
+                        break;
+
+                    if (used == -1)
+                    {
+                        LOG_ERROR("time: bad value for \'%s\'\n", tokens[optionIndex]);
+                        cleanUpCommandChain(chain);
+                        cleanUpCommand(command);
+                        cleanUpSimpleCommand(simpleCommand);
+                        return NULL;
+                    }
+
+                    currentIndexInTokens = used == 1 ? optionIndex : valueIndex;
+                }
+            }
+            else if (!simpleCommand->commandName && IS_CPU_PLACEMENT(tokens[currentIndexInTokens]))
+            {
+                // @cpulist before a command pins it, over the cpu placement option
+                const char* cpuList = tokens[currentIndexInTokens] + 1;
+                if (simpleCommand->cpuList || !isValidCpuList(cpuList))
+                {
+                    LOG_ERROR("Invalid cpu list \'%s\'\n", tokens[currentIndexInTokens]);
+                    cleanUpCommandChain(chain);
+                    cleanUpCommand(command);
+                    cleanUpSimpleCommand(simpleCommand);
+                    return NULL;
+                }
+
+                simpleCommand->cpuList = strdup(cpuList);
+            }
             else if (!simpleCommand->commandName && tokens[currentIndexInTokens][0] == '!' && strlen(tokens[currentIndexInTokens]) > 1)
             {
                 // pushing the '!' as history
@@ -250,7 +361,12 @@ CommandChain* parseTokens(char** tokens)
                 tokens[currentIndexInTokens] = removeQuotes(tokens[currentIndexInTokens]);
                 // expand any wildcards, in case there are any, if there's none return the same token
                 glob_t globbuf;
+                uint64_t globStart = TRACE_START();
                 int globReturn = glob(tokens[currentIndexInTokens], GLOB_NOCHECK | GLOB_TILDE, NULL, &globbuf);
+                TRACE_SPAN("glob", "parse", globStart, tokens[currentIndexInTokens]);
+
+                if (globbuf.gl_flags & GLOB_MAGCHAR)
+                    countMetric(METRIC_GLOB_EXPANSIONS);
 
                 if (globReturn != 0)
                 {
@@ -284,13 +400,13 @@ CommandChain* parseTokens(char** tokens)
         if (simpleCommand && simpleCommand->commandName)
         {
             // add the simple command to the command's simple commands
-            simpleCommand->execute = getExecutionFunction(simpleCommand->commandName);
+            simpleCommand->execute = resolveExecutionFunction(simpleCommand);
             addSimpleCommand(command, simpleCommand);
             simpleCommand = NULL; // no more simple commands
         }
 
         // update the chain operator
-        command->chainingOperator = COPY(tokens[currentIndexInTokens]);
+        command->chainingOperator = TRACKED_COPY(ALLOC_PARSER, tokens[currentIndexInTokens]);
         if (IS_BACKGROUND(command->chainingOperator))
             command->background = true;
 
@@ -307,4 +423,49 @@ CommandChain* parseTokens(char** tokens)
     return chain;
 }
 
+// tokenizes, parses and executes a line of input
+int executeInputLine(const char* input)
+{
+    // simple whitespace tokenizer
+    uint64_t start = TRACE_START();
+    char** tokens = tokenizeString(input, ' ');
+    TRACE_SPAN("tokenize", "parse", start, input);
+    if (!tokens)
+    {
+        LOG_DEBUG("Failed to tokenize input\n");
+        return -1;
+    }
+
+    for (int i = 0; tokens[i] != NULL; i++) {
+        LOG_DEBUG("Token %d: [%s]\n", i, tokens[i]);
+    }
+
+    PROBE_TOKENS(getTokenCount(tokens), input);
+
+    // generate the command from tokens
+    start = TRACE_START();
+    CommandChain* commandChain = parseTokens(tokens);
+    TRACE_SPAN("parse", "parse", start, input);
+    PROBE_PARSE_DONE(commandChain);
+    if (!commandChain)
+        countMetric(METRIC_PARSE_ERRORS);
+
+    // display the command chain
+    printCommandChain(commandChain);
+
+    // execute the command
+    start = TRACE_START();
+    int status = executeCommandChain(commandChain);
+    TRACE_SPAN("execute", "execute", start, input);
+    LOG_DEBUG("Command executed with status %d\n", status);
+
+    // Free tokens
+    freeTokens(tokens);
+
+    // free the command chain
+    cleanUpCommandChain(commandChain);
+
+    return status;
+}
+
 #endif /* PARSER_H_ */
\ No newline at end of file
@@ -0,0 +1,235 @@
+/**
+ * @file path_cache.c
+ * @brief Contains the function definitions for the PATH lookup cache declared in path_cache.h
+ * @version 0.1
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "path_cache.h"
+#include "utils.h"
+#include "accounting.h"
+
+#include <limits.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// a cached lookup, chained in its bucket
+typedef struct PathCacheEntry {
+    char* name;
+    char* path;
+    struct PathCacheEntry* next;
+} PathCacheEntry;
+
+static PathCacheEntry* buckets[PATH_CACHE_BUCKETS];
+
+// the PATH the cached entries were resolved against, and the mtimes its directories had then
+static char* cachedPath = NULL;
+static struct timespec* cachedMtimes = NULL;
+static int nCachedMtimes = 0;
+
+/*----------------------------------------------------------------------------------------*/
+
+static unsigned int hashName(const char* name)
+{
+    uint32_t hash = 2166136261u;
+    for (; *name; name++)
+    {
+        hash ^= (unsigned char)*name;
+        hash *= 16777619u;
+    }
+
+    return hash & (PATH_CACHE_BUCKETS - 1);
+}
+
+// searches the directories of PATH for an executable regular file. The caller frees the result
+static char* searchPath(const char* name, const char* path)
+{
+    size_t nameLength = strlen(name);
+
+    while (path && *path)
+    {
+        const char* end = strchr(path, ':');
+        size_t dirLength = end ? (size_t)(end - path) : strlen(path);
+
+        // an empty entry means the current directory
+        char* candidate = (char*)trackedMalloc(ALLOC_PATH_CACHE, dirLength + nameLength + 3);
+        if (!candidate)
+            return NULL;
+
+        if (dirLength == 0)
+            sprintf(candidate, "./%s", name);
+        else
+            sprintf(candidate, "%.*s/%s", (int)dirLength, path, name);
+
+        struct stat st;
+        if (stat(candidate, &st) == 0 && S_ISREG(st.st_mode) && access(candidate, X_OK) == 0)
+            return candidate;
+
+        trackedFree(ALLOC_PATH_CACHE, candidate);
+        path = end ? end + 1 : NULL;
+    }
+
+    return NULL;
+}
+
+// fills the mtimes of the directories of path, all zero for a directory that can't be read. Returns the number of directories, -1 on failure
+static int statPathDirectories(const char* path, struct timespec** mtimes)
+{
+    int count = 1;
+    for (const char* c = path; *c; c++)
+        count += *c == ':';
+
+    *mtimes = (struct timespec*)trackedCalloc(ALLOC_PATH_CACHE, count, sizeof(struct timespec));
+    if (!*mtimes)
+        return -1;
+
+    for (int i = 0; i < count; i++)
+    {
+        const char* end = strchr(path, ':');
+        size_t dirLength = end ? (size_t)(end - path) : strlen(path);
+
+        char dir[PATH_MAX];
+        struct stat st;
+        snprintf(dir, sizeof(dir), "%.*s", (int)dirLength, dirLength ? path : ".");
+        if (stat(dir, &st) == 0)
+            (*mtimes)[i] = st.st_mtim;
+
+        path = end ? end + 1 : path + dirLength;
+    }
+
+    return count;
+}
+
+void invalidatePathCache()
+{
+    for (int i = 0; i < PATH_CACHE_BUCKETS; i++)
+    {
+        PathCacheEntry* entry = buckets[i];
+        while (entry)
+        {
+            PathCacheEntry* next = entry->next;
+            trackedFree(ALLOC_PATH_CACHE, entry->name);
+            trackedFree(ALLOC_PATH_CACHE, entry->path);
+            trackedFree(ALLOC_PATH_CACHE, entry);
+            entry = next;
+        }
+        buckets[i] = NULL;
+    }
+
+    trackedFree(ALLOC_PATH_CACHE, cachedPath);
+    trackedFree(ALLOC_PATH_CACHE, cachedMtimes);
+    cachedPath = NULL;
+    cachedMtimes = NULL;
+    nCachedMtimes = 0;
+}
+
+bool revalidatePathCache()
+{
+    if (!cachedPath)
+        return false;
+
+    struct timespec* mtimes;
+    int count = statPathDirectories(cachedPath, &mtimes);
+    bool changed = count != nCachedMtimes || !cachedMtimes || memcmp(mtimes, cachedMtimes, count * sizeof(struct timespec)) != 0;
+
+    if (count != -1)
+        trackedFree(ALLOC_PATH_CACHE, mtimes);
+
+    if (changed)
+    {
+        LOG_DEBUG("A directory of PATH changed, dropping the cached paths\n");
+        invalidatePathCache();
+    }
+
+    return changed;
+}
+
+const char* resolveCommandPath(const char* commandName)
+{
+    if (!commandName || !*commandName)
+        return NULL;
+
+    // paths are not looked up, like execvp
+    if (strchr(commandName, '/'))
+        return commandName;
+
+    const char* path = getenv("PATH");
+    if (!path)
+        path = "/bin:/usr/bin";
+
+    // the cached lookups only hold for the PATH they were made with
+    if (!cachedPath || strcmp(cachedPath, path) != 0)
+    {
+        invalidatePathCache();
+        cachedPath = TRACKED_COPY(ALLOC_PATH_CACHE, path);
+        nCachedMtimes = cachedPath ? statPathDirectories(cachedPath, &cachedMtimes) : 0;
+    }
+
+    unsigned int bucket = hashName(commandName);
+    for (PathCacheEntry* entry = buckets[bucket]; entry; entry = entry->next)
+    {
+        if (strcmp(entry->name, commandName) == 0)
+            return entry->path;
+    }
+
+    char* resolved = searchPath(commandName, path);
+    if (!resolved)
+        return NULL;
+
+    PathCacheEntry* entry = (PathCacheEntry*)trackedMalloc(ALLOC_PATH_CACHE, sizeof(PathCacheEntry));
+    if (!entry)
+    {
+        trackedFree(ALLOC_PATH_CACHE, resolved);
+        return NULL;
+    }
+
+    entry->name = TRACKED_COPY(ALLOC_PATH_CACHE, commandName);
+    entry->path = resolved;
+    entry->next = buckets[bucket];
+    buckets[bucket] = entry;
+
+    LOG_DEBUG("Resolved %s to %s\n", commandName, resolved);
+    return resolved;
+}
+
+int hashBuiltin(SimpleCommand* simpleCommand)
+{
+    int first = 1;
+    if (simpleCommand->argc > 1 && strcmp(simpleCommand->args[1], "-r") == 0)
+    {
+        invalidatePathCache();
+        first = 2;
+    }
+    else if (simpleCommand->argc > 1 && simpleCommand->args[1][0] == '-')
+    {
+        LOG_ERROR("hash: Usage: hash [-r] [name]*\n");
+        return -1;
+    }
+
+    // without names or -r, the cache is listed
+    if (simpleCommand->argc == 1)
+    {
+        for (int i = 0; i < PATH_CACHE_BUCKETS; i++)
+        {
+            for (PathCacheEntry* entry = buckets[i]; entry; entry = entry->next)
+                dprintf(simpleCommand->outputFD, "%s\t%s\n", entry->name, entry->path);
+        }
+
+        return 0;
+    }
+
+    int status = 0;
+    for (int i = first; i < simpleCommand->argc; i++)
+    {
+        if (!resolveCommandPath(simpleCommand->args[i]))
+        {
+            LOG_ERROR("hash: %s: not found\n", simpleCommand->args[i]);
+            status = 1;
+        }
+    }
+
+    return status;
+}
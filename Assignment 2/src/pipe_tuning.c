@@ -0,0 +1,198 @@
+/**
+ * @file pipe_tuning.c
+ * @brief Contains the function definitions for the pipe sizing declared in pipe_tuning.h
+ * @version 0.1
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include "pipe_tuning.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct PipeMonitor {
+    PeriodicSampler sampler;
+    size_t maxSize;         //< 0 until the first round
+
+    int nReaders;
+    pid_t* readers;
+    int* fullSamples;       // samples in a row each reader's pipe was full on
+    bool* exited;           // readers about to be reaped, their pid may belong to another process afterwards
+};
+
+bool parsePipeSize(const char* str, size_t* size)
+{
+    char* end;
+    errno = 0;
+    unsigned long value = strtoul(str, &end, 10);
+    if (end == str || errno || str[0] == '-')
+        return false;
+
+    if (*end == 'k' || *end == 'K')
+        value <<= 10, end++;
+    else if (*end == 'm' || *end == 'M')
+        value <<= 20, end++;
+
+    // anything larger than a GiB is a typo, the kernel caps pipes far below that
+    if (*end != '\0' || value == 0 || value > (1UL << 30))
+        return false;
+
+    *size = value;
+    return true;
+}
+
+size_t getPipeMaxSize()
+{
+    // read every time, an administrator may change it while the shell runs
+    FILE* file = fopen("/proc/sys/fs/pipe-max-size", "re");
+    if (!file)
+        return PIPE_DEFAULT_MAX_SIZE;
+
+    unsigned long maxSize = 0;
+    if (fscanf(file, "%lu", &maxSize) != 1 || maxSize == 0)
+        maxSize = PIPE_DEFAULT_MAX_SIZE;
+
+    fclose(file);
+    return maxSize;
+}
+
+int setPipeSize(int fd, size_t size)
+{
+    size_t maxSize = getPipeMaxSize();
+    if (size > maxSize)
+        size = maxSize;
+
+    int capacity = fcntl(fd, F_SETPIPE_SZ, (int)size);
+    if (capacity == -1)
+    {
+        // EPERM once the user's pipes are over pipe-user-pages-soft, EBUSY when the pipe holds more than the new size. The pipe works on with the capacity it has
+        LOG_DEBUG("F_SETPIPE_SZ %zu: %s\n", size, strerror(errno));
+        capacity = fcntl(fd, F_GETPIPE_SZ);
+    }
+
+    return capacity;
+}
+
+/*-------------------------------Adaptive sizing-----------------------------------------*/
+
+// looks at the pipe a reader reads from, and grows it once it has been found full often enough. Called with the mutex held
+static void samplePipe(PipeMonitor* monitor, int i)
+{
+    if (monitor->exited[i])
+        return;
+
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/fd/0", (int)monitor->readers[i]);
+
+    // the reader may be gone, or not have its stdin set up yet
+    int fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd == -1)
+    {
+        monitor->fullSamples[i] = 0;
+        return;
+    }
+
+    struct stat st;
+    int queued = 0;
+    int capacity = fcntl(fd, F_GETPIPE_SZ);
+
+    bool full = fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode) && capacity > 0 && ioctl(fd, FIONREAD, &queued) == 0 && queued + PIPE_FULL_SLACK >= capacity;
+
+    if (!full)
+        monitor->fullSamples[i] = 0;
+    else if (++monitor->fullSamples[i] >= PIPE_GROW_SAMPLES && (size_t)capacity < monitor->maxSize)
+    {
+        int grown = setPipeSize(fd, (size_t)capacity * 2);
+        LOG_DEBUG("pipe of %d grown from %d to %d bytes\n", (int)monitor->readers[i], capacity, grown);
+        monitor->fullSamples[i] = 0;
+    }
+
+    close(fd);
+}
+
+// a round of the monitor. The mutex of the sampler is held, so a reader marked exited isn't looked at once forgetPipeReader returns
+static void monitorPipes(void* arg)
+{
+    PipeMonitor* monitor = (PipeMonitor*)arg;
+
+    // read on the monitor's thread, the pipeline doesn't wait for it
+    if (!monitor->maxSize)
+        monitor->maxSize = getPipeMaxSize();
+
+    for (int i = 0; i < monitor->nReaders; i++)
+        samplePipe(monitor, i);
+}
+
+PipeMonitor* startPipeMonitor(const pid_t* readers, int nReaders)
+{
+    if (nReaders <= 0)
+        return NULL;
+
+    PipeMonitor* monitor = (PipeMonitor*)calloc(1, sizeof(PipeMonitor));
+    if (!monitor)
+        return NULL;
+
+    monitor->readers = (pid_t*)malloc(nReaders * sizeof(pid_t));
+    monitor->fullSamples = (int*)calloc(nReaders, sizeof(int));
+    monitor->exited = (bool*)calloc(nReaders, sizeof(bool));
+    if (!monitor->readers || !monitor->fullSamples || !monitor->exited)
+    {
+        free(monitor->readers);
+        free(monitor->fullSamples);
+        free(monitor->exited);
+        free(monitor);
+        return NULL;
+    }
+
+    memcpy(monitor->readers, readers, nReaders * sizeof(pid_t));
+    monitor->nReaders = nReaders;
+
+    int error = startPeriodicSampler(&monitor->sampler, PIPE_MONITOR_INTERVAL_MS, monitorPipes, monitor);
+    if (error)
+    {
+        LOG_DEBUG("pthread_create: %s\n", strerror(error));
+        free(monitor->readers);
+        free(monitor->fullSamples);
+        free(monitor->exited);
+        free(monitor);
+        return NULL;
+    }
+
+    return monitor;
+}
+
+void forgetPipeReader(PipeMonitor* monitor, pid_t reader)
+{
+    if (!monitor)
+        return;
+
+    pthread_mutex_lock(&monitor->sampler.mutex);
+    for (int i = 0; i < monitor->nReaders; i++)
+    {
+        if (monitor->readers[i] == reader)
+            monitor->exited[i] = true;
+    }
+    pthread_mutex_unlock(&monitor->sampler.mutex);
+}
+
+void stopPipeMonitor(PipeMonitor* monitor)
+{
+    if (!monitor)
+        return;
+
+    stopPeriodicSampler(&monitor->sampler);
+    destroyPeriodicSampler(&monitor->sampler);
+    free(monitor->readers);
+    free(monitor->fullSamples);
+    free(monitor->exited);
+    free(monitor);
+}
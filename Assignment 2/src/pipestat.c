@@ -0,0 +1,306 @@
+/**
+ * @file pipestat.c
+ * @brief Contains the function definitions for the pipeline statistics declared in pipestat.h
+ * @version 0.1
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include "pipestat.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// what a sleeping process waits for
+typedef enum PipeWait {
+    PIPE_WAIT_NONE,
+    PIPE_WAIT_READ,     //< an empty pipe
+    PIPE_WAIT_WRITE     //< a full pipe
+} PipeWait;
+
+struct PipeStat {
+    int nStages;
+    StageStats* stages;
+
+    double startTime;
+    double stopTime;    //< 0 while sampling
+
+    PeriodicSampler sampler;
+    bool running;
+};
+
+// reads a file of /proc/<pid> into a NUL terminated buffer
+static bool readProcFile(pid_t pid, const char* name, char* buffer, size_t size)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/%s", (int)pid, name);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+
+    ssize_t nread;
+    while ((nread = read(fd, buffer, size - 1)) == -1 && errno == EINTR);
+    close(fd);
+
+    if (nread <= 0)
+        return false;
+
+    buffer[nread] = '\0';
+    return true;
+}
+
+/*-------------------------------Sampling------------------------------------------------*/
+
+// tells whether a sleeping process waits on a pipe, from the kernel function it sleeps in or else from its syscall and the fd it passed
+static PipeWait findPipeWait(pid_t pid)
+{
+    char buffer[256];
+    if (readProcFile(pid, "wchan", buffer, sizeof(buffer)))
+    {
+        if (strstr(buffer, "pipe_read") || strstr(buffer, "wait_readable"))
+            return PIPE_WAIT_READ;
+        if (strstr(buffer, "pipe_write") || strstr(buffer, "wait_writable"))
+            return PIPE_WAIT_WRITE;
+    }
+
+    // wchan is 0 when the kernel hides it, and ambiguous on older kernels
+    long nr;
+    unsigned long fd;
+    if (!readProcFile(pid, "syscall", buffer, sizeof(buffer)) || sscanf(buffer, "%ld %lx", &nr, &fd) != 2)
+        return PIPE_WAIT_NONE;
+
+    PipeWait wait = PIPE_WAIT_NONE;
+    if (nr == SYS_read || nr == SYS_readv)
+        wait = PIPE_WAIT_READ;
+    else if (nr == SYS_write || nr == SYS_writev)
+        wait = PIPE_WAIT_WRITE;
+
+    if (wait == PIPE_WAIT_NONE)
+        return wait;
+
+    char path[64];
+    struct stat st;
+    snprintf(path, sizeof(path), "/proc/%d/fd/%lu", (int)pid, fd);
+    return stat(path, &st) == 0 && S_ISFIFO(st.st_mode) ? wait : PIPE_WAIT_NONE;
+}
+
+// updates the counters of a stage. The time since the last sample counts as blocked if the process sleeps on a pipe now
+static void sampleStage(StageStats* stage, bool exited)
+{
+    double now = monotonicSeconds();
+    char buffer[1024];
+
+    if (readProcFile(stage->pid, "io", buffer, sizeof(buffer)))
+    {
+        const char* rchar = strstr(buffer, "rchar:");
+        const char* wchar = strstr(buffer, "wchar:");
+        if (rchar)
+            sscanf(rchar, "rchar: %llu", &stage->readBytes);
+        if (wchar)
+            sscanf(wchar, "wchar: %llu", &stage->writtenBytes);
+    }
+
+    // the command name may hold spaces and parentheses, the fields start after the last )
+    const char* fields = readProcFile(stage->pid, "stat", buffer, sizeof(buffer)) ? strrchr(buffer, ')') : NULL;
+    char state;
+    unsigned long utime, stime;
+
+    if (fields && sscanf(fields + 1, " %c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &state, &utime, &stime) == 3)
+    {
+        stage->cpuSeconds = (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+
+        if (!exited && state == 'S')
+        {
+            PipeWait wait = findPipeWait(stage->pid);
+            if (wait == PIPE_WAIT_READ)
+                stage->blockedReading += now - stage->lastSample;
+            else if (wait == PIPE_WAIT_WRITE)
+                stage->blockedWriting += now - stage->lastSample;
+        }
+    }
+
+    stage->lastSample = now;
+}
+
+// a round of the sampler. The lock is held while sampling, the final samples and the printing wait at most one round
+static void samplePipeline(void* arg)
+{
+    PipeStat* stats = (PipeStat*)arg;
+
+    for (int i = 0; i < stats->nStages; i++)
+    {
+        if (stats->stages[i].pid > 0 && !stats->stages[i].finished)
+            sampleStage(&stats->stages[i], false);
+    }
+}
+
+/*-------------------------------Interface-----------------------------------------------*/
+
+PipeStat* startPipeStat(Command* command)
+{
+    PipeStat* stats = (PipeStat*)calloc(1, sizeof(PipeStat));
+    if (!stats)
+        return NULL;
+
+    stats->stages = (StageStats*)calloc(command->nSimpleCommands, sizeof(StageStats));
+    if (!stats->stages)
+    {
+        free(stats);
+        return NULL;
+    }
+
+    stats->nStages = command->nSimpleCommands;
+    stats->startTime = monotonicSeconds();
+
+    int nProcesses = 0;
+    for (int i = 0; i < stats->nStages; i++)
+    {
+        int pid = command->simpleCommands[i]->pid;
+        stats->stages[i].pid = pid > 0 ? pid : 0;
+        stats->stages[i].lastSample = stats->startTime;
+        nProcesses += pid > 0;
+    }
+
+    if (nProcesses == 0)
+    {
+        free(stats->stages);
+        free(stats);
+        return NULL;
+    }
+
+    int error = startPeriodicSampler(&stats->sampler, PIPESTAT_INTERVAL_MS, samplePipeline, stats);
+    if (error)
+    {
+        LOG_DEBUG("pthread_create: %s\n", strerror(error));
+        free(stats->stages);
+        free(stats);
+        return NULL;
+    }
+
+    stats->running = true;
+    return stats;
+}
+
+void finishStageStats(PipeStat* stats, pid_t pid)
+{
+    pthread_mutex_lock(&stats->sampler.mutex);
+
+    for (int i = 0; i < stats->nStages; i++)
+    {
+        StageStats* stage = &stats->stages[i];
+        if (stage->pid == pid && !stage->finished)
+        {
+            sampleStage(stage, true);
+            stage->finished = true;
+        }
+    }
+
+    pthread_mutex_unlock(&stats->sampler.mutex);
+}
+
+void stopPipeStat(PipeStat* stats)
+{
+    if (!stats || !stats->running)
+        return;
+
+    pthread_mutex_lock(&stats->sampler.mutex);
+    stats->stopTime = monotonicSeconds();
+    pthread_mutex_unlock(&stats->sampler.mutex);
+
+    stopPeriodicSampler(&stats->sampler);
+    stats->running = false;
+}
+
+// formats a byte count with a binary unit
+static void formatBytes(char* buffer, size_t size, unsigned long long bytes)
+{
+    const char* units = "BKMGT";
+    double value = bytes;
+    int unit = 0;
+
+    while (value >= 1024 && units[unit + 1])
+    {
+        value /= 1024;
+        unit++;
+    }
+
+    if (unit == 0)
+        snprintf(buffer, size, "%lluB", bytes);
+    else
+        snprintf(buffer, size, "%.1f%c", value, units[unit]);
+}
+
+void printPipeStat(PipeStat* stats, Command* command, int fd)
+{
+    pthread_mutex_lock(&stats->sampler.mutex);
+
+    double elapsed = (stats->stopTime ? stats->stopTime : monotonicSeconds()) - stats->startTime;
+
+    // the stage that waited the least on its pipes is the one the others waited for
+    int bottleneck = -1;
+    double leastBlocked = 0, mostBlocked = 0;
+    for (int i = 0; i < stats->nStages; i++)
+    {
+        StageStats* stage = &stats->stages[i];
+        if (stage->pid == 0)
+            continue;
+
+        double blocked = stage->blockedReading + stage->blockedWriting;
+        if (bottleneck == -1 || blocked < leastBlocked)
+        {
+            bottleneck = i;
+            leastBlocked = blocked;
+        }
+        if (blocked > mostBlocked)
+            mostBlocked = blocked;
+    }
+
+    // nobody waited on anybody, there is no bottleneck to point at
+    if (mostBlocked <= leastBlocked)
+        bottleneck = -1;
+
+    dprintf(fd, "pipestat: %.2fs\n", elapsed);
+    dprintf(fd, "  %-5s %-7s %-14s %9s %9s %8s %9s %9s\n", "stage", "pid", "command", "read", "written", "cpu", "in-wait", "out-wait");
+
+    for (int i = 0; i < stats->nStages; i++)
+    {
+        StageStats* stage = &stats->stages[i];
+        const char* name = i < command->nSimpleCommands ? command->simpleCommands[i]->commandName : "?";
+
+        if (stage->pid == 0)
+        {
+            dprintf(fd, "  %-5d %-7s %-14.14s %9s %9s %8s %9s %9s\n", i, "thread", name, "-", "-", "-", "-", "-");
+            continue;
+        }
+
+        char readBytes[16], writtenBytes[16];
+        formatBytes(readBytes, sizeof(readBytes), stage->readBytes);
+        formatBytes(writtenBytes, sizeof(writtenBytes), stage->writtenBytes);
+
+        dprintf(fd, "  %-5d %-7d %-14.14s %9s %9s %7.2fs %8.2fs %8.2fs%s\n", i, (int)stage->pid, name, readBytes, writtenBytes,
+                stage->cpuSeconds, stage->blockedReading, stage->blockedWriting, i == bottleneck ? "  <- bottleneck" : "");
+    }
+
+    pthread_mutex_unlock(&stats->sampler.mutex);
+}
+
+void cleanUpPipeStat(PipeStat* stats)
+{
+    if (!stats)
+        return;
+
+    stopPipeStat(stats);
+
+    destroyPeriodicSampler(&stats->sampler);
+    free(stats->stages);
+    free(stats);
+}
@@ -0,0 +1,27 @@
+/**
+ * @file probes.c
+ * @brief Contains the semaphores of the static probes declared in probes.h. A tracer attaching to a probe increments its semaphore, so the probes that compute their arguments only do it while they are traced.
+ * @version 0.1
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "probes.h"
+
+#ifdef SHELL_PROBES
+
+// sdt.h looks the semaphores up by name, provider_probe_semaphore, in the .probes section
+#define PROBE_SEMAPHORE(name) unsigned short shell_##name##_semaphore __attribute__((section(".probes"))) = 0
+
+PROBE_SEMAPHORE(line__read);
+PROBE_SEMAPHORE(tokens);
+PROBE_SEMAPHORE(parse__done);
+PROBE_SEMAPHORE(spawn__start);
+PROBE_SEMAPHORE(spawn__done);
+PROBE_SEMAPHORE(exec__failed);
+PROBE_SEMAPHORE(child__exit);
+PROBE_SEMAPHORE(builtin__enter);
+PROBE_SEMAPHORE(builtin__exit);
+
+#endif // SHELL_PROBES
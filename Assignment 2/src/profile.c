@@ -0,0 +1,190 @@
+/**
+ * @file profile.c
+ * @brief Contains the function definitions for the line profiler declared in profile.h
+ * @version 0.1
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include "profile.h"
+#include "metrics.h"
+#include "trace.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <unistd.h>
+
+// the totals of a line. The times are in microseconds, except the wall time in nanoseconds
+typedef struct ProfileLine {
+    uint64_t runs;
+    uint64_t wall;
+    uint64_t childUser;
+    uint64_t childSystem;
+    uint64_t shellCPU;
+    uint64_t forks;
+    char* text;             //< the line the first time it ran, NULL for a line that never did
+} ProfileLine;
+
+bool profiling = false;
+
+// indexed by the line number, slot 0 takes the lines past PROFILE_MAX_LINES
+static ProfileLine* lines = NULL;
+static char* scriptName = NULL;
+static char* outputPath = NULL;
+static pid_t profilePid = 0;
+
+static uint64_t microseconds(const struct timeval* tv)
+{
+    return (uint64_t)tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+void startProfileLine(ProfileMark* mark)
+{
+    getrusage(RUSAGE_SELF, &mark->self);
+    getrusage(RUSAGE_CHILDREN, &mark->children);
+    mark->forks = readMetric(METRIC_FORKS);
+    mark->start = traceNow();
+}
+
+void endProfileLine(const ProfileMark* mark, int line, const char* text)
+{
+    uint64_t end = traceNow();
+    struct rusage self, children;
+    getrusage(RUSAGE_SELF, &self);
+    getrusage(RUSAGE_CHILDREN, &children);
+
+    ProfileLine* entry = &lines[line > 0 && line < PROFILE_MAX_LINES ? line : 0];
+    entry->runs++;
+    entry->wall += end - mark->start;
+    entry->childUser += microseconds(&children.ru_utime) - microseconds(&mark->children.ru_utime);
+    entry->childSystem += microseconds(&children.ru_stime) - microseconds(&mark->children.ru_stime);
+    entry->shellCPU += microseconds(&self.ru_utime) + microseconds(&self.ru_stime) - microseconds(&mark->self.ru_utime) - microseconds(&mark->self.ru_stime);
+    entry->forks += readMetric(METRIC_FORKS) - mark->forks;
+
+    if (!entry->text)
+        entry->text = strdup(line > 0 && line < PROFILE_MAX_LINES ? text : "(lines past the table)");
+}
+
+/*-------------------------------Output--------------------------------------------------*/
+
+// the line with the most wall time comes first
+static int compareWall(const void* a, const void* b)
+{
+    const ProfileLine* lineA = &lines[*(const int*)a];
+    const ProfileLine* lineB = &lines[*(const int*)b];
+
+    if (lineA->wall != lineB->wall)
+        return lineA->wall < lineB->wall ? 1 : -1;
+    return *(const int*)a - *(const int*)b;
+}
+
+static void writeReport(FILE* file)
+{
+    int* order = malloc(PROFILE_MAX_LINES * sizeof(int));
+    if (!order)
+    {
+        LOG_ERROR("profile: malloc failure\n");
+        return;
+    }
+
+    int nLines = 0;
+    uint64_t totalWall = 0;
+    for (int i = 0; i < PROFILE_MAX_LINES; i++)
+    {
+        if (lines[i].runs)
+        {
+            order[nLines++] = i;
+            totalWall += lines[i].wall;
+        }
+    }
+    qsort(order, nLines, sizeof(int), compareWall);
+
+    fprintf(file, "profile of %s: %d lines, %.3fs\n", scriptName, nLines, totalWall / 1e9);
+    fprintf(file, "  %6s %6s %10s %6s %10s %10s %10s %6s  %s\n", "line", "runs", "wall", "%", "child usr", "child sys", "shell cpu", "forks", "text");
+
+    for (int i = 0; i < nLines; i++)
+    {
+        ProfileLine* entry = &lines[order[i]];
+        char number[16];
+        snprintf(number, sizeof(number), order[i] ? "%d" : "-", order[i]);
+
+        fprintf(file, "  %6s %6lu %9.3fs %5.1f%% %9.3fs %9.3fs %9.3fs %6lu  %.*s\n",
+                number, (unsigned long)entry->runs, entry->wall / 1e9, totalWall ? 100.0 * entry->wall / totalWall : 0.0,
+                entry->childUser / 1e6, entry->childSystem / 1e6, entry->shellCPU / 1e6, (unsigned long)entry->forks,
+                PROFILE_TEXT_LENGTH, entry->text);
+    }
+
+    free(order);
+}
+
+// the lines are the positions of a single function, kcachegrind annotates the script with the events
+static void writeCallgrind(FILE* file)
+{
+    fprintf(file, "# callgrind format\nversion: 1\ncreator: shell --profile\n");
+    fprintf(file, "cmd: %s\npositions: line\n", scriptName);
+    fprintf(file, "events: Wall ChildUser ChildSys ShellCPU Forks Runs\n");
+    fprintf(file, "event: Wall : wall time (us)\nevent: ChildUser : user CPU of the children (us)\nevent: ChildSys : system CPU of the children (us)\nevent: ShellCPU : CPU of the shell (us)\n");
+    fprintf(file, "fl=%s\nfn=main\n", scriptName);
+
+    for (int i = 1; i < PROFILE_MAX_LINES; i++)
+    {
+        ProfileLine* entry = &lines[i];
+        if (entry->runs)
+        {
+            fprintf(file, "%d %lu %lu %lu %lu %lu %lu\n", i, (unsigned long)(entry->wall / 1000), (unsigned long)entry->childUser,
+                    (unsigned long)entry->childSystem, (unsigned long)entry->shellCPU, (unsigned long)entry->forks, (unsigned long)entry->runs);
+        }
+    }
+}
+
+// writes the results, only the shell that started profiling does. Its forked children exit without writing
+static void writeProfile()
+{
+    if (getpid() != profilePid)
+        return;
+
+    if (!outputPath)
+    {
+        writeReport(stderr);
+        return;
+    }
+
+    FILE* file = fopen(outputPath, "we");
+    if (!file)
+    {
+        LOG_ERROR("profile: %s: %s\n", outputPath, strerror(errno));
+        return;
+    }
+
+    writeCallgrind(file);
+    fclose(file);
+}
+
+int initProfile(const char* script, const char* output)
+{
+    lines = (ProfileLine*)calloc(PROFILE_MAX_LINES, sizeof(ProfileLine));
+    if (!lines)
+    {
+        LOG_ERROR("profile: malloc failure\n");
+        return -1;
+    }
+
+    // kcachegrind finds the source by its path
+    char path[PATH_MAX];
+    if (script && realpath(script, path))
+        script = path;
+
+    scriptName = strdup(script ? script : "(stdin)");
+    if (output)
+        outputPath = strdup(output);
+
+    profilePid = getpid();
+    profiling = true;
+    atexit(writeProfile);
+    return 0;
+}
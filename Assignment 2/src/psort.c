@@ -0,0 +1,973 @@
+/**
+ * @file psort.c
+ * @brief Contains the function definitions for the psort builtin declared in psort.h
+ * @version 0.1
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include "psort.h"
+#include "shell_builtins.h"
+#include "thread_pool.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <unistd.h>
+
+/*----------------------------------------------------------------------------------------*/
+
+typedef struct SortOptions {
+    bool numeric;
+    bool reverse;
+    bool unique;
+    char separator;         // '\0' when fields start at a run of blanks
+    int keyStart;           // first field of the key, 0 for the whole line
+    int keyEnd;             // last field of the key, 0 for the end of the line
+    size_t memoryBudget;
+    const char* file;
+} SortOptions;
+
+// a line with the radix prefix of its key
+typedef struct SortRecord {
+    uint64_t prefix;
+    const char* line;
+    uint32_t length;        // without the newline, which is always there after the line
+    uint32_t keyOffset;
+    uint32_t keyLength;
+} SortRecord;
+
+// a chunk of whole lines, sorted by one task on the pool
+typedef struct SortChunk {
+    char* data;
+    size_t length;
+    size_t capacity;
+
+    SortRecord* records;
+    size_t nRecords;
+
+    const SortOptions* options;
+    bool failed;
+} SortChunk;
+
+// a number of a -n key, split into its digits. Leading zeros of the integer part and trailing zeros of the fraction are dropped
+typedef struct ParsedNumber {
+    bool negative;
+    const char* intDigits;
+    size_t intLength;
+    const char* fracDigits;
+    size_t fracLength;
+} ParsedNumber;
+
+// one input of the k-way merge, either a sorted chunk or a run spilled to disk
+typedef struct MergeSource {
+    SortRecord current;
+    int index;              // earlier input has a lower index, ties go to it so the sort is stable
+
+    SortChunk* chunk;
+    size_t next;
+
+    int fd;
+    char* buffer;
+    size_t capacity;
+    size_t start;
+    size_t length;
+    bool eof;
+} MergeSource;
+
+/*-------------------------------Keys----------------------------------------------------*/
+
+static bool isBlank(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+// returns the end of the field starting at pos
+static size_t fieldEnd(const SortOptions* options, const char* line, size_t length, size_t pos)
+{
+    if (options->separator)
+    {
+        const char* separator = (const char*)memchr(line + pos, options->separator, length - pos);
+        return separator ? (size_t)(separator - line) : length;
+    }
+
+    // without a separator the blanks before a field belong to it
+    while (pos < length && isBlank(line[pos]))
+        pos++;
+    while (pos < length && !isBlank(line[pos]))
+        pos++;
+
+    return pos;
+}
+
+// returns the start of the field after the one starting at pos
+static size_t nextField(const SortOptions* options, const char* line, size_t length, size_t pos)
+{
+    size_t end = fieldEnd(options, line, length, pos);
+    if (options->separator && end < length)
+        end++;
+
+    return end;
+}
+
+static void findKey(const SortOptions* options, const char* line, size_t length, size_t* keyOffset, size_t* keyLength)
+{
+    if (options->keyStart == 0)
+    {
+        *keyOffset = 0;
+        *keyLength = length;
+        return;
+    }
+
+    size_t start = 0;
+    for (int field = 1; field < options->keyStart && start < length; field++)
+        start = nextField(options, line, length, start);
+
+    size_t end = length;
+    if (options->keyEnd)
+    {
+        size_t pos = start;
+        for (int field = options->keyStart; field < options->keyEnd && pos < length; field++)
+            pos = nextField(options, line, length, pos);
+
+        end = fieldEnd(options, line, length, pos);
+    }
+
+    *keyOffset = start;
+    *keyLength = end > start ? end - start : 0;
+}
+
+static void parseNumber(const char* key, size_t length, ParsedNumber* number)
+{
+    size_t i = 0;
+    while (i < length && isBlank(key[i]))
+        i++;
+
+    number->negative = i < length && key[i] == '-';
+    if (number->negative)
+        i++;
+
+    while (i < length && key[i] == '0')
+        i++;
+
+    number->intDigits = key + i;
+    while (i < length && key[i] >= '0' && key[i] <= '9')
+        i++;
+    number->intLength = key + i - number->intDigits;
+
+    number->fracDigits = key + i;
+    number->fracLength = 0;
+    if (i < length && key[i] == '.')
+    {
+        number->fracDigits = key + ++i;
+        while (i < length && key[i] >= '0' && key[i] <= '9')
+            i++;
+        number->fracLength = key + i - number->fracDigits;
+
+        while (number->fracLength > 0 && number->fracDigits[number->fracLength - 1] == '0')
+            number->fracLength--;
+    }
+
+    // -0 is 0
+    if (number->intLength == 0 && number->fracLength == 0)
+        number->negative = false;
+}
+
+static int compareNumbers(const ParsedNumber* a, const ParsedNumber* b)
+{
+    if (a->negative != b->negative)
+        return a->negative ? -1 : 1;
+
+    int result;
+    if (a->intLength != b->intLength)
+        result = a->intLength < b->intLength ? -1 : 1;
+    else if ((result = memcmp(a->intDigits, b->intDigits, a->intLength)) == 0)
+    {
+        size_t common = a->fracLength < b->fracLength ? a->fracLength : b->fracLength;
+        result = memcmp(a->fracDigits, b->fracDigits, common);
+
+        // the trailing zeros are gone, so the longer fraction is the larger one
+        if (result == 0)
+            result = (a->fracLength > b->fracLength) - (a->fracLength < b->fracLength);
+    }
+
+    return a->negative ? -result : result;
+}
+
+static int compareBytes(const char* a, size_t aLength, const char* b, size_t bLength)
+{
+    int result = memcmp(a, b, aLength < bLength ? aLength : bLength);
+    if (result)
+        return result;
+
+    return (aLength > bLength) - (aLength < bLength);
+}
+
+/**
+ * @brief Encodes a number into 64 bits that order like the numbers: the sign, then 6 bits of integer digit count, then the first 14 digits in BCD. Negative numbers take the complement, numbers with more than 62 integer digits share the largest prefix.
+ *
+ */
+static uint64_t numericPrefix(const ParsedNumber* number)
+{
+    const uint64_t magnitudeMask = UINT64_MAX >> 1;
+    uint64_t magnitude;
+
+    if (number->intLength >= 63)
+        magnitude = magnitudeMask;
+    else
+    {
+        magnitude = (uint64_t)number->intLength << 57;
+
+        int shift = 52;
+        for (size_t i = 0; i < number->intLength && shift >= 0; i++, shift -= 4)
+            magnitude |= (uint64_t)(number->intDigits[i] - '0') << shift;
+        for (size_t i = 0; i < number->fracLength && shift >= 0; i++, shift -= 4)
+            magnitude |= (uint64_t)(number->fracDigits[i] - '0') << shift;
+    }
+
+    return number->negative ? magnitudeMask - magnitude : (1ULL << 63) | magnitude;
+}
+
+// the first 8 bytes of a key, big endian so the integers order like the bytes
+static uint64_t bytesPrefix(const char* key, size_t length)
+{
+    uint64_t prefix = 0;
+    for (size_t i = 0; i < 8; i++)
+        prefix = (prefix << 8) | (i < length ? (unsigned char)key[i] : 0);
+
+    return prefix;
+}
+
+static void makeRecord(const SortOptions* options, const char* line, size_t length, SortRecord* record)
+{
+    size_t keyOffset, keyLength;
+    findKey(options, line, length, &keyOffset, &keyLength);
+
+    record->line = line;
+    record->length = length;
+    record->keyOffset = keyOffset;
+    record->keyLength = keyLength;
+
+    if (options->numeric)
+    {
+        ParsedNumber number;
+        parseNumber(line + keyOffset, keyLength, &number);
+        record->prefix = numericPrefix(&number);
+    }
+    else
+        record->prefix = bytesPrefix(line + keyOffset, keyLength);
+
+    // reversed, the radix sort still sorts ascending
+    if (options->reverse)
+        record->prefix = ~record->prefix;
+}
+
+// compares two records, the prefixes first and the full keys only when they are equal. Equal keys fall back to the whole lines, except with -u
+static int compareRecords(const SortOptions* options, const SortRecord* a, const SortRecord* b)
+{
+    if (a->prefix != b->prefix)
+        return a->prefix < b->prefix ? -1 : 1;
+
+    const char* aKey = a->line + a->keyOffset;
+    const char* bKey = b->line + b->keyOffset;
+    int result;
+
+    if (options->numeric)
+    {
+        ParsedNumber aNumber, bNumber;
+        parseNumber(aKey, a->keyLength, &aNumber);
+        parseNumber(bKey, b->keyLength, &bNumber);
+        result = compareNumbers(&aNumber, &bNumber);
+    }
+    else
+        result = compareBytes(aKey, a->keyLength, bKey, b->keyLength);
+
+    if (result == 0 && !options->unique)
+        result = compareBytes(a->line, a->length, b->line, b->length);
+
+    return options->reverse ? -result : result;
+}
+
+/*-------------------------------Chunk sorting-------------------------------------------*/
+
+// LSD radix sort on the prefixes, skipping the bytes every record has in common
+static void radixSort(SortRecord* records, SortRecord* tmp, size_t nRecords)
+{
+    size_t counts[8][256];
+    memset(counts, 0, sizeof(counts));
+
+    for (size_t i = 0; i < nRecords; i++)
+    {
+        for (int byte = 0; byte < 8; byte++)
+            counts[byte][(records[i].prefix >> (8 * byte)) & 0xff]++;
+    }
+
+    SortRecord* src = records;
+    SortRecord* dst = tmp;
+
+    for (int byte = 0; byte < 8; byte++)
+    {
+        size_t offsets[256];
+        size_t sum = 0;
+        bool trivial = false;
+
+        for (int bucket = 0; bucket < 256; bucket++)
+        {
+            if (counts[byte][bucket] == nRecords)
+                trivial = true;
+
+            offsets[bucket] = sum;
+            sum += counts[byte][bucket];
+        }
+
+        if (trivial)
+            continue;
+
+        for (size_t i = 0; i < nRecords; i++)
+            dst[offsets[(src[i].prefix >> (8 * byte)) & 0xff]++] = src[i];
+
+        SortRecord* swap = src;
+        src = dst;
+        dst = swap;
+    }
+
+    if (src != records)
+        memcpy(records, src, nRecords * sizeof(SortRecord));
+}
+
+static void insertionSort(const SortOptions* options, SortRecord* records, size_t nRecords)
+{
+    for (size_t i = 1; i < nRecords; i++)
+    {
+        SortRecord record = records[i];
+        size_t j = i;
+        while (j > 0 && compareRecords(options, &records[j - 1], &record) > 0)
+        {
+            records[j] = records[j - 1];
+            j--;
+        }
+        records[j] = record;
+    }
+}
+
+// stable merge sort, for the records that share a prefix
+static void mergeSort(const SortOptions* options, SortRecord* records, SortRecord* tmp, size_t nRecords)
+{
+    if (nRecords < PSORT_INSERTION_THRESHOLD)
+    {
+        insertionSort(options, records, nRecords);
+        return;
+    }
+
+    size_t half = nRecords / 2;
+    mergeSort(options, records, tmp, half);
+    mergeSort(options, records + half, tmp, nRecords - half);
+
+    // already in order
+    if (compareRecords(options, &records[half - 1], &records[half]) <= 0)
+        return;
+
+    size_t i = 0, j = half, k = 0;
+    while (i < half && j < nRecords)
+        tmp[k++] = compareRecords(options, &records[j], &records[i]) < 0 ? records[j++] : records[i++];
+    while (i < half)
+        tmp[k++] = records[i++];
+    while (j < nRecords)
+        tmp[k++] = records[j++];
+
+    memcpy(records, tmp, nRecords * sizeof(SortRecord));
+}
+
+static void sortChunkTask(void* arg)
+{
+    SortChunk* chunk = (SortChunk*)arg;
+    const SortOptions* options = chunk->options;
+
+    // every line of a chunk ends with a newline
+    size_t nRecords = 0;
+    for (const char* p = chunk->data; (p = (const char*)memchr(p, '\n', chunk->data + chunk->length - p)) != NULL; p++)
+        nRecords++;
+
+    chunk->records = (SortRecord*)malloc(nRecords * sizeof(SortRecord));
+    SortRecord* tmp = (SortRecord*)malloc(nRecords * sizeof(SortRecord));
+    if (nRecords && (!chunk->records || !tmp))
+    {
+        free(tmp);
+        chunk->failed = true;
+        return;
+    }
+
+    const char* line = chunk->data;
+    for (size_t i = 0; i < nRecords; i++)
+    {
+        const char* newline = (const char*)memchr(line, '\n', chunk->data + chunk->length - line);
+        makeRecord(options, line, newline - line, &chunk->records[i]);
+        line = newline + 1;
+    }
+    chunk->nRecords = nRecords;
+
+    radixSort(chunk->records, tmp, nRecords);
+
+    // only the records sharing a prefix need the full comparison
+    for (size_t i = 0; i < nRecords; )
+    {
+        size_t j = i + 1;
+        while (j < nRecords && chunk->records[j].prefix == chunk->records[i].prefix)
+            j++;
+
+        if (j - i > 1)
+            mergeSort(options, chunk->records + i, tmp, j - i);
+
+        i = j;
+    }
+
+    free(tmp);
+}
+
+static SortChunk* initSortChunk(const SortOptions* options, size_t capacity)
+{
+    SortChunk* chunk = (SortChunk*)calloc(1, sizeof(SortChunk));
+    if (!chunk)
+        return NULL;
+
+    chunk->data = (char*)malloc(capacity);
+    if (!chunk->data)
+    {
+        free(chunk);
+        return NULL;
+    }
+
+    chunk->capacity = capacity;
+    chunk->options = options;
+    return chunk;
+}
+
+static void cleanUpSortChunk(SortChunk* chunk)
+{
+    if (!chunk)
+        return;
+
+    free(chunk->data);
+    free(chunk->records);
+    free(chunk);
+}
+
+/*-------------------------------Merging-------------------------------------------------*/
+
+// moves a source to its next record. It returns 1 with a record, 0 once the source is exhausted, -1 on failure
+static int advanceSource(const SortOptions* options, MergeSource* source)
+{
+    if (source->chunk)
+    {
+        if (source->next >= source->chunk->nRecords)
+            return 0;
+
+        source->current = source->chunk->records[source->next++];
+        return 1;
+    }
+
+    while (1)
+    {
+        const char* newline = (const char*)memchr(source->buffer + source->start, '\n', source->length - source->start);
+        if (newline)
+        {
+            const char* line = source->buffer + source->start;
+            makeRecord(options, line, newline - line, &source->current);
+            source->start = newline + 1 - source->buffer;
+            return 1;
+        }
+
+        // the runs are written by us, every line ends with a newline
+        if (source->eof)
+            return 0;
+
+        size_t pending = source->length - source->start;
+        memmove(source->buffer, source->buffer + source->start, pending);
+        source->start = 0;
+        source->length = pending;
+
+        if (source->length == source->capacity)
+        {
+            char* grown = (char*)realloc(source->buffer, source->capacity * 2);
+            if (!grown)
+                return -1;
+
+            source->buffer = grown;
+            source->capacity *= 2;
+        }
+
+        ssize_t nread;
+        while ((nread = read(source->fd, source->buffer + source->length, source->capacity - source->length)) == -1 && errno == EINTR);
+
+        if (nread < 0)
+            return -1;
+        if (nread == 0)
+            source->eof = true;
+
+        source->length += nread;
+    }
+}
+
+static bool sourceLess(const SortOptions* options, const MergeSource* a, const MergeSource* b)
+{
+    int result = compareRecords(options, &a->current, &b->current);
+    return result < 0 || (result == 0 && a->index < b->index);
+}
+
+static void siftDown(const SortOptions* options, MergeSource** heap, size_t size, size_t i)
+{
+    while (1)
+    {
+        size_t smallest = i;
+        size_t left = 2 * i + 1;
+        size_t right = left + 1;
+
+        if (left < size && sourceLess(options, heap[left], heap[smallest]))
+            smallest = left;
+        if (right < size && sourceLess(options, heap[right], heap[smallest]))
+            smallest = right;
+
+        if (smallest == i)
+            return;
+
+        MergeSource* swap = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = swap;
+        i = smallest;
+    }
+}
+
+// k-way merge of the spilled runs and the sorted chunks into output
+static int mergeSources(const SortOptions* options, int* runs, size_t nRuns, SortChunk** chunks, size_t nChunks, Stream* output)
+{
+    size_t nSources = nRuns + nChunks;
+    MergeSource* sources = (MergeSource*)calloc(nSources ? nSources : 1, sizeof(MergeSource));
+    MergeSource** heap = (MergeSource**)calloc(nSources ? nSources : 1, sizeof(MergeSource*));
+    int status = 0;
+
+    if (!sources || !heap)
+    {
+        free(sources);
+        free(heap);
+        return -1;
+    }
+
+    // the runs hold the earlier input, so they come first
+    for (size_t i = 0; i < nSources; i++)
+    {
+        MergeSource* source = &sources[i];
+        source->index = i;
+
+        if (i < nRuns)
+        {
+            source->fd = runs[i];
+            source->capacity = PSORT_RUN_BUFFER_SIZE;
+            source->buffer = (char*)malloc(source->capacity);
+            if (!source->buffer || lseek(source->fd, 0, SEEK_SET) == -1)
+                status = -1;
+        }
+        else
+            source->chunk = chunks[i - nRuns];
+    }
+
+    size_t heapSize = 0;
+    for (size_t i = 0; status == 0 && i < nSources; i++)
+    {
+        int advanced = advanceSource(options, &sources[i]);
+        if (advanced < 0)
+            status = -1;
+        else if (advanced)
+            heap[heapSize++] = &sources[i];
+    }
+
+    for (size_t i = heapSize / 2; i-- > 0; )
+        siftDown(options, heap, heapSize, i);
+
+    // with -u the last line written is kept, the sources may reuse its memory
+    char* last = NULL;
+    size_t lastCapacity = 0;
+    SortRecord lastRecord;
+    bool haveLast = false;
+
+    while (status == 0 && heapSize > 0)
+    {
+        MergeSource* top = heap[0];
+        SortRecord* record = &top->current;
+
+        if (!options->unique || !haveLast || compareRecords(options, &lastRecord, record) != 0)
+        {
+            if (streamWrite(output, record->line, record->length + 1) != 0)
+            {
+                status = -1;
+                break;
+            }
+
+            if (options->unique)
+            {
+                if (record->length + 1 > lastCapacity)
+                {
+                    char* grown = (char*)realloc(last, record->length + 1);
+                    if (!grown)
+                    {
+                        status = -1;
+                        break;
+                    }
+                    last = grown;
+                    lastCapacity = record->length + 1;
+                }
+
+                memcpy(last, record->line, record->length + 1);
+                makeRecord(options, last, record->length, &lastRecord);
+                haveLast = true;
+            }
+        }
+
+        int advanced = advanceSource(options, top);
+        if (advanced < 0)
+            status = -1;
+        else if (!advanced)
+            heap[0] = heap[--heapSize];
+
+        siftDown(options, heap, heapSize, 0);
+    }
+
+    for (size_t i = 0; i < nRuns; i++)
+        free(sources[i].buffer);
+
+    free(last);
+    free(sources);
+    free(heap);
+    return status;
+}
+
+// merges the sorted chunks into a run in the temporary directory, the fd is returned unlinked
+static int spillRun(const SortOptions* options, SortChunk** chunks, size_t nChunks)
+{
+    const char* dir = getenv("TMPDIR");
+    if (!dir || !*dir)
+        dir = "/tmp";
+
+    char path[MAX_PATH_LENGTH];
+    snprintf(path, sizeof(path), "%s/psort-XXXXXX", dir);
+
+    int fd = mkostemp(path, O_CLOEXEC);
+    if (fd == -1)
+    {
+        LOG_ERROR("psort: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    unlink(path);
+
+    Stream run;
+    initFDStream(&run, fd, true);
+
+    if (mergeSources(options, NULL, 0, chunks, nChunks, &run) != 0 || streamClose(&run) != 0)
+    {
+        LOG_ERROR("psort: failed to write a run: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    LOG_DEBUG("psort: spilled %zu chunks\n", nChunks);
+    return fd;
+}
+
+/*-------------------------------Builtin-------------------------------------------------*/
+
+// parses a -S size, KiB unless a suffix says otherwise
+static bool parseSize(const char* str, size_t* size)
+{
+    char* end;
+    unsigned long long value = strtoull(str, &end, 10);
+    if (end == str)
+        return false;
+
+    switch (*end)
+    {
+        case 'b': case 'B': break;
+        case '\0': case 'k': case 'K': value <<= 10; break;
+        case 'm': case 'M': value <<= 20; break;
+        case 'g': case 'G': value <<= 30; break;
+        default: return false;
+    }
+
+    if (*end && end[1] != '\0')
+        return false;
+
+    *size = value;
+    return value > 0;
+}
+
+// parses -k start[,end]
+static bool parseKey(const char* str, SortOptions* options)
+{
+    char* end;
+    long start = strtol(str, &end, 10);
+    if (end == str || start < 1 || start > INT32_MAX)
+        return false;
+
+    long last = 0;
+    if (*end == ',')
+    {
+        const char* lastStr = end + 1;
+        last = strtol(lastStr, &end, 10);
+        if (end == lastStr || last < start || last > INT32_MAX)
+            return false;
+    }
+
+    if (*end != '\0')
+        return false;
+
+    options->keyStart = start;
+    options->keyEnd = last;
+    return true;
+}
+
+static bool parseSortOptions(SimpleCommand* simpleCommand, SortOptions* options)
+{
+    memset(options, 0, sizeof(SortOptions));
+    options->memoryBudget = PSORT_DEFAULT_MEMORY;
+
+    bool endOfOptions = false;
+    for (int i = 1; i < simpleCommand->argc; i++)
+    {
+        const char* arg = simpleCommand->args[i];
+
+        if (endOfOptions || arg[0] != '-' || arg[1] == '\0')
+        {
+            if (options->file)
+                return false;
+
+            options->file = arg;
+            continue;
+        }
+
+        if (strcmp(arg, "--") == 0)
+        {
+            endOfOptions = true;
+            continue;
+        }
+
+        for (const char* flag = arg + 1; *flag; flag++)
+        {
+            if (*flag == 'n' || *flag == 'r' || *flag == 'u')
+            {
+                options->numeric |= *flag == 'n';
+                options->reverse |= *flag == 'r';
+                options->unique |= *flag == 'u';
+                continue;
+            }
+
+            // the other options take a value, either the rest of this arg or the next arg
+            const char* value = flag[1] ? flag + 1 : (i + 1 < simpleCommand->argc ? simpleCommand->args[++i] : NULL);
+            if (!value)
+                return false;
+
+            if (*flag == 't' && strlen(value) == 1)
+                options->separator = value[0];
+            else if (*flag == 'k' && parseKey(value, options))
+                ;
+            else if (*flag == 'S' && parseSize(value, &options->memoryBudget))
+                ;
+            else
+                return false;
+
+            break;
+        }
+    }
+
+    return true;
+}
+
+int psortStream(SimpleCommand* simpleCommand, Stream* input, Stream* output)
+{
+    SortOptions options;
+    if (!parseSortOptions(simpleCommand, &options))
+    {
+        LOG_ERROR("psort: Usage: psort [-n] [-r] [-u] [-t char] [-k start[,end]] [-S size] [file]\n");
+        return -1;
+    }
+
+    Stream fileStream;
+    int fileFD = -1;
+    if (options.file)
+    {
+        fileFD = open(options.file, O_RDONLY | O_CLOEXEC);
+        if (fileFD == -1)
+        {
+            LOG_ERROR("psort: %s: %s\n", options.file, strerror(errno));
+            return -1;
+        }
+
+        initFDStream(&fileStream, fileFD, false);
+        input = &fileStream;
+    }
+
+    ThreadPool* pool = initThreadPool(0, 0);
+
+    if (!pool)
+    {
+        LOG_ERROR("psort: failed to start the thread pool\n");
+        if (fileFD != -1)
+            close(fileFD);
+        return -1;
+    }
+
+    // chunks small enough that every worker has a couple of them in flight within the budget
+    size_t chunkSize = options.memoryBudget / (4 * (size_t)getThreadPoolSize(pool));
+    if (chunkSize > PSORT_CHUNK_SIZE)
+        chunkSize = PSORT_CHUNK_SIZE;
+    if (chunkSize < PSORT_MIN_CHUNK_SIZE)
+        chunkSize = PSORT_MIN_CHUNK_SIZE;
+
+    SortChunk** chunks = NULL;
+    size_t nChunks = 0;
+    int* runs = NULL;
+    size_t nRuns = 0;
+    size_t memoryUsed = 0;
+    int status = 0;
+    bool eof = false;
+
+    SortChunk* current = initSortChunk(&options, chunkSize);
+    if (!current)
+        status = -1;
+
+    while (status == 0 && !eof)
+    {
+        // one byte is kept for the newline a last line may be missing
+        if (current->length + 1 >= current->capacity)
+        {
+            char* grown = (char*)realloc(current->data, current->capacity * 2);
+            if (!grown)
+            {
+                status = -1;
+                break;
+            }
+            current->data = grown;
+            current->capacity *= 2;
+        }
+
+        ssize_t nread = streamRead(input, current->data + current->length, current->capacity - current->length - 1);
+        if (nread < 0)
+        {
+            LOG_ERROR("psort: read error: %s\n", strerror(errno));
+            status = -1;
+            break;
+        }
+
+        eof = nread == 0;
+        current->length += nread;
+
+        if (!eof && current->length + 1 < current->capacity)
+            continue;
+
+        SortChunk* next = NULL;
+        if (eof)
+        {
+            if (current->length > 0 && current->data[current->length - 1] != '\n')
+                current->data[current->length++] = '\n';
+        }
+        else
+        {
+            // the chunk is full, the partial line at its end moves to the next one. A line longer than a chunk grows it
+            const char* lastNewline = (const char*)memrchr(current->data, '\n', current->length);
+            if (!lastNewline)
+                continue;
+
+            size_t pending = current->data + current->length - (lastNewline + 1);
+            next = initSortChunk(&options, pending * 2 > chunkSize ? pending * 2 : chunkSize);
+            if (!next)
+            {
+                status = -1;
+                break;
+            }
+
+            memcpy(next->data, lastNewline + 1, pending);
+            next->length = pending;
+            current->length -= pending;
+        }
+
+        if (current->length == 0)
+            cleanUpSortChunk(current);
+        else
+        {
+            SortChunk** grown = (SortChunk**)realloc(chunks, (nChunks + 1) * sizeof(SortChunk*));
+            if (!grown)
+            {
+                cleanUpSortChunk(current);
+                cleanUpSortChunk(next);
+                status = -1;
+                break;
+            }
+
+            chunks = grown;
+            chunks[nChunks++] = current;
+            submitTask(pool, sortChunkTask, current);
+
+            // the data and, roughly, its records
+            memoryUsed += current->capacity + current->length / 2;
+        }
+
+        current = next;
+
+        // over the budget, the chunks so far become a run on disk
+        if (memoryUsed >= options.memoryBudget && !eof)
+        {
+            waitThreadPool(pool);
+
+            for (size_t i = 0; i < nChunks; i++)
+                status |= chunks[i]->failed ? -1 : 0;
+
+            int* grownRuns = status == 0 ? (int*)realloc(runs, (nRuns + 1) * sizeof(int)) : NULL;
+            int fd = grownRuns ? spillRun(&options, chunks, nChunks) : -1;
+
+            if (grownRuns)
+                runs = grownRuns;
+            if (fd == -1)
+                status = -1;
+            else
+                runs[nRuns++] = fd;
+
+            for (size_t i = 0; i < nChunks; i++)
+                cleanUpSortChunk(chunks[i]);
+            nChunks = 0;
+            memoryUsed = 0;
+        }
+    }
+
+    waitThreadPool(pool);
+    cleanUpThreadPool(pool);
+
+    for (size_t i = 0; i < nChunks; i++)
+        status |= chunks[i]->failed ? -1 : 0;
+
+    if (status == 0 && mergeSources(&options, runs, nRuns, chunks, nChunks, output) != 0)
+        status = -1;
+
+    if (status != 0 && output->error != EPIPE)
+        LOG_ERROR("psort: failed: %s\n", strerror(errno));
+
+    if (!eof)
+        cleanUpSortChunk(current);
+    for (size_t i = 0; i < nChunks; i++)
+        cleanUpSortChunk(chunks[i]);
+    for (size_t i = 0; i < nRuns; i++)
+        close(runs[i]);
+
+    free(chunks);
+    free(runs);
+
+    if (fileFD != -1)
+        close(fileFD);
+
+    return status;
+}
+
+int psort(SimpleCommand* simpleCommand)
+{
+    return runStreamBuiltin(simpleCommand, psortStream);
+}
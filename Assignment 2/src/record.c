@@ -0,0 +1,457 @@
+/**
+ * @file record.c
+ * @brief Contains the function definitions for the session recording and replay declared in record.h
+ * @version 0.1
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include "record.h"
+#include "trace.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+// a varint takes at most 10 bytes
+#define VARINT_MAX 10
+
+// a line read but not written yet, its top-level line hasn't ended
+typedef struct PendingLine {
+    uint64_t read;          //< traceNow()
+    char* text;
+    char* cwd;
+} PendingLine;
+
+typedef struct ReplayLine {
+    uint64_t offset;        //< us since the start of the recording
+    uint64_t duration;      //< us
+    int status;
+    char* cwd;              //< shared by the lines in the same directory
+    char* text;
+} ReplayLine;
+
+bool recording = false;
+bool replaying = false;
+
+static int recordFD = -1;
+static pid_t recordPid = 0;
+static uint64_t lastRead = 0;
+static char* lastCwd = NULL;
+static PendingLine* pending = NULL;
+static int nPending = 0;
+
+static ReplayLine* replayLines = NULL;
+static int nReplayLines = 0;
+static int nextReplay = 0;
+static char* replayName = NULL;
+static char* recordedRoot = NULL;
+static char* sandboxRoot = NULL;
+static bool replayFast = false;
+static uint64_t replayStart = 0;
+static pid_t replayPid = 0;
+static int statusChecked = -1;      //< the last line fed, its status is checked at the end of the top-level line
+static int mismatches = 0;
+
+/*-------------------------------Varints-------------------------------------------------*/
+
+static size_t putVarint(unsigned char* out, uint64_t value)
+{
+    size_t length = 0;
+    while (value >= 0x80)
+    {
+        out[length++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    out[length++] = value;
+    return length;
+}
+
+// reads a varint at *position, returns -1 if the data ends inside it
+static int getVarint(const unsigned char* data, size_t size, size_t* position, uint64_t* value)
+{
+    *value = 0;
+    for (int shift = 0; shift < 64 && *position < size; shift += 7)
+    {
+        unsigned char byte = data[(*position)++];
+        *value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return 0;
+    }
+
+    return -1;
+}
+
+static uint64_t zigzag(int64_t value)
+{
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static int64_t unzigzag(uint64_t value)
+{
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+// reads a varint length and as many bytes, as a new string
+static char* getString(const unsigned char* data, size_t size, size_t* position, uint64_t length)
+{
+    if (length > size - *position)
+        return NULL;
+
+    char* str = strndup((const char*)data + *position, length);
+    *position += length;
+    return str;
+}
+
+/*-------------------------------Record--------------------------------------------------*/
+
+static int writeAll(const unsigned char* data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t written = write(recordFD, data, length);
+        if (written == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        data += written;
+        length -= written;
+    }
+
+    return 0;
+}
+
+// writes the pending lines with the status and run time of their top-level line
+static void writePending(int status, uint64_t end)
+{
+    for (int i = 0; i < nPending; i++)
+    {
+        PendingLine* line = &pending[i];
+        size_t textLength = strlen(line->text);
+        bool sameCwd = lastCwd && strcmp(lastCwd, line->cwd) == 0;
+        size_t cwdLength = sameCwd ? 0 : strlen(line->cwd);
+
+        unsigned char* buffer = malloc(5 * VARINT_MAX + cwdLength + textLength);
+        if (!buffer)
+        {
+            LOG_ERROR("record: malloc failure\n");
+            break;
+        }
+
+        size_t length = putVarint(buffer, (line->read - lastRead) / 1000);
+        length += putVarint(buffer + length, (end - pending[0].read) / 1000);
+        length += putVarint(buffer + length, zigzag(status));
+        length += putVarint(buffer + length, sameCwd ? 0 : cwdLength + 1);
+        memcpy(buffer + length, line->cwd, cwdLength);
+        length += cwdLength;
+        length += putVarint(buffer + length, textLength);
+        memcpy(buffer + length, line->text, textLength);
+        length += textLength;
+
+        // the deltas are taken in whole microseconds, so they don't drift
+        lastRead += (line->read - lastRead) / 1000 * 1000;
+
+        if (writeAll(buffer, length) == -1)
+            LOG_ERROR("record: write: %s\n", strerror(errno));
+        free(buffer);
+
+        if (!sameCwd)
+        {
+            free(lastCwd);
+            lastCwd = line->cwd;
+            line->cwd = NULL;
+        }
+        free(line->cwd);
+        free(line->text);
+    }
+
+    nPending = 0;
+}
+
+// writes the lines read since the last top-level line, like the exit that ended the session. Only the recording shell does
+static void closeRecord()
+{
+    if (getpid() != recordPid)
+        return;
+
+    writePending(0, traceNow());
+    close(recordFD);
+}
+
+int initRecord(const char* path)
+{
+    recordFD = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (recordFD == -1)
+    {
+        LOG_ERROR("record: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd)))
+        strcpy(cwd, "/");
+
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+
+    size_t cwdLength = strlen(cwd);
+    unsigned char header[sizeof(RECORD_MAGIC) + 3 * VARINT_MAX + PATH_MAX];
+    memcpy(header, RECORD_MAGIC, sizeof(RECORD_MAGIC) - 1);
+    size_t length = sizeof(RECORD_MAGIC) - 1;
+    length += putVarint(header + length, RECORD_VERSION);
+    length += putVarint(header + length, (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec);
+    length += putVarint(header + length, cwdLength);
+    memcpy(header + length, cwd, cwdLength);
+    length += cwdLength;
+
+    if (writeAll(header, length) == -1)
+    {
+        LOG_ERROR("record: %s: %s\n", path, strerror(errno));
+        close(recordFD);
+        return -1;
+    }
+
+    lastRead = traceNow();
+    recordPid = getpid();
+    recording = true;
+    atexit(closeRecord);
+    return 0;
+}
+
+void recordInput(const char* line)
+{
+    if (!recording || line[0] == '\0')
+        return;
+
+    PendingLine* temp = realloc(pending, (nPending + 1) * sizeof(PendingLine));
+    if (!temp)
+    {
+        LOG_ERROR("record: malloc failure\n");
+        return;
+    }
+    pending = temp;
+
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd)))
+        strcpy(cwd, "/");
+
+    PendingLine* entry = &pending[nPending];
+    entry->read = traceNow();
+    entry->text = strdup(line);
+    entry->cwd = strdup(cwd);
+    if (!entry->text || !entry->cwd)
+    {
+        LOG_ERROR("record: malloc failure\n");
+        free(entry->text);
+        free(entry->cwd);
+        return;
+    }
+    nPending++;
+}
+
+void endRecordedLine(int status)
+{
+    if (recording)
+        writePending(status, traceNow());
+
+    if (replaying && statusChecked != -1)
+    {
+        ReplayLine* line = &replayLines[statusChecked];
+        if (line->status != status)
+        {
+            LOG_ERROR("replay: line %d '%s' exited %d, recorded %d\n", statusChecked + 1, line->text, status, line->status);
+            mismatches++;
+        }
+        statusChecked = -1;
+    }
+}
+
+/*-------------------------------Replay--------------------------------------------------*/
+
+// the summary, written by the replaying shell only
+static void writeReplaySummary()
+{
+    if (getpid() != replayPid)
+        return;
+
+    uint64_t recorded = 0;
+    if (nReplayLines > 0)
+        recorded = replayLines[nReplayLines - 1].offset + replayLines[nReplayLines - 1].duration;
+
+    fprintf(stderr, "replay of %s: %d of %d lines in %.3fs, recorded in %.3fs, %d exit status mismatches\n", replayName,
+            nextReplay, nReplayLines, (traceNow() - replayStart) / 1e9, recorded / 1e6, mismatches);
+}
+
+static int readFile(const char* path, unsigned char** data, size_t* size)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !(*data = malloc(st.st_size + 1)))
+    {
+        close(fd);
+        return -1;
+    }
+
+    size_t done = 0;
+    while (done < (size_t)st.st_size)
+    {
+        ssize_t n = read(fd, *data + done, st.st_size - done);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        done += n;
+    }
+
+    close(fd);
+    *size = done;
+    return 0;
+}
+
+// decodes the lines of a recording, returns -1 if it is malformed
+static int decodeRecording(const unsigned char* data, size_t size)
+{
+    size_t magicLength = sizeof(RECORD_MAGIC) - 1;
+    if (size < magicLength || memcmp(data, RECORD_MAGIC, magicLength) != 0)
+        return -1;
+
+    size_t position = magicLength;
+    uint64_t version, startTime, length;
+    if (getVarint(data, size, &position, &version) || version != RECORD_VERSION
+        || getVarint(data, size, &position, &startTime) || getVarint(data, size, &position, &length)
+        || !(recordedRoot = getString(data, size, &position, length)))
+        return -1;
+
+    uint64_t offset = 0;
+    char* cwd = recordedRoot;
+    while (position < size)
+    {
+        uint64_t delta, duration, status, cwdLength, textLength;
+        if (getVarint(data, size, &position, &delta) || getVarint(data, size, &position, &duration)
+            || getVarint(data, size, &position, &status) || getVarint(data, size, &position, &cwdLength))
+            return -1;
+
+        if (cwdLength > 0 && !(cwd = getString(data, size, &position, cwdLength - 1)))
+            return -1;
+
+        char* text;
+        if (getVarint(data, size, &position, &textLength) || !(text = getString(data, size, &position, textLength)))
+            return -1;
+
+        ReplayLine* temp = realloc(replayLines, (nReplayLines + 1) * sizeof(ReplayLine));
+        if (!temp)
+        {
+            free(text);
+            return -1;
+        }
+        replayLines = temp;
+
+        offset += delta;
+        replayLines[nReplayLines++] = (ReplayLine){ offset, duration, (int)unzigzag(status), cwd, text };
+    }
+
+    return 0;
+}
+
+int initReplay(const char* path, bool fast, const char* sandbox)
+{
+    unsigned char* data;
+    size_t size;
+    if (readFile(path, &data, &size) == -1)
+    {
+        LOG_ERROR("replay: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    int status = decodeRecording(data, size);
+    free(data);
+    if (status == -1)
+    {
+        LOG_ERROR("replay: %s: not a recording of this shell, or truncated\n", path);
+        return -1;
+    }
+
+    // the replay starts in the sandbox, the recorded starting directory
+    if (sandbox)
+    {
+        char resolved[PATH_MAX];
+        if (!realpath(sandbox, resolved) || chdir(resolved) == -1)
+        {
+            LOG_ERROR("replay: %s: %s\n", sandbox, strerror(errno));
+            return -1;
+        }
+        sandboxRoot = strdup(resolved);
+    }
+
+    replayName = strdup(path);
+    replayFast = fast;
+    replayStart = traceNow();
+    replayPid = getpid();
+    replaying = true;
+    atexit(writeReplaySummary);
+    return 0;
+}
+
+// the directory a line runs in: the recorded one, or with a sandbox, the recorded one moved from the starting directory to the sandbox
+static void enterDirectory(const char* cwd)
+{
+    char path[PATH_MAX];
+    if (sandboxRoot)
+    {
+        size_t rootLength = strlen(recordedRoot);
+        if (strncmp(cwd, recordedRoot, rootLength) != 0 || (cwd[rootLength] != '/' && cwd[rootLength] != '\0'))
+        {
+            LOG_DEBUG("replay: %s is outside the recorded %s, the line runs where it is\n", cwd, recordedRoot);
+            return;
+        }
+        snprintf(path, sizeof(path), "%s%s", sandboxRoot, strcmp(recordedRoot, "/") == 0 ? cwd : cwd + rootLength);
+        cwd = path;
+    }
+
+    char current[PATH_MAX];
+    if (getcwd(current, sizeof(current)) && strcmp(current, cwd) == 0)
+        return;
+
+    if (chdir(cwd) == -1)
+        LOG_DEBUG("replay: %s: %s, the line runs where it is\n", cwd, strerror(errno));
+}
+
+char* nextReplayLine()
+{
+    if (nextReplay >= nReplayLines)
+        return NULL;
+
+    ReplayLine* line = &replayLines[nextReplay];
+
+    // at the recorded pace, a line waits for its time since the start. Signals from the children cut the sleep short
+    if (!replayFast)
+    {
+        uint64_t due = replayStart + line->offset * 1000;
+        struct timespec ts = { due / 1000000000ULL, due % 1000000000ULL };
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+    }
+
+    enterDirectory(line->cwd);
+
+    // a task block's lines are fed inside its top-level line, the status is checked against the first of them
+    if (statusChecked == -1)
+        statusChecked = nextReplay;
+
+    nextReplay++;
+    return strdup(line->text);
+}
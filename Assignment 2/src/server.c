@@ -0,0 +1,470 @@
+/**
+ * @file server.c
+ * @brief Contains the function definitions for the shell server declared in server.h
+ * @version 0.1
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include "server.h"
+#include "path_cache.h"
+#include "shell_builtins.h"
+#include "parser.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+/*----------------------------------------------------------------------------------------*/
+
+// a script kept in memory by the server
+typedef struct CachedScript {
+    char* path;
+    off_t size;
+    struct timespec mtime;
+
+    char* content;
+    size_t length;
+
+    struct CachedScript* next;
+} CachedScript;
+
+// a request received from a client
+typedef struct ServerRequest {
+    char* strings;      // the NUL terminated strings of the request
+    const char* cwd;
+    const char* script;
+    char** env;         // NULL terminated, points into strings
+    int fds[SERVER_PASSED_FDS];
+} ServerRequest;
+
+// most recently used first
+static CachedScript* scriptCache = NULL;
+
+/*-------------------------------Script cache--------------------------------------------*/
+
+static void freeCachedScript(CachedScript* script)
+{
+    free(script->path);
+    free(script->content);
+    free(script);
+}
+
+// looks the commands of every line of a script up in PATH, so the workers inherit the resolved paths
+static void warmPathCache(const char* content, size_t length)
+{
+    const char* line = content;
+    while (line < content + length)
+    {
+        const char* end = memchr(line, '\n', content + length - line);
+        size_t lineLength = end ? (size_t)(end - line) : (size_t)(content + length - line);
+
+        char* copy = strndup(line, lineLength);
+        char** tokens = copy ? tokenizeString(copy, ' ') : NULL;
+
+        // the first word, and every word after a pipe or a chaining operator, is a command
+        bool commandPosition = true;
+        for (int i = 0; tokens && tokens[i] != NULL; i++)
+        {
+            if (IGNORE(tokens[i]))
+                continue;
+
+            if (IS_PIPE(tokens[i]) || IS_CHAINING_OPERATOR(tokens[i]))
+            {
+                commandPosition = true;
+                continue;
+            }
+
+            if (commandPosition && getExecutionFunction(tokens[i]) == executeProcess)
+                resolveCommandPath(tokens[i]);
+
+            commandPosition = false;
+        }
+
+        if (tokens)
+            freeTokens(tokens);
+        free(copy);
+
+        line = end ? end + 1 : content + length;
+    }
+}
+
+// returns the contents of a script, from the cache when the file hasn't changed
+static CachedScript* loadScript(const char* path)
+{
+    struct stat st;
+    if (stat(path, &st) == -1 || !S_ISREG(st.st_mode))
+        return NULL;
+
+    CachedScript* prev = NULL;
+    for (CachedScript* script = scriptCache; script; prev = script, script = script->next)
+    {
+        if (strcmp(script->path, path) != 0)
+            continue;
+
+        if (script->size == st.st_size && script->mtime.tv_sec == st.st_mtim.tv_sec && script->mtime.tv_nsec == st.st_mtim.tv_nsec)
+        {
+            // move it to the front
+            if (prev)
+            {
+                prev->next = script->next;
+                script->next = scriptCache;
+                scriptCache = script;
+            }
+            return script;
+        }
+
+        // the file changed, drop the stale copy
+        if (prev)
+            prev->next = script->next;
+        else
+            scriptCache = script->next;
+        freeCachedScript(script);
+        break;
+    }
+
+    CachedScript* script = (CachedScript*)calloc(1, sizeof(CachedScript));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (!script || fd == -1)
+    {
+        free(script);
+        if (fd != -1)
+            close(fd);
+        return NULL;
+    }
+
+    script->path = strdup(path);
+    script->size = st.st_size;
+    script->mtime = st.st_mtim;
+    script->content = (char*)malloc(st.st_size + 1);
+
+    size_t used = 0;
+    while (script->content && used < (size_t)st.st_size)
+    {
+        ssize_t nread = read(fd, script->content + used, st.st_size - used);
+        if (nread == -1 && errno == EINTR)
+            continue;
+        if (nread <= 0)
+            break;
+        used += nread;
+    }
+    close(fd);
+
+    if (!script->path || !script->content || used != (size_t)st.st_size)
+    {
+        freeCachedScript(script);
+        return NULL;
+    }
+
+    script->content[used] = '\0';
+    script->length = used;
+    warmPathCache(script->content, script->length);
+
+    script->next = scriptCache;
+    scriptCache = script;
+
+    // keep the cache bounded, the least recently used scripts go first
+    int count = 0;
+    for (CachedScript* entry = scriptCache; entry; entry = entry->next)
+    {
+        if (++count == SERVER_SCRIPT_CACHE_ENTRIES && entry->next)
+        {
+            CachedScript* stale = entry->next;
+            entry->next = NULL;
+            while (stale)
+            {
+                CachedScript* next = stale->next;
+                freeCachedScript(stale);
+                stale = next;
+            }
+            break;
+        }
+    }
+
+    LOG_DEBUG("server: cached script %s (%zu bytes)\n", path, used);
+    return script;
+}
+
+/*-------------------------------Requests------------------------------------------------*/
+
+static void cleanUpRequest(ServerRequest* request)
+{
+    for (int i = 0; i < SERVER_PASSED_FDS; i++)
+    {
+        if (request->fds[i] != -1)
+            close(request->fds[i]);
+        request->fds[i] = -1;
+    }
+
+    free(request->env);
+    free(request->strings);
+    request->env = NULL;
+    request->strings = NULL;
+}
+
+// reads exactly length bytes
+static int readFully(int fd, void* buffer, size_t length)
+{
+    size_t used = 0;
+    while (used < length)
+    {
+        ssize_t nread = read(fd, (char*)buffer + used, length - used);
+        if (nread == -1 && errno == EINTR)
+            continue;
+        if (nread <= 0)
+            return -1;
+        used += nread;
+    }
+
+    return 0;
+}
+
+// receives the header with the client's fds, then the strings of the request
+static int receiveRequest(int connection, ServerRequest* request)
+{
+    memset(request, 0, sizeof(ServerRequest));
+    for (int i = 0; i < SERVER_PASSED_FDS; i++)
+        request->fds[i] = -1;
+
+    ServerRequestHeader header;
+    struct iovec iov = { .iov_base = &header, .iov_len = sizeof(header) };
+
+    union {
+        char buffer[CMSG_SPACE(SERVER_PASSED_FDS * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.buffer;
+    message.msg_controllen = sizeof(control.buffer);
+
+    ssize_t received;
+    while ((received = recvmsg(connection, &message, MSG_CMSG_CLOEXEC)) == -1 && errno == EINTR);
+
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&message); received > 0 && cmsg; cmsg = CMSG_NXTHDR(&message, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS && cmsg->cmsg_len == CMSG_LEN(SERVER_PASSED_FDS * sizeof(int)))
+            memcpy(request->fds, CMSG_DATA(cmsg), SERVER_PASSED_FDS * sizeof(int));
+    }
+
+    if (received != sizeof(header) || header.magic != SERVER_PROTOCOL_MAGIC || header.length == 0 || header.length > SERVER_MAX_REQUEST_LENGTH || request->fds[0] == -1)
+    {
+        LOG_DEBUG("server: malformed request\n");
+        return -1;
+    }
+
+    // the rest of the header may have arrived with it, read whatever remains
+    request->strings = (char*)malloc(header.length + 1);
+    request->env = (char**)calloc(header.envCount + 1, sizeof(char*));
+    if (!request->strings || !request->env || readFully(connection, request->strings, header.length) != 0)
+    {
+        LOG_DEBUG("server: failed to read the request\n");
+        return -1;
+    }
+    request->strings[header.length] = '\0';
+
+    // split the strings: cwd, script, then the environment
+    char* p = request->strings;
+    char* end = request->strings + header.length;
+    request->cwd = p;
+    p += strlen(p) + 1;
+    if (p >= end)
+        return -1;
+    request->script = p;
+    p += strlen(p) + 1;
+
+    for (uint32_t i = 0; i < header.envCount && p < end; i++)
+    {
+        request->env[i] = p;
+        p += strlen(p) + 1;
+    }
+
+    return 0;
+}
+
+/*-------------------------------Workers-------------------------------------------------*/
+
+// sends the exit status of the script to the client
+static void sendStatus(int connection, int32_t status)
+{
+    if (write(connection, &status, sizeof(status)) != sizeof(status))
+        LOG_DEBUG("server: failed to send the status\n");
+}
+
+// `exit N` in a script exits the worker from inside the builtin, the client still gets N
+static void sendStatusOnExit(int status, void* connection)
+{
+    fflush(stdout);
+    sendStatus((int)(intptr_t)connection, status);
+}
+
+// takes over the client's context and runs the script. Never returns
+static void runWorker(int connection, ServerRequest* request, CachedScript* script, ScriptRunner runScript)
+{
+    int32_t status = 1;
+
+    // the client's stdio becomes ours
+    for (int i = 0; i < SERVER_PASSED_FDS; i++)
+    {
+        if (dup2(request->fds[i], i) == -1)
+        {
+            LOG_DEBUG("server: dup2: %s\n", strerror(errno));
+            goto reply;
+        }
+        close(request->fds[i]);
+        request->fds[i] = -1;
+    }
+
+    if (chdir(request->cwd) == -1)
+    {
+        dprintf(STDERR_FD, "shell: %s: %s\n", request->cwd, strerror(errno));
+        goto reply;
+    }
+
+    // the environment is replaced by the client's, the strings live as long as the worker
+    clearenv();
+    for (int i = 0; request->env[i] != NULL; i++)
+        putenv(request->env[i]);
+
+    FILE* stream;
+    if (strcmp(request->script, SERVER_SCRIPT_STDIN) == 0)
+        stream = fdopen(dup(STDIN_FD), "r");
+    else if (script)
+        stream = fmemopen(script->content, script->length, "r");
+    else
+        stream = fopen(request->script, "r");
+
+    if (!stream)
+    {
+        dprintf(STDERR_FD, "shell: %s: %s\n", request->script, strerror(errno));
+        status = 127;
+        goto reply;
+    }
+
+    // registered last, so it runs before the handlers the worker inherited
+    if (on_exit(sendStatusOnExit, (void*)(intptr_t)connection) != 0)
+        LOG_DEBUG("server: on_exit failed\n");
+
+    status = runScript(stream);
+    fclose(stream);
+    fflush(stdout);
+
+reply:
+    sendStatus(connection, status);
+    _exit(status & 0xff);
+}
+
+/*-------------------------------Server--------------------------------------------------*/
+
+int runServer(const char* socketPath, ScriptRunner runScript)
+{
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+
+    if (strlen(socketPath) >= sizeof(address.sun_path))
+    {
+        LOG_ERROR("server: socket path too long: %s\n", socketPath);
+        return -1;
+    }
+    strcpy(address.sun_path, socketPath);
+
+    int listenFD = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listenFD == -1)
+    {
+        LOG_ERROR("server: socket: %s\n", strerror(errno));
+        return -1;
+    }
+
+    // replace a socket left over by a previous server, but nothing else
+    struct stat st;
+    if (lstat(socketPath, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(socketPath);
+
+    if (bind(listenFD, (struct sockaddr*)&address, sizeof(address)) == -1 || listen(listenFD, SERVER_BACKLOG) == -1)
+    {
+        LOG_ERROR("server: %s: %s\n", socketPath, strerror(errno));
+        close(listenFD);
+        return -1;
+    }
+
+    // a client going away must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
+    LOG_DEBUG("server: listening on %s\n", socketPath);
+
+    while (1)
+    {
+        int connection = accept4(listenFD, NULL, NULL, SOCK_CLOEXEC);
+        int acceptError = errno;
+
+        // the workers are the only children of the server, reap whatever finished
+        while (waitpid(-1, NULL, WNOHANG) > 0);
+
+        if (connection == -1)
+        {
+            if (acceptError == EINTR || acceptError == ECONNABORTED)
+                continue;
+
+            LOG_ERROR("server: accept: %s\n", strerror(acceptError));
+            break;
+        }
+
+        // a client that connects and sends nothing must not hold up the others for long
+        struct timeval timeout = { .tv_sec = SERVER_RECEIVE_TIMEOUT_MS / 1000, .tv_usec = SERVER_RECEIVE_TIMEOUT_MS % 1000 * 1000 };
+        if (setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == -1)
+            LOG_DEBUG("server: SO_RCVTIMEO: %s\n", strerror(errno));
+
+        ServerRequest request;
+        if (receiveRequest(connection, &request) != 0)
+        {
+            cleanUpRequest(&request);
+            close(connection);
+            continue;
+        }
+
+        // a command installed since the last request may shadow a cached path, the worker would run the old one
+        bool pathsDropped = revalidatePathCache();
+
+        // the script is loaded in the server, so the next workers find it in the cache
+        CachedScript* script = NULL;
+        if (strcmp(request.script, SERVER_SCRIPT_STDIN) != 0)
+            script = loadScript(request.script);
+        if (script && pathsDropped)
+            warmPathCache(script->content, script->length);
+
+        // the worker inherits the stdio buffers, anything pending would be written twice
+        fflush(stdout);
+        fflush(stderr);
+
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            close(listenFD);
+            signal(SIGPIPE, SIG_DFL);
+            runWorker(connection, &request, script, runScript);
+        }
+        else if (pid == -1)
+        {
+            LOG_ERROR("server: fork: %s\n", strerror(errno));
+            sendStatus(connection, 1);
+        }
+
+        cleanUpRequest(&request);
+        close(connection);
+    }
+
+    close(listenFD);
+    unlink(socketPath);
+    return -1;
+}
\ No newline at end of file
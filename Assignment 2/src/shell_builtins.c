@@ -7,11 +7,29 @@
  * 
  */
 
+#define _GNU_SOURCE
+
 #include "shell_builtins.h"
+#include "accounting.h"
 #include "parser.h"
+#include "bench.h"
 #include "command.h"
+#include "cpu_placement.h"
+#include "parallel.h"
+#include "io_builtins.h"
+#include "jobs.h"
+#include "memo.h"
+#include "metrics.h"
+#include "path_cache.h"
+#include "probes.h"
+#include "psort.h"
+#include "text_builtins.h"
+#include "trace.h"
 
 #include <errno.h>
+#include <limits.h>
+#include <stddef.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <fcntl.h>
 #include <readline/readline.h>
@@ -26,8 +44,8 @@ int add_to_history(HistoryList* list, char* command)
     if (!command)
         return -1;
 
-    HistoryNode* node = malloc(sizeof(HistoryNode));
-    node->command = COPY(command);
+    HistoryNode* node = trackedMalloc(ALLOC_HISTORY, sizeof(HistoryNode));
+    node->command = TRACKED_COPY(ALLOC_HISTORY, command);
     node->next = NULL;
 
     if (!list->head)
@@ -69,8 +87,8 @@ void clean_history(HistoryList* list) {
 
     while (current != NULL) {
         next = current->next;
-        free(current->command);
-        free(current);
+        trackedFree(ALLOC_HISTORY, current->command);
+        trackedFree(ALLOC_HISTORY, current);
         current = next;
     }
 
@@ -118,6 +136,11 @@ ShellState* init_shell_state()
     stateObj->originalStdoutFD = STDOUT_FD;
     stateObj->originalStderrFD = STDERR_FD;
 
+    struct stat stdinStat;
+    bool stdinOpen = fstat(STDIN_FD, &stdinStat) == 0;
+    stateObj->stdinDevice = stdinOpen ? stdinStat.st_dev : 0;
+    stateObj->stdinInode = stdinOpen ? stdinStat.st_ino : 0;
+
     // default prompt
     strncpy(stateObj->prompt_buffer, "\%", MAX_STRING_LENGTH);
 
@@ -125,6 +148,24 @@ ShellState* init_shell_state()
     stateObj->history.tail = NULL;
     stateObj->history.size = 0;
 
+    // no limit on background jobs by default, and no pressure based throttling
+    stateObj->options.maxJobs = 0;
+    stateObj->options.psiCpuLimit = 0;
+    stateObj->options.psiMemoryLimit = 0;
+    stateObj->options.memoMaxMegabytes = 256;
+
+    // pipes keep the kernel's capacity unless asked otherwise
+    stateObj->options.pipeSizeKilobytes = 0;
+    stateObj->options.pipeAdaptive = 0;
+
+    // stages run wherever the kernel puts them unless placement is asked for
+    stateObj->options.cpuPlacement = 0;
+    stateObj->options.pipeStat = 0;
+
+    // the level the logger started with, from the build or SHELL_LOG_LEVEL
+    stateObj->options.logLevel = logLevel;
+    stateObj->options.leakCheck = 0;
+
     return stateObj;
 }
 
@@ -146,7 +187,7 @@ int clear_shell_state(ShellState* stateObj)
 /**
  * @brief Sets up the file descriptors for a command. Duplicates the file descriptors to stdin, and stdout, and if we are in the parent process, we also save the original stdin and stdout file descriptors.
  * 
- * Uses dup2 system call to set up the file descriptors. Returns 0 on success, -1 on failure. Only dups if the file descriptors are not the default ones.
+ * Uses dup2 system call to set up the file descriptors. Returns 0 on success, -1 on failure. Only dups if the file descriptors are not the default ones. The fds themselves are closed by executeCommand once the stage is launched, they are close-on-exec so children don't keep them.
  * 
  * @param inputFD The input file descriptor
  * @param outputFD The output file descriptor
@@ -156,41 +197,66 @@ static int setUpFD(int inputFD, int outputFD, int stderrFD)
 {
     if (inputFD != STDIN_FD)
     {
-        globalShellState->originalStdinFD = dup(STDIN_FD);
+        // the original is saved once, so a builtin nested in another (history recalling a redirected command) doesn't save the redirected one over it. It is close-on-exec, an exec'd command doesn't inherit it
+        if (globalShellState->originalStdinFD == STDIN_FD)
+        {
+            globalShellState->originalStdinFD = fcntl(STDIN_FD, F_DUPFD_CLOEXEC, 0);
+            if (globalShellState->originalStdinFD == -1)
+            {
+                LOG_DEBUG("dup: %s\n", strerror(errno));
+                globalShellState->originalStdinFD = STDIN_FD;
+                return -1;
+            }
+            registerFD(globalShellState->originalStdinFD, "saved stdin");
+        }
 
         if (dup2(inputFD, STDIN_FD) == -1)
         {
             LOG_DEBUG("dup2: %s\n", strerror(errno));
             return -1;
         }
-
-        close(inputFD);
     }
 
     if (outputFD != STDOUT_FD)
     {
-        globalShellState->originalStdoutFD = dup(STDOUT_FD);
+        if (globalShellState->originalStdoutFD == STDOUT_FD)
+        {
+            globalShellState->originalStdoutFD = fcntl(STDOUT_FD, F_DUPFD_CLOEXEC, 0);
+            if (globalShellState->originalStdoutFD == -1)
+            {
+                LOG_DEBUG("dup: %s\n", strerror(errno));
+                globalShellState->originalStdoutFD = STDOUT_FD;
+                return -1;
+            }
+            registerFD(globalShellState->originalStdoutFD, "saved stdout");
+        }
         
         if (dup2(outputFD, STDOUT_FD) == -1)
         {
             LOG_DEBUG("dup2: %s\n", strerror(errno));
             return -1;
         }
-
-        close(outputFD);
     }
 
     if (stderrFD != STDERR_FD)
     {
-        globalShellState->originalStderrFD = dup(STDERR_FD);
+        if (globalShellState->originalStderrFD == STDERR_FD)
+        {
+            globalShellState->originalStderrFD = fcntl(STDERR_FD, F_DUPFD_CLOEXEC, 0);
+            if (globalShellState->originalStderrFD == -1)
+            {
+                LOG_DEBUG("dup: %s\n", strerror(errno));
+                globalShellState->originalStderrFD = STDERR_FD;
+                return -1;
+            }
+            registerFD(globalShellState->originalStderrFD, "saved stderr");
+        }
         
         if (dup2(stderrFD, STDERR_FD) == -1)
         {
             LOG_DEBUG("dup2: %s\n", strerror(errno));
             return -1;
         }
-
-        close(stderrFD);
     }
 
     return 0;
@@ -203,6 +269,10 @@ static int setUpFD(int inputFD, int outputFD, int stderrFD)
  */
 static void resetFD()
 {
+    // whatever the builtin printed belongs to the redirected fds
+    fflush(stdout);
+    fflush(stderr);
+
     if (globalShellState->originalStdinFD != STDIN_FD)
     {
         if (dup2(globalShellState->originalStdinFD, STDIN_FD) == -1)
@@ -210,6 +280,10 @@ static void resetFD()
             LOG_ERROR("dup2: %s\n", strerror(errno));
             exit(1);
         }
+
+        forgetFD(globalShellState->originalStdinFD);
+        close(globalShellState->originalStdinFD);
+        globalShellState->originalStdinFD = STDIN_FD;
     }
 
     if (globalShellState->originalStdoutFD != STDOUT_FD)
@@ -219,6 +293,10 @@ static void resetFD()
             LOG_ERROR("dup2: %s\n", strerror(errno));
             exit(1);
         }
+
+        forgetFD(globalShellState->originalStdoutFD);
+        close(globalShellState->originalStdoutFD);
+        globalShellState->originalStdoutFD = STDOUT_FD;
     }
 
     if (globalShellState->originalStderrFD != STDERR_FD)
@@ -228,6 +306,10 @@ static void resetFD()
             LOG_ERROR("dup2: %s\n", strerror(errno));
             exit(1);
         }
+
+        forgetFD(globalShellState->originalStderrFD);
+        close(globalShellState->originalStderrFD);
+        globalShellState->originalStderrFD = STDERR_FD;
     }
 }
 
@@ -262,8 +344,11 @@ int cd(SimpleCommand* simpleCommand)
     return 0;
 }
 
-int pwd(SimpleCommand* simpleCommand)
+// pwd writes to a stream, so it can run on a thread inside a run of builtins
+static int pwdStream(SimpleCommand* simpleCommand, Stream* input, Stream* output)
 {
+    (void)input;
+
     if (simpleCommand->argc > 1)
     {
         LOG_ERROR("pwd: Too many arguments\n");
@@ -278,15 +363,12 @@ int pwd(SimpleCommand* simpleCommand)
         return -1;
     }
 
-    if (setUpFD(simpleCommand->inputFD, simpleCommand->outputFD, simpleCommand->stderrFD))
-    {
-        return -1;
-    }
-
-    LOG_PRINT("%s\n", cwd);
+    return streamPrintf(output, "%s\n", cwd);
+}
 
-    resetFD();
-    return 0;
+int pwd(SimpleCommand* simpleCommand)
+{
+    return runStreamBuiltin(simpleCommand, pwdStream);
 }
 
 int exitShell(SimpleCommand* simpleCommand)
@@ -298,6 +380,9 @@ int exitShell(SimpleCommand* simpleCommand)
     }
     LOG_OUT("exit\n");
 
+    // start whatever is still queued in the background before leaving
+    drainJobQueue();
+
     if (simpleCommand->argc == 1)
         exit(0);
     
@@ -312,98 +397,133 @@ int exitShell(SimpleCommand* simpleCommand)
     exit(exit_status);
 }
 
-int history(SimpleCommand* simpleCommand)
+// lists the history, recalling a command is left to history() because it runs the command in the shell
+static int historyStream(SimpleCommand* simpleCommand, Stream* input, Stream* output)
 {
-    if (simpleCommand->argc > 2)
+    (void)input;
+    (void)simpleCommand;
+
+    HistoryNode* curr = globalShellState->history.head;
+    int i = 1;
+    while (curr)
     {
-        LOG_ERROR("history: Too many arguments\n");
-        return -1;
+        if (streamPrintf(output, "%d %s\n", i, curr->command) != 0)
+            return -1;
+
+        curr = curr->next;
+        i++;
     }
 
-    if (setUpFD(simpleCommand->inputFD, simpleCommand->outputFD, simpleCommand->stderrFD))
+    return 0;
+}
+
+int history(SimpleCommand* simpleCommand)
+{
+    if (simpleCommand->argc > 2)
     {
+        LOG_ERROR("history: Too many arguments\n");
         return -1;
     }
 
     if (simpleCommand->argc == 1)
+        return runStreamBuiltin(simpleCommand, historyStream);
+
+    char* input = NULL;
+    if(strspn(simpleCommand->args[1], "0123456789") == strlen(simpleCommand->args[1]))
     {
-        HistoryNode* curr = globalShellState->history.head;
-        int i = 1;
-        while (curr)
+        // execute the commmand at that index
+        unsigned int idx = (unsigned int)atoi(simpleCommand->args[1]);
+        input = COPY(get_command(&globalShellState->history, idx));
+
+        if (!input)
         {
-            LOG_PRINT("%d %s\n", i, curr->command);
-            curr = curr->next;
-            i++;
+            LOG_ERROR("history: invalid index\n");
+            return -1;
         }
-
-        resetFD();
     }
     else
     {
-        char* input = NULL;
-        if(strspn(simpleCommand->args[1], "0123456789") == strlen(simpleCommand->args[1]))
-        {
-            // execute the commmand at that index
-            unsigned int idx = (unsigned int)atoi(simpleCommand->args[1]);
-            input = COPY(get_command(&globalShellState->history, idx));
+        char* last = find_last_command_with_prefix(&globalShellState->history, simpleCommand->args[1]);
+        input = COPY(last);
 
-            if (!input)
-            {
-                LOG_ERROR("history: invalid index\n");
-                return -1;
-            }
-        }
-        else
+        if (!input)
         {
-            char* last = find_last_command_with_prefix(&globalShellState->history, simpleCommand->args[1]);
-            input = COPY(last);
-
-            if (!input)
-            {
-                LOG_ERROR("history: no matching command found\n");
-                return -1;
-            }
+            LOG_ERROR("history: no matching command found\n");
+            return -1;
         }
+    }
 
-        // simple whitespace tokenizer
-        char** tokens = tokenizeString(input, ' ');
+    // the recalled command inherits the redirections of history itself
+    if (setUpFD(simpleCommand->inputFD, simpleCommand->outputFD, simpleCommand->stderrFD))
+    {
+        free(input);
+        return -1;
+    }
 
-        // generate the command from tokens
-        CommandChain* commandChain = parseTokens(tokens);
-        
-        // execute the command
-        int status = executeCommandChain(commandChain);
-        (void)status;
-        // Free tokens
-        freeTokens(tokens);
+    // execute the command
+    int status = executeInputLine(input);
+    (void)status;
 
-        // free the command chain
-        cleanUpCommandChain(commandChain);
+    resetFD();
 
-        // Free buffer that was allocated for input
-        free(input);
-    }
+    // Free buffer that was allocated for input
+    free(input);
 
     return 0;
 }
 
 int executeProcess(SimpleCommand* simpleCommand)
 {
+    // the PATH lookup is done in the parent, so the cache outlives the child
+    const char* path = resolveCommandPath(simpleCommand->commandName);
+
+    // when tracing, the exec closes a close-on-exec pipe, so the parent sees when the child got to run its command
+    int execPipe[2] = {-1, -1};
+    if (tracing && pipe2(execPipe, O_CLOEXEC) == -1)
+        execPipe[0] = execPipe[1] = -1;
+
+    countMetric(METRIC_EXTERNAL_COMMANDS);
+
+    // the fork is always timed, for the spawn latency of the metrics
+    PROBE_SPAWN_START(simpleCommand);
+    uint64_t forkStart = traceNow();
     int pid = fork();
 
     if (pid == -1)
     {
         LOG_DEBUG("fork: %s\n", strerror(errno));
+        if (execPipe[0] != -1)
+        {
+            close(execPipe[0]);
+            close(execPipe[1]);
+        }
         return -1;
     }
     else if (pid == 0)
     {
+        if (execPipe[0] != -1)
+            close(execPipe[0]);
+
         // Duplicate the FDs. Default FDs are STDIN AND STDOUT but, if pipes or  < > are used, the FDs are updated in the parsing step, by opening the relevant file or creating relevant pipes
         setUpFD(simpleCommand->inputFD, simpleCommand->outputFD, simpleCommand->stderrFD);
 
-        // Execute the command
+        // a failed pinning leaves the command where the kernel puts it
+        if (simpleCommand->cpuList && applyCpuList(simpleCommand->cpuList) == -1)
+            LOG_DEBUG("sched_setaffinity %s: %s\n", simpleCommand->cpuList, strerror(errno));
+
+        // Execute the command, the cached path may be stale so execvp gets the last word
+        if (path)
+            execv(path, simpleCommand->args);
+
         if (execvp(simpleCommand->commandName, simpleCommand->args) == -1)
         {
+            PROBE_EXEC_FAILED(simpleCommand, errno);
+            countMetric(METRIC_EXEC_FAILURES);
+
+            // a byte tells the parent the exec failed, the pipe closing at exit would look like an exec
+            if (execPipe[1] != -1 && write(execPipe[1], "", 1) == -1)
+                LOG_DEBUG("write: %s\n", strerror(errno));
+
             LOG_ERROR("%s: %s\n", simpleCommand->commandName, strerror(errno));
             exit(1);
         }
@@ -416,17 +536,46 @@ int executeProcess(SimpleCommand* simpleCommand)
     {
         // Parent process
         simpleCommand->pid = pid;
+        recordSpawn(pid, forkStart);
+        TRACE_SPAN("fork", "spawn", forkStart, simpleCommand->commandName);
+        PROBE_SPAWN_DONE(simpleCommand);
+
+        // the read returns at the exec, or with the byte of a failed one
+        if (execPipe[0] != -1)
+        {
+            close(execPipe[1]);
+
+            char failed;
+            ssize_t nread;
+            while ((nread = read(execPipe[0], &failed, 1)) == -1 && errno == EINTR);
+            close(execPipe[0]);
+
+            traceProcessStart(pid, simpleCommand->commandName, forkStart, nread == 0 ? "exec" : "exec failed");
+        }
 
         if (!simpleCommand->noWait) {
             // waiting for the child process to finish
             int status;
             LOG_DEBUG("Waiting for child process, with command name %s\n", simpleCommand->commandName);
-            if (waitpid(pid, &status, 0) == -1)
+            uint64_t waitStart = TRACE_START();
+            while (waitpid(pid, &status, 0) == -1)
             {
+                // SIGCHLD from background jobs interrupts the wait, the queued jobs take their place without waiting for the prompt
+                if (errno == EINTR)
+                {
+                    reapJobs();
+                    continue;
+                }
+
                 LOG_ERROR("waitpid: %s\n", strerror(errno));
                 return -1;
             }
 
+            TRACE_SPAN("wait", "wait", waitStart, simpleCommand->commandName);
+            TRACE_PROCESS_EXIT(pid);
+            PROBE_CHILD_EXIT(pid, WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+            recordChildExit(pid);
+
             // print the error (if any) from errno
             if (WEXITSTATUS(status) != 0)
             {
@@ -461,6 +610,102 @@ int prompt(SimpleCommand* simpleCommand)
     return 0;
 }
 
+/**
+ * @brief This struct describes an option of the shell that can be changed with setopt.
+ *
+ */
+typedef struct OptionRegistry
+{
+    char* name;
+    size_t offset;          // offset of the int field in ShellOptions
+    int minValue;
+    int maxValue;
+    char* description;
+} OptionRegistry;
+
+/**
+ * @brief Registry of all the options supported by setopt. Add new options here, after adding their field to ShellOptions.
+ *
+ */
+static const OptionRegistry optionRegistry[] = {
+    {"maxjobs", offsetof(ShellOptions, maxJobs), 0, INT_MAX, "max background jobs running at once, 0 for no limit"},
+    {"psi-cpu", offsetof(ShellOptions, psiCpuLimit), 0, 100, "hold queued jobs while cpu pressure avg10 is above this %, 0 to disable"},
+    {"psi-memory", offsetof(ShellOptions, psiMemoryLimit), 0, 100, "hold queued jobs while memory pressure avg10 is above this %, 0 to disable"},
+    {"memo-max-mb", offsetof(ShellOptions, memoMaxMegabytes), 0, INT_MAX, "size of the memo cache before LRU eviction, 0 for no limit"},
+    {"pipesize", offsetof(ShellOptions, pipeSizeKilobytes), 0, 1024 * 1024, "capacity of pipeline pipes in KiB, capped at pipe-max-size, 0 for the default"},
+    {"pipe-adaptive", offsetof(ShellOptions, pipeAdaptive), 0, 1, "grow the pipes of foreground pipelines while their writers block, 0 to disable"},
+    {"cpu-placement", offsetof(ShellOptions, cpuPlacement), 0, 1, "pin each pipeline's stages to one L3/NUMA group of CPUs, 0 to disable"},
+    {"pipestat", offsetof(ShellOptions, pipeStat), 0, 1, "sample pipeline stages, show them in jobs -v and summarize them at the end, 0 to disable"},
+    {"loglevel", offsetof(ShellOptions, logLevel), LOG_ERR, LOG_DBG, "log errors only (0) or debug messages too (1), starts from SHELL_LOG_LEVEL"},
+    {"leakcheck", offsetof(ShellOptions, leakCheck), 0, 1, "report the heap and fds a top-level command leaves behind, 0 to disable"},
+    {NULL, 0, 0, 0, NULL}
+};
+
+// returns the field of an option in the global shell state
+static int* getOptionField(const OptionRegistry* option)
+{
+    return (int*)((char*)&globalShellState->options + option->offset);
+}
+
+int setopt(SimpleCommand* simpleCommand)
+{
+    if (simpleCommand->argc > 3)
+    {
+        LOG_ERROR("setopt: Too many arguments\n");
+        return -1;
+    }
+
+    for (int i = 0; optionRegistry[i].name != NULL; i++)
+    {
+        const OptionRegistry* option = &optionRegistry[i];
+
+        // without arguments, list all the options
+        if (simpleCommand->argc == 1)
+        {
+            dprintf(simpleCommand->outputFD, "%-12s %-8d # %s\n", option->name, *getOptionField(option), option->description);
+            continue;
+        }
+
+        if (strcmp(option->name, simpleCommand->args[1]) != 0)
+            continue;
+
+        if (simpleCommand->argc == 2)
+        {
+            dprintf(simpleCommand->outputFD, "%d\n", *getOptionField(option));
+            return 0;
+        }
+
+        const char* value = simpleCommand->args[2];
+        if (strspn(value, "0123456789") != strlen(value) || strlen(value) > 9)
+        {
+            LOG_ERROR("setopt: %s expects a number\n", option->name);
+            return -1;
+        }
+
+        int number = atoi(value);
+        if (number < option->minValue || number > option->maxValue)
+        {
+            LOG_ERROR("setopt: %s must be between %d and %d\n", option->name, option->minValue, option->maxValue);
+            return -1;
+        }
+
+        *getOptionField(option) = number;
+
+        // the logger keeps its own copy of the level, read on every message
+        setLogLevel(globalShellState->options.logLevel);
+
+        // a raised limit may let queued jobs start
+        reapJobs();
+        return 0;
+    }
+
+    if (simpleCommand->argc == 1)
+        return 0;
+
+    LOG_ERROR("setopt: unknown option %s\n", simpleCommand->args[1]);
+    return -1;
+}
+
 /**
  * @brief This struct represents the builtin commands of the shell, and their corresponding execution functions.
  * 
@@ -469,6 +714,8 @@ typedef struct commandRegistry
 {
     char* commandName;
     ExecutionFunction executionFunction;
+    StreamFunction streamFunction;          // set for builtins that can run on a thread inside a run of builtins
+    SupportFunction supportFunction;        // set for builtins that only implement some of the options of the utility they replace
 } CommandRegistry;
 
 /**
@@ -476,23 +723,92 @@ typedef struct commandRegistry
  * 
  */
 static const CommandRegistry commandRegistry[] = {
-    {"cd", cd},
-    {"pwd", pwd},
-    {"exit", exitShell},
-    {"history", history},
-    {"prompt", prompt},
-    {NULL, NULL}
+    {"cd", cd, NULL, NULL},
+    {"pwd", pwd, pwdStream, NULL},
+    {"exit", exitShell, NULL, NULL},
+    {"history", history, historyStream, NULL},
+    {"prompt", prompt, NULL, NULL},
+    {"parallel", parallel, NULL, NULL},
+    {"setopt", setopt, NULL, NULL},
+    {"jobs", jobs, NULL, NULL},
+    {"wait", waitBuiltin, NULL, NULL},
+    {"memo", memo, NULL, NULL},
+    {"grep", grep, grepStream, grepSupported},
+    {"wc", wc, wcStream, wcSupported},
+    {"head", head, headStream, headSupported},
+    {"tail", tail, tailStream, tailSupported},
+    {"psort", psort, psortStream, NULL},
+    {"cat", cat, catStream, catSupported},
+    {"tee", teeBuiltin, teeStream, teeSupported},
+    {"bench", bench, NULL, NULL},
+    {"stats", stats, NULL, NULL},
+    {"shellstats", shellstats, NULL, NULL},
+    {"hash", hashBuiltin, NULL, NULL},
+    {NULL, NULL, NULL, NULL}
 };
 
-ExecutionFunction getExecutionFunction(char* commandName)
+// returns the registry entry of a command, NULL for external commands
+static const CommandRegistry* findRegistryEntry(const char* commandName)
 {
-    for (int i = 0; commandRegistry[i].commandName != NULL; i++)
+    for (int i = 0; commandName && commandRegistry[i].commandName != NULL; i++)
     {
         if (strcmp(commandRegistry[i].commandName, commandName) == 0)
-        {
-            return commandRegistry[i].executionFunction;
-        }
+            return &commandRegistry[i];
     }
 
-    return executeProcess;
-}
\ No newline at end of file
+    return NULL;
+}
+
+ExecutionFunction getExecutionFunction(char* commandName)
+{
+    const CommandRegistry* entry = findRegistryEntry(commandName);
+    return entry ? entry->executionFunction : executeProcess;
+}
+
+ExecutionFunction resolveExecutionFunction(SimpleCommand* simpleCommand)
+{
+    const CommandRegistry* entry = findRegistryEntry(simpleCommand->commandName);
+    if (!entry)
+        return executeProcess;
+
+    // options the builtin doesn't implement are left to the real utility
+    if (entry->supportFunction && !entry->supportFunction(simpleCommand))
+        return executeProcess;
+
+    return entry->executionFunction;
+}
+
+StreamFunction getStreamFunction(SimpleCommand* simpleCommand)
+{
+    if (!simpleCommand->commandName || simpleCommand->execute == executeProcess)
+        return NULL;
+
+    // recalling a command runs it in the shell, only the listing streams
+    if (strcmp(simpleCommand->commandName, "history") == 0 && simpleCommand->argc > 1)
+        return NULL;
+
+    const CommandRegistry* entry = findRegistryEntry(simpleCommand->commandName);
+    return entry ? entry->streamFunction : NULL;
+}
+
+int runStreamBuiltin(SimpleCommand* simpleCommand, StreamFunction function)
+{
+    // the builtin writes straight to its fds, no dup2 of the shell's stdio needed
+    Stream input, output;
+    initFDStream(&input, simpleCommand->inputFD, false);
+    initFDStream(&output, simpleCommand->outputFD, true);
+
+    // a builtin sharing the terminal with the shell's own printf output must not overtake it
+    fflush(stdout);
+
+    int status = function(simpleCommand, &input, &output);
+
+    if (streamClose(&output) != 0 && status == 0)
+    {
+        LOG_ERROR("%s: write error: %s\n", simpleCommand->commandName, strerror(output.error));
+        status = -1;
+    }
+    streamClose(&input);
+
+    return status;
+}
@@ -0,0 +1,345 @@
+/**
+ * @file stream.c
+ * @brief Contains the function definitions for the streams and ring buffers declared in stream.h
+ * @version 0.1
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include "stream.h"
+#include "thread_pool.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/*-------------------------------Ring buffer---------------------------------------------*/
+
+static void futexWait(_Atomic uint32_t* word, uint32_t expected)
+{
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+static void futexWakeAll(_Atomic uint32_t* word)
+{
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+// polling only pays off when the other end runs on another CPU at the same time
+static int spinIterations()
+{
+    static int iterations = -1;
+    if (iterations == -1)
+        iterations = getOnlineCPUs() > 1 ? RING_SPIN_ITERATIONS : 0;
+
+    return iterations;
+}
+
+// wakes the other end of the ring, costs a syscall only when it is asleep
+static void notifyRing(RingBuffer* ring)
+{
+    if (atomic_load(&ring->sleepers) > 0)
+    {
+        atomic_fetch_add(&ring->event, 1);
+        futexWakeAll(&ring->event);
+    }
+}
+
+// bytes the consumer can read, or the room the producer has
+static size_t readableBytes(RingBuffer* ring)
+{
+    return atomic_load(&ring->head) - atomic_load(&ring->tail);
+}
+
+static size_t writableBytes(RingBuffer* ring)
+{
+    return ring->capacity - readableBytes(ring);
+}
+
+// waits until the consumer has data or the producer is done
+static bool canRead(RingBuffer* ring)
+{
+    return readableBytes(ring) > 0 || atomic_load(&ring->writerClosed);
+}
+
+// waits until the producer has room or the consumer is gone
+static bool canWrite(RingBuffer* ring)
+{
+    return writableBytes(ring) > 0 || atomic_load(&ring->readerClosed);
+}
+
+static void waitRing(RingBuffer* ring, bool (*ready)(RingBuffer*))
+{
+    for (int i = spinIterations(); i > 0; i--)
+    {
+        if (ready(ring))
+            return;
+    }
+
+    while (!ready(ring))
+    {
+        // the event is read before announcing the sleep, so a notification in between makes the futex wait return at once
+        uint32_t event = atomic_load(&ring->event);
+        atomic_fetch_add(&ring->sleepers, 1);
+
+        if (!ready(ring))
+            futexWait(&ring->event, event);
+
+        atomic_fetch_sub(&ring->sleepers, 1);
+    }
+}
+
+RingBuffer* initRingBuffer(size_t capacity)
+{
+    if (capacity == 0)
+        capacity = RING_BUFFER_CAPACITY;
+
+    size_t rounded = 1;
+    while (rounded < capacity)
+        rounded <<= 1;
+
+    RingBuffer* ring = (RingBuffer*)malloc(sizeof(RingBuffer));
+    if (!ring)
+        return NULL;
+
+    ring->data = (char*)malloc(rounded);
+    if (!ring->data)
+    {
+        free(ring);
+        return NULL;
+    }
+
+    ring->capacity = rounded;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->event, 0);
+    atomic_init(&ring->sleepers, 0);
+    atomic_init(&ring->writerClosed, false);
+    atomic_init(&ring->readerClosed, false);
+
+    return ring;
+}
+
+void cleanUpRingBuffer(RingBuffer* ring)
+{
+    if (!ring)
+        return;
+
+    free(ring->data);
+    free(ring);
+}
+
+static ssize_t ringRead(RingBuffer* ring, char* buffer, size_t length)
+{
+    waitRing(ring, canRead);
+
+    size_t available = readableBytes(ring);
+    if (available == 0)
+        return 0;
+
+    if (length > available)
+        length = available;
+
+    // the data may wrap around the end of the buffer
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t offset = tail & (ring->capacity - 1);
+    size_t first = ring->capacity - offset < length ? ring->capacity - offset : length;
+
+    memcpy(buffer, ring->data + offset, first);
+    memcpy(buffer + first, ring->data, length - first);
+
+    atomic_store(&ring->tail, tail + length);
+    notifyRing(ring);
+
+    return length;
+}
+
+static int ringWrite(RingBuffer* ring, const char* data, size_t length)
+{
+    while (length > 0)
+    {
+        waitRing(ring, canWrite);
+
+        if (atomic_load(&ring->readerClosed))
+        {
+            errno = EPIPE;
+            return -1;
+        }
+
+        size_t chunk = writableBytes(ring);
+        if (chunk > length)
+            chunk = length;
+
+        size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        size_t offset = head & (ring->capacity - 1);
+        size_t first = ring->capacity - offset < chunk ? ring->capacity - offset : chunk;
+
+        memcpy(ring->data + offset, data, first);
+        memcpy(ring->data, data + first, chunk - first);
+
+        atomic_store(&ring->head, head + chunk);
+        notifyRing(ring);
+
+        data += chunk;
+        length -= chunk;
+    }
+
+    return 0;
+}
+
+/*-------------------------------Streams-------------------------------------------------*/
+
+void initFDStream(Stream* stream, int fd, bool writable)
+{
+    stream->type = STREAM_FD;
+    stream->fd = fd;
+    stream->ring = NULL;
+    stream->writable = writable;
+    stream->buffered = 0;
+    stream->error = 0;
+}
+
+void initRingStream(Stream* stream, RingBuffer* ring, bool writable)
+{
+    stream->type = STREAM_RING;
+    stream->fd = -1;
+    stream->ring = ring;
+    stream->writable = writable;
+    stream->buffered = 0;
+    stream->error = 0;
+}
+
+// writes the whole buffer to an fd
+static int writeFD(int fd, const char* data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t nwritten = write(fd, data, length);
+        if (nwritten == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        data += nwritten;
+        length -= nwritten;
+    }
+
+    return 0;
+}
+
+ssize_t streamRead(Stream* stream, void* buffer, size_t length)
+{
+    if (stream->type == STREAM_RING)
+        return ringRead(stream->ring, (char*)buffer, length);
+
+    ssize_t nread;
+    while ((nread = read(stream->fd, buffer, length)) == -1 && errno == EINTR);
+
+    return nread;
+}
+
+int streamFlush(Stream* stream)
+{
+    if (stream->type != STREAM_FD || stream->buffered == 0)
+        return stream->error ? -1 : 0;
+
+    int status = writeFD(stream->fd, stream->buffer, stream->buffered);
+    stream->buffered = 0;
+
+    if (status == -1 && !stream->error)
+        stream->error = errno;
+
+    return status;
+}
+
+int streamWrite(Stream* stream, const void* data, size_t length)
+{
+    if (stream->error)
+    {
+        errno = stream->error;
+        return -1;
+    }
+
+    int status;
+    if (stream->type == STREAM_RING)
+    {
+        status = ringWrite(stream->ring, (const char*)data, length);
+    }
+    else if (stream->buffered + length <= STREAM_BUFFER_SIZE)
+    {
+        memcpy(stream->buffer + stream->buffered, data, length);
+        stream->buffered += length;
+        return 0;
+    }
+    else
+    {
+        // large writes skip the buffer
+        status = streamFlush(stream);
+        if (status == 0)
+            status = writeFD(stream->fd, (const char*)data, length);
+    }
+
+    if (status == -1 && !stream->error)
+        stream->error = errno;
+
+    return status;
+}
+
+int streamPrintf(Stream* stream, const char* format, ...)
+{
+    char buffer[MAX_STRING_LENGTH];
+
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+
+    if (length < 0)
+        return -1;
+
+    if ((size_t)length < sizeof(buffer))
+        return streamWrite(stream, buffer, length);
+
+    // too long for the stack buffer, format it again on the heap
+    char* large = (char*)malloc(length + 1);
+    if (!large)
+        return -1;
+
+    va_start(args, format);
+    vsnprintf(large, length + 1, format, args);
+    va_end(args);
+
+    int status = streamWrite(stream, large, length);
+    free(large);
+    return status;
+}
+
+int streamClose(Stream* stream)
+{
+    int status = 0;
+    if (stream->writable)
+        status = streamFlush(stream);
+
+    if (stream->type == STREAM_RING && stream->ring)
+    {
+        if (stream->writable)
+            atomic_store(&stream->ring->writerClosed, true);
+        else
+            atomic_store(&stream->ring->readerClosed, true);
+
+        notifyRing(stream->ring);
+        stream->ring = NULL;
+    }
+
+    return status;
+}
@@ -0,0 +1,573 @@
+/**
+ * @file taskgraph.c
+ * @brief Contains the function definitions for the task blocks declared in taskgraph.h
+ * @version 0.1
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#include "taskgraph.h"
+#include "thread_pool.h"
+#include "parser.h"
+#include "jobs.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <sys/wait.h>
+#include <time.h>
+
+// whitespace that separates the names in a task declaration
+#define TASK_NAME_DELIMITERS " \t"
+
+/*----------------------------------------------------------------------------------------*/
+
+struct TaskRun;
+
+// the state of one run of a task block
+typedef struct TaskGraph {
+    Task* tasks;
+    int nTasks;
+    int* order;                 // the tasks in topological order
+
+    ThreadPool* pool;
+    struct TaskRun* runs;       // the pool arguments, one per task
+    struct timespec origin;     // when the block started
+    sigset_t originalMask;      // the signal mask to restore in the subshells
+
+    atomic_bool failed;         // set by the first task that fails
+    atomic_int firstFailure;    // index of that task
+} TaskGraph;
+
+// argument of the pool function, one per task
+typedef struct TaskRun {
+    TaskGraph* graph;
+    int index;
+} TaskRun;
+
+/*-------------------------------Helpers-------------------------------------------------*/
+
+// seconds elapsed since the origin
+static double secondsSince(const struct timespec* origin)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - origin->tv_sec) + (now.tv_nsec - origin->tv_nsec) / 1e9;
+}
+
+// skips the leading whitespace of a line
+static const char* skipSpaces(const char* str)
+{
+    while (*str && isspace((unsigned char)*str))
+        str++;
+    return str;
+}
+
+// copies a string without the trailing whitespace. The caller frees it
+static char* copyTrimmed(const char* str, size_t length)
+{
+    while (length > 0 && isspace((unsigned char)str[length - 1]))
+        length--;
+
+    return strndup(str, length);
+}
+
+// appends a value to a growing int array
+static int pushIndex(int** array, int* count, int value)
+{
+    int* temp = (int*)realloc(*array, (*count + 1) * sizeof(int));
+    if (!temp)
+        return -1;
+
+    *array = temp;
+    (*array)[(*count)++] = value;
+    return 0;
+}
+
+static int findTask(TaskGraph* graph, const char* name)
+{
+    for (int i = 0; i < graph->nTasks; i++)
+    {
+        if (strcmp(graph->tasks[i].name, name) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+static void cleanUpTaskGraph(TaskGraph* graph)
+{
+    for (int i = 0; i < graph->nTasks; i++)
+    {
+        Task* task = &graph->tasks[i];
+        free(task->name);
+        for (int j = 0; j < task->nLines; j++)
+            free(task->lines[j]);
+        free(task->lines);
+        free(task->dependencies);
+        free(task->dependents);
+    }
+
+    free(graph->tasks);
+    free(graph->order);
+    graph->tasks = NULL;
+    graph->order = NULL;
+    graph->nTasks = 0;
+}
+
+/*-------------------------------Parsing-------------------------------------------------*/
+
+// adds a task declared by `name: [dependency]*`. The dependency names are kept aside until they are resolved
+static int declareTask(TaskGraph* graph, const char* line, char*** dependencyNames)
+{
+    const char* colon = strchr(line, ':');
+    char* name = copyTrimmed(line, colon - line);
+
+    if (!name || strlen(name) == 0 || strpbrk(name, TASK_NAME_DELIMITERS))
+    {
+        LOG_ERROR("tasks: invalid task declaration '%s'\n", line);
+        free(name);
+        return -1;
+    }
+
+    if (findTask(graph, name) != -1)
+    {
+        LOG_ERROR("tasks: task '%s' is declared twice\n", name);
+        free(name);
+        return -1;
+    }
+
+    Task* tasks = (Task*)realloc(graph->tasks, (graph->nTasks + 1) * sizeof(Task));
+    char** names = (char**)realloc(*dependencyNames, (graph->nTasks + 1) * sizeof(char*));
+    if (tasks)
+        graph->tasks = tasks;
+    if (names)
+        *dependencyNames = names;
+
+    if (!tasks || !names)
+    {
+        LOG_ERROR("tasks: malloc failure\n");
+        free(name);
+        return -1;
+    }
+
+    Task* task = &graph->tasks[graph->nTasks];
+    memset(task, 0, sizeof(Task));
+    task->name = name;
+    atomic_init(&task->pendingDependencies, 0);
+    atomic_init(&task->pid, 0);
+
+    // the dependencies are resolved once all the tasks are known, they may be declared later in the block
+    (*dependencyNames)[graph->nTasks] = strdup(colon + 1);
+    graph->nTasks++;
+
+    return 0;
+}
+
+// resolves the dependency names, and sorts the tasks topologically. Fails on unknown tasks and cycles
+static int resolveDependencies(TaskGraph* graph, char** dependencyNames)
+{
+    for (int i = 0; i < graph->nTasks; i++)
+    {
+        char* saveptr = NULL;
+        for (char* name = strtok_r(dependencyNames[i], TASK_NAME_DELIMITERS, &saveptr); name; name = strtok_r(NULL, TASK_NAME_DELIMITERS, &saveptr))
+        {
+            int dependency = findTask(graph, name);
+            if (dependency == -1)
+            {
+                LOG_ERROR("tasks: '%s' depends on unknown task '%s'\n", graph->tasks[i].name, name);
+                return -1;
+            }
+
+            if (pushIndex(&graph->tasks[i].dependencies, &graph->tasks[i].nDependencies, dependency) != 0 ||
+                pushIndex(&graph->tasks[dependency].dependents, &graph->tasks[dependency].nDependents, i) != 0)
+            {
+                LOG_ERROR("tasks: malloc failure\n");
+                return -1;
+            }
+        }
+    }
+
+    if (graph->nTasks <= 0)
+        return -1;
+
+    // Kahn's algorithm, whatever can't be ordered is part of a cycle
+    graph->order = (int*)malloc(graph->nTasks * sizeof(int));
+    int* remaining = (int*)malloc(graph->nTasks * sizeof(int));
+    if (!graph->order || !remaining)
+    {
+        LOG_ERROR("tasks: malloc failure\n");
+        free(remaining);
+        return -1;
+    }
+
+    int nOrdered = 0;
+    for (int i = 0; i < graph->nTasks; i++)
+    {
+        remaining[i] = graph->tasks[i].nDependencies;
+        if (remaining[i] == 0)
+            graph->order[nOrdered++] = i;
+    }
+
+    for (int next = 0; next < nOrdered; next++)
+    {
+        Task* task = &graph->tasks[graph->order[next]];
+        for (int j = 0; j < task->nDependents; j++)
+        {
+            if (--remaining[task->dependents[j]] == 0)
+                graph->order[nOrdered++] = task->dependents[j];
+        }
+    }
+
+    free(remaining);
+
+    if (nOrdered != graph->nTasks)
+    {
+        LOG_ERROR("tasks: the dependencies form a cycle\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+// builds the graph from the lines of the block
+static int parseTaskBlock(TaskGraph* graph, char** lines, int nLines)
+{
+    char** dependencyNames = NULL;
+    int status = 0;
+
+    for (int i = 0; i < nLines && status == 0; i++)
+    {
+        const char* content = skipSpaces(lines[i]);
+        if (*content == '\0')
+            continue;
+
+        // indented lines are the commands of the last declared task
+        if (content != lines[i])
+        {
+            if (graph->nTasks == 0)
+            {
+                LOG_ERROR("tasks: command '%s' is outside of a task\n", content);
+                status = -1;
+                break;
+            }
+
+            Task* task = &graph->tasks[graph->nTasks - 1];
+            char** temp = (char**)realloc(task->lines, (task->nLines + 1) * sizeof(char*));
+            if (!temp)
+            {
+                LOG_ERROR("tasks: malloc failure\n");
+                status = -1;
+                break;
+            }
+
+            task->lines = temp;
+            task->lines[task->nLines++] = copyTrimmed(content, strlen(content));
+        }
+        else if (strchr(content, ':'))
+        {
+            status = declareTask(graph, content, &dependencyNames);
+        }
+        else
+        {
+            LOG_ERROR("tasks: expected a task declaration 'name: [dependency]*', got '%s'\n", content);
+            status = -1;
+        }
+    }
+
+    if (status == 0 && graph->nTasks == 0)
+    {
+        LOG_ERROR("tasks: the block declares no tasks\n");
+        status = -1;
+    }
+
+    if (status == 0)
+        status = resolveDependencies(graph, dependencyNames);
+
+    for (int i = 0; dependencyNames && i < graph->nTasks; i++)
+        free(dependencyNames[i]);
+    free(dependencyNames);
+
+    return status;
+}
+
+/*-------------------------------Execution-----------------------------------------------*/
+
+// terminates the subshells of all the running tasks
+static void stopRunningTasks(TaskGraph* graph)
+{
+    for (int i = 0; i < graph->nTasks; i++)
+    {
+        int pid = atomic_load(&graph->tasks[i].pid);
+        if (pid > 0)
+            kill(-pid, SIGTERM);
+    }
+}
+
+// runs the lines of a task in a subshell and waits for it, on a worker of the pool
+static void runTask(void* arg)
+{
+    TaskRun* run = (TaskRun*)arg;
+    TaskGraph* graph = run->graph;
+    Task* task = &graph->tasks[run->index];
+
+    // fail fast, nothing new starts once a task failed
+    if (atomic_load(&graph->failed))
+        return;
+
+    task->start = secondsSince(&graph->origin);
+
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+        LOG_ERROR("tasks: fork: %s\n", strerror(errno));
+        task->status = 1;
+    }
+    else if (pid == 0)
+    {
+        // the subshell leads its own process group so a failure elsewhere can stop everything it started
+        setpgid(0, 0);
+        pthread_sigmask(SIG_SETMASK, &graph->originalMask, NULL);
+
+        int status = 0;
+        for (int i = 0; i < task->nLines && status == 0; i++)
+            status = executeInputLine(task->lines[i]);
+
+        drainJobQueue();
+        fflush(stdout);
+        _exit(status == 0 ? 0 : (status > 0 ? status & 0xff : 1));
+    }
+    else
+    {
+        // set the group from both sides, whichever runs first
+        setpgid(pid, pid);
+        atomic_store(&task->pid, pid);
+
+        // a task that failed meanwhile may have missed this one
+        if (atomic_load(&graph->failed))
+            kill(-pid, SIGTERM);
+
+        int status = 0;
+        while (waitpid(pid, &status, 0) == -1 && errno == EINTR);
+        atomic_store(&task->pid, 0);
+
+        task->status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    }
+
+    task->end = secondsSince(&graph->origin);
+    task->ran = true;
+
+    if (task->status != 0)
+    {
+        bool expected = false;
+        if (atomic_compare_exchange_strong(&graph->failed, &expected, true))
+        {
+            atomic_store(&graph->firstFailure, run->index);
+            LOG_ERROR("tasks: %s failed with status %d, stopping\n", task->name, task->status);
+            stopRunningTasks(graph);
+        }
+        return;
+    }
+
+    // release the dependents, the last dependency to finish submits them
+    for (int i = 0; i < task->nDependents; i++)
+    {
+        Task* dependent = &graph->tasks[task->dependents[i]];
+        if (atomic_fetch_sub(&dependent->pendingDependencies, 1) == 1)
+            submitTask(graph->pool, runTask, &graph->runs[task->dependents[i]]);
+    }
+}
+
+// prints the timing of the tasks and the critical path of the graph
+static void reportTaskBlock(TaskGraph* graph, int jobs, double elapsed)
+{
+    int nFailed = 0, nSkipped = 0;
+    for (int i = 0; i < graph->nTasks; i++)
+    {
+        Task* task = &graph->tasks[i];
+        if (!task->ran)
+        {
+            nSkipped++;
+            fprintf(stderr, "tasks: %-20s skipped\n", task->name);
+            continue;
+        }
+
+        if (task->status != 0)
+            nFailed++;
+
+        fprintf(stderr, "tasks: %-20s %8.3fs  start %8.3fs  status %d\n", task->name, task->end - task->start, task->start, task->status);
+    }
+
+    fprintf(stderr, "tasks: %d done, %d failed, %d skipped in %.3fs (-j %d)\n", graph->nTasks - nFailed - nSkipped, nFailed, nSkipped, elapsed, jobs);
+
+    // longest chain of durations through the graph, walked in topological order
+    double* finish = (double*)calloc(graph->nTasks, sizeof(double));
+    int* previous = (int*)malloc(graph->nTasks * sizeof(int));
+    if (!finish || !previous)
+    {
+        free(finish);
+        free(previous);
+        return;
+    }
+
+    int last = -1;
+    for (int n = 0; n < graph->nTasks; n++)
+    {
+        int i = graph->order[n];
+        Task* task = &graph->tasks[i];
+
+        previous[i] = -1;
+        double longest = 0;
+        for (int j = 0; j < task->nDependencies; j++)
+        {
+            if (finish[task->dependencies[j]] > longest || previous[i] == -1)
+            {
+                longest = finish[task->dependencies[j]];
+                previous[i] = task->dependencies[j];
+            }
+        }
+
+        finish[i] = longest + (task->ran ? task->end - task->start : 0);
+        if (last == -1 || finish[i] > finish[last])
+            last = i;
+    }
+
+    fprintf(stderr, "tasks: critical path %.3fs:", finish[last]);
+
+    // the path is walked backwards, print it from the start
+    int* path = (int*)malloc(graph->nTasks * sizeof(int));
+    int length = 0;
+    for (int i = last; path && i != -1; i = previous[i])
+        path[length++] = i;
+
+    for (int i = length - 1; i >= 0; i--)
+    {
+        Task* task = &graph->tasks[path[i]];
+        fprintf(stderr, "%s %s (%.3fs)", i == length - 1 ? "" : " ->", task->name, task->ran ? task->end - task->start : 0);
+    }
+    fprintf(stderr, "\n");
+
+    free(path);
+    free(finish);
+    free(previous);
+}
+
+/*-------------------------------Task blocks---------------------------------------------*/
+
+bool isTaskBlockStart(const char* line)
+{
+    line = skipSpaces(line);
+    size_t length = strlen(TASK_BLOCK_START);
+
+    return strncmp(line, TASK_BLOCK_START, length) == 0 && (line[length] == '\0' || isspace((unsigned char)line[length]));
+}
+
+bool isTaskBlockEnd(const char* line)
+{
+    line = skipSpaces(line);
+    size_t length = strlen(TASK_BLOCK_END);
+
+    return strncmp(line, TASK_BLOCK_END, length) == 0 && *skipSpaces(line + length) == '\0';
+}
+
+int runTaskBlock(const char* header, char** lines, int nLines)
+{
+    // the header is `tasks [-j jobs]`
+    int jobs = 0;
+    char** tokens = tokenizeString(skipSpaces(header), ' ');
+    if (!tokens)
+        return -1;
+
+    for (int i = 1; tokens[i] != NULL; i++)
+    {
+        if (IGNORE(tokens[i]))
+            continue;
+
+        if (strcmp(tokens[i], "-j") == 0 && tokens[i + 1] && strspn(tokens[i + 1], "0123456789") == strlen(tokens[i + 1]) && atoi(tokens[i + 1]) > 0)
+        {
+            jobs = atoi(tokens[++i]);
+        }
+        else
+        {
+            LOG_ERROR("Usage: tasks [-j jobs]\n");
+            freeTokens(tokens);
+            return -1;
+        }
+    }
+    freeTokens(tokens);
+
+    TaskGraph graph;
+    memset(&graph, 0, sizeof(graph));
+    atomic_init(&graph.failed, false);
+    atomic_init(&graph.firstFailure, -1);
+
+    if (parseTaskBlock(&graph, lines, nLines) != 0)
+    {
+        cleanUpTaskGraph(&graph);
+        return -1;
+    }
+
+    TaskRun* runs = (TaskRun*)malloc(graph.nTasks * sizeof(TaskRun));
+    if (!runs)
+    {
+        LOG_ERROR("tasks: malloc failure\n");
+        cleanUpTaskGraph(&graph);
+        return -1;
+    }
+
+    graph.runs = runs;
+    for (int i = 0; i < graph.nTasks; i++)
+    {
+        runs[i].graph = &graph;
+        runs[i].index = i;
+        atomic_store(&graph.tasks[i].pendingDependencies, graph.tasks[i].nDependencies);
+    }
+
+    // the workers reap their own subshells, keep the SIGCHLD handler out of the way. The workers block every signal already, this keeps it off the main thread
+    sigset_t childMask;
+    sigemptyset(&childMask);
+    sigaddset(&childMask, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &childMask, &graph.originalMask);
+
+    // the subshells inherit the stdio buffers, anything pending would be written twice
+    fflush(stdout);
+    fflush(stderr);
+
+    graph.pool = initThreadPool(jobs, 0);
+    if (!graph.pool)
+    {
+        LOG_ERROR("tasks: failed to start the workers\n");
+        pthread_sigmask(SIG_SETMASK, &graph.originalMask, NULL);
+        free(runs);
+        cleanUpTaskGraph(&graph);
+        return -1;
+    }
+
+    jobs = getThreadPoolSize(graph.pool);
+    clock_gettime(CLOCK_MONOTONIC, &graph.origin);
+
+    for (int i = 0; i < graph.nTasks; i++)
+    {
+        if (graph.tasks[i].nDependencies == 0)
+            submitTask(graph.pool, runTask, &runs[i]);
+    }
+
+    waitThreadPool(graph.pool);
+    double elapsed = secondsSince(&graph.origin);
+
+    cleanUpThreadPool(graph.pool);
+    pthread_sigmask(SIG_SETMASK, &graph.originalMask, NULL);
+
+    reportTaskBlock(&graph, jobs, elapsed);
+
+    int failure = atomic_load(&graph.firstFailure);
+    int status = failure == -1 ? 0 : graph.tasks[failure].status;
+
+    free(runs);
+    cleanUpTaskGraph(&graph);
+
+    return status;
+}
\ No newline at end of file
@@ -0,0 +1,997 @@
+/**
+ * @file text_builtins.c
+ * @brief Contains the function definitions for the text filter builtins declared in text_builtins.h
+ * @version 0.1
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include "text_builtins.h"
+#include "shell_builtins.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*-------------------------------Kernels-------------------------------------------------*/
+
+// counts the occurrences of a byte
+static size_t countByte(const char* data, size_t length, char byte)
+{
+    size_t count = 0;
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    // every match subtracts -1 from a byte lane, the lanes are summed before any of them can overflow
+    const __m128i needle = _mm_set1_epi8(byte);
+    const __m128i zero = _mm_setzero_si128();
+
+    while (i + 16 <= length)
+    {
+        size_t blocks = (length - i) / 16;
+        if (blocks > 255)
+            blocks = 255;
+
+        __m128i counts = zero;
+        for (size_t b = 0; b < blocks; b++, i += 16)
+        {
+            __m128i block = _mm_loadu_si128((const __m128i*)(data + i));
+            counts = _mm_sub_epi8(counts, _mm_cmpeq_epi8(block, needle));
+        }
+
+        __m128i sums = _mm_sad_epu8(counts, zero);
+        count += _mm_cvtsi128_si32(sums) + _mm_extract_epi16(sums, 4);
+    }
+#endif
+
+    for (; i < length; i++)
+        count += data[i] == byte;
+
+    return count;
+}
+
+// returns the offset just past the count-th newline, or length if there are fewer. found receives the number of newlines passed
+static size_t skipLines(const char* data, size_t length, size_t count, size_t* found)
+{
+    size_t seen = 0;
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    const __m128i newline = _mm_set1_epi8('\n');
+
+    for (; seen < count && i + 16 <= length; i += 16)
+    {
+        unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(data + i)), newline));
+        size_t inBlock = __builtin_popcount(mask);
+
+        if (seen + inBlock < count)
+        {
+            seen += inBlock;
+            continue;
+        }
+
+        // the line ends in this block, walk its newlines
+        while (mask)
+        {
+            int bit = __builtin_ctz(mask);
+            if (++seen == count)
+            {
+                *found = seen;
+                return i + bit + 1;
+            }
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    for (; seen < count && i < length; i++)
+    {
+        if (data[i] == '\n' && ++seen == count)
+        {
+            *found = seen;
+            return i + 1;
+        }
+    }
+
+    *found = seen;
+    return length;
+}
+
+// returns the offset where the last count lines start, scanning backwards from the end. A newline ending the data doesn't start an empty line
+static size_t findLastLines(const char* data, size_t length, size_t count)
+{
+    if (count == 0)
+        return length;
+
+    size_t i = length;
+    if (i > 0 && data[i - 1] == '\n')
+        i--;
+
+    size_t seen = 0;
+
+#if defined(__SSE2__)
+    const __m128i newline = _mm_set1_epi8('\n');
+
+    for (; i >= 16; i -= 16)
+    {
+        unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(data + i - 16)), newline));
+        size_t inBlock = __builtin_popcount(mask);
+
+        if (seen + inBlock < count)
+        {
+            seen += inBlock;
+            continue;
+        }
+
+        // the first wanted line starts in this block, walk its newlines from the back
+        while (mask)
+        {
+            int bit = 31 - __builtin_clz(mask);
+            if (++seen == count)
+                return i - 16 + bit + 1;
+            mask &= ~(1u << bit);
+        }
+    }
+#endif
+
+    while (i > 0)
+    {
+        i--;
+        if (data[i] == '\n' && ++seen == count)
+            return i + 1;
+    }
+
+    return 0;
+}
+
+#if defined(__SSE2__)
+// mask of the bytes of a block that are ASCII whitespace: ' ' or '\t' to '\r'
+static unsigned int whitespaceMask(__m128i block)
+{
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i range = _mm_set1_epi8('\r' - '\t');
+
+    // c - '\t' <= '\r' - '\t' unsigned, min equals the value exactly when it's in range
+    __m128i shifted = _mm_sub_epi8(block, tab);
+    __m128i inRange = _mm_cmpeq_epi8(_mm_min_epu8(shifted, range), shifted);
+
+    return _mm_movemask_epi8(_mm_or_si128(inRange, _mm_cmpeq_epi8(block, space)));
+}
+#endif
+
+static bool isWhitespace(char c)
+{
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+// counts the words, runs of bytes that are not whitespace. inWord carries the state across calls
+static size_t countWords(const char* data, size_t length, bool* inWord)
+{
+    size_t count = 0;
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    // a word starts at a non-whitespace byte whose previous byte is whitespace
+    unsigned int carry = *inWord ? 1 : 0;
+
+    for (; i + 16 <= length; i += 16)
+    {
+        unsigned int word = ~whitespaceMask(_mm_loadu_si128((const __m128i*)(data + i))) & 0xFFFF;
+        unsigned int starts = word & ~((word << 1) | carry);
+
+        count += __builtin_popcount(starts & 0xFFFF);
+        carry = (word >> 15) & 1;
+    }
+
+    *inWord = carry;
+#endif
+
+    for (; i < length; i++)
+    {
+        bool word = !isWhitespace(data[i]);
+        count += word && !*inWord;
+        *inWord = word;
+    }
+
+    return count;
+}
+
+// finds the first occurrence of needle. SSE2 checks the first and the last byte of the needle at 16 positions at once, and memcmp verifies the candidates
+static const char* findFixed(const char* data, size_t length, const char* needle, size_t needleLength)
+{
+    if (needleLength == 0)
+        return data;
+
+    if (needleLength > length)
+        return NULL;
+
+    if (needleLength == 1)
+        return (const char*)memchr(data, needle[0], length);
+
+    size_t last = needleLength - 1;
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i final = _mm_set1_epi8(needle[last]);
+
+    for (; i + last + 16 <= length; i += 16)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i*)(data + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(data + i + last));
+        unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, final)));
+
+        while (mask)
+        {
+            int bit = __builtin_ctz(mask);
+            if (memcmp(data + i + bit + 1, needle + 1, needleLength - 2) == 0)
+                return data + i + bit;
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    for (; i + needleLength <= length; i++)
+    {
+        if (data[i] == needle[0] && data[i + last] == needle[last] && memcmp(data + i + 1, needle + 1, needleLength - 2) == 0)
+            return data + i;
+    }
+
+    return NULL;
+}
+
+/*-------------------------------Input---------------------------------------------------*/
+
+/**
+ * @brief The input of a text builtin, read in chunks of whole lines, or in chunks as they were read for the builtins that carry their state across lines. A regular file is mapped and handed out as one chunk, anything else is read in large blocks.
+ *
+ */
+typedef struct TextInput {
+    Stream* stream;         //< where the data comes from when it isn't mapped
+    Stream fileStream;      //< the stream over a file operand
+    int fileFD;             //< fd of a file operand, -1 if reading the stage's input
+
+    const char* map;
+    size_t mapLength;
+    size_t mapOffset;       //< where the fd's offset was when it got mapped
+    bool mapped;
+
+    char* buffer;
+    size_t capacity;
+    size_t start;           //< the unconsumed data is buffer[start, length)
+    size_t scanned;         //< buffer[start, scanned) holds no newline, only what was read after it is searched
+    size_t length;
+    bool eof;
+    bool wholeLines;        //< chunks end at a newline. Otherwise they are handed out as read and a long line doesn't grow the buffer
+} TextInput;
+
+// maps an fd if it is a non-empty regular file. Files like the ones in /proc have a size of 0, they are read instead
+static void mapInput(TextInput* in, int fd)
+{
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0)
+        return;
+
+    off_t offset = lseek(fd, 0, SEEK_CUR);
+    if (offset == -1 || offset > st.st_size)
+        return;
+
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+        return;
+
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    in->map = (const char*)map;
+    in->mapLength = st.st_size;
+    in->mapOffset = offset;
+    in->mapped = true;
+}
+
+static int openTextInput(TextInput* in, const char* name, const char* path, Stream* stream, bool wholeLines)
+{
+    memset(in, 0, sizeof(TextInput));
+    in->stream = stream;
+    in->fileFD = -1;
+    in->wholeLines = wholeLines;
+
+    if (path)
+    {
+        in->fileFD = open(path, O_RDONLY | O_CLOEXEC);
+        if (in->fileFD == -1)
+        {
+            LOG_ERROR("%s: %s: %s\n", name, path, strerror(errno));
+            return -1;
+        }
+
+        initFDStream(&in->fileStream, in->fileFD, false);
+        in->stream = &in->fileStream;
+    }
+
+    if (in->stream->type == STREAM_FD)
+        mapInput(in, in->stream->fd);
+
+    return 0;
+}
+
+static void closeTextInput(TextInput* in)
+{
+    if (in->mapped)
+        munmap((void*)in->map, in->mapLength);
+
+    if (in->fileFD != -1)
+        close(in->fileFD);
+
+    free(in->buffer);
+    in->buffer = NULL;
+}
+
+// hands out the next chunk, of whole lines unless the input was opened for any chunk. Only the last chunk of lines may end without a newline. It returns 1 with a chunk, 0 at the end, -1 on failure
+static int nextTextChunk(TextInput* in, const char** data, size_t* length)
+{
+    if (in->mapped)
+    {
+        if (in->mapOffset >= in->mapLength)
+            return 0;
+
+        *data = in->map + in->mapOffset;
+        *length = in->mapLength - in->mapOffset;
+        in->mapOffset = in->mapLength;
+        return 1;
+    }
+
+    while (1)
+    {
+        if (in->start < in->length)
+        {
+            size_t end = in->length;
+            if (in->wholeLines && !in->eof)
+            {
+                // the partial line kept from before was searched already
+                const char* lastNewline = (const char*)memrchr(in->buffer + in->scanned, '\n', in->length - in->scanned);
+                end = lastNewline ? (size_t)(lastNewline - in->buffer) + 1 : in->start;
+                in->scanned = in->length;
+            }
+
+            if (end > in->start)
+            {
+                *data = in->buffer + in->start;
+                *length = end - in->start;
+                in->start = end;
+                return 1;
+            }
+        }
+
+        if (in->eof)
+            return 0;
+
+        // keep the partial line, and make room for a full read after it
+        size_t pending = in->length - in->start;
+        memmove(in->buffer, in->buffer + in->start, pending);
+        in->scanned -= in->start;
+        in->start = 0;
+        in->length = pending;
+
+        if (in->capacity - in->length < TEXT_READ_SIZE)
+        {
+            size_t capacity = in->capacity ? in->capacity * 2 : TEXT_READ_SIZE;
+            while (capacity - in->length < TEXT_READ_SIZE)
+                capacity *= 2;
+
+            char* grown = (char*)realloc(in->buffer, capacity);
+            if (!grown)
+                return -1;
+
+            in->buffer = grown;
+            in->capacity = capacity;
+        }
+
+        ssize_t nread = streamRead(in->stream, in->buffer + in->length, in->capacity - in->length);
+        if (nread < 0)
+            return -1;
+
+        if (nread == 0)
+            in->eof = true;
+
+        in->length += nread;
+    }
+}
+
+// writes lines, adding the newline a last line without one is missing
+static int writeLines(Stream* output, const char* data, size_t length)
+{
+    if (length == 0)
+        return 0;
+
+    if (streamWrite(output, data, length) != 0)
+        return -1;
+
+    return data[length - 1] == '\n' ? 0 : streamWrite(output, "\n", 1);
+}
+
+// parses a line count, digits only
+static bool parseCount(const char* str, size_t* count)
+{
+    if (!str || !*str || strspn(str, "0123456789") != strlen(str))
+        return false;
+
+    *count = strtoull(str, NULL, 10);
+    return true;
+}
+
+/*-------------------------------grep----------------------------------------------------*/
+
+typedef struct GrepOptions {
+    bool fixed;
+    bool invert;
+    bool count;
+    bool quiet;
+    const char* pattern;
+    const char* file;
+} GrepOptions;
+
+static bool parseGrepOptions(SimpleCommand* simpleCommand, GrepOptions* options)
+{
+    memset(options, 0, sizeof(GrepOptions));
+
+    bool endOfOptions = false;
+    for (int i = 1; i < simpleCommand->argc; i++)
+    {
+        const char* arg = simpleCommand->args[i];
+
+        if (!endOfOptions && options->pattern == NULL && arg[0] == '-' && arg[1] != '\0')
+        {
+            if (strcmp(arg, "--") == 0)
+            {
+                endOfOptions = true;
+                continue;
+            }
+
+            for (const char* flag = arg + 1; *flag; flag++)
+            {
+                switch (*flag)
+                {
+                    case 'F': options->fixed = true; break;
+                    case 'v': options->invert = true; break;
+                    case 'c': options->count = true; break;
+                    case 'q': options->quiet = true; break;
+                    default: return false;
+                }
+            }
+        }
+        else if (!options->pattern)
+            options->pattern = arg;
+        else if (!options->file)
+            options->file = arg;
+        else
+            return false;
+    }
+
+    return options->fixed && options->pattern;
+}
+
+bool grepSupported(SimpleCommand* simpleCommand)
+{
+    GrepOptions options;
+    return parseGrepOptions(simpleCommand, &options);
+}
+
+// handles a chunk of whole lines, selected counts the selected lines. Returns -1 on a write failure
+static int grepChunk(const GrepOptions* options, size_t patternLength, const char* data, size_t length, Stream* output, size_t* selected)
+{
+    const char* pos = data;
+    const char* end = data + length;
+    bool printing = !options->count && !options->quiet;
+
+    while (pos < end)
+    {
+        const char* match = findFixed(pos, end - pos, options->pattern, patternLength);
+
+        // the line holding the match, or the end of the chunk
+        const char* lineStart = end;
+        const char* lineEnd = end;
+        if (match)
+        {
+            const char* previousNewline = (const char*)memrchr(pos, '\n', match - pos);
+            lineStart = previousNewline ? previousNewline + 1 : pos;
+
+            const char* newline = (const char*)memchr(match, '\n', end - match);
+            lineEnd = newline ? newline + 1 : end;
+        }
+
+        if (options->invert)
+        {
+            // every line before the matching one is selected
+            if (lineStart > pos)
+            {
+                size_t lines = countByte(pos, lineStart - pos, '\n');
+                if (lineStart == end && end[-1] != '\n')
+                    lines++;
+
+                *selected += lines;
+                if (printing && writeLines(output, pos, lineStart - pos) != 0)
+                    return -1;
+            }
+        }
+        else if (match)
+        {
+            (*selected)++;
+            if (printing && writeLines(output, lineStart, lineEnd - lineStart) != 0)
+                return -1;
+        }
+
+        if (options->quiet && *selected)
+            return 0;
+
+        pos = lineEnd;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief The line being counted by grep -c or -q, when chunks end anywhere. A match may straddle two chunks, so the end of the line so far is kept.
+ *
+ */
+typedef struct GrepLine {
+    bool open;              //< some of the line was seen, its newline wasn't
+    bool matched;
+    char tail[MAX_STRING_LENGTH];   //< the last bytes of the line so far, up to the pattern length - 1
+    size_t tailLength;
+} GrepLine;
+
+static void endGrepLine(const GrepOptions* options, GrepLine* line, size_t* selected)
+{
+    *selected += line->matched != options->invert;
+    line->open = false;
+    line->matched = false;
+    line->tailLength = 0;
+}
+
+// keeps the last bytes of the line so far, a match starting in them can end in the next chunk
+static void keepGrepTail(GrepLine* line, size_t patternLength, const char* data, size_t length)
+{
+    if (patternLength <= 1)
+        return;
+
+    size_t keep = patternLength - 1;
+    if (length >= keep)
+    {
+        memcpy(line->tail, data + length - keep, keep);
+        line->tailLength = keep;
+        return;
+    }
+
+    size_t fromTail = line->tailLength + length > keep ? keep - length : line->tailLength;
+    memmove(line->tail, line->tail + line->tailLength - fromTail, fromTail);
+    memcpy(line->tail + fromTail, data, length);
+    line->tailLength = fromTail + length;
+}
+
+// counts the selected lines of a chunk that may start and end inside a line, nothing is printed. The memory used doesn't depend on the line length
+static void grepCountChunk(const GrepOptions* options, size_t patternLength, const char* data, size_t length, GrepLine* line, size_t* selected)
+{
+    const char* pos = data;
+    const char* end = data + length;
+
+    // a match across the boundary: the kept end of the line followed by the start of this chunk
+    if (line->open && !line->matched && line->tailLength > 0)
+    {
+        char window[2 * MAX_STRING_LENGTH];
+        size_t head = length < patternLength - 1 ? length : patternLength - 1;
+        const char* newline = (const char*)memchr(data, '\n', head);
+        if (newline)
+            head = newline - data;
+
+        memcpy(window, line->tail, line->tailLength);
+        memcpy(window + line->tailLength, data, head);
+        line->matched = findFixed(window, line->tailLength + head, options->pattern, patternLength) != NULL;
+    }
+
+    while (pos < end)
+    {
+        if (options->quiet && *selected)
+            return;
+
+        // the rest of a matched line doesn't need searching
+        const char* match = line->matched ? NULL : findFixed(pos, end - pos, options->pattern, patternLength);
+        const char* searchEnd = match ? match : end;
+        if (line->matched)
+            searchEnd = pos;
+
+        // every newline before the match ends a line that didn't match
+        const char* lastNewline = (const char*)memrchr(pos, '\n', searchEnd - pos);
+        if (lastNewline)
+        {
+            size_t lines = countByte(pos, lastNewline + 1 - pos, '\n');
+            endGrepLine(options, line, selected);
+            *selected += (lines - 1) * options->invert;
+            pos = lastNewline + 1;
+        }
+
+        if (!match && !line->matched)
+        {
+            if (pos < end)
+            {
+                keepGrepTail(line, patternLength, pos, end - pos);
+                line->open = true;
+            }
+            return;
+        }
+
+        line->matched = true;
+        line->open = true;
+
+        const char* newline = (const char*)memchr(match ? match : pos, '\n', end - (match ? match : pos));
+        if (!newline)
+            return;
+
+        endGrepLine(options, line, selected);
+        pos = newline + 1;
+    }
+}
+
+int grepStream(SimpleCommand* simpleCommand, Stream* input, Stream* output)
+{
+    GrepOptions options;
+    if (!parseGrepOptions(simpleCommand, &options))
+    {
+        LOG_ERROR("grep: unsupported options\n");
+        return 2;
+    }
+
+    // without printing, -c and -q take the input as it is read and a huge line isn't buffered
+    size_t patternLength = strlen(options.pattern);
+    bool counting = (options.count || options.quiet) && patternLength < MAX_STRING_LENGTH;
+
+    TextInput in;
+    if (openTextInput(&in, "grep", options.file, input, !counting) != 0)
+        return 2;
+
+    GrepLine line = {0};
+    size_t selected = 0;
+    int status = 0;
+
+    const char* data;
+    size_t length;
+    while ((status = nextTextChunk(&in, &data, &length)) == 1)
+    {
+        if (counting)
+            grepCountChunk(&options, patternLength, data, length, &line, &selected);
+        else if (grepChunk(&options, patternLength, data, length, output, &selected) != 0)
+        {
+            status = -1;
+            break;
+        }
+
+        if (options.quiet && selected)
+            break;
+    }
+
+    closeTextInput(&in);
+
+    if (status < 0)
+        return 2;
+
+    // the last line may end without a newline
+    if (line.open)
+        endGrepLine(&options, &line, &selected);
+
+    if (options.count && streamPrintf(output, "%zu\n", selected) != 0)
+        return 2;
+
+    return selected ? 0 : 1;
+}
+
+int grep(SimpleCommand* simpleCommand)
+{
+    return runStreamBuiltin(simpleCommand, grepStream);
+}
+
+/*-------------------------------wc------------------------------------------------------*/
+
+typedef struct WcOptions {
+    bool lines;
+    bool words;
+    bool bytes;
+    const char* file;
+} WcOptions;
+
+static bool parseWcOptions(SimpleCommand* simpleCommand, WcOptions* options)
+{
+    memset(options, 0, sizeof(WcOptions));
+
+    for (int i = 1; i < simpleCommand->argc; i++)
+    {
+        const char* arg = simpleCommand->args[i];
+
+        if (arg[0] == '-' && arg[1] != '\0' && !options->file)
+        {
+            for (const char* flag = arg + 1; *flag; flag++)
+            {
+                switch (*flag)
+                {
+                    case 'l': options->lines = true; break;
+                    case 'w': options->words = true; break;
+                    case 'c': options->bytes = true; break;
+                    default: return false;
+                }
+            }
+        }
+        else if (!options->file)
+            options->file = arg;
+        else
+            return false;
+    }
+
+    if (!options->lines && !options->words && !options->bytes)
+        options->lines = options->words = options->bytes = true;
+
+    return true;
+}
+
+bool wcSupported(SimpleCommand* simpleCommand)
+{
+    WcOptions options;
+    return parseWcOptions(simpleCommand, &options);
+}
+
+// the width of the columns, like coreutils: the digits of the file size, or 7 when the size isn't known up front
+static int wcColumnWidth(const TextInput* in)
+{
+    struct stat st;
+    if (in->stream->type != STREAM_FD || fstat(in->stream->fd, &st) == -1 || !S_ISREG(st.st_mode))
+        return 7;
+
+    int width = 1;
+    for (off_t size = st.st_size; size >= 10; size /= 10)
+        width++;
+
+    return width;
+}
+
+int wcStream(SimpleCommand* simpleCommand, Stream* input, Stream* output)
+{
+    WcOptions options;
+    if (!parseWcOptions(simpleCommand, &options))
+    {
+        LOG_ERROR("wc: unsupported options\n");
+        return -1;
+    }
+
+    TextInput in;
+    if (openTextInput(&in, "wc", options.file, input, false) != 0)
+        return -1;
+
+    size_t lines = 0, words = 0, bytes = 0;
+    bool inWord = false;
+    int width = wcColumnWidth(&in);
+    int status;
+
+    const char* data;
+    size_t length;
+    while ((status = nextTextChunk(&in, &data, &length)) == 1)
+    {
+        if (options.lines)
+            lines += countByte(data, length, '\n');
+        if (options.words)
+            words += countWords(data, length, &inWord);
+        bytes += length;
+    }
+
+    closeTextInput(&in);
+
+    if (status < 0)
+    {
+        LOG_ERROR("wc: read error: %s\n", strerror(errno));
+        return -1;
+    }
+
+    // a lone count is printed as is, several are padded into columns
+    size_t counts[] = { lines, words, bytes };
+    bool selected[] = { options.lines, options.words, options.bytes };
+    int nSelected = options.lines + options.words + options.bytes;
+
+    char line[MAX_STRING_LENGTH];
+    int used = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        if (selected[i])
+            used += snprintf(line + used, sizeof(line) - used, "%*zu ", nSelected > 1 ? width : 1, counts[i]);
+    }
+    line[used - 1] = '\0';
+
+    if (options.file)
+        return streamPrintf(output, "%s %s\n", line, options.file);
+
+    return streamPrintf(output, "%s\n", line);
+}
+
+int wc(SimpleCommand* simpleCommand)
+{
+    return runStreamBuiltin(simpleCommand, wcStream);
+}
+
+/*-------------------------------head and tail-------------------------------------------*/
+
+// parses [-n N | -nN | -N] [file], shared by head and tail
+static bool parseLineOptions(SimpleCommand* simpleCommand, size_t* count, const char** file)
+{
+    *count = TEXT_DEFAULT_LINES;
+    *file = NULL;
+
+    for (int i = 1; i < simpleCommand->argc; i++)
+    {
+        const char* arg = simpleCommand->args[i];
+
+        if (strcmp(arg, "-n") == 0)
+        {
+            if (++i >= simpleCommand->argc || !parseCount(simpleCommand->args[i], count))
+                return false;
+        }
+        else if (strncmp(arg, "-n", 2) == 0)
+        {
+            if (!parseCount(arg + 2, count))
+                return false;
+        }
+        else if (arg[0] == '-' && arg[1] != '\0')
+        {
+            if (!parseCount(arg + 1, count))
+                return false;
+        }
+        else if (!*file)
+            *file = arg;
+        else
+            return false;
+    }
+
+    return true;
+}
+
+bool headSupported(SimpleCommand* simpleCommand)
+{
+    size_t count;
+    const char* file;
+    return parseLineOptions(simpleCommand, &count, &file);
+}
+
+bool tailSupported(SimpleCommand* simpleCommand)
+{
+    return headSupported(simpleCommand);
+}
+
+int headStream(SimpleCommand* simpleCommand, Stream* input, Stream* output)
+{
+    size_t remaining;
+    const char* file;
+    if (!parseLineOptions(simpleCommand, &remaining, &file))
+    {
+        LOG_ERROR("head: unsupported options\n");
+        return -1;
+    }
+
+    TextInput in;
+    if (openTextInput(&in, "head", file, input, false) != 0)
+        return -1;
+
+    int status = 0;
+    const char* data;
+    size_t length;
+
+    // stops reading as soon as it has the lines, closing the input ends the writer early
+    while (remaining > 0 && (status = nextTextChunk(&in, &data, &length)) == 1)
+    {
+        size_t found;
+        size_t end = skipLines(data, length, remaining, &found);
+
+        if (streamWrite(output, data, end) != 0)
+        {
+            status = -1;
+            break;
+        }
+
+        remaining -= found;
+    }
+
+    closeTextInput(&in);
+    return status < 0 ? -1 : 0;
+}
+
+int head(SimpleCommand* simpleCommand)
+{
+    return runStreamBuiltin(simpleCommand, headStream);
+}
+
+int tailStream(SimpleCommand* simpleCommand, Stream* input, Stream* output)
+{
+    size_t count;
+    const char* file;
+    if (!parseLineOptions(simpleCommand, &count, &file))
+    {
+        LOG_ERROR("tail: unsupported options\n");
+        return -1;
+    }
+
+    TextInput in;
+    if (openTextInput(&in, "tail", file, input, true) != 0)
+        return -1;
+
+    const char* data;
+    size_t length;
+    int status;
+
+    // a mapped file is scanned backwards from its end without reading the rest
+    if (in.mapped)
+    {
+        status = nextTextChunk(&in, &data, &length);
+        if (status == 1)
+        {
+            size_t start = findLastLines(data, length, count);
+            status = streamWrite(output, data + start, length - start);
+        }
+
+        closeTextInput(&in);
+        return status < 0 ? -1 : 0;
+    }
+
+    // anything else is kept in a buffer, trimmed to the lines that can still be among the last ones
+    char* kept = NULL;
+    size_t keptLength = 0;
+    size_t keptCapacity = 0;
+
+    while ((status = nextTextChunk(&in, &data, &length)) == 1)
+    {
+        if (keptLength + length > keptCapacity)
+        {
+            size_t capacity = keptCapacity ? keptCapacity : TEXT_READ_SIZE;
+            while (capacity < keptLength + length)
+                capacity *= 2;
+
+            char* grown = (char*)realloc(kept, capacity);
+            if (!grown)
+            {
+                status = -1;
+                break;
+            }
+
+            kept = grown;
+            keptCapacity = capacity;
+        }
+
+        memcpy(kept + keptLength, data, length);
+        keptLength += length;
+
+        if (keptLength > TAIL_COMPACT_SIZE)
+        {
+            size_t start = findLastLines(kept, keptLength, count);
+            memmove(kept, kept + start, keptLength - start);
+            keptLength -= start;
+        }
+    }
+
+    closeTextInput(&in);
+
+    if (status == 0 && keptLength > 0)
+    {
+        size_t start = findLastLines(kept, keptLength, count);
+        status = streamWrite(output, kept + start, keptLength - start);
+    }
+
+    free(kept);
+    return status < 0 ? -1 : 0;
+}
+
+int tail(SimpleCommand* simpleCommand)
+{
+    return runStreamBuiltin(simpleCommand, tailStream);
+}
@@ -0,0 +1,389 @@
+/**
+ * @file thread_pool.c
+ * @brief Contains the function definitions for the thread pool defined in thread_pool.h
+ * @version 0.1
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include "thread_pool.h"
+#include "utils.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+// keeps the producer and consumer counters of a queue on different cache lines
+#define CACHE_LINE_SIZE 64
+
+/*----------------------------------------------------------------------------------------*/
+
+// a single slot of a queue. the sequence number tells whether the slot is free for the producer or ready for the consumer
+typedef struct TaskQueueCell {
+    atomic_size_t sequence;
+    TaskFunction function;
+    void* arg;
+} TaskQueueCell;
+
+// bounded lock-free multi-producer/multi-consumer queue (Vyukov's array based queue)
+typedef struct TaskQueue {
+    TaskQueueCell* cells;
+    size_t mask;
+
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t enqueuePos;
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t dequeuePos;
+} TaskQueue;
+
+struct ThreadPool {
+    int nWorkers;
+    int nStarted;               // threads running, fewer than nWorkers only when one failed to start
+    pthread_t* threads;
+    TaskQueue* queues;          // one queue per worker
+
+    sem_t available;            // counts the tasks sitting in the queues
+    atomic_size_t pending;      // tasks submitted but not finished yet
+    atomic_uint nextQueue;      // round robin cursor for submits from outside the pool
+    atomic_bool stopping;
+
+    pthread_mutex_t idleLock;   // guards the idle condition, used by waitThreadPool
+    pthread_cond_t idle;
+};
+
+// lets a worker find its own queue, -1 outside the pool
+static __thread int currentWorker = -1;
+static __thread ThreadPool* currentPool = NULL;
+
+/*-------------------------------Queue---------------------------------------------------*/
+
+static int initTaskQueue(TaskQueue* queue, size_t capacity)
+{
+    queue->cells = (TaskQueueCell*)malloc(capacity * sizeof(TaskQueueCell));
+    if (!queue->cells)
+        return -1;
+
+    for (size_t i = 0; i < capacity; i++)
+        atomic_init(&queue->cells[i].sequence, i);
+
+    queue->mask = capacity - 1;
+    atomic_init(&queue->enqueuePos, 0);
+    atomic_init(&queue->dequeuePos, 0);
+
+    return 0;
+}
+
+static bool pushTask(TaskQueue* queue, TaskFunction function, void* arg)
+{
+    size_t pos = atomic_load_explicit(&queue->enqueuePos, memory_order_relaxed);
+
+    while (1)
+    {
+        TaskQueueCell* cell = &queue->cells[pos & queue->mask];
+        size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+
+        if (diff == 0)
+        {
+            // the slot is free, try to claim it
+            if (atomic_compare_exchange_weak_explicit(&queue->enqueuePos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+            {
+                cell->function = function;
+                cell->arg = arg;
+                atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+                return true;
+            }
+        }
+        else if (diff < 0)
+        {
+            // the consumer hasn't freed this slot yet, the queue is full
+            return false;
+        }
+        else
+        {
+            pos = atomic_load_explicit(&queue->enqueuePos, memory_order_relaxed);
+        }
+    }
+}
+
+static bool popTask(TaskQueue* queue, TaskFunction* function, void** arg)
+{
+    size_t pos = atomic_load_explicit(&queue->dequeuePos, memory_order_relaxed);
+
+    while (1)
+    {
+        TaskQueueCell* cell = &queue->cells[pos & queue->mask];
+        size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+
+        if (diff == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&queue->dequeuePos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+            {
+                *function = cell->function;
+                *arg = cell->arg;
+                atomic_store_explicit(&cell->sequence, pos + queue->mask + 1, memory_order_release);
+                return true;
+            }
+        }
+        else if (diff < 0)
+        {
+            // nothing published in this slot, the queue is empty
+            return false;
+        }
+        else
+        {
+            pos = atomic_load_explicit(&queue->dequeuePos, memory_order_relaxed);
+        }
+    }
+}
+
+/*-------------------------------Workers-------------------------------------------------*/
+
+// marks a task as finished, and wakes up waitThreadPool if it was the last one
+static void finishTask(ThreadPool* pool)
+{
+    if (atomic_fetch_sub_explicit(&pool->pending, 1, memory_order_acq_rel) == 1)
+    {
+        pthread_mutex_lock(&pool->idleLock);
+        pthread_cond_broadcast(&pool->idle);
+        pthread_mutex_unlock(&pool->idleLock);
+    }
+}
+
+// pops a task from the worker's own queue, or steals one from the other workers
+static bool findTask(ThreadPool* pool, int self, TaskFunction* function, void** arg)
+{
+    for (int i = 0; i < pool->nWorkers; i++)
+    {
+        if (popTask(&pool->queues[(self + i) % pool->nWorkers], function, arg))
+            return true;
+    }
+
+    return false;
+}
+
+typedef struct WorkerStart {
+    ThreadPool* pool;
+    int index;
+} WorkerStart;
+
+static void* workerMain(void* data)
+{
+    WorkerStart start = *(WorkerStart*)data;
+    free(data);
+
+    ThreadPool* pool = start.pool;
+    currentWorker = start.index;
+    currentPool = pool;
+
+    while (1)
+    {
+        // every post on the semaphore matches exactly one task in the queues
+        while (sem_wait(&pool->available) == -1);
+
+        if (atomic_load_explicit(&pool->stopping, memory_order_acquire))
+            break;
+
+        TaskFunction function = NULL;
+        void* arg = NULL;
+
+        // a task pushed just before its post may have been taken by another worker, so keep scanning until ours shows up
+        while (!findTask(pool, start.index, &function, &arg))
+            sched_yield();
+
+        function(arg);
+        finishTask(pool);
+    }
+
+    return NULL;
+}
+
+/*-------------------------------Pool----------------------------------------------------*/
+
+int getOnlineCPUs()
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+
+    if (sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) > 0)
+        return CPU_COUNT(&set);
+
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+}
+
+ThreadPool* initThreadPool(int nWorkers, size_t queueCapacity)
+{
+    if (nWorkers < 1)
+        nWorkers = getOnlineCPUs();
+
+    if (queueCapacity == 0)
+        queueCapacity = TASK_QUEUE_CAPACITY;
+
+    // round the capacity up to a power of two, the queue indexes with a mask
+    size_t capacity = 2;
+    while (capacity < queueCapacity)
+        capacity <<= 1;
+
+    ThreadPool* pool = (ThreadPool*)calloc(1, sizeof(ThreadPool));
+    if (!pool)
+    {
+        LOG_DEBUG("Failed to allocate memory for thread pool\n");
+        return NULL;
+    }
+
+    pool->nWorkers = nWorkers;
+    pool->threads = (pthread_t*)calloc(nWorkers, sizeof(pthread_t));
+    pool->queues = (TaskQueue*)aligned_alloc(CACHE_LINE_SIZE, nWorkers * sizeof(TaskQueue));
+
+    if (!pool->threads || !pool->queues)
+    {
+        LOG_DEBUG("Failed to allocate memory for thread pool workers\n");
+        free(pool->threads);
+        free(pool->queues);
+        free(pool);
+        return NULL;
+    }
+
+    for (int i = 0; i < nWorkers; i++)
+    {
+        if (initTaskQueue(&pool->queues[i], capacity) != 0)
+        {
+            LOG_DEBUG("Failed to allocate memory for task queue\n");
+            for (int j = 0; j < i; j++)
+                free(pool->queues[j].cells);
+            free(pool->threads);
+            free(pool->queues);
+            free(pool);
+            return NULL;
+        }
+    }
+
+    sem_init(&pool->available, 0, 0);
+    atomic_init(&pool->pending, 0);
+    atomic_init(&pool->nextQueue, 0);
+    atomic_init(&pool->stopping, false);
+    pthread_mutex_init(&pool->idleLock, NULL);
+    pthread_cond_init(&pool->idle, NULL);
+
+    for (int i = 0; i < nWorkers; i++)
+    {
+        // the start record is freed by the worker once it has read it
+        WorkerStart* start = (WorkerStart*)malloc(sizeof(WorkerStart));
+        if (start)
+        {
+            start->pool = pool;
+            start->index = i;
+        }
+
+        // the workers that started are stopped, every queue is freed. nWorkers stays as it is, the running workers read it
+        if (!start || startHelperThread(&pool->threads[i], workerMain, start) != 0)
+        {
+            LOG_DEBUG("Failed to start worker thread %d\n", i);
+            free(start);
+            cleanUpThreadPool(pool);
+            return NULL;
+        }
+
+        pool->nStarted++;
+    }
+
+    return pool;
+}
+
+int trySubmitTask(ThreadPool* pool, TaskFunction function, void* arg)
+{
+    if (!pool || !function)
+        return -1;
+
+    // workers keep their own work local, the others spread it round robin
+    unsigned int first;
+    if (currentPool == pool && currentWorker >= 0)
+        first = (unsigned int)currentWorker;
+    else
+        first = atomic_fetch_add_explicit(&pool->nextQueue, 1, memory_order_relaxed) % pool->nWorkers;
+
+    atomic_fetch_add_explicit(&pool->pending, 1, memory_order_acq_rel);
+
+    for (int i = 0; i < pool->nWorkers; i++)
+    {
+        if (pushTask(&pool->queues[(first + i) % pool->nWorkers], function, arg))
+        {
+            sem_post(&pool->available);
+            return 0;
+        }
+    }
+
+    // every queue is full, undo the accounting
+    finishTask(pool);
+    return -1;
+}
+
+int submitTask(ThreadPool* pool, TaskFunction function, void* arg)
+{
+    if (!pool || !function)
+        return -1;
+
+    while (trySubmitTask(pool, function, arg) != 0)
+    {
+        // a worker waiting for room could deadlock the pool, so it runs the task itself
+        if (currentPool == pool)
+        {
+            function(arg);
+            return 0;
+        }
+
+        sched_yield();
+    }
+
+    return 0;
+}
+
+void waitThreadPool(ThreadPool* pool)
+{
+    if (!pool)
+        return;
+
+    pthread_mutex_lock(&pool->idleLock);
+    while (atomic_load_explicit(&pool->pending, memory_order_acquire) != 0)
+        pthread_cond_wait(&pool->idle, &pool->idleLock);
+    pthread_mutex_unlock(&pool->idleLock);
+}
+
+int getThreadPoolSize(ThreadPool* pool)
+{
+    return pool ? pool->nWorkers : 0;
+}
+
+void cleanUpThreadPool(ThreadPool* pool)
+{
+    if (!pool)
+        return;
+
+    waitThreadPool(pool);
+
+    // wake every worker up with the stop flag set
+    atomic_store_explicit(&pool->stopping, true, memory_order_release);
+    for (int i = 0; i < pool->nStarted; i++)
+        sem_post(&pool->available);
+
+    for (int i = 0; i < pool->nStarted; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    for (int i = 0; i < pool->nWorkers; i++)
+        free(pool->queues[i].cells);
+
+    sem_destroy(&pool->available);
+    pthread_mutex_destroy(&pool->idleLock);
+    pthread_cond_destroy(&pool->idle);
+
+    free(pool->queues);
+    free(pool->threads);
+    free(pool);
+    pool = NULL;
+}
\ No newline at end of file
@@ -0,0 +1,267 @@
+/**
+ * @file timing.c
+ * @brief Contains the function definitions for the time keyword declared in timing.h
+ * @version 0.1
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include "timing.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+CommandTiming* initCommandTiming()
+{
+    CommandTiming* timing = (CommandTiming*)calloc(1, sizeof(CommandTiming));
+    if (!timing)
+        return NULL;
+
+    timing->fd = STDERR_FD;
+    return timing;
+}
+
+int parseTimingOption(CommandTiming* timing, const char* option, const char* value)
+{
+    if (strcmp(option, "-j") == 0)
+    {
+        timing->json = true;
+        return 1;
+    }
+
+    if (strcmp(option, "-o") != 0)
+        return 0;
+
+    if (!value)
+        return -1;
+
+    // a number is an fd of the shell, anything else a file the report is appended to
+    if (strspn(value, "0123456789") == strlen(value) && strlen(value) <= 9)
+    {
+        timing->fd = atoi(value);
+        return 2;
+    }
+
+    free(timing->path);
+    timing->path = strdup(value);
+    timing->fd = -1;
+    return timing->path ? 2 : -1;
+}
+
+int startCommandTiming(CommandTiming* timing, int nStages)
+{
+    free(timing->usage);
+    free(timing->measured);
+
+    timing->usage = (struct rusage*)calloc(nStages, sizeof(struct rusage));
+    timing->measured = (bool*)calloc(nStages, sizeof(bool));
+    if (!timing->usage || !timing->measured)
+        return -1;
+
+    timing->nStages = nStages;
+    timing->start = monotonicSeconds();
+    timing->end = 0;
+    return 0;
+}
+
+void recordStageUsage(CommandTiming* timing, int stage, const struct rusage* usage)
+{
+    if (stage < 0 || stage >= timing->nStages || !timing->usage)
+        return;
+
+    timing->usage[stage] = *usage;
+    timing->measured[stage] = true;
+    timing->end = monotonicSeconds();
+}
+
+void getThreadUsage(struct rusage* usage)
+{
+    if (getrusage(RUSAGE_THREAD, usage) == -1)
+        memset(usage, 0, sizeof(*usage));
+}
+
+void recordThreadUsage(CommandTiming* timing, int stage, const struct rusage* since)
+{
+    struct rusage usage;
+    getThreadUsage(&usage);
+
+    // the max RSS is the shell's own, it can't be split between what ran before and after
+    timersub(&usage.ru_utime, &since->ru_utime, &usage.ru_utime);
+    timersub(&usage.ru_stime, &since->ru_stime, &usage.ru_stime);
+    usage.ru_minflt -= since->ru_minflt;
+    usage.ru_majflt -= since->ru_majflt;
+    usage.ru_nvcsw -= since->ru_nvcsw;
+    usage.ru_nivcsw -= since->ru_nivcsw;
+    usage.ru_inblock -= since->ru_inblock;
+    usage.ru_oublock -= since->ru_oublock;
+
+    recordStageUsage(timing, stage, &usage);
+}
+
+// formats a size in KiB with a binary unit
+static void formatKilobytes(char* buffer, size_t size, long kilobytes)
+{
+    if (kilobytes < 1024)
+        snprintf(buffer, size, "%ldK", kilobytes);
+    else if (kilobytes < 1024 * 1024)
+        snprintf(buffer, size, "%.1fM", kilobytes / 1024.0);
+    else
+        snprintf(buffer, size, "%.1fG", kilobytes / (1024.0 * 1024.0));
+}
+
+// writes a string as a JSON string
+// how a stage ran, for the pid column
+static const char* describeStage(Command* command, int stage, char* buffer, size_t size)
+{
+    int pid = command->simpleCommands[stage]->pid;
+    if (pid > 0)
+        snprintf(buffer, size, "%d", pid);
+    else
+        snprintf(buffer, size, "shell");
+
+    return buffer;
+}
+
+static void writeTable(FILE* out, CommandTiming* timing, Command* command, double real, const struct rusage* total, int status)
+{
+    char maxRSS[24];
+    formatKilobytes(maxRSS, sizeof(maxRSS), total->ru_maxrss);
+
+    fprintf(out, "real %.3fs  user %.3fs  sys %.3fs  maxrss %s  status %d\n", real, toSeconds(total->ru_utime), toSeconds(total->ru_stime), maxRSS, status);
+
+    if (command->nSimpleCommands < 2)
+        return;
+
+    fprintf(out, "  %-5s %-7s %-14s %8s %8s %7s %8s %6s %8s %6s %7s %7s\n", "stage", "pid", "command", "user", "sys", "maxrss", "minflt", "majflt", "vcsw", "ivcsw", "inblk", "oublk");
+
+    for (int i = 0; i < timing->nStages; i++)
+    {
+        char pid[16];
+        describeStage(command, i, pid, sizeof(pid));
+
+        if (!timing->measured[i])
+        {
+            fprintf(out, "  %-5d %-7s %-14.14s %8s\n", i, pid, command->simpleCommands[i]->commandName, "-");
+            continue;
+        }
+
+        const struct rusage* usage = &timing->usage[i];
+        formatKilobytes(maxRSS, sizeof(maxRSS), usage->ru_maxrss);
+
+        fprintf(out, "  %-5d %-7s %-14.14s %7.3fs %7.3fs %7s %8ld %6ld %8ld %6ld %7ld %7ld\n", i, pid, command->simpleCommands[i]->commandName,
+                toSeconds(usage->ru_utime), toSeconds(usage->ru_stime), maxRSS, usage->ru_minflt, usage->ru_majflt,
+                usage->ru_nvcsw, usage->ru_nivcsw, usage->ru_inblock, usage->ru_oublock);
+    }
+}
+
+static void writeUsageJSON(FILE* out, const struct rusage* usage)
+{
+    fprintf(out, "\"user\":%.6f,\"sys\":%.6f,\"maxrss_kb\":%ld,\"minflt\":%ld,\"majflt\":%ld,\"nvcsw\":%ld,\"nivcsw\":%ld,\"inblock\":%ld,\"oublock\":%ld",
+            toSeconds(usage->ru_utime), toSeconds(usage->ru_stime), usage->ru_maxrss, usage->ru_minflt, usage->ru_majflt,
+            usage->ru_nvcsw, usage->ru_nivcsw, usage->ru_inblock, usage->ru_oublock);
+}
+
+static void writeJSON(FILE* out, CommandTiming* timing, Command* command, double real, const struct rusage* total, int status)
+{
+    char* description = describeCommand(command);
+
+    fprintf(out, "{\"command\":");
+    writeJSONString(out, description ? description : "");
+    fprintf(out, ",\"status\":%d,\"real\":%.6f,", status, real);
+    writeUsageJSON(out, total);
+    fprintf(out, ",\"stages\":[");
+
+    for (int i = 0; i < timing->nStages; i++)
+    {
+        fprintf(out, "%s{\"command\":", i ? "," : "");
+        writeJSONString(out, command->simpleCommands[i]->commandName);
+        fprintf(out, ",\"pid\":%d", command->simpleCommands[i]->pid > 0 ? command->simpleCommands[i]->pid : 0);
+
+        if (timing->measured[i])
+        {
+            fputc(',', out);
+            writeUsageJSON(out, &timing->usage[i]);
+        }
+        fputc('}', out);
+    }
+
+    fprintf(out, "]}\n");
+    free(description);
+}
+
+void reportCommandTiming(CommandTiming* timing, Command* command, int status)
+{
+    if (!timing->usage)
+        return;
+
+    // the wall time ends with the last stage, not when the report is written
+    double real = (timing->end > 0 ? timing->end : monotonicSeconds()) - timing->start;
+
+    // the totals add the stages up, except the max RSS which is the largest of them
+    struct rusage total = {0};
+    for (int i = 0; i < timing->nStages; i++)
+    {
+        if (!timing->measured[i])
+            continue;
+
+        const struct rusage* usage = &timing->usage[i];
+        timeradd(&total.ru_utime, &usage->ru_utime, &total.ru_utime);
+        timeradd(&total.ru_stime, &usage->ru_stime, &total.ru_stime);
+        if (usage->ru_maxrss > total.ru_maxrss)
+            total.ru_maxrss = usage->ru_maxrss;
+        total.ru_minflt += usage->ru_minflt;
+        total.ru_majflt += usage->ru_majflt;
+        total.ru_nvcsw += usage->ru_nvcsw;
+        total.ru_nivcsw += usage->ru_nivcsw;
+        total.ru_inblock += usage->ru_inblock;
+        total.ru_oublock += usage->ru_oublock;
+    }
+
+    // the report is built in memory and written at once, so reports of concurrent jobs don't interleave
+    char* report = NULL;
+    size_t length = 0;
+    FILE* out = open_memstream(&report, &length);
+    if (!out)
+        return;
+
+    if (timing->json)
+        writeJSON(out, timing, command, real, &total, status);
+    else
+        writeTable(out, timing, command, real, &total, status);
+    fclose(out);
+
+    int fd = timing->fd;
+    if (timing->path)
+    {
+        fd = open(timing->path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd == -1)
+            LOG_ERROR("time: %s: %s\n", timing->path, strerror(errno));
+    }
+
+    if (fd != -1 && write(fd, report, length) != (ssize_t)length)
+        LOG_ERROR("time: write error: %s\n", strerror(errno));
+
+    if (timing->path && fd != -1)
+        close(fd);
+
+    free(report);
+}
+
+void cleanUpCommandTiming(CommandTiming* timing)
+{
+    if (!timing)
+        return;
+
+    free(timing->path);
+    free(timing->usage);
+    free(timing->measured);
+    free(timing);
+}
@@ -0,0 +1,204 @@
+/**
+ * @file trace.c
+ * @brief Contains the function definitions for the span tracing declared in trace.h
+ * @version 0.1
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include "trace.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+// a complete event of the trace, or the name of a track
+typedef struct TraceEvent {
+    const char* name;       //< NULL for the name of a track, which is in detail
+    const char* category;
+    uint64_t start;
+    uint64_t end;
+    int pid;
+    int tid;
+    char detail[TRACE_DETAIL_LENGTH];
+} TraceEvent;
+
+// a child process between its fork and its reap
+typedef struct TracedProcess {
+    pid_t pid;
+    uint64_t start;
+    char command[TRACE_DETAIL_LENGTH];
+} TracedProcess;
+
+bool tracing = false;
+
+static char* tracePath = NULL;
+static pid_t tracePid = 0;
+
+// the buffer is allocated once, the threads take slots with an atomic increment
+static TraceEvent* events = NULL;
+static size_t maxEvents = 0;
+static atomic_size_t nEvents = 0;
+static atomic_size_t droppedEvents = 0;
+
+// the children are forked and reaped by the main thread only
+static TracedProcess processes[TRACE_MAX_PROCESSES];
+
+uint64_t traceNow()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static TraceEvent* takeEvent()
+{
+    size_t index = atomic_fetch_add_explicit(&nEvents, 1, memory_order_relaxed);
+    if (index >= maxEvents)
+    {
+        atomic_fetch_add_explicit(&droppedEvents, 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    return &events[index];
+}
+
+static void recordEvent(const char* name, const char* category, uint64_t start, uint64_t end, int pid, int tid, const char* detail)
+{
+    TraceEvent* event = takeEvent();
+    if (!event)
+        return;
+
+    event->name = name;
+    event->category = category;
+    event->start = start;
+    event->end = end;
+    event->pid = pid;
+    event->tid = tid;
+    snprintf(event->detail, sizeof(event->detail), "%s", detail ? detail : "");
+}
+
+void traceSpan(const char* name, const char* category, uint64_t start, const char* detail)
+{
+    recordEvent(name, category, start, traceNow(), getpid(), gettid(), detail);
+}
+
+void traceProcessStart(pid_t pid, const char* command, uint64_t forkTime, const char* phase)
+{
+    uint64_t now = traceNow();
+
+    // the track is named after the command
+    recordEvent(NULL, NULL, 0, 0, pid, pid, command);
+
+    if (phase)
+        recordEvent(phase, "spawn", forkTime, now, pid, pid, command);
+
+    for (int i = 0; i < TRACE_MAX_PROCESSES; i++)
+    {
+        if (processes[i].pid == 0)
+        {
+            processes[i].pid = pid;
+            processes[i].start = phase ? now : forkTime;
+            snprintf(processes[i].command, sizeof(processes[i].command), "%s", command ? command : "");
+            return;
+        }
+    }
+}
+
+void traceProcessExit(pid_t pid)
+{
+    for (int i = 0; i < TRACE_MAX_PROCESSES; i++)
+    {
+        if (processes[i].pid == pid)
+        {
+            recordEvent("run", "process", processes[i].start, traceNow(), pid, pid, processes[i].command);
+            processes[i].pid = 0;
+            return;
+        }
+    }
+}
+
+/*-------------------------------Output--------------------------------------------------*/
+
+// writes the trace, only the shell that started tracing does. Its forked children exit without writing
+static void writeTrace()
+{
+    if (getpid() != tracePid)
+        return;
+
+    FILE* file = fopen(tracePath, "we");
+    if (!file)
+    {
+        LOG_ERROR("SHELL_TRACE %s: %s\n", tracePath, strerror(errno));
+        return;
+    }
+
+    size_t count = atomic_load(&nEvents);
+    if (count > maxEvents)
+        count = maxEvents;
+
+    fprintf(file, "{\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"shell\"}}", (int)tracePid, (int)tracePid);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        TraceEvent* event = &events[i];
+
+        if (!event->name)
+        {
+            fprintf(file, ",\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":", event->pid, event->tid);
+            writeJSONString(file, event->detail);
+            fprintf(file, "}}");
+            continue;
+        }
+
+        fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d",
+                event->name, event->category, event->start / 1000.0, (event->end - event->start) / 1000.0, event->pid, event->tid);
+
+        if (event->detail[0])
+        {
+            fprintf(file, ",\"args\":{\"detail\":");
+            writeJSONString(file, event->detail);
+            fputc('}', file);
+        }
+        fputc('}', file);
+    }
+
+    fprintf(file, "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped\":%zu}}\n", atomic_load(&droppedEvents));
+    fclose(file);
+}
+
+void initTracing()
+{
+    const char* path = getenv("SHELL_TRACE");
+    if (!path || !*path)
+        return;
+
+    maxEvents = TRACE_DEFAULT_EVENTS;
+    const char* size = getenv("SHELL_TRACE_EVENTS");
+    if (size && strspn(size, "0123456789") == strlen(size) && strlen(size) <= 9 && atoi(size) > 0)
+        maxEvents = atoi(size);
+
+    // the buffer is allocated and touched up front, recording an event never allocates or faults
+    events = (TraceEvent*)calloc(maxEvents, sizeof(TraceEvent));
+    tracePath = strdup(path);
+    if (!events || !tracePath)
+    {
+        LOG_ERROR("SHELL_TRACE: can't allocate %zu events\n", maxEvents);
+        free(events);
+        free(tracePath);
+        return;
+    }
+    memset(events, 0, maxEvents * sizeof(TraceEvent));
+
+    tracePid = getpid();
+    tracing = true;
+    atexit(writeTrace);
+}
@@ -8,16 +8,19 @@
  */
 
 #include "utils.h"
+#include "accounting.h"
 
+#include <signal.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
 
 
 // tokenizes the string based on the delimiter
 char **tokenizeString(const char *input, char delimiter)
 {
     int input_length = strlen(input);
-    char **tokens = (char **)malloc(sizeof(char *) * input_length);
+    char **tokens = (char **)trackedMalloc(ALLOC_TOKENIZER, sizeof(char *) * input_length);
     int token_count = 0;
 
     int i = 0;
@@ -29,7 +32,7 @@ char **tokenizeString(const char *input, char delimiter)
         if (input[i] == delimiter && !inside_quotes)
         {
             int token_length = i - token_start;
-            tokens[token_count] = (char *)malloc(sizeof(char) * (token_length + 1));
+            tokens[token_count] = (char *)trackedMalloc(ALLOC_TOKENIZER, sizeof(char) * (token_length + 1));
             strncpy(tokens[token_count], input + token_start, token_length);
             tokens[token_count][token_length] = '\0';
             token_count++;
@@ -43,12 +46,12 @@ char **tokenizeString(const char *input, char delimiter)
     }
 
     int token_length = i - token_start;
-    tokens[token_count] = (char *)malloc(sizeof(char) * (token_length + 1));
+    tokens[token_count] = (char *)trackedMalloc(ALLOC_TOKENIZER, sizeof(char) * (token_length + 1));
     strncpy(tokens[token_count], input + token_start, token_length);
     tokens[token_count][token_length] = '\0';
     token_count++;
 
-    char** temp = (char **)realloc(tokens, sizeof(char *) * (token_count + 1));
+    char** temp = (char **)trackedRealloc(ALLOC_TOKENIZER, tokens, sizeof(char *) * (token_count + 1));
     if (!temp)
         return NULL;
     
@@ -71,14 +74,34 @@ int getTokenCount(char **tokens)
     return token_count;
 }
 
+// copies the first count tokens, charged to the tokenizer like the originals
+char **copyTokens(char **tokens, int count)
+{
+    char **copy = (char **)trackedCalloc(ALLOC_TOKENIZER, count + 1, sizeof(char *));
+    if (!copy)
+        return NULL;
+
+    for (int i = 0; i < count; i++)
+    {
+        copy[i] = trackedStrndup(ALLOC_TOKENIZER, tokens[i], strlen(tokens[i]));
+        if (!copy[i])
+        {
+            freeTokens(copy);
+            return NULL;
+        }
+    }
+
+    return copy;
+}
+
 // frees the tokens
 void freeTokens(char **tokens)
 {
     for (int i = 0; tokens[i] != NULL; i++)
     {
-        free(tokens[i]);
+        trackedFree(ALLOC_TOKENIZER, tokens[i]);
     }
-    free(tokens);
+    trackedFree(ALLOC_TOKENIZER, tokens);
 }
 
 // removes quotes from the string
@@ -98,10 +121,10 @@ char *removeQuotes(char *inputString)
     {
         // Create a modified string without the quotes
         size_t modifiedLength = inputLength - 2;
-        char *modifiedString = malloc((modifiedLength + 1) * sizeof(char));
+        char *modifiedString = trackedMalloc(ALLOC_TOKENIZER, (modifiedLength + 1) * sizeof(char));
         strncpy(modifiedString, inputString + 1, modifiedLength);
         modifiedString[modifiedLength] = '\0';
-        free(inputString);
+        trackedFree(ALLOC_TOKENIZER, inputString);
         return modifiedString;
     }
     else
@@ -109,4 +132,105 @@ char *removeQuotes(char *inputString)
         // String is not enclosed in quotes
         return inputString; // Return a copy of the input string
     }
-}
\ No newline at end of file
+}
+
+// the time on the monotonic clock, in seconds
+double monotonicSeconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// converts a timeval to seconds
+double toSeconds(struct timeval tv)
+{
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// writes a string as a quoted JSON string
+void writeJSONString(FILE* file, const char* str)
+{
+    fputc('"', file);
+    for (const unsigned char* c = (const unsigned char*)str; *c; c++)
+    {
+        if (*c == '"' || *c == '\\')
+            fprintf(file, "\\%c", *c);
+        else if (*c < 0x20)
+            fprintf(file, "\\u%04x", *c);
+        else
+            fputc(*c, file);
+    }
+    fputc('"', file);
+}
+
+// starts a thread with every signal blocked, the mask of the caller is left as it was
+int startHelperThread(pthread_t* thread, void* (*function)(void*), void* arg)
+{
+    sigset_t all, original;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &original);
+    int error = pthread_create(thread, NULL, function, arg);
+    pthread_sigmask(SIG_SETMASK, &original, NULL);
+    return error;
+}
+
+static void* runPeriodicSampler(void* arg)
+{
+    PeriodicSampler* sampler = (PeriodicSampler*)arg;
+
+    pthread_mutex_lock(&sampler->mutex);
+    while (!sampler->stop)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += sampler->intervalMs / 1000;
+        deadline.tv_nsec += (sampler->intervalMs % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        // the stop doesn't wait for the end of the interval
+        pthread_cond_timedwait(&sampler->wakeUp, &sampler->mutex, &deadline);
+        if (sampler->stop)
+            break;
+
+        sampler->sample(sampler->arg);
+    }
+    pthread_mutex_unlock(&sampler->mutex);
+
+    return NULL;
+}
+
+int startPeriodicSampler(PeriodicSampler* sampler, int intervalMs, void (*sample)(void* arg), void* arg)
+{
+    sampler->stop = false;
+    sampler->intervalMs = intervalMs;
+    sampler->sample = sample;
+    sampler->arg = arg;
+    pthread_mutex_init(&sampler->mutex, NULL);
+    pthread_cond_init(&sampler->wakeUp, NULL);
+
+    int error = startHelperThread(&sampler->thread, runPeriodicSampler, sampler);
+    if (error)
+        destroyPeriodicSampler(sampler);
+    return error;
+}
+
+void stopPeriodicSampler(PeriodicSampler* sampler)
+{
+    pthread_mutex_lock(&sampler->mutex);
+    sampler->stop = true;
+    pthread_cond_signal(&sampler->wakeUp);
+    pthread_mutex_unlock(&sampler->mutex);
+
+    pthread_join(sampler->thread, NULL);
+}
+
+void destroyPeriodicSampler(PeriodicSampler* sampler)
+{
+    pthread_mutex_destroy(&sampler->mutex);
+    pthread_cond_destroy(&sampler->wakeUp);
+}